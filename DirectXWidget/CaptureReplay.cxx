@@ -0,0 +1,72 @@
+#include "CommandStream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+// capturereplay <capture> [--repeat <n>]
+// Times decoding a capture saved by DirectXWidget::captureFrames into the null commandsink, which is
+// the cost replaying adds on top of the driver, without Direct3D or Qt.
+int main(int argc, char *argv[])
+{
+    static const char *const names[] = {
+        "object", "set_shader", "set_inputlayout", "set_vertexbuffers", "set_indexbuffer", "set_primitivetopology",
+        "set_rendertargets", "set_viewports", "set_shaderresources", "set_samplers", "set_constantbuffers",
+        "set_blendstate", "set_rasterizerstate", "set_depthstencilstate", "clear_rendertargetview", "clear_depthstencilview",
+        "draw", "draw_indexed", "update_subresource", "copy_resource", "copy_subresource_region", "map", "unmap",
+        "begin_query", "end_query", "finish_commandlist", "execute_commandlist", "clear_state", "end_frame",
+        "draw_instanced", "draw_indexed_instanced", "draw_indirect", "resolve_subresource"
+    };
+    static_assert(sizeof(names) / sizeof(names[0]) == (size_t)dx::commandop::count, "a command has no name");
+
+    std::string path;
+    unsigned int repeat = 100;
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = (unsigned int)atoi(argv[++i]);
+        }
+        else if(path.empty()) {
+            path = argv[i];
+        }
+    }
+    if(path.empty() || repeat == 0) {
+        fprintf(stderr, "usage: capturereplay <capture> [--repeat <n>]\n");
+        return 2;
+    }
+
+    dx::commandstream stream;
+    if(!stream.load(path)) {
+        fprintf(stderr, "can't load %s\n", path.c_str());
+        return 1;
+    }
+
+    // the first pass counts the commands and checks the stream
+    dx::commandsink sink;
+    dx::replaystatistics statistics;
+    if(!stream.replay(sink, &statistics)) {
+        fprintf(stderr, "%s is malformed\n", path.c_str());
+        return 1;
+    }
+    uint64_t commands = 0;
+    for(uint32_t n : statistics.commands) {
+        commands += n;
+    }
+
+    typedef std::chrono::steady_clock clock;
+    clock::time_point start = clock::now();
+    for(unsigned int i = 0; i < repeat; ++i) {
+        stream.replay(sink);
+    }
+    double seconds = std::chrono::duration<double>(clock::now() - start).count() / repeat;
+
+    printf("%s: %llu bytes, %u frames, %llu commands\n", path.c_str(), (unsigned long long)stream.size(), statistics.frames, (unsigned long long)commands);
+    printf("%.3f ms per replay, %.1f ns per command, %.2f us per frame, %.0f MB/s\n", seconds * 1e3,
+           commands ? seconds * 1e9 / commands : 0.0, statistics.frames ? seconds * 1e6 / statistics.frames : 0.0,
+           (seconds > 0.0) ? stream.size() / seconds / 1e6 : 0.0);
+    for(size_t op = 0; op < (size_t)dx::commandop::count; ++op) {
+        if(statistics.commands[op]) {
+            printf("  %-24s %u\n", names[op], statistics.commands[op]);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,374 @@
+#pragma once
+
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "DirectXPlus.h"
+#include "CommandStream.h"
+
+namespace dx {
+
+    namespace d3d11 {
+
+        /// <summary>
+        /// Plays a command stream back on a real context, through the wrapper so that the state filter sees it too.
+        /// Objects are passed on as borrowed handles, replaying costs no reference counting.
+        ///
+        /// Resource creation is not part of a stream, so ids have to be bound to live objects first:
+        /// bind_objects() takes the pointers of a stream recorded in this process, bind_object() maps
+        /// single ids for a loaded stream. Unbound ids replay as null, clears and queries on them are skipped.
+        /// </summary>
+        class contextreplay : public commandsink {
+        public:
+            explicit contextreplay(const devicecontext &context)
+                : m_context(context)
+            {}
+
+            /// <summary>
+            /// Use the objects a stream was recorded with, they must still be alive.
+            /// </summary>
+            void bind_objects(const commandstream &stream)
+            {
+                const std::vector<const void*> &objects = stream.objects();
+                for(size_t i = 0; i < objects.size(); ++i) {
+                    bind_object((uint32_t)i + 1, (IUnknown*)objects[i]);
+                }
+            }
+
+            /// <summary>
+            /// object must be the interface the id was recorded as (ID3D11Buffer, ID3D11PixelShader, ...).
+            /// </summary>
+            void bind_object(uint32_t id, IUnknown *object)
+            {
+                if(id >= m_objects.size()) {
+                    m_objects.resize(id + 1, nullptr);
+                }
+                m_objects[id] = object;
+            }
+
+            void set_shader(shaderstagekind stage, uint32_t shader) override
+            {
+                switch(stage) {
+                case shaderstagekind::vertex:
+                    m_context.set_shader(borrowed<vertexshader>(get<ID3D11VertexShader>(shader)));
+                    break;
+                case shaderstagekind::hull:
+                    m_context.set_shader(borrowed<hullshader>(get<ID3D11HullShader>(shader)));
+                    break;
+                case shaderstagekind::domain:
+                    m_context.set_shader(borrowed<domainshader>(get<ID3D11DomainShader>(shader)));
+                    break;
+                case shaderstagekind::geometry:
+                    m_context.set_shader(borrowed<geometryshader>(get<ID3D11GeometryShader>(shader)));
+                    break;
+                case shaderstagekind::pixel:
+                    m_context.set_shader(borrowed<pixelshader>(get<ID3D11PixelShader>(shader)));
+                    break;
+                case shaderstagekind::compute:
+                    m_context.set_shader(borrowed<computeshader>(get<ID3D11ComputeShader>(shader)));
+                    break;
+                }
+            }
+
+            void set_inputlayout(uint32_t layout) override
+            {
+                m_context.set_inputlayout(borrowed<inputlayout>(get<ID3D11InputLayout>(layout)));
+            }
+
+            void set_vertexbuffers(uint32_t start_slot, uint32_t count, const uint32_t *buffers, const uint32_t *strides, const uint32_t *offsets) override
+            {
+                ID3D11Buffer *b[max_slots];
+                resolve(b, buffers, count);
+                m_context.set_vertexbuffers(start_slot, b, strides, offsets, count);
+            }
+
+            void set_indexbuffer(uint32_t buffer, uint32_t format, uint32_t offset) override
+            {
+                m_context.set_indexbuffer(get<ID3D11Buffer>(buffer), (INDEX_BUFFER_FORMAT)format, offset);
+            }
+
+            void set_primitivetopology(uint32_t topology) override
+            {
+                m_context.set_primitivetopology((D3D11_PRIMITIVE_TOPOLOGY)topology);
+            }
+
+            void set_rendertargets(uint32_t count, const uint32_t *rtvs, uint32_t dsv) override
+            {
+                static_vector<borrowed<rendertargetview>, D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT> views;
+                for(uint32_t i = 0; i < count; ++i) {
+                    views.push_back(borrowed<rendertargetview>(get<ID3D11RenderTargetView>(rtvs[i])));
+                }
+                m_context.set_rendertargets(views, borrowed<depthstencilview>(get<ID3D11DepthStencilView>(dsv)));
+            }
+
+            void set_viewports(uint32_t count, const commandviewport *viewports) override
+            {
+                if(count == 1) {
+                    m_context.set_viewport(*(const D3D11_VIEWPORT*)viewports);
+                }
+                else {
+                    m_context.set_viewports((const D3D11_VIEWPORT*)viewports, count);
+                }
+            }
+
+            void set_shaderresources(shaderstagekind stage, uint32_t start_slot, uint32_t count, const uint32_t *srvs) override
+            {
+                ID3D11ShaderResourceView *v[max_slots];
+                resolve(v, srvs, count);
+                per_stage<bind_shaderresources>(stage, start_slot, count, v);
+            }
+
+            void set_samplers(shaderstagekind stage, uint32_t start_slot, uint32_t count, const uint32_t *samplers) override
+            {
+                ID3D11SamplerState *v[max_slots];
+                resolve(v, samplers, count);
+                per_stage<bind_samplers>(stage, start_slot, count, v);
+            }
+
+            void set_constantbuffers(shaderstagekind stage, uint32_t start_slot, uint32_t count, const uint32_t *buffers) override
+            {
+                ID3D11Buffer *v[max_slots];
+                resolve(v, buffers, count);
+                per_stage<bind_constantbuffers>(stage, start_slot, count, v);
+            }
+
+            void set_blendstate(uint32_t state, const float factor[4], uint32_t sample_mask) override
+            {
+                m_context.set_blendstate(borrowed<blendstate>(get<ID3D11BlendState>(state)), factor, sample_mask);
+            }
+
+            void set_rasterizerstate(uint32_t state) override
+            {
+                m_context.set_rasterizerstate(borrowed<rasterizerstate>(get<ID3D11RasterizerState>(state)));
+            }
+
+            void set_depthstencilstate(uint32_t state, uint32_t stencil_ref) override
+            {
+                m_context.set_depthstencilstate(borrowed<depthstencilstate>(get<ID3D11DepthStencilState>(state)), stencil_ref);
+            }
+
+            void clear_rendertargetview(uint32_t rtv, const float rgba[4]) override
+            {
+                if(ID3D11RenderTargetView *v = get<ID3D11RenderTargetView>(rtv)) {
+                    m_context.clear_rendertargetview(borrowed<rendertargetview>(v), rgba);
+                }
+            }
+
+            void clear_depthstencilview(uint32_t dsv, uint32_t flags, float depth, uint32_t stencil) override
+            {
+                if(ID3D11DepthStencilView *v = get<ID3D11DepthStencilView>(dsv)) {
+                    m_context.clear_depthstencilview(borrowed<depthstencilview>(v), flags, depth, (unsigned char)stencil);
+                }
+            }
+
+            void draw(uint32_t vertex_count, uint32_t start_vertex) override
+            {
+                m_context.draw(vertex_count, start_vertex);
+            }
+
+            void draw_indexed(uint32_t index_count, uint32_t start_index, int32_t base_vertex) override
+            {
+                m_context.draw_indexed(index_count, start_index, base_vertex);
+            }
+
+            void draw_instanced(uint32_t vertex_count, uint32_t instance_count, uint32_t start_vertex, uint32_t start_instance) override
+            {
+                m_context.draw_instanced(vertex_count, instance_count, start_vertex, start_instance);
+            }
+
+            void draw_indexed_instanced(uint32_t index_count, uint32_t instance_count, uint32_t start_index, int32_t base_vertex, uint32_t start_instance) override
+            {
+                m_context.draw_indexed_instanced(index_count, instance_count, start_index, base_vertex, start_instance);
+            }
+
+            void draw_indirect(uint32_t args, uint32_t offset, bool indexed) override
+            {
+                borrowed<buffer> b(get<ID3D11Buffer>(args));
+                if(indexed) {
+                    m_context.draw_indexed_instanced_indirect(b, offset);
+                }
+                else {
+                    m_context.draw_instanced_indirect(b, offset);
+                }
+            }
+
+            void update_subresource(uint32_t resource, uint32_t subresource, const commandbox *box, const void *data, uint32_t size, uint32_t row_pitch, uint32_t depth_pitch) override
+            {
+                ID3D11Resource *r = get<ID3D11Resource>(resource);
+                if(nullptr != r) {
+                    m_context.winapi()->UpdateSubresource(r, subresource, (const D3D11_BOX*)box, data, row_pitch, depth_pitch);
+                }
+            }
+
+            void copy_resource(uint32_t dst, uint32_t src) override
+            {
+                ID3D11Resource *d = get<ID3D11Resource>(dst);
+                ID3D11Resource *s = get<ID3D11Resource>(src);
+                if(nullptr != d && nullptr != s) {
+                    m_context.winapi()->CopyResource(d, s);
+                }
+            }
+
+            void resolve_subresource(uint32_t dst, uint32_t dst_subresource, uint32_t src, uint32_t src_subresource, uint32_t format) override
+            {
+                ID3D11Resource *d = get<ID3D11Resource>(dst);
+                ID3D11Resource *s = get<ID3D11Resource>(src);
+                if(nullptr != d && nullptr != s) {
+                    m_context.winapi()->ResolveSubresource(d, dst_subresource, s, src_subresource, (DXGI_FORMAT)format);
+                }
+            }
+
+            void copy_subresource_region(uint32_t dst, uint32_t dst_subresource, uint32_t x, uint32_t y, uint32_t src, uint32_t src_subresource, const commandbox *box) override
+            {
+                ID3D11Resource *d = get<ID3D11Resource>(dst);
+                ID3D11Resource *s = get<ID3D11Resource>(src);
+                if(nullptr != d && nullptr != s) {
+                    m_context.winapi()->CopySubresourceRegion(d, dst_subresource, x, y, 0, s, src_subresource, (const D3D11_BOX*)box);
+                }
+            }
+
+            void map(uint32_t resource, uint32_t subresource, uint32_t type, uint32_t flags) override
+            {
+                ID3D11Resource *r = get<ID3D11Resource>(resource);
+                if(nullptr == r) {
+                    return;
+                }
+                // a replayed DO_NOT_WAIT map waits, the capture only contains maps that succeeded
+                D3D11_MAPPED_SUBRESOURCE mapped;
+                if(SUCCEEDED(m_context.winapi()->Map(r, subresource, (D3D11_MAP)type, flags & ~(UINT)D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped))) {
+                    openmap m = { resource, subresource, mapped.pData };
+                    m_maps.push_back(m);
+                }
+            }
+
+            /// <summary>
+            /// The written bytes are copied as captured, texture row pitches are assumed to match the capturing driver.
+            /// </summary>
+            void unmap(uint32_t resource, uint32_t subresource, const void *written, uint32_t size) override
+            {
+                for(auto it = m_maps.begin(); it != m_maps.end(); ++it) {
+                    if(it->resource == resource && it->subresource == subresource) {
+                        if(size > 0) {
+                            memcpy(it->data, written, size);
+                        }
+                        m_context.winapi()->Unmap(get<ID3D11Resource>(resource), subresource);
+                        m_maps.erase(it);
+                        return;
+                    }
+                }
+            }
+
+            void begin_query(uint32_t q) override
+            {
+                if(ID3D11Query *p = get<ID3D11Query>(q)) {
+                    m_context.begin(borrowed<query>(p));
+                }
+            }
+
+            void end_query(uint32_t q) override
+            {
+                if(ID3D11Query *p = get<ID3D11Query>(q)) {
+                    m_context.end(borrowed<query>(p));
+                }
+            }
+
+            void finish_commandlist(uint32_t list) override
+            {
+                // the list the capture produced is already bound to its id, this one is a fresh copy
+                if(m_context.is_deferred()) {
+                    m_context.finish_commandlist();
+                }
+            }
+
+            void execute_commandlist(uint32_t list, bool restore_state) override
+            {
+                ID3D11CommandList *l = get<ID3D11CommandList>(list);
+                if(nullptr != l) {
+                    m_context.execute_commandlist(borrowed<commandlist>(l), restore_state);
+                }
+            }
+
+            void clear_state() override
+            {
+                m_context.clear_state();
+            }
+
+        private:
+            struct openmap {
+                uint32_t resource;
+                uint32_t subresource;
+                void *data;
+            };
+
+            template<class I>
+            I *get(uint32_t id) const
+            {
+                return (id < m_objects.size()) ? (I*)m_objects[id] : nullptr;
+            }
+
+            template<class I>
+            void resolve(I **objects, const uint32_t *ids, uint32_t count) const
+            {
+                for(uint32_t i = 0; i < count; ++i) {
+                    objects[i] = get<I>(ids[i]);
+                }
+            }
+
+            struct bind_shaderresources {
+                template<class shader>
+                static void apply(devicecontext &c, uint32_t start, uint32_t count, ID3D11ShaderResourceView *const *v)
+                {
+                    c.set_shaderresources<shader>(start, v, count);
+                }
+            };
+
+            struct bind_samplers {
+                template<class shader>
+                static void apply(devicecontext &c, uint32_t start, uint32_t count, ID3D11SamplerState *const *v)
+                {
+                    c.set_samplers<shader>(start, v, count);
+                }
+            };
+
+            struct bind_constantbuffers {
+                template<class shader>
+                static void apply(devicecontext &c, uint32_t start, uint32_t count, ID3D11Buffer *const *v)
+                {
+                    c.set_constantbuffers<shader>(start, v, count);
+                }
+            };
+
+            template<class B, class T>
+            void per_stage(shaderstagekind stage, uint32_t start, uint32_t count, T *const *v)
+            {
+                switch(stage) {
+                case shaderstagekind::vertex:
+                    B::template apply<vertexshader>(m_context, start, count, v);
+                    break;
+                case shaderstagekind::hull:
+                    B::template apply<hullshader>(m_context, start, count, v);
+                    break;
+                case shaderstagekind::domain:
+                    B::template apply<domainshader>(m_context, start, count, v);
+                    break;
+                case shaderstagekind::geometry:
+                    B::template apply<geometryshader>(m_context, start, count, v);
+                    break;
+                case shaderstagekind::pixel:
+                    B::template apply<pixelshader>(m_context, start, count, v);
+                    break;
+                case shaderstagekind::compute:
+                    B::template apply<computeshader>(m_context, start, count, v);
+                    break;
+                }
+            }
+
+            devicecontext m_context;
+            std::vector<IUnknown*> m_objects;
+            std::vector<openmap> m_maps;
+        };
+
+    } /* End of namespace d3d11 */
+
+} /* End of namespace dx */
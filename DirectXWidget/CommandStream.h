@@ -0,0 +1,1052 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+    Portable recording of devicecontext calls.
+
+    This header does not depend on Windows or D3D11, so captured frames can be
+    decoded, measured and replayed against a null or mock backend anywhere.
+    Enumerations (formats, topologies, map types) are stored as their D3D11 values.
+*/
+
+namespace dx {
+
+    enum class commandop : uint8_t {
+        object,
+        set_shader,
+        set_inputlayout,
+        set_vertexbuffers,
+        set_indexbuffer,
+        set_primitivetopology,
+        set_rendertargets,
+        set_viewports,
+        set_shaderresources,
+        set_samplers,
+        set_constantbuffers,
+        set_blendstate,
+        set_rasterizerstate,
+        set_depthstencilstate,
+        clear_rendertargetview,
+        clear_depthstencilview,
+        draw,
+        draw_indexed,
+        update_subresource,
+        copy_resource,
+        copy_subresource_region,
+        map,
+        unmap,
+        begin_query,
+        end_query,
+        finish_commandlist,
+        execute_commandlist,
+        clear_state,
+        end_frame,
+        draw_instanced,
+        draw_indexed_instanced,
+        draw_indirect,
+        resolve_subresource,
+        count
+    };
+
+    enum class objectkind : uint32_t {
+        unknown,
+        buffer,
+        texture2d,
+        rendertargetview,
+        depthstencilview,
+        shaderresourceview,
+        vertexshader,
+        hullshader,
+        domainshader,
+        geometryshader,
+        pixelshader,
+        computeshader,
+        inputlayout,
+        samplerstate,
+        blendstate,
+        rasterizerstate,
+        depthstencilstate,
+        query,
+        commandlist
+    };
+
+    enum class shaderstagekind : uint32_t {
+        vertex,
+        hull,
+        domain,
+        geometry,
+        pixel,
+        compute
+    };
+
+    /// <summary>
+    /// Same layout as D3D11_VIEWPORT.
+    /// </summary>
+    struct commandviewport {
+        float x, y, width, height, min_depth, max_depth;
+    };
+
+    /// <summary>
+    /// Same layout as D3D11_BOX.
+    /// </summary>
+    struct commandbox {
+        uint32_t left, top, front, right, bottom, back;
+    };
+
+    /// <summary>
+    /// Receives decoded commands. Objects are referred to by the ids of the stream, 0 is null.
+    /// Every member does nothing by default, so this class on its own is a null backend.
+    /// </summary>
+    class commandsink {
+    public:
+        /// <summary>
+        /// Bindings of this many slots or less are passed on, longer ones make the stream malformed.
+        /// </summary>
+        static const uint32_t max_slots = 128;
+
+        virtual ~commandsink() {}
+
+        virtual void object(uint32_t /*id*/, objectkind /*kind*/) {}
+        virtual void set_shader(shaderstagekind /*stage*/, uint32_t /*shader*/) {}
+        virtual void set_inputlayout(uint32_t /*layout*/) {}
+        virtual void set_vertexbuffers(uint32_t /*start_slot*/, uint32_t /*count*/, const uint32_t * /*buffers*/, const uint32_t * /*strides*/, const uint32_t * /*offsets*/) {}
+        virtual void set_indexbuffer(uint32_t /*buffer*/, uint32_t /*format*/, uint32_t /*offset*/) {}
+        virtual void set_primitivetopology(uint32_t /*topology*/) {}
+        virtual void set_rendertargets(uint32_t /*count*/, const uint32_t * /*rtvs*/, uint32_t /*dsv*/) {}
+        virtual void set_viewports(uint32_t /*count*/, const commandviewport * /*viewports*/) {}
+        virtual void set_shaderresources(shaderstagekind /*stage*/, uint32_t /*start_slot*/, uint32_t /*count*/, const uint32_t * /*srvs*/) {}
+        virtual void set_samplers(shaderstagekind /*stage*/, uint32_t /*start_slot*/, uint32_t /*count*/, const uint32_t * /*samplers*/) {}
+        virtual void set_constantbuffers(shaderstagekind /*stage*/, uint32_t /*start_slot*/, uint32_t /*count*/, const uint32_t * /*buffers*/) {}
+        virtual void set_blendstate(uint32_t /*state*/, const float /*factor*/[4], uint32_t /*sample_mask*/) {}
+        virtual void set_rasterizerstate(uint32_t /*state*/) {}
+        virtual void set_depthstencilstate(uint32_t /*state*/, uint32_t /*stencil_ref*/) {}
+        virtual void clear_rendertargetview(uint32_t /*rtv*/, const float /*rgba*/[4]) {}
+        virtual void clear_depthstencilview(uint32_t /*dsv*/, uint32_t /*flags*/, float /*depth*/, uint32_t /*stencil*/) {}
+        virtual void draw(uint32_t /*vertex_count*/, uint32_t /*start_vertex*/) {}
+        virtual void draw_indexed(uint32_t /*index_count*/, uint32_t /*start_index*/, int32_t /*base_vertex*/) {}
+        virtual void draw_instanced(uint32_t /*vertex_count*/, uint32_t /*instance_count*/, uint32_t /*start_vertex*/, uint32_t /*start_instance*/) {}
+        virtual void draw_indexed_instanced(uint32_t /*index_count*/, uint32_t /*instance_count*/, uint32_t /*start_index*/, int32_t /*base_vertex*/, uint32_t /*start_instance*/) {}
+        virtual void draw_indirect(uint32_t /*args*/, uint32_t /*offset*/, bool /*indexed*/) {}
+        virtual void update_subresource(uint32_t /*resource*/, uint32_t /*subresource*/, const commandbox * /*box*/, const void * /*data*/, uint32_t /*size*/, uint32_t /*row_pitch*/, uint32_t /*depth_pitch*/) {}
+        virtual void copy_resource(uint32_t /*dst*/, uint32_t /*src*/) {}
+        virtual void copy_subresource_region(uint32_t /*dst*/, uint32_t /*dst_subresource*/, uint32_t /*x*/, uint32_t /*y*/, uint32_t /*src*/, uint32_t /*src_subresource*/, const commandbox * /*box*/) {}
+        virtual void resolve_subresource(uint32_t /*dst*/, uint32_t /*dst_subresource*/, uint32_t /*src*/, uint32_t /*src_subresource*/, uint32_t /*format*/) {}
+        virtual void map(uint32_t /*resource*/, uint32_t /*subresource*/, uint32_t /*type*/, uint32_t /*flags*/) {}
+        /// <summary>
+        /// written holds what the application stored while the resource was mapped, empty for read maps.
+        /// </summary>
+        virtual void unmap(uint32_t /*resource*/, uint32_t /*subresource*/, const void * /*written*/, uint32_t /*size*/) {}
+        virtual void begin_query(uint32_t /*query*/) {}
+        virtual void end_query(uint32_t /*query*/) {}
+        virtual void finish_commandlist(uint32_t /*list*/) {}
+        virtual void execute_commandlist(uint32_t /*list*/, bool /*restore_state*/) {}
+        virtual void clear_state() {}
+        virtual void end_frame() {}
+    };
+
+    struct replaystatistics {
+        uint32_t commands[(size_t)commandop::count] = {};
+        uint32_t frames = 0;
+        uint64_t bytes = 0;
+    };
+
+    /// <summary>
+    /// Append-only binary stream of context commands.
+    ///
+    /// Every record is a 32-bit header (op in the low byte, payload size above it) followed by the
+    /// payload, padded to 4 bytes. Objects are numbered the first time they are seen and declared
+    /// with an object record. clear() keeps the storage, so recording a frame into a reused stream
+    /// does not allocate once it has grown to the frame's size.
+    /// </summary>
+    class commandstream {
+    public:
+        commandstream() {}
+
+        commandstream(const commandstream &) = delete;
+        commandstream &operator= (const commandstream &) = delete;
+
+        void clear()
+        {
+            m_data.clear();
+            m_ids.clear();
+            m_objects.clear();
+        }
+
+        const uint8_t *data() const
+        {
+            return m_data.data();
+        }
+
+        size_t size() const
+        {
+            return m_data.size();
+        }
+
+        /// <summary>
+        /// The recorded pointers, indexed by id - 1. Only meaningful in the recording process
+        /// and only while the objects are alive, empty for a loaded stream.
+        /// </summary>
+        const std::vector<const void*> &objects() const
+        {
+            return m_objects;
+        }
+
+        /// <summary>
+        /// Id of an object, declaring it on first use. Null is 0.
+        /// Note that a released object's address may come back as a different object with the same id.
+        /// </summary>
+        uint32_t object(const void *p, objectkind kind)
+        {
+            if(nullptr == p) {
+                return 0;
+            }
+            auto it = m_ids.find(p);
+            if(it != m_ids.end()) {
+                return it->second;
+            }
+            m_objects.push_back(p);
+            uint32_t id = (uint32_t)m_objects.size();
+            m_ids.emplace(p, id);
+            writer w = begin(commandop::object, 8);
+            w.u32(id);
+            w.u32((uint32_t)kind);
+            return id;
+        }
+
+        void set_shader(shaderstagekind stage, const void *shader)
+        {
+            uint32_t id = object(shader, shader_kind(stage));
+            writer w = begin(commandop::set_shader, 8);
+            w.u32((uint32_t)stage);
+            w.u32(id);
+        }
+
+        void set_inputlayout(const void *layout)
+        {
+            single(commandop::set_inputlayout, object(layout, objectkind::inputlayout));
+        }
+
+        template<class T>
+        void set_vertexbuffers(uint32_t start_slot, uint32_t count, T *const *buffers, const unsigned int *strides, const unsigned int *offsets)
+        {
+            uint32_t ids[commandsink::max_slots];
+            declare(ids, buffers, count, objectkind::buffer);
+            writer w = begin(commandop::set_vertexbuffers, 8 + 12 * count);
+            w.u32(start_slot);
+            w.u32(count);
+            for(uint32_t i = 0; i < count; ++i) {
+                w.u32(ids[i]);
+                w.u32(strides[i]);
+                w.u32(offsets[i]);
+            }
+        }
+
+        void set_indexbuffer(const void *buffer, uint32_t format, uint32_t offset)
+        {
+            uint32_t id = object(buffer, objectkind::buffer);
+            writer w = begin(commandop::set_indexbuffer, 12);
+            w.u32(id);
+            w.u32(format);
+            w.u32(offset);
+        }
+
+        void set_primitivetopology(uint32_t topology)
+        {
+            single(commandop::set_primitivetopology, topology);
+        }
+
+        template<class T>
+        void set_rendertargets(uint32_t count, T *const *rtvs, const void *dsv)
+        {
+            uint32_t ids[commandsink::max_slots];
+            declare(ids, rtvs, count, objectkind::rendertargetview);
+            uint32_t dsv_id = object(dsv, objectkind::depthstencilview);
+            writer w = begin(commandop::set_rendertargets, 8 + 4 * count);
+            w.u32(count);
+            w.u32(dsv_id);
+            for(uint32_t i = 0; i < count; ++i) {
+                w.u32(ids[i]);
+            }
+        }
+
+        void set_viewports(uint32_t count, const void *viewports)
+        {
+            writer w = begin(commandop::set_viewports, 4 + sizeof(commandviewport) * count);
+            w.u32(count);
+            w.bytes(viewports, sizeof(commandviewport) * count);
+        }
+
+        template<class T>
+        void set_shaderresources(shaderstagekind stage, uint32_t start_slot, uint32_t count, T *const *srvs)
+        {
+            slots(commandop::set_shaderresources, stage, start_slot, count, srvs, objectkind::shaderresourceview);
+        }
+
+        template<class T>
+        void set_samplers(shaderstagekind stage, uint32_t start_slot, uint32_t count, T *const *samplers)
+        {
+            slots(commandop::set_samplers, stage, start_slot, count, samplers, objectkind::samplerstate);
+        }
+
+        template<class T>
+        void set_constantbuffers(shaderstagekind stage, uint32_t start_slot, uint32_t count, T *const *buffers)
+        {
+            slots(commandop::set_constantbuffers, stage, start_slot, count, buffers, objectkind::buffer);
+        }
+
+        void set_blendstate(const void *state, const float factor[4], uint32_t sample_mask)
+        {
+            uint32_t id = object(state, objectkind::blendstate);
+            writer w = begin(commandop::set_blendstate, 24);
+            w.u32(id);
+            w.bytes(factor, 16);
+            w.u32(sample_mask);
+        }
+
+        void set_rasterizerstate(const void *state)
+        {
+            single(commandop::set_rasterizerstate, object(state, objectkind::rasterizerstate));
+        }
+
+        void set_depthstencilstate(const void *state, uint32_t stencil_ref)
+        {
+            uint32_t id = object(state, objectkind::depthstencilstate);
+            writer w = begin(commandop::set_depthstencilstate, 8);
+            w.u32(id);
+            w.u32(stencil_ref);
+        }
+
+        void clear_rendertargetview(const void *rtv, const float rgba[4])
+        {
+            uint32_t id = object(rtv, objectkind::rendertargetview);
+            writer w = begin(commandop::clear_rendertargetview, 20);
+            w.u32(id);
+            w.bytes(rgba, 16);
+        }
+
+        void clear_depthstencilview(const void *dsv, uint32_t flags, float depth, uint32_t stencil)
+        {
+            uint32_t id = object(dsv, objectkind::depthstencilview);
+            writer w = begin(commandop::clear_depthstencilview, 16);
+            w.u32(id);
+            w.u32(flags);
+            w.bytes(&depth, 4);
+            w.u32(stencil);
+        }
+
+        void draw(uint32_t vertex_count, uint32_t start_vertex)
+        {
+            writer w = begin(commandop::draw, 8);
+            w.u32(vertex_count);
+            w.u32(start_vertex);
+        }
+
+        void draw_indexed(uint32_t index_count, uint32_t start_index, int32_t base_vertex)
+        {
+            writer w = begin(commandop::draw_indexed, 12);
+            w.u32(index_count);
+            w.u32(start_index);
+            w.u32((uint32_t)base_vertex);
+        }
+
+        void draw_instanced(uint32_t vertex_count, uint32_t instance_count, uint32_t start_vertex, uint32_t start_instance)
+        {
+            writer w = begin(commandop::draw_instanced, 16);
+            w.u32(vertex_count);
+            w.u32(instance_count);
+            w.u32(start_vertex);
+            w.u32(start_instance);
+        }
+
+        void draw_indexed_instanced(uint32_t index_count, uint32_t instance_count, uint32_t start_index, int32_t base_vertex, uint32_t start_instance)
+        {
+            writer w = begin(commandop::draw_indexed_instanced, 20);
+            w.u32(index_count);
+            w.u32(instance_count);
+            w.u32(start_index);
+            w.u32((uint32_t)base_vertex);
+            w.u32(start_instance);
+        }
+
+        /// <summary>
+        /// The arguments live on the GPU, only the buffer is recorded.
+        /// </summary>
+        void draw_indirect(const void *args, uint32_t offset, bool indexed)
+        {
+            uint32_t id = object(args, objectkind::buffer);
+            writer w = begin(commandop::draw_indirect, 12);
+            w.u32(id);
+            w.u32(offset);
+            w.u32(indexed ? 1 : 0);
+        }
+
+        /// <summary>
+        /// size is the number of bytes the update reads from data.
+        /// </summary>
+        void update_subresource(const void *resource, objectkind kind, uint32_t subresource, const void *box, const void *data, uint32_t size, uint32_t row_pitch, uint32_t depth_pitch)
+        {
+            uint32_t id = object(resource, kind);
+            writer w = begin(commandop::update_subresource, 48 + size);
+            w.u32(id);
+            w.u32(subresource);
+            w.u32(row_pitch);
+            w.u32(depth_pitch);
+            w.u32(nullptr != box ? 1 : 0);
+            w.box(box);
+            w.u32(size);
+            w.bytes(data, size);
+        }
+
+        void copy_resource(const void *dst, const void *src, objectkind kind)
+        {
+            uint32_t dst_id = object(dst, kind);
+            uint32_t src_id = object(src, kind);
+            writer w = begin(commandop::copy_resource, 8);
+            w.u32(dst_id);
+            w.u32(src_id);
+        }
+
+        void resolve_subresource(const void *dst, uint32_t dst_subresource, const void *src, uint32_t src_subresource, uint32_t format, objectkind kind)
+        {
+            uint32_t dst_id = object(dst, kind);
+            uint32_t src_id = object(src, kind);
+            writer w = begin(commandop::resolve_subresource, 20);
+            w.u32(dst_id);
+            w.u32(dst_subresource);
+            w.u32(src_id);
+            w.u32(src_subresource);
+            w.u32(format);
+        }
+
+        void copy_subresource_region(const void *dst, uint32_t dst_subresource, uint32_t x, uint32_t y, const void *src, uint32_t src_subresource, const void *box, objectkind kind)
+        {
+            uint32_t dst_id = object(dst, kind);
+            uint32_t src_id = object(src, kind);
+            writer w = begin(commandop::copy_subresource_region, 52);
+            w.u32(dst_id);
+            w.u32(dst_subresource);
+            w.u32(x);
+            w.u32(y);
+            w.u32(src_id);
+            w.u32(src_subresource);
+            w.u32(nullptr != box ? 1 : 0);
+            w.box(box);
+        }
+
+        void map(const void *resource, objectkind kind, uint32_t subresource, uint32_t type, uint32_t flags)
+        {
+            uint32_t id = object(resource, kind);
+            writer w = begin(commandop::map, 16);
+            w.u32(id);
+            w.u32(subresource);
+            w.u32(type);
+            w.u32(flags);
+        }
+
+        void unmap(const void *resource, objectkind kind, uint32_t subresource, const void *written, uint32_t size)
+        {
+            uint32_t id = object(resource, kind);
+            writer w = begin(commandop::unmap, 12 + size);
+            w.u32(id);
+            w.u32(subresource);
+            w.u32(size);
+            w.bytes(written, size);
+        }
+
+        void begin_query(const void *query)
+        {
+            single(commandop::begin_query, object(query, objectkind::query));
+        }
+
+        void end_query(const void *query)
+        {
+            single(commandop::end_query, object(query, objectkind::query));
+        }
+
+        void finish_commandlist(const void *list)
+        {
+            single(commandop::finish_commandlist, object(list, objectkind::commandlist));
+        }
+
+        void execute_commandlist(const void *list, bool restore_state)
+        {
+            uint32_t id = object(list, objectkind::commandlist);
+            writer w = begin(commandop::execute_commandlist, 8);
+            w.u32(id);
+            w.u32(restore_state ? 1 : 0);
+        }
+
+        void clear_state()
+        {
+            begin(commandop::clear_state, 0);
+        }
+
+        /// <summary>
+        /// Mark the end of a frame, call it after present.
+        /// </summary>
+        void end_frame()
+        {
+            begin(commandop::end_frame, 0);
+        }
+
+        /// <summary>
+        /// Decode the stream into a sink. Returns false, after passing on what came before,
+        /// if the stream is malformed.
+        /// </summary>
+        bool replay(commandsink &sink, replaystatistics *statistics = nullptr) const
+        {
+            return replay(m_data.data(), m_data.size(), sink, statistics);
+        }
+
+        static bool replay(const uint8_t *data, size_t size, commandsink &sink, replaystatistics *statistics = nullptr)
+        {
+            reader r(data, size);
+            uint32_t ids[commandsink::max_slots];
+            uint32_t strides[commandsink::max_slots];
+            uint32_t offsets[commandsink::max_slots];
+
+            while(!r.at_end()) {
+                uint32_t header = r.u32();
+                commandop op = (commandop)(header & 0xFF);
+                uint32_t payload = header >> 8;
+                if(payload == large_payload) {
+                    payload = r.u32();
+                }
+                if(!r.ok() || op >= commandop::count) {
+                    return false;
+                }
+                reader p = r.sub(payload);
+                if(!r.ok()) {
+                    return false;
+                }
+
+                switch(op) {
+                case commandop::object: {
+                    uint32_t id = p.u32();
+                    objectkind kind = (objectkind)p.u32();
+                    if(p.ok()) {
+                        sink.object(id, kind);
+                    }
+                    break;
+                }
+                case commandop::set_shader: {
+                    shaderstagekind stage = (shaderstagekind)p.u32();
+                    uint32_t id = p.u32();
+                    if(p.ok()) {
+                        sink.set_shader(stage, id);
+                    }
+                    break;
+                }
+                case commandop::set_inputlayout: {
+                    uint32_t id = p.u32();
+                    if(p.ok()) {
+                        sink.set_inputlayout(id);
+                    }
+                    break;
+                }
+                case commandop::set_vertexbuffers: {
+                    uint32_t start = p.u32();
+                    uint32_t count = p.count();
+                    for(uint32_t i = 0; i < count && p.ok(); ++i) {
+                        ids[i] = p.u32();
+                        strides[i] = p.u32();
+                        offsets[i] = p.u32();
+                    }
+                    if(p.ok()) {
+                        sink.set_vertexbuffers(start, count, ids, strides, offsets);
+                    }
+                    break;
+                }
+                case commandop::set_indexbuffer: {
+                    uint32_t id = p.u32();
+                    uint32_t format = p.u32();
+                    uint32_t offset = p.u32();
+                    if(p.ok()) {
+                        sink.set_indexbuffer(id, format, offset);
+                    }
+                    break;
+                }
+                case commandop::set_primitivetopology: {
+                    uint32_t topology = p.u32();
+                    if(p.ok()) {
+                        sink.set_primitivetopology(topology);
+                    }
+                    break;
+                }
+                case commandop::set_rendertargets: {
+                    uint32_t count = p.count();
+                    uint32_t dsv = p.u32();
+                    p.u32s(ids, count);
+                    if(p.ok()) {
+                        sink.set_rendertargets(count, ids, dsv);
+                    }
+                    break;
+                }
+                case commandop::set_viewports: {
+                    uint32_t count = p.count();
+                    commandviewport viewports[commandsink::max_slots];
+                    p.bytes(viewports, sizeof(commandviewport) * count);
+                    if(p.ok()) {
+                        sink.set_viewports(count, viewports);
+                    }
+                    break;
+                }
+                case commandop::set_shaderresources:
+                case commandop::set_samplers:
+                case commandop::set_constantbuffers: {
+                    shaderstagekind stage = (shaderstagekind)p.u32();
+                    uint32_t start = p.u32();
+                    uint32_t count = p.count();
+                    p.u32s(ids, count);
+                    if(!p.ok()) {
+                        break;
+                    }
+                    if(op == commandop::set_shaderresources) {
+                        sink.set_shaderresources(stage, start, count, ids);
+                    }
+                    else if(op == commandop::set_samplers) {
+                        sink.set_samplers(stage, start, count, ids);
+                    }
+                    else {
+                        sink.set_constantbuffers(stage, start, count, ids);
+                    }
+                    break;
+                }
+                case commandop::set_blendstate: {
+                    uint32_t id = p.u32();
+                    float factor[4];
+                    p.bytes(factor, 16);
+                    uint32_t mask = p.u32();
+                    if(p.ok()) {
+                        sink.set_blendstate(id, factor, mask);
+                    }
+                    break;
+                }
+                case commandop::set_rasterizerstate: {
+                    uint32_t id = p.u32();
+                    if(p.ok()) {
+                        sink.set_rasterizerstate(id);
+                    }
+                    break;
+                }
+                case commandop::set_depthstencilstate: {
+                    uint32_t id = p.u32();
+                    uint32_t ref = p.u32();
+                    if(p.ok()) {
+                        sink.set_depthstencilstate(id, ref);
+                    }
+                    break;
+                }
+                case commandop::clear_rendertargetview: {
+                    uint32_t id = p.u32();
+                    float rgba[4];
+                    p.bytes(rgba, 16);
+                    if(p.ok()) {
+                        sink.clear_rendertargetview(id, rgba);
+                    }
+                    break;
+                }
+                case commandop::clear_depthstencilview: {
+                    uint32_t id = p.u32();
+                    uint32_t flags = p.u32();
+                    float depth;
+                    p.bytes(&depth, 4);
+                    uint32_t stencil = p.u32();
+                    if(p.ok()) {
+                        sink.clear_depthstencilview(id, flags, depth, stencil);
+                    }
+                    break;
+                }
+                case commandop::draw: {
+                    uint32_t count = p.u32();
+                    uint32_t start = p.u32();
+                    if(p.ok()) {
+                        sink.draw(count, start);
+                    }
+                    break;
+                }
+                case commandop::draw_indexed: {
+                    uint32_t count = p.u32();
+                    uint32_t start = p.u32();
+                    int32_t base = (int32_t)p.u32();
+                    if(p.ok()) {
+                        sink.draw_indexed(count, start, base);
+                    }
+                    break;
+                }
+                case commandop::draw_instanced: {
+                    uint32_t count = p.u32();
+                    uint32_t instances = p.u32();
+                    uint32_t start = p.u32();
+                    uint32_t start_instance = p.u32();
+                    if(p.ok()) {
+                        sink.draw_instanced(count, instances, start, start_instance);
+                    }
+                    break;
+                }
+                case commandop::draw_indexed_instanced: {
+                    uint32_t count = p.u32();
+                    uint32_t instances = p.u32();
+                    uint32_t start = p.u32();
+                    int32_t base = (int32_t)p.u32();
+                    uint32_t start_instance = p.u32();
+                    if(p.ok()) {
+                        sink.draw_indexed_instanced(count, instances, start, base, start_instance);
+                    }
+                    break;
+                }
+                case commandop::draw_indirect: {
+                    uint32_t id = p.u32();
+                    uint32_t offset = p.u32();
+                    bool indexed = p.u32() != 0;
+                    if(p.ok()) {
+                        sink.draw_indirect(id, offset, indexed);
+                    }
+                    break;
+                }
+                case commandop::update_subresource: {
+                    uint32_t id = p.u32();
+                    uint32_t sub = p.u32();
+                    uint32_t row_pitch = p.u32();
+                    uint32_t depth_pitch = p.u32();
+                    bool has_box = p.u32() != 0;
+                    commandbox box = p.box();
+                    uint32_t bytes = p.u32();
+                    const void *data = p.skip(bytes);
+                    if(p.ok()) {
+                        sink.update_subresource(id, sub, has_box ? &box : nullptr, data, bytes, row_pitch, depth_pitch);
+                    }
+                    break;
+                }
+                case commandop::copy_resource: {
+                    uint32_t dst = p.u32();
+                    uint32_t src = p.u32();
+                    if(p.ok()) {
+                        sink.copy_resource(dst, src);
+                    }
+                    break;
+                }
+                case commandop::resolve_subresource: {
+                    uint32_t dst = p.u32();
+                    uint32_t dst_sub = p.u32();
+                    uint32_t src = p.u32();
+                    uint32_t src_sub = p.u32();
+                    uint32_t format = p.u32();
+                    if(p.ok()) {
+                        sink.resolve_subresource(dst, dst_sub, src, src_sub, format);
+                    }
+                    break;
+                }
+                case commandop::copy_subresource_region: {
+                    uint32_t dst = p.u32();
+                    uint32_t dst_sub = p.u32();
+                    uint32_t x = p.u32();
+                    uint32_t y = p.u32();
+                    uint32_t src = p.u32();
+                    uint32_t src_sub = p.u32();
+                    bool has_box = p.u32() != 0;
+                    commandbox box = p.box();
+                    if(p.ok()) {
+                        sink.copy_subresource_region(dst, dst_sub, x, y, src, src_sub, has_box ? &box : nullptr);
+                    }
+                    break;
+                }
+                case commandop::map: {
+                    uint32_t id = p.u32();
+                    uint32_t sub = p.u32();
+                    uint32_t type = p.u32();
+                    uint32_t flags = p.u32();
+                    if(p.ok()) {
+                        sink.map(id, sub, type, flags);
+                    }
+                    break;
+                }
+                case commandop::unmap: {
+                    uint32_t id = p.u32();
+                    uint32_t sub = p.u32();
+                    uint32_t bytes = p.u32();
+                    const void *written = p.skip(bytes);
+                    if(p.ok()) {
+                        sink.unmap(id, sub, written, bytes);
+                    }
+                    break;
+                }
+                case commandop::begin_query:
+                case commandop::end_query:
+                case commandop::finish_commandlist: {
+                    uint32_t id = p.u32();
+                    if(!p.ok()) {
+                        break;
+                    }
+                    if(op == commandop::begin_query) {
+                        sink.begin_query(id);
+                    }
+                    else if(op == commandop::end_query) {
+                        sink.end_query(id);
+                    }
+                    else {
+                        sink.finish_commandlist(id);
+                    }
+                    break;
+                }
+                case commandop::execute_commandlist: {
+                    uint32_t id = p.u32();
+                    bool restore = p.u32() != 0;
+                    if(p.ok()) {
+                        sink.execute_commandlist(id, restore);
+                    }
+                    break;
+                }
+                case commandop::clear_state:
+                    sink.clear_state();
+                    break;
+                case commandop::end_frame:
+                    sink.end_frame();
+                    break;
+                default:
+                    break;
+                }
+
+                if(!p.ok()) {
+                    return false;
+                }
+                if(nullptr != statistics) {
+                    statistics->commands[(size_t)op]++;
+                    statistics->bytes += payload + 4;
+                    if(op == commandop::end_frame) {
+                        statistics->frames++;
+                    }
+                }
+            }
+            return true;
+        }
+
+        /// <summary>
+        /// Write the stream to a file, returns false on failure.
+        /// </summary>
+        bool save(const std::string &path) const
+        {
+            FILE *fp = fopen(path.c_str(), "wb");
+            if(nullptr == fp) {
+                return false;
+            }
+            uint32_t header[4] = { file_magic, file_version, (uint32_t)(m_data.size() & 0xFFFFFFFF), (uint32_t)((uint64_t)m_data.size() >> 32) };
+            bool ok = (fwrite(header, sizeof(header), 1, fp) == 1);
+            ok = ok && (m_data.empty() || fwrite(m_data.data(), m_data.size(), 1, fp) == 1);
+            ok = (fclose(fp) == 0) && ok;
+            return ok;
+        }
+
+        /// <summary>
+        /// Replace the stream with one saved before. The loaded stream has no object pointers.
+        /// </summary>
+        bool load(const std::string &path)
+        {
+            clear();
+            FILE *fp = fopen(path.c_str(), "rb");
+            if(nullptr == fp) {
+                return false;
+            }
+            uint32_t header[4];
+            bool ok = (fread(header, sizeof(header), 1, fp) == 1) && header[0] == file_magic && header[1] == file_version;
+            if(ok) {
+                uint64_t size = ((uint64_t)header[3] << 32) | header[2];
+                m_data.resize((size_t)size);
+                ok = (size == 0) || fread(m_data.data(), m_data.size(), 1, fp) == 1;
+            }
+            fclose(fp);
+            if(!ok) {
+                m_data.clear();
+            }
+            return ok;
+        }
+
+    private:
+        static const uint32_t large_payload = 0xFFFFFF;
+        static const uint32_t file_magic = 0x53435844;     // "DXCS"
+        static const uint32_t file_version = 1;
+
+        class writer {
+        public:
+            explicit writer(uint8_t *p)
+                : m_p(p)
+            {}
+
+            void u32(uint32_t v)
+            {
+                memcpy(m_p, &v, 4);
+                m_p += 4;
+            }
+
+            void bytes(const void *data, size_t size)
+            {
+                if(size > 0) {
+                    memcpy(m_p, data, size);
+                    m_p += size;
+                }
+            }
+
+            void box(const void *b)
+            {
+                if(nullptr != b) {
+                    bytes(b, sizeof(commandbox));
+                }
+                else {
+                    memset(m_p, 0, sizeof(commandbox));
+                    m_p += sizeof(commandbox);
+                }
+            }
+
+        private:
+            uint8_t *m_p;
+        };
+
+        class reader {
+        public:
+            reader(const uint8_t *p, size_t size)
+                : m_p(p), m_end(p + size)
+            {}
+
+            bool ok() const
+            {
+                return m_ok;
+            }
+
+            bool at_end() const
+            {
+                return m_p >= m_end;
+            }
+
+            const void *skip(size_t size)
+            {
+                if(!m_ok || (size_t)(m_end - m_p) < size) {
+                    m_ok = false;
+                    return nullptr;
+                }
+                const void *result = m_p;
+                m_p += size;
+                return result;
+            }
+
+            uint32_t u32()
+            {
+                uint32_t v = 0;
+                bytes(&v, 4);
+                return v;
+            }
+
+            /// <summary>
+            /// Slot count, which must fit the sink's arrays.
+            /// </summary>
+            uint32_t count()
+            {
+                uint32_t n = u32();
+                if(n > commandsink::max_slots) {
+                    m_ok = false;
+                    return 0;
+                }
+                return n;
+            }
+
+            void u32s(uint32_t *v, uint32_t n)
+            {
+                bytes(v, 4 * (size_t)n);
+            }
+
+            void bytes(void *data, size_t size)
+            {
+                const void *p = skip(size);
+                if(nullptr != p && size > 0) {
+                    memcpy(data, p, size);
+                }
+            }
+
+            commandbox box()
+            {
+                commandbox b = {};
+                bytes(&b, sizeof(b));
+                return b;
+            }
+
+            /// <summary>
+            /// Carve out a padded payload as its own reader.
+            /// </summary>
+            reader sub(size_t size)
+            {
+                const uint8_t *p = (const uint8_t*)skip(size);
+                reader result(p, (nullptr != p) ? size : 0);
+                result.m_ok = m_ok;
+                return result;
+            }
+
+        private:
+            const uint8_t *m_p;
+            const uint8_t *m_end;
+            bool m_ok = true;
+        };
+
+        writer begin(commandop op, size_t payload)
+        {
+            size_t padded = (payload + 3) & ~(size_t)3;
+            bool large = padded >= large_payload;
+            size_t offset = m_data.size();
+            m_data.resize(offset + 4 + (large ? 4 : 0) + padded);
+            uint8_t *p = m_data.data() + offset;
+            uint32_t header = (uint32_t)op | ((large ? large_payload : (uint32_t)padded) << 8);
+            memcpy(p, &header, 4);
+            p += 4;
+            if(large) {
+                uint32_t size = (uint32_t)padded;
+                memcpy(p, &size, 4);
+                p += 4;
+            }
+            // zero the padding so identical frames serialize to identical bytes
+            memset(p + payload, 0, padded - payload);
+            return writer(p);
+        }
+
+        void single(commandop op, uint32_t value)
+        {
+            writer w = begin(op, 4);
+            w.u32(value);
+        }
+
+        template<class T>
+        void declare(uint32_t *ids, T *const *objects, uint32_t count, objectkind kind)
+        {
+            for(uint32_t i = 0; i < count && i < commandsink::max_slots; ++i) {
+                ids[i] = object(objects[i], kind);
+            }
+        }
+
+        template<class T>
+        void slots(commandop op, shaderstagekind stage, uint32_t start_slot, uint32_t count, T *const *objects, objectkind kind)
+        {
+            uint32_t ids[commandsink::max_slots];
+            declare(ids, objects, count, kind);
+            writer w = begin(op, 12 + 4 * count);
+            w.u32((uint32_t)stage);
+            w.u32(start_slot);
+            w.u32(count);
+            for(uint32_t i = 0; i < count; ++i) {
+                w.u32(ids[i]);
+            }
+        }
+
+        static objectkind shader_kind(shaderstagekind stage)
+        {
+            return (objectkind)((uint32_t)objectkind::vertexshader + (uint32_t)stage);
+        }
+
+        std::vector<uint8_t> m_data;
+        std::unordered_map<const void*, uint32_t> m_ids;
+        std::vector<const void*> m_objects;
+    };
+
+} /* End of namespace dx */
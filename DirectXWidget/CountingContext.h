@@ -0,0 +1,319 @@
+#pragma once
+
+#include <atomic>
+
+#include "DirectXPlus.h"
+
+namespace dx {
+
+    namespace d3d11 {
+
+        /// <summary>
+        /// Reference counts taken and dropped on mock objects since the last reset().
+        /// </summary>
+        struct refcountstatistics {
+            std::atomic<uint64_t> addrefs{0};
+            std::atomic<uint64_t> releases{0};
+
+            void reset()
+            {
+                addrefs = 0;
+                releases = 0;
+            }
+
+            uint64_t total() const
+            {
+                return addrefs + releases;
+            }
+        };
+
+        /// <summary>
+        /// A COM object that only counts AddRef and Release, never deletes itself, and stands in for any
+        /// view, buffer, state or shader handed to a countingcontext.
+        ///
+        /// The comobj wrappers and countingcontext call nothing but IUnknown on those objects, and by the COM
+        /// binary standard every interface starts with the IUnknown vtable, so as<I>() can be passed where an
+        /// ID3D11ShaderResourceView or an ID3D11Buffer is expected. Anything calling further methods on it,
+        /// like a real context or a capture asking a resource for its type, must not get one.
+        /// </summary>
+        class countingunknown : public IUnknown {
+        public:
+            explicit countingunknown(refcountstatistics &statistics)
+                : m_statistics(statistics)
+            {}
+
+            countingunknown(const countingunknown &) = delete;
+            countingunknown &operator= (const countingunknown &) = delete;
+
+            template<class I>
+            I *as()
+            {
+                return reinterpret_cast<I*>(static_cast<IUnknown*>(this));
+            }
+
+            HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvObject) override
+            {
+                if(nullptr == ppvObject) {
+                    return E_POINTER;
+                }
+                if(riid == __uuidof(IUnknown)) {
+                    *ppvObject = static_cast<IUnknown*>(this);
+                    AddRef();
+                    return S_OK;
+                }
+                *ppvObject = nullptr;
+                return E_NOINTERFACE;
+            }
+
+            ULONG STDMETHODCALLTYPE AddRef() override
+            {
+                m_statistics.addrefs++;
+                return ++m_references;
+            }
+
+            ULONG STDMETHODCALLTYPE Release() override
+            {
+                m_statistics.releases++;
+                return --m_references;
+            }
+
+            ULONG references() const
+            {
+                return m_references;
+            }
+
+        private:
+            refcountstatistics &m_statistics;
+            std::atomic<ULONG> m_references{1};
+        };
+
+        /// <summary>
+        /// An immediate context that does nothing but count the references taken on it, for measuring
+        /// devicecontext on its own without a driver. Getters return empty state, Map fails.
+        /// Private data has a single slot, enough for the state cache devicecontext keeps there.
+        /// Wrap it with devicecontext(&mock, adopt), it must outlive every copy.
+        /// </summary>
+        class countingcontext : public ID3D11DeviceContext {
+        public:
+            explicit countingcontext(refcountstatistics &statistics)
+                : m_statistics(statistics)
+            {}
+
+            ~countingcontext()
+            {
+                if(nullptr != m_private) {
+                    m_private->Release();
+                }
+            }
+
+            countingcontext(const countingcontext &) = delete;
+            countingcontext &operator= (const countingcontext &) = delete;
+
+            // IUnknown
+            HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvObject) override
+            {
+                if(nullptr == ppvObject) {
+                    return E_POINTER;
+                }
+                if(riid == __uuidof(IUnknown) || riid == __uuidof(ID3D11DeviceChild) || riid == __uuidof(ID3D11DeviceContext)) {
+                    *ppvObject = static_cast<ID3D11DeviceContext*>(this);
+                    AddRef();
+                    return S_OK;
+                }
+                *ppvObject = nullptr;
+                return E_NOINTERFACE;
+            }
+
+            ULONG STDMETHODCALLTYPE AddRef() override
+            {
+                m_statistics.addrefs++;
+                return ++m_references;
+            }
+
+            ULONG STDMETHODCALLTYPE Release() override
+            {
+                m_statistics.releases++;
+                return --m_references;
+            }
+
+            // ID3D11DeviceChild
+            void STDMETHODCALLTYPE GetDevice(ID3D11Device **ppDevice) override { none(ppDevice); }
+            HRESULT STDMETHODCALLTYPE SetPrivateData(REFGUID, UINT, const void *) override { return S_OK; }
+
+            HRESULT STDMETHODCALLTYPE GetPrivateData(REFGUID guid, UINT *pDataSize, void *pData) override
+            {
+                if(nullptr == pDataSize) {
+                    return E_INVALIDARG;
+                }
+                if(nullptr == m_private || guid != m_private_guid) {
+                    *pDataSize = 0;
+                    return DXGI_ERROR_NOT_FOUND;
+                }
+                if(nullptr == pData) {
+                    *pDataSize = sizeof(IUnknown*);
+                    return S_OK;
+                }
+                if(*pDataSize < sizeof(IUnknown*)) {
+                    return DXGI_ERROR_MORE_DATA;
+                }
+                // like the runtime, hand out a reference of its own
+                m_private->AddRef();
+                *(IUnknown**)pData = m_private;
+                *pDataSize = sizeof(IUnknown*);
+                return S_OK;
+            }
+
+            HRESULT STDMETHODCALLTYPE SetPrivateDataInterface(REFGUID guid, const IUnknown *pData) override
+            {
+                if(nullptr != m_private && guid != m_private_guid) {
+                    return E_OUTOFMEMORY;
+                }
+                IUnknown *p = const_cast<IUnknown*>(pData);
+                if(nullptr != p) {
+                    p->AddRef();
+                }
+                if(nullptr != m_private) {
+                    m_private->Release();
+                }
+                m_private = p;
+                m_private_guid = guid;
+                return S_OK;
+            }
+
+            // binds
+            void STDMETHODCALLTYPE VSSetConstantBuffers(UINT, UINT, ID3D11Buffer *const *) override {}
+            void STDMETHODCALLTYPE PSSetShaderResources(UINT, UINT, ID3D11ShaderResourceView *const *) override {}
+            void STDMETHODCALLTYPE PSSetShader(ID3D11PixelShader *, ID3D11ClassInstance *const *, UINT) override {}
+            void STDMETHODCALLTYPE PSSetSamplers(UINT, UINT, ID3D11SamplerState *const *) override {}
+            void STDMETHODCALLTYPE VSSetShader(ID3D11VertexShader *, ID3D11ClassInstance *const *, UINT) override {}
+            void STDMETHODCALLTYPE PSSetConstantBuffers(UINT, UINT, ID3D11Buffer *const *) override {}
+            void STDMETHODCALLTYPE IASetInputLayout(ID3D11InputLayout *) override {}
+            void STDMETHODCALLTYPE IASetVertexBuffers(UINT, UINT, ID3D11Buffer *const *, const UINT *, const UINT *) override {}
+            void STDMETHODCALLTYPE IASetIndexBuffer(ID3D11Buffer *, DXGI_FORMAT, UINT) override {}
+            void STDMETHODCALLTYPE GSSetConstantBuffers(UINT, UINT, ID3D11Buffer *const *) override {}
+            void STDMETHODCALLTYPE GSSetShader(ID3D11GeometryShader *, ID3D11ClassInstance *const *, UINT) override {}
+            void STDMETHODCALLTYPE IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY) override {}
+            void STDMETHODCALLTYPE VSSetShaderResources(UINT, UINT, ID3D11ShaderResourceView *const *) override {}
+            void STDMETHODCALLTYPE VSSetSamplers(UINT, UINT, ID3D11SamplerState *const *) override {}
+            void STDMETHODCALLTYPE SetPredication(ID3D11Predicate *, BOOL) override {}
+            void STDMETHODCALLTYPE GSSetShaderResources(UINT, UINT, ID3D11ShaderResourceView *const *) override {}
+            void STDMETHODCALLTYPE GSSetSamplers(UINT, UINT, ID3D11SamplerState *const *) override {}
+            void STDMETHODCALLTYPE OMSetRenderTargets(UINT, ID3D11RenderTargetView *const *, ID3D11DepthStencilView *) override {}
+            void STDMETHODCALLTYPE OMSetRenderTargetsAndUnorderedAccessViews(UINT, ID3D11RenderTargetView *const *, ID3D11DepthStencilView *, UINT, UINT, ID3D11UnorderedAccessView *const *, const UINT *) override {}
+            void STDMETHODCALLTYPE OMSetBlendState(ID3D11BlendState *, const FLOAT[4], UINT) override {}
+            void STDMETHODCALLTYPE OMSetDepthStencilState(ID3D11DepthStencilState *, UINT) override {}
+            void STDMETHODCALLTYPE SOSetTargets(UINT, ID3D11Buffer *const *, const UINT *) override {}
+            void STDMETHODCALLTYPE RSSetState(ID3D11RasterizerState *) override {}
+            void STDMETHODCALLTYPE RSSetViewports(UINT, const D3D11_VIEWPORT *) override {}
+            void STDMETHODCALLTYPE RSSetScissorRects(UINT, const D3D11_RECT *) override {}
+            void STDMETHODCALLTYPE HSSetShaderResources(UINT, UINT, ID3D11ShaderResourceView *const *) override {}
+            void STDMETHODCALLTYPE HSSetShader(ID3D11HullShader *, ID3D11ClassInstance *const *, UINT) override {}
+            void STDMETHODCALLTYPE HSSetSamplers(UINT, UINT, ID3D11SamplerState *const *) override {}
+            void STDMETHODCALLTYPE HSSetConstantBuffers(UINT, UINT, ID3D11Buffer *const *) override {}
+            void STDMETHODCALLTYPE DSSetShaderResources(UINT, UINT, ID3D11ShaderResourceView *const *) override {}
+            void STDMETHODCALLTYPE DSSetShader(ID3D11DomainShader *, ID3D11ClassInstance *const *, UINT) override {}
+            void STDMETHODCALLTYPE DSSetSamplers(UINT, UINT, ID3D11SamplerState *const *) override {}
+            void STDMETHODCALLTYPE DSSetConstantBuffers(UINT, UINT, ID3D11Buffer *const *) override {}
+            void STDMETHODCALLTYPE CSSetShaderResources(UINT, UINT, ID3D11ShaderResourceView *const *) override {}
+            void STDMETHODCALLTYPE CSSetUnorderedAccessViews(UINT, UINT, ID3D11UnorderedAccessView *const *, const UINT *) override {}
+            void STDMETHODCALLTYPE CSSetShader(ID3D11ComputeShader *, ID3D11ClassInstance *const *, UINT) override {}
+            void STDMETHODCALLTYPE CSSetSamplers(UINT, UINT, ID3D11SamplerState *const *) override {}
+            void STDMETHODCALLTYPE CSSetConstantBuffers(UINT, UINT, ID3D11Buffer *const *) override {}
+
+            // draws, copies and clears
+            void STDMETHODCALLTYPE DrawIndexed(UINT, UINT, INT) override {}
+            void STDMETHODCALLTYPE Draw(UINT, UINT) override {}
+            HRESULT STDMETHODCALLTYPE Map(ID3D11Resource *, UINT, D3D11_MAP, UINT, D3D11_MAPPED_SUBRESOURCE *pMappedResource) override { if(pMappedResource) ZeroMemory(pMappedResource, sizeof(*pMappedResource)); return E_NOTIMPL; }
+            void STDMETHODCALLTYPE Unmap(ID3D11Resource *, UINT) override {}
+            void STDMETHODCALLTYPE DrawIndexedInstanced(UINT, UINT, UINT, INT, UINT) override {}
+            void STDMETHODCALLTYPE DrawInstanced(UINT, UINT, UINT, UINT) override {}
+            void STDMETHODCALLTYPE Begin(ID3D11Asynchronous *) override {}
+            void STDMETHODCALLTYPE End(ID3D11Asynchronous *) override {}
+            HRESULT STDMETHODCALLTYPE GetData(ID3D11Asynchronous *, void *, UINT, UINT) override { return S_FALSE; }
+            void STDMETHODCALLTYPE DrawAuto() override {}
+            void STDMETHODCALLTYPE DrawIndexedInstancedIndirect(ID3D11Buffer *, UINT) override {}
+            void STDMETHODCALLTYPE DrawInstancedIndirect(ID3D11Buffer *, UINT) override {}
+            void STDMETHODCALLTYPE Dispatch(UINT, UINT, UINT) override {}
+            void STDMETHODCALLTYPE DispatchIndirect(ID3D11Buffer *, UINT) override {}
+            void STDMETHODCALLTYPE CopySubresourceRegion(ID3D11Resource *, UINT, UINT, UINT, UINT, ID3D11Resource *, UINT, const D3D11_BOX *) override {}
+            void STDMETHODCALLTYPE CopyResource(ID3D11Resource *, ID3D11Resource *) override {}
+            void STDMETHODCALLTYPE UpdateSubresource(ID3D11Resource *, UINT, const D3D11_BOX *, const void *, UINT, UINT) override {}
+            void STDMETHODCALLTYPE CopyStructureCount(ID3D11Buffer *, UINT, ID3D11UnorderedAccessView *) override {}
+            void STDMETHODCALLTYPE ClearRenderTargetView(ID3D11RenderTargetView *, const FLOAT[4]) override {}
+            void STDMETHODCALLTYPE ClearUnorderedAccessViewUint(ID3D11UnorderedAccessView *, const UINT[4]) override {}
+            void STDMETHODCALLTYPE ClearUnorderedAccessViewFloat(ID3D11UnorderedAccessView *, const FLOAT[4]) override {}
+            void STDMETHODCALLTYPE ClearDepthStencilView(ID3D11DepthStencilView *, UINT, FLOAT, UINT8) override {}
+            void STDMETHODCALLTYPE GenerateMips(ID3D11ShaderResourceView *) override {}
+            void STDMETHODCALLTYPE SetResourceMinLOD(ID3D11Resource *, FLOAT) override {}
+            FLOAT STDMETHODCALLTYPE GetResourceMinLOD(ID3D11Resource *) override { return 0.0f; }
+            void STDMETHODCALLTYPE ResolveSubresource(ID3D11Resource *, UINT, ID3D11Resource *, UINT, DXGI_FORMAT) override {}
+            void STDMETHODCALLTYPE ExecuteCommandList(ID3D11CommandList *, BOOL) override {}
+            void STDMETHODCALLTYPE ClearState() override {}
+            void STDMETHODCALLTYPE Flush() override {}
+            D3D11_DEVICE_CONTEXT_TYPE STDMETHODCALLTYPE GetType() override { return D3D11_DEVICE_CONTEXT_IMMEDIATE; }
+            UINT STDMETHODCALLTYPE GetContextFlags() override { return 0; }
+            HRESULT STDMETHODCALLTYPE FinishCommandList(BOOL, ID3D11CommandList **ppCommandList) override { none(ppCommandList); return DXGI_ERROR_INVALID_CALL; }
+
+            // getters, the mock keeps no state
+            void STDMETHODCALLTYPE VSGetConstantBuffers(UINT, UINT n, ID3D11Buffer **pp) override { none(pp, n); }
+            void STDMETHODCALLTYPE PSGetShaderResources(UINT, UINT n, ID3D11ShaderResourceView **pp) override { none(pp, n); }
+            void STDMETHODCALLTYPE PSGetShader(ID3D11PixelShader **pp, ID3D11ClassInstance **, UINT *pn) override { none(pp); if(pn) *pn = 0; }
+            void STDMETHODCALLTYPE PSGetSamplers(UINT, UINT n, ID3D11SamplerState **pp) override { none(pp, n); }
+            void STDMETHODCALLTYPE VSGetShader(ID3D11VertexShader **pp, ID3D11ClassInstance **, UINT *pn) override { none(pp); if(pn) *pn = 0; }
+            void STDMETHODCALLTYPE PSGetConstantBuffers(UINT, UINT n, ID3D11Buffer **pp) override { none(pp, n); }
+            void STDMETHODCALLTYPE IAGetInputLayout(ID3D11InputLayout **pp) override { none(pp); }
+            void STDMETHODCALLTYPE IAGetVertexBuffers(UINT, UINT n, ID3D11Buffer **pp, UINT *, UINT *) override { none(pp, n); }
+            void STDMETHODCALLTYPE IAGetIndexBuffer(ID3D11Buffer **pp, DXGI_FORMAT *, UINT *) override { none(pp); }
+            void STDMETHODCALLTYPE GSGetConstantBuffers(UINT, UINT n, ID3D11Buffer **pp) override { none(pp, n); }
+            void STDMETHODCALLTYPE GSGetShader(ID3D11GeometryShader **pp, ID3D11ClassInstance **, UINT *pn) override { none(pp); if(pn) *pn = 0; }
+            void STDMETHODCALLTYPE IAGetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY *p) override { if(p) *p = D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED; }
+            void STDMETHODCALLTYPE VSGetShaderResources(UINT, UINT n, ID3D11ShaderResourceView **pp) override { none(pp, n); }
+            void STDMETHODCALLTYPE VSGetSamplers(UINT, UINT n, ID3D11SamplerState **pp) override { none(pp, n); }
+            void STDMETHODCALLTYPE GetPredication(ID3D11Predicate **pp, BOOL *) override { none(pp); }
+            void STDMETHODCALLTYPE GSGetShaderResources(UINT, UINT n, ID3D11ShaderResourceView **pp) override { none(pp, n); }
+            void STDMETHODCALLTYPE GSGetSamplers(UINT, UINT n, ID3D11SamplerState **pp) override { none(pp, n); }
+            void STDMETHODCALLTYPE OMGetRenderTargets(UINT n, ID3D11RenderTargetView **pp, ID3D11DepthStencilView **pdsv) override { none(pp, n); none(pdsv); }
+            void STDMETHODCALLTYPE OMGetRenderTargetsAndUnorderedAccessViews(UINT n, ID3D11RenderTargetView **pp, ID3D11DepthStencilView **pdsv, UINT, UINT nuav, ID3D11UnorderedAccessView **puav) override { none(pp, n); none(pdsv); none(puav, nuav); }
+            void STDMETHODCALLTYPE OMGetBlendState(ID3D11BlendState **pp, FLOAT[4], UINT *) override { none(pp); }
+            void STDMETHODCALLTYPE OMGetDepthStencilState(ID3D11DepthStencilState **pp, UINT *) override { none(pp); }
+            void STDMETHODCALLTYPE SOGetTargets(UINT n, ID3D11Buffer **pp) override { none(pp, n); }
+            void STDMETHODCALLTYPE RSGetState(ID3D11RasterizerState **pp) override { none(pp); }
+            void STDMETHODCALLTYPE RSGetViewports(UINT *pn, D3D11_VIEWPORT *) override { if(pn) *pn = 0; }
+            void STDMETHODCALLTYPE RSGetScissorRects(UINT *pn, D3D11_RECT *) override { if(pn) *pn = 0; }
+            void STDMETHODCALLTYPE HSGetShaderResources(UINT, UINT n, ID3D11ShaderResourceView **pp) override { none(pp, n); }
+            void STDMETHODCALLTYPE HSGetShader(ID3D11HullShader **pp, ID3D11ClassInstance **, UINT *pn) override { none(pp); if(pn) *pn = 0; }
+            void STDMETHODCALLTYPE HSGetSamplers(UINT, UINT n, ID3D11SamplerState **pp) override { none(pp, n); }
+            void STDMETHODCALLTYPE HSGetConstantBuffers(UINT, UINT n, ID3D11Buffer **pp) override { none(pp, n); }
+            void STDMETHODCALLTYPE DSGetShaderResources(UINT, UINT n, ID3D11ShaderResourceView **pp) override { none(pp, n); }
+            void STDMETHODCALLTYPE DSGetShader(ID3D11DomainShader **pp, ID3D11ClassInstance **, UINT *pn) override { none(pp); if(pn) *pn = 0; }
+            void STDMETHODCALLTYPE DSGetSamplers(UINT, UINT n, ID3D11SamplerState **pp) override { none(pp, n); }
+            void STDMETHODCALLTYPE DSGetConstantBuffers(UINT, UINT n, ID3D11Buffer **pp) override { none(pp, n); }
+            void STDMETHODCALLTYPE CSGetShaderResources(UINT, UINT n, ID3D11ShaderResourceView **pp) override { none(pp, n); }
+            void STDMETHODCALLTYPE CSGetUnorderedAccessViews(UINT, UINT n, ID3D11UnorderedAccessView **pp) override { none(pp, n); }
+            void STDMETHODCALLTYPE CSGetShader(ID3D11ComputeShader **pp, ID3D11ClassInstance **, UINT *pn) override { none(pp); if(pn) *pn = 0; }
+            void STDMETHODCALLTYPE CSGetSamplers(UINT, UINT n, ID3D11SamplerState **pp) override { none(pp, n); }
+            void STDMETHODCALLTYPE CSGetConstantBuffers(UINT, UINT n, ID3D11Buffer **pp) override { none(pp, n); }
+
+            ULONG references() const
+            {
+                return m_references;
+            }
+
+        private:
+            template<class T>
+            static void none(T **pp, UINT n = 1)
+            {
+                for(UINT i = 0; nullptr != pp && i < n; ++i) {
+                    pp[i] = nullptr;
+                }
+            }
+
+            refcountstatistics &m_statistics;
+            std::atomic<ULONG> m_references{1};
+            IUnknown *m_private = nullptr;
+            GUID m_private_guid = {};
+        };
+
+    } /* End of namespace d3d11 */
+
+} /* End of namespace dx */
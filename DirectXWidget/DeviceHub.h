@@ -0,0 +1,273 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "DirectXPlus.h"
+#include "PipelineState.h"
+
+namespace dx {
+
+    namespace d3d11 {
+
+        struct widgetmemory {
+            std::string name;
+            uint64_t bytes = 0;
+        };
+
+        struct hubmemorystatistics {
+            uint64_t shared_texture_bytes = 0;
+            uint64_t shared_shader_bytes = 0;
+            unsigned int textures = 0;
+            unsigned int shaders = 0;
+            unsigned int pipelines = 0;
+            std::vector<widgetmemory> widgets;
+            memorysnapshot device;          // everything the device factory functions allocated
+
+            uint64_t widget_bytes() const
+            {
+                uint64_t bytes = 0;
+                for(auto& w : widgets) {
+                    bytes += w.bytes;
+                }
+                return bytes;
+            }
+        };
+
+        /// <summary>
+        /// One device for every widget of the process, and caches of what widgets can share:
+        /// shaders by bytecode, textures by name and pipeline states by description.
+        /// Swapchains and everything sized by a window stay with the widgets.
+        ///
+        /// The immediate context is shared as well, whoever draws from a thread of its own
+        /// has to hold context_mutex() for the whole frame.
+        /// </summary>
+        class devicehub {
+        public:
+            /// <summary>
+            /// The process-wide hub, created on first use and destroyed with its last user.
+            /// </summary>
+            static std::shared_ptr<devicehub> acquire()
+            {
+                static std::mutex mutex;
+                static std::weak_ptr<devicehub> instance;
+
+                std::lock_guard<std::mutex> lock(mutex);
+                std::shared_ptr<devicehub> hub = instance.lock();
+                if(!hub) {
+                    hub.reset(new devicehub());
+                    instance = hub;
+                }
+                return hub;
+            }
+
+            ~devicehub()
+            {
+                m_device.memory().remove_eviction_callback(m_evict_callback);
+            }
+
+            devicehub(const devicehub &) = delete;
+            devicehub &operator= (const devicehub &) = delete;
+
+            dxgi::factory &factory()
+            {
+                return m_factory;
+            }
+
+            d3d11::device &device()
+            {
+                return m_device;
+            }
+
+            devicecontext &immediate_context()
+            {
+                return m_context;
+            }
+
+            std::mutex &context_mutex()
+            {
+                return m_context_mutex;
+            }
+
+            pipelinecache &pipelines()
+            {
+                return m_pipelines;
+            }
+
+            /// <summary>
+            /// Create a shader, or return the one made from identical bytecode before.
+            /// </summary>
+            template<class shader>
+            shader create_shader(const void *bytecode, size_t size)
+            {
+                typedef typename borrowed<shader>::interface_type interface_type;
+                const uint32_t stage = (uint32_t)shaderstage<shader>::kind;
+                uint64_t key = fnv1a(14695981039346656037ull, bytecode, size);
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto range = m_shaders[stage].equal_range(key);
+                for(auto it = range.first; it != range.second; ++it) {
+                    if(it->second.code.size() == size && memcmp(it->second.code.data(), bytecode, size) == 0) {
+                        return shader((interface_type*)it->second.object.get());
+                    }
+                }
+
+                shader result = m_device.create_shader<shader>(bytecode, size);
+                sharedshader entry;
+                entry.object = share(result.winapi());
+                entry.code.assign((const uint8_t*)bytecode, (const uint8_t*)bytecode + size);
+                m_shaders[stage].emplace(key, std::move(entry));
+                return result;
+            }
+
+            /// <summary>
+            /// Look up a texture by name, returns an invalid texture if there is none.
+            /// </summary>
+            texture2d find_texture(const std::string &name)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto it = m_textures.find(name);
+                return (it != m_textures.end()) ? it->second : texture2d();
+            }
+
+            /// <summary>
+            /// Return the texture of that name, or make it with create(device) and keep it.
+            /// create runs under the hub's lock and must not call back into the hub.
+            /// </summary>
+            template<class F>
+            texture2d texture(const std::string &name, F create)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto it = m_textures.find(name);
+                if(it != m_textures.end()) {
+                    return it->second;
+                }
+                texture2d result = create(m_device);
+                m_textures.emplace(name, result);
+                return result;
+            }
+
+            void remove_texture(const std::string &name)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_textures.erase(name);
+            }
+
+            /// <summary>
+            /// Drop shared shaders and textures that nobody but the hub holds any more, and unused pipelines.
+            /// </summary>
+            void trim()
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                for(auto& stage : m_shaders) {
+                    for(auto it = stage.begin(); it != stage.end();) {
+                        it = only_hub_holds(it->second.object.get()) ? stage.erase(it) : std::next(it);
+                    }
+                }
+                for(auto it = m_textures.begin(); it != m_textures.end();) {
+                    it = only_hub_holds(it->second.winapi()) ? m_textures.erase(it) : std::next(it);
+                }
+                m_pipelines.trim();
+            }
+
+            /// <summary>
+            /// Widgets report what they allocate for themselves (swapchain, depth, pooled targets).
+            /// </summary>
+            void report_widget_memory(const void *widget, const std::string &name, uint64_t bytes)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                widgetmemory &w = m_widgets[widget];
+                w.name = name;
+                w.bytes = bytes;
+            }
+
+            void remove_widget(const void *widget)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_widgets.erase(widget);
+            }
+
+            hubmemorystatistics memory() const
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                hubmemorystatistics result;
+                for(auto& stage : m_shaders) {
+                    for(auto& s : stage) {
+                        result.shared_shader_bytes += s.second.code.size();
+                        result.shaders++;
+                    }
+                }
+                for(auto& t : m_textures) {
+                    result.shared_texture_bytes += texture_bytes(t.second.desc());
+                    result.textures++;
+                }
+                result.pipelines = (unsigned int)m_pipelines.size();
+                for(auto& w : m_widgets) {
+                    result.widgets.push_back(w.second);
+                }
+                result.device = m_device.memory().snapshot();
+                return result;
+            }
+
+        private:
+            devicehub()
+                : m_factory(dxgi::factory::create()),
+                  m_device(d3d11::device::create_default_device()),
+                  m_context(m_device.immediate_context()),
+                  m_pipelines(m_device)
+            {
+                m_context.enable_state_filter();
+                m_evict_callback = m_device.memory().add_eviction_callback([this](const memorysnapshot &) {
+                    trim();
+                });
+            }
+
+            struct sharedshader {
+                std::shared_ptr<IUnknown> object;
+                std::vector<uint8_t> code;     // kept to tell hash collisions apart
+            };
+
+            static std::shared_ptr<IUnknown> share(IUnknown *object)
+            {
+                object->AddRef();
+                return std::shared_ptr<IUnknown>(object, [](IUnknown *p) { p->Release(); });
+            }
+
+            static bool only_hub_holds(IUnknown *object)
+            {
+                // the count Release returns is only a hint, which is enough for trimming a cache
+                object->AddRef();
+                return object->Release() == 1;
+            }
+
+            static uint64_t fnv1a(uint64_t h, const void *data, size_t size)
+            {
+                const unsigned char *p = (const unsigned char*)data;
+                for(size_t i = 0; i < size; ++i) {
+                    h = (h ^ p[i]) * 1099511628211ull;
+                }
+                return h;
+            }
+
+            dxgi::factory m_factory;
+            d3d11::device m_device;
+            devicecontext m_context;
+            std::mutex m_context_mutex;
+            pipelinecache m_pipelines;
+            unsigned int m_evict_callback = 0;
+
+            mutable std::mutex m_mutex;
+            std::unordered_multimap<uint64_t, sharedshader> m_shaders[6];
+            std::map<std::string, texture2d> m_textures;
+            std::map<const void*, widgetmemory> m_widgets;
+        };
+
+    } /* End of namespace d3d11 */
+
+} /* End of namespace dx */
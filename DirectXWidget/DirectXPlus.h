@@ -4,6 +4,12 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <iterator>
+#include <type_traits>
+#include <utility>
 
 #define WIN_LEAN_AND_MEAN
 #define NOMINMAX
@@ -15,6 +21,11 @@
 #include <d2d1.h>
 #pragma comment(lib, "d2d1")
 #include <d2d1_1.h>
+#include <d3dcompiler.h>
+#pragma comment(lib, "d3dcompiler")
+
+#include "DxgiFormat.h"
+#include "CommandStream.h"
 
 #ifndef DEBUG_REF
 #define DEBUG_REF(exp) (exp)
@@ -55,6 +66,17 @@
             reclaim();                                                          \
         }                                                                       \
                                                                                 \
+        C(I *p##C, adopt_t)                                                     \
+            : m_##C(p##C)                                                       \
+        {}                                                                      \
+                                                                                \
+        I *detach()                                                             \
+        {                                                                       \
+            I *p = m_##C;                                                       \
+            m_##C = nullptr;                                                    \
+            return p;                                                           \
+        }                                                                       \
+                                                                                \
         C(const C &c)                                                           \
         {                                                                       \
             release();                                                          \
@@ -149,14 +171,225 @@ namespace dx {
         }
     }
 
+    /// <summary>
+    /// Tag to take over a reference handed out by the API, instead of adding one.
+    /// </summary>
+    struct adopt_t {};
+    const adopt_t adopt = adopt_t();
+
     template<typename T, typename P, typename ... Args>
     inline T make_comobj(P ptr, Args ... args)
     {
-        T r(ptr, args...);
-        if(nullptr!=ptr) {
-            ptr->Release();
+        return T(ptr, adopt, args...);
+    }
+
+    /// <summary>
+    /// Non-owning reference to a comobj, copying it never touches the reference count.
+    /// For frame code and per-frame arrays, the owner must outlive it.
+    /// </summary>
+    template<class C>
+    class borrowed {
+    public:
+        typedef typename std::remove_pointer<decltype(std::declval<const C&>().winapi())>::type interface_type;
+
+        borrowed() {}
+
+        borrowed(const C &c)
+            : m_p(c.winapi())
+        {}
+
+        explicit borrowed(interface_type *p)
+            : m_p(p)
+        {}
+
+        bool is_valid() const
+        {
+            return (nullptr != m_p);
+        }
+
+        interface_type *winapi() const
+        {
+            return m_p;
+        }
+
+        /// <summary>
+        /// Take a counted reference, to keep the object beyond the owner.
+        /// </summary>
+        C own() const
+        {
+            return C(m_p);
+        }
+
+        bool operator== (const borrowed &b) const
+        {
+            return m_p == b.m_p;
+        }
+
+        bool operator!= (const borrowed &b) const
+        {
+            return m_p != b.m_p;
+        }
+
+    private:
+        interface_type *m_p = nullptr;
+    };
+
+    /// <summary>
+    /// Non-owning view of consecutive handles as raw interface pointers, ready for multi-bind calls.
+    /// Views arrays of comobjs, borrowed handles or raw pointers without copying them.
+    /// </summary>
+    template<class C>
+    class handle_span {
+    public:
+        typedef typename borrowed<C>::interface_type interface_type;
+
+        handle_span() {}
+
+        handle_span(interface_type *const *p, size_t n)
+            : m_data(p), m_size((unsigned int)n)
+        {}
+
+        handle_span(const borrowed<C> *p, size_t n)
+            : m_data(reinterpret_cast<interface_type *const *>(p)), m_size((unsigned int)n)
+        {
+            static_assert(sizeof(borrowed<C>) == sizeof(interface_type*), "borrowed must be a plain pointer");
+        }
+
+        handle_span(const C *p, size_t n)
+            : m_data(reinterpret_cast<interface_type *const *>(p)), m_size((unsigned int)n)
+        {
+            static_assert(sizeof(C) == sizeof(interface_type*) && std::is_standard_layout<C>::value, "only comobjs holding nothing but their interface can be viewed");
+        }
+
+        /// <summary>
+        /// Any contiguous container with data() and size(): std::vector, std::array, static_vector.
+        /// </summary>
+        template<class Range>
+        handle_span(const Range &r)
+            : handle_span(r.data(), r.size())
+        {}
+
+        interface_type *const *data() const
+        {
+            return m_data;
+        }
+
+        unsigned int size() const
+        {
+            return m_size;
+        }
+
+        bool empty() const
+        {
+            return m_size == 0;
+        }
+
+        borrowed<C> operator[] (unsigned int i) const
+        {
+            return borrowed<C>(m_data[i]);
+        }
+
+        const borrowed<C> *begin() const
+        {
+            return reinterpret_cast<const borrowed<C>*>(m_data);
+        }
+
+        const borrowed<C> *end() const
+        {
+            return begin() + m_size;
+        }
+
+    private:
+        interface_type *const *m_data = nullptr;
+        unsigned int m_size = 0;
+    };
+
+    /// <summary>
+    /// Fixed-capacity vector living on the stack, used to gather handles for multi-bind calls
+    /// without touching the heap.
+    /// </summary>
+    template<class T, size_t N>
+    class static_vector {
+    public:
+        static_vector() {}
+
+        template<class Range>
+        explicit static_vector(const Range &r)
+        {
+            for(auto& x : r) {
+                push_back(x);
+            }
+        }
+
+        void push_back(const T &x)
+        {
+            if(m_size >= N) {
+                throw runtime_error(E_INVALIDARG);
+            }
+            m_data[m_size++] = x;
+        }
+
+        void clear()
+        {
+            m_size = 0;
+        }
+
+        T *data()
+        {
+            return m_data;
+        }
+
+        const T *data() const
+        {
+            return m_data;
+        }
+
+        unsigned int size() const
+        {
+            return m_size;
+        }
+
+        bool empty() const
+        {
+            return m_size == 0;
+        }
+
+        static unsigned int capacity()
+        {
+            return (unsigned int)N;
+        }
+
+        T &operator[] (unsigned int i)
+        {
+            return m_data[i];
+        }
+
+        const T &operator[] (unsigned int i) const
+        {
+            return m_data[i];
+        }
+
+        T *begin() { return m_data; }
+        T *end() { return m_data + m_size; }
+        const T *begin() const { return m_data; }
+        const T *end() const { return m_data + m_size; }
+
+    private:
+        T m_data[N];
+        unsigned int m_size = 0;
+    };
+
+    /// <summary>
+    /// Gather the raw interfaces of a range of comobjs.
+    /// </summary>
+    template<class I, size_t N, class Range>
+    inline static_vector<I*, N> winapi_array(const Range &objs)
+    {
+        static_vector<I*, N> result;
+        for(auto& obj : objs) {
+            result.push_back(obj.winapi());
         }
-        return r;
+        return result;
     }
 
     namespace dxgi {
@@ -191,8 +424,72 @@ namespace dx {
         INJECT_COMOBJ_CONCEPT(blob, ID3DBlob)
     public:
         blob() {}
+
+        const void *data() const
+        {
+            return m_blob->GetBufferPointer();
+        }
+
+        size_t size() const
+        {
+            return m_blob->GetBufferSize();
+        }
+    };
+
+    class compile_error : public runtime_error {
+    public:
+        /// <summary>
+        /// Construct from the return code and the compiler's error log.
+        /// </summary>
+        compile_error(HRESULT hr, const std::string &log)
+            : runtime_error(hr), m_log(log)
+        {}
+
+        const char *what() const noexcept override
+        {
+            return m_log.empty() ? runtime_error::what() : m_log.c_str();
+        }
+
+        const std::string &log() const
+        {
+            return m_log;
+        }
+
+    private:
+        std::string m_log;
     };
 
+    /// <summary>
+    /// Compile HLSL source to bytecode. defines is terminated by a {nullptr, nullptr} entry, or null.
+    /// #include reads files relative to the working directory unless another include handler is given.
+    /// </summary>
+    inline blob compile_shader(const char *source, size_t length, const D3D_SHADER_MACRO *defines, const char *entry, const char *profile, unsigned int flags = D3DCOMPILE_OPTIMIZATION_LEVEL3, ID3DInclude *include = D3D_COMPILE_STANDARD_FILE_INCLUDE)
+    {
+        ID3DBlob *pCode = nullptr;
+        ID3DBlob *pErrors = nullptr;
+        HRESULT hr = D3DCompile(source, length, nullptr, defines, include, entry, profile, flags, 0, &pCode, &pErrors);
+        blob errors = make_comobj<blob>(pErrors);
+        if(FAILED(hr)) {
+            throw compile_error(hr, errors.is_valid() ? std::string((const char*)errors.data(), errors.size()) : std::string());
+        }
+        return make_comobj<blob>(pCode);
+    }
+
+    /// <summary>
+    /// Run the HLSL preprocessor, the result is null-terminated text with includes and macros expanded.
+    /// </summary>
+    inline blob preprocess_shader(const char *source, size_t length, const D3D_SHADER_MACRO *defines, ID3DInclude *include = D3D_COMPILE_STANDARD_FILE_INCLUDE)
+    {
+        ID3DBlob *pText = nullptr;
+        ID3DBlob *pErrors = nullptr;
+        HRESULT hr = D3DPreprocess(source, length, nullptr, defines, include, &pText, &pErrors);
+        blob errors = make_comobj<blob>(pErrors);
+        if(FAILED(hr)) {
+            throw compile_error(hr, errors.is_valid() ? std::string((const char*)errors.data(), errors.size()) : std::string());
+        }
+        return make_comobj<blob>(pText);
+    }
+
     namespace dxgi {
 
         class surface {
@@ -222,16 +519,16 @@ namespace dx {
             template<>
             d3d11::texture2d backbuffer<d3d11::texture2d>(unsigned int buffer_id);
 
-            void resize(unsigned int width = 0, unsigned int height = 0, unsigned int buffer_count = 0, DXGI_FORMAT new_format = DXGI_FORMAT_UNKNOWN, unsigned int flags = 0)
-            {
-                throw_if_failed(m_swapchain->ResizeBuffers(buffer_count, width, height, new_format, flags));
-            }
+            void resize(unsigned int width = 0, unsigned int height = 0, unsigned int buffer_count = 0, DXGI_FORMAT new_format = DXGI_FORMAT_UNKNOWN, unsigned int flags = 0);
 
             HRESULT present(unsigned int sync_interval = 0, unsigned int flags = 0)
             {
                 return m_swapchain->Present(sync_interval, flags);
             }
 
+        private:
+            void track();
+
         };
 
         class device {
@@ -286,210 +583,1583 @@ namespace dx {
 
     namespace d3d11 {
 
-        class texture2d {
-            INJECT_COMOBJ_CONCEPT(texture2d, ID3D11Texture2D)
-        public:
-            texture2d() {}
+        /// <summary>
+        /// Round a target dimension up to its allocation bucket,
+        /// targets allocated this way survive small size changes and are drawn through a sub-viewport.
+        /// </summary>
+        inline unsigned int bucket_size(unsigned int size, unsigned int granularity = 256)
+        {
+            return (size + granularity - 1) / granularity * granularity;
+        }
+
+        /// <summary>
+        /// Whether an allocation of the given dimension can be kept for a target of the needed dimension,
+        /// it is dropped once it is more than twice the bucket that would be allocated now.
+        /// </summary>
+        inline bool bucket_fits(unsigned int allocated, unsigned int needed, unsigned int granularity = 256)
+        {
+            return needed <= allocated && allocated <= 2 * bucket_size(needed, granularity);
+        }
+
+        /// <summary>
+        /// Video memory taken by a texture, all mips, array slices and samples, ignoring driver padding.
+        /// </summary>
+        inline uint64_t texture_bytes(const D3D11_TEXTURE2D_DESC &desc)
+        {
+            uint64_t bytes = 0;
+            unsigned int mips = (desc.MipLevels > 0) ? desc.MipLevels : 1;
+            for(unsigned int mip = 0; mip < mips; ++mip) {
+                bytes += dxgi::depth_pitch(desc.Format, dxgi::mip_size(desc.Width, mip), dxgi::mip_size(desc.Height, mip));
+            }
+            return bytes * desc.ArraySize * desc.SampleDesc.Count;
+        }
+
+        enum class memorycategory : unsigned int {
+            rendertarget,
+            depth,
+            texture,
+            buffer,
+            swapchain,
+            count
+        };
+
+        inline memorycategory texture_category(const D3D11_TEXTURE2D_DESC &desc)
+        {
+            if(desc.BindFlags & D3D11_BIND_DEPTH_STENCIL) {
+                return memorycategory::depth;
+            }
+            if(desc.BindFlags & D3D11_BIND_RENDER_TARGET) {
+                return memorycategory::rendertarget;
+            }
+            return memorycategory::texture;
+        }
+
+        struct memorysnapshot {
+            static const unsigned int categories = (unsigned int)memorycategory::count;
+
+            uint64_t bytes[categories];
+            uint64_t peak_bytes[categories];
+            unsigned int objects[categories];
+            uint64_t budget[categories];        // 0 when unlimited
+            uint64_t total_budget;
+
+            uint64_t total() const
+            {
+                uint64_t sum = 0;
+                for(unsigned int i = 0; i < categories; ++i) {
+                    sum += bytes[i];
+                }
+                return sum;
+            }
+
+            uint64_t of(memorycategory c) const
+            {
+                return bytes[(unsigned int)c];
+            }
+
+            bool over_budget(memorycategory c) const
+            {
+                return budget[(unsigned int)c] != 0 && bytes[(unsigned int)c] > budget[(unsigned int)c];
+            }
+
+            bool over_budget() const
+            {
+                for(unsigned int i = 0; i < categories; ++i) {
+                    if(over_budget((memorycategory)i)) {
+                        return true;
+                    }
+                }
+                return total_budget != 0 && total() > total_budget;
+            }
+        };
+
+        /// <summary>
+        /// Minimal IUnknown for the objects we hang on D3D objects as private data.
+        /// </summary>
+        class privateunknown : public IUnknown {
+        public:
+            HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **object) override
+            {
+                if(nullptr == object) {
+                    return E_POINTER;
+                }
+                if(riid == __uuidof(IUnknown)) {
+                    AddRef();
+                    *object = static_cast<IUnknown*>(this);
+                    return S_OK;
+                }
+                *object = nullptr;
+                return E_NOINTERFACE;
+            }
+
+            ULONG STDMETHODCALLTYPE AddRef() override
+            {
+                return ++m_refs;
+            }
+
+            ULONG STDMETHODCALLTYPE Release() override
+            {
+                ULONG refs = --m_refs;
+                if(refs == 0) {
+                    delete this;
+                }
+                return refs;
+            }
+
+        protected:
+            virtual ~privateunknown() {}
+
+        private:
+            std::atomic<ULONG> m_refs{1};
+        };
+
+        /// <summary>
+        /// Bytes held by the resources of one device, by category, with soft budgets.
+        ///
+        /// The device factory functions attach a tracker to every resource they create,
+        /// D3D releases it with the resource, so the counters drop when the last reference goes,
+        /// whoever holds it. Resources created through the raw ID3D11Device are not seen.
+        ///
+        /// Budgets are soft: going over only raises a flag, enforce_budgets() then runs the eviction
+        /// callbacks in registration order until the device is back under budget. Call it at a point
+        /// where the registered pools and caches may be touched, e.g. at the end of a frame.
+        /// </summary>
+        class memoryaccounting : public privateunknown {
+        public:
+            typedef std::function<void(const memorysnapshot &snapshot)> evictcallback;
+
+            /// <summary>
+            /// The accounting of a device, created on first use. Lives as long as the device.
+            /// </summary>
+            static memoryaccounting &of(ID3D11Device *device)
+            {
+                static std::mutex create_mutex;
+                std::lock_guard<std::mutex> lock(create_mutex);
+
+                IUnknown *p = nullptr;
+                UINT size = sizeof(p);
+                if(SUCCEEDED(device->GetPrivateData(guid(), &size, &p)) && nullptr != p) {
+                    // the device keeps its own reference
+                    p->Release();
+                    return *static_cast<memoryaccounting*>(p);
+                }
+                memoryaccounting *accounting = new memoryaccounting();
+                HRESULT hr = device->SetPrivateDataInterface(guid(), accounting);
+                accounting->Release();
+                throw_if_failed(hr);
+                return *accounting;
+            }
+
+            /// <summary>
+            /// Count bytes against the category until object is destroyed.
+            /// </summary>
+            template<class Object>
+            void track(Object *object, memorycategory category, uint64_t bytes)
+            {
+                allocation *a = new allocation(this, category, bytes);
+                HRESULT hr = object->SetPrivateDataInterface(allocation::guid(), a);
+                a->Release();
+                throw_if_failed(hr);
+            }
+
+            /// <summary>
+            /// Stop counting an object before it is destroyed, for objects whose size changes in place.
+            /// </summary>
+            template<class Object>
+            static void untrack(Object *object)
+            {
+                object->SetPrivateDataInterface(allocation::guid(), nullptr);
+            }
+
+            void set_budget(memorycategory category, uint64_t bytes)
+            {
+                m_budget[(unsigned int)category] = bytes;
+                check_budgets();
+            }
+
+            void set_total_budget(uint64_t bytes)
+            {
+                m_total_budget = bytes;
+                check_budgets();
+            }
+
+            /// <summary>
+            /// Returns an id for remove_eviction_callback().
+            /// </summary>
+            unsigned int add_eviction_callback(evictcallback callback)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_callbacks.emplace_back(++m_next_callback, std::move(callback));
+                return m_next_callback;
+            }
+
+            void remove_eviction_callback(unsigned int id)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                for(auto it = m_callbacks.begin(); it != m_callbacks.end(); ++it) {
+                    if(it->first == id) {
+                        m_callbacks.erase(it);
+                        break;
+                    }
+                }
+            }
+
+            bool over_budget() const
+            {
+                return m_over_budget;
+            }
+
+            /// <summary>
+            /// Run eviction callbacks while over budget. Returns whether the device is still over budget.
+            /// </summary>
+            bool enforce_budgets()
+            {
+                if(!m_over_budget.exchange(false)) {
+                    return false;
+                }
+
+                std::vector<std::pair<unsigned int, evictcallback>> callbacks;
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    callbacks = m_callbacks;
+                }
+                memorysnapshot s = snapshot();
+                for(auto& c : callbacks) {
+                    if(!s.over_budget()) {
+                        break;
+                    }
+                    c.second(s);
+                    s = snapshot();
+                    m_evictions++;
+                }
+                check_budgets();
+                return m_over_budget;
+            }
+
+            memorysnapshot snapshot() const
+            {
+                memorysnapshot s;
+                for(unsigned int i = 0; i < memorysnapshot::categories; ++i) {
+                    s.bytes[i] = m_bytes[i];
+                    s.peak_bytes[i] = m_peak[i];
+                    s.objects[i] = m_objects[i];
+                    s.budget[i] = m_budget[i];
+                }
+                s.total_budget = m_total_budget;
+                return s;
+            }
+
+            /// <summary>
+            /// How many eviction callbacks ran so far.
+            /// </summary>
+            unsigned int evictions() const
+            {
+                return m_evictions;
+            }
+
+        private:
+            class allocation : public privateunknown {
+            public:
+                allocation(memoryaccounting *accounting, memorycategory category, uint64_t bytes)
+                    : m_accounting(accounting), m_category(category), m_bytes(bytes)
+                {
+                    m_accounting->AddRef();
+                    m_accounting->add(m_category, m_bytes);
+                }
+
+                static const GUID &guid()
+                {
+                    // {3B0E7A52-91C4-4D2F-A6E8-5F1D0C7B9A21}
+                    static const GUID g = { 0x3b0e7a52, 0x91c4, 0x4d2f, { 0xa6, 0xe8, 0x5f, 0x1d, 0x0c, 0x7b, 0x9a, 0x21 } };
+                    return g;
+                }
+
+            protected:
+                ~allocation()
+                {
+                    m_accounting->remove(m_category, m_bytes);
+                    m_accounting->Release();
+                }
+
+            private:
+                memoryaccounting *m_accounting;
+                memorycategory m_category;
+                uint64_t m_bytes;
+            };
+
+            memoryaccounting()
+            {
+                for(unsigned int i = 0; i < memorysnapshot::categories; ++i) {
+                    m_bytes[i] = 0;
+                    m_peak[i] = 0;
+                    m_objects[i] = 0;
+                    m_budget[i] = 0;
+                }
+            }
+
+            static const GUID &guid()
+            {
+                // {8F4C21D6-0B7A-4E93-B25C-C6E0174AD3F8}
+                static const GUID g = { 0x8f4c21d6, 0x0b7a, 0x4e93, { 0xb2, 0x5c, 0xc6, 0xe0, 0x17, 0x4a, 0xd3, 0xf8 } };
+                return g;
+            }
+
+            void add(memorycategory category, uint64_t bytes)
+            {
+                unsigned int i = (unsigned int)category;
+                uint64_t now = (m_bytes[i] += bytes);
+                m_objects[i]++;
+                uint64_t peak = m_peak[i];
+                while(now > peak && !m_peak[i].compare_exchange_weak(peak, now)) {
+                }
+                check_budgets();
+            }
+
+            void remove(memorycategory category, uint64_t bytes)
+            {
+                unsigned int i = (unsigned int)category;
+                m_bytes[i] -= bytes;
+                m_objects[i]--;
+            }
+
+            void check_budgets()
+            {
+                if(snapshot().over_budget()) {
+                    m_over_budget = true;
+                }
+            }
+
+            std::atomic<uint64_t> m_bytes[memorysnapshot::categories];
+            std::atomic<uint64_t> m_peak[memorysnapshot::categories];
+            std::atomic<unsigned int> m_objects[memorysnapshot::categories];
+            std::atomic<uint64_t> m_budget[memorysnapshot::categories];
+            std::atomic<uint64_t> m_total_budget{0};
+            std::atomic<bool> m_over_budget{false};
+            std::atomic<unsigned int> m_evictions{0};
+
+            std::mutex m_mutex;
+            unsigned int m_next_callback = 0;
+            std::vector<std::pair<unsigned int, evictcallback>> m_callbacks;
+        };
+
+        class texture2d {
+            INJECT_COMOBJ_CONCEPT(texture2d, ID3D11Texture2D)
+        public:
+            texture2d() {}
+
+            int width()
+            {
+                D3D11_TEXTURE2D_DESC s;
+                m_texture2d->GetDesc(&s);
+                return s.Width;
+            }
+
+            int height()
+            {
+                D3D11_TEXTURE2D_DESC s;
+                m_texture2d->GetDesc(&s);
+                return s.Height;
+            }
+
+            D3D11_TEXTURE2D_DESC desc() const
+            {
+                D3D11_TEXTURE2D_DESC s;
+                m_texture2d->GetDesc(&s);
+                return s;
+            }
+        };
+
+        class rendertargetview {
+            INJECT_COMOBJ_CONCEPT(rendertargetview, ID3D11RenderTargetView)
+        public:
+            rendertargetview() {}
+        };
+
+        class depthstencilview {
+            INJECT_COMOBJ_CONCEPT(depthstencilview, ID3D11DepthStencilView)
+        public:
+            depthstencilview() {}
+        };
+
+        class shaderresourceview {
+            INJECT_COMOBJ_CONCEPT(shaderresourceview, ID3D11ShaderResourceView)
+        public:
+            shaderresourceview() {}
+        };
+
+        class buffer {
+            INJECT_COMOBJ_CONCEPT(buffer, ID3D11Buffer)
+        public:
+            buffer() {}
+        };
+
+        class vertexshader {
+            INJECT_COMOBJ_CONCEPT(vertexshader, ID3D11VertexShader)
+        public:
+            vertexshader() {}
+        };
+
+        class hullshader {
+            INJECT_COMOBJ_CONCEPT(hullshader, ID3D11HullShader)
+        public:
+            hullshader() {}
+        };
+
+        class domainshader {
+            INJECT_COMOBJ_CONCEPT(domainshader, ID3D11DomainShader)
+        public:
+            domainshader() {}
+        };
+
+        class geometryshader {
+            INJECT_COMOBJ_CONCEPT(geometryshader, ID3D11GeometryShader)
+        public:
+            geometryshader() {}
+        };
+
+        class pixelshader {
+            INJECT_COMOBJ_CONCEPT(pixelshader, ID3D11PixelShader)
+        public:
+            pixelshader() {}
+        };
+
+        class computeshader {
+            INJECT_COMOBJ_CONCEPT(computeshader, ID3D11ComputeShader)
+        public:
+            computeshader() {}
+        };
+
+        class inputlayout {
+            INJECT_COMOBJ_CONCEPT(inputlayout, ID3D11InputLayout)
+        public:
+            inputlayout() {}
+        };
+
+        class samplerstate {
+            INJECT_COMOBJ_CONCEPT(samplerstate, ID3D11SamplerState)
+        public:
+            samplerstate() {}
+        };
+
+        class blendstate {
+            INJECT_COMOBJ_CONCEPT(blendstate, ID3D11BlendState)
+        public:
+            blendstate() {}
+        };
+
+        class rasterizerstate {
+            INJECT_COMOBJ_CONCEPT(rasterizerstate, ID3D11RasterizerState)
+        public:
+            rasterizerstate() {}
+        };
+
+        class depthstencilstate {
+            INJECT_COMOBJ_CONCEPT(depthstencilstate, ID3D11DepthStencilState)
+        public:
+            depthstencilstate() {}
+        };
+
+        class query {
+            INJECT_COMOBJ_CONCEPT(query, ID3D11Query)
+        public:
+            query() {}
+        };
+
+        class commandlist {
+            INJECT_COMOBJ_CONCEPT(commandlist, ID3D11CommandList)
+        public:
+            commandlist() {}
+        };
+
+        /// <summary>
+        /// Per-stage entry points of ID3D11DeviceContext, selected by shader type.
+        /// </summary>
+        template<class shader>
+        struct shaderstage;
+
+#define DEFINE_SHADER_STAGE(S, P, K)                                                                                    \
+        template<>                                                                                                      \
+        struct shaderstage<S> {                                                                                         \
+            static const shaderstagekind kind = shaderstagekind::K;                                                     \
+            static void set_shaderresources(ID3D11DeviceContext *c, UINT slot, UINT n, ID3D11ShaderResourceView *const *v) \
+            {                                                                                                           \
+                c->P##SetShaderResources(slot, n, v);                                                                   \
+            }                                                                                                           \
+            static void set_samplers(ID3D11DeviceContext *c, UINT slot, UINT n, ID3D11SamplerState *const *v)          \
+            {                                                                                                           \
+                c->P##SetSamplers(slot, n, v);                                                                          \
+            }                                                                                                           \
+            static void set_constantbuffers(ID3D11DeviceContext *c, UINT slot, UINT n, ID3D11Buffer *const *v)         \
+            {                                                                                                           \
+                c->P##SetConstantBuffers(slot, n, v);                                                                   \
+            }                                                                                                           \
+        };
+
+        DEFINE_SHADER_STAGE(vertexshader, VS, vertex)
+        DEFINE_SHADER_STAGE(hullshader, HS, hull)
+        DEFINE_SHADER_STAGE(domainshader, DS, domain)
+        DEFINE_SHADER_STAGE(geometryshader, GS, geometry)
+        DEFINE_SHADER_STAGE(pixelshader, PS, pixel)
+        DEFINE_SHADER_STAGE(computeshader, CS, compute)
+
+#undef DEFINE_SHADER_STAGE
+
+        static_assert(sizeof(commandviewport) == sizeof(D3D11_VIEWPORT), "commandviewport must match D3D11_VIEWPORT");
+        static_assert(sizeof(commandbox) == sizeof(D3D11_BOX), "commandbox must match D3D11_BOX");
+
+        /// <summary>
+        /// Last value submitted for one piece of pipeline state.
+        /// </summary>
+        template<class T>
+        struct shadowvalue {
+            T value;
+            bool known = false;
+
+            bool matches(const T &v) const
+            {
+                return known && (value == v);
+            }
+
+            void assign(const T &v)
+            {
+                value = v;
+                known = true;
+            }
+        };
+
+        struct vertexbufferbinding {
+            ID3D11Buffer *buffer;
+            unsigned int stride;
+            unsigned int offset;
+
+            bool operator== (const vertexbufferbinding &b) const
+            {
+                return buffer == b.buffer && stride == b.stride && offset == b.offset;
+            }
+        };
+
+        struct indexbufferbinding {
+            ID3D11Buffer *buffer;
+            DXGI_FORMAT format;
+            unsigned int offset;
+
+            bool operator== (const indexbufferbinding &b) const
+            {
+                return buffer == b.buffer && format == b.format && offset == b.offset;
+            }
+        };
+
+        struct rendertargetbinding {
+            unsigned int count;
+            ID3D11RenderTargetView *rtvs[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT];
+            ID3D11DepthStencilView *dsv;
+
+            bool operator== (const rendertargetbinding &b) const
+            {
+                if(count != b.count || dsv != b.dsv) {
+                    return false;
+                }
+                for(unsigned int i = 0; i < count; ++i) {
+                    if(rtvs[i] != b.rtvs[i]) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+        };
+
+        struct viewportbinding {
+            D3D11_VIEWPORT viewport;
+
+            bool operator== (const viewportbinding &b) const
+            {
+                return memcmp(&viewport, &b.viewport, sizeof(D3D11_VIEWPORT)) == 0;
+            }
+        };
+
+        struct blendbinding {
+            ID3D11BlendState *state;
+            float factor[4];
+            unsigned int sample_mask;
+
+            bool operator== (const blendbinding &b) const
+            {
+                return state == b.state && sample_mask == b.sample_mask && memcmp(factor, b.factor, sizeof(factor)) == 0;
+            }
+        };
+
+        struct depthstencilbinding {
+            ID3D11DepthStencilState *state;
+            unsigned int stencil_ref;
+
+            bool operator== (const depthstencilbinding &b) const
+            {
+                return state == b.state && stencil_ref == b.stencil_ref;
+            }
+        };
+
+        /// <summary>
+        /// Number of state-setting calls sent to the driver and skipped as redundant.
+        /// </summary>
+        struct statestatistics {
+            unsigned int issued = 0;
+            unsigned int filtered = 0;
+        };
+
+        /// <summary>
+        /// Shadow copy of the state bound through a devicecontext.
+        /// The context holds a reference on everything bound to it,
+        /// so comparing raw interface pointers cannot be fooled by address reuse.
+        /// </summary>
+        struct statecache : public privateunknown {
+            bool enabled = false;
+            statestatistics statistics;
+
+            shadowvalue<ID3D11VertexShader*> vs;
+            shadowvalue<ID3D11HullShader*> hs;
+            shadowvalue<ID3D11DomainShader*> ds;
+            shadowvalue<ID3D11GeometryShader*> gs;
+            shadowvalue<ID3D11PixelShader*> ps;
+            shadowvalue<ID3D11ComputeShader*> cs;
+            shadowvalue<ID3D11InputLayout*> inputlayout;
+            shadowvalue<vertexbufferbinding> vertexbuffers[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+            shadowvalue<indexbufferbinding> indexbuffer;
+            shadowvalue<D3D11_PRIMITIVE_TOPOLOGY> topology;
+            shadowvalue<rendertargetbinding> rendertargets;
+            shadowvalue<viewportbinding> viewport;
+            shadowvalue<blendbinding> blend;
+            shadowvalue<ID3D11RasterizerState*> rasterizer;
+            shadowvalue<depthstencilbinding> depthstencil;
+
+            // recording, see devicecontext::begin_capture
+            struct capturedmap {
+                ID3D11Resource *resource;
+                unsigned int subresource;
+                const void *data;
+                uint32_t size;
+            };
+            commandstream *capture = nullptr;
+            std::vector<capturedmap> captured_maps;
+
+            void invalidate()
+            {
+                vs.known = hs.known = ds.known = gs.known = ps.known = cs.known = false;
+                inputlayout.known = false;
+                for(auto& vb : vertexbuffers) {
+                    vb.known = false;
+                }
+                indexbuffer.known = false;
+                topology.known = false;
+                rendertargets.known = false;
+                viewport.known = false;
+                blend.known = rasterizer.known = depthstencil.known = false;
+            }
+
+            /// <summary>
+            /// The cache of a native context, made on first use and kept as private data of the context,
+            /// so every devicecontext wrapping it shares one however it was wrapped. It dies with the context.
+            /// </summary>
+            static statecache &of(ID3D11DeviceContext *context)
+            {
+                static std::mutex create_mutex;
+                std::lock_guard<std::mutex> lock(create_mutex);
+
+                IUnknown *p = nullptr;
+                UINT size = sizeof(p);
+                if(SUCCEEDED(context->GetPrivateData(guid(), &size, &p)) && nullptr != p) {
+                    // the context keeps its own reference
+                    p->Release();
+                    return *static_cast<statecache*>(p);
+                }
+                statecache *cache = new statecache();
+                HRESULT hr = context->SetPrivateDataInterface(guid(), cache);
+                cache->Release();
+                throw_if_failed(hr);
+                return *cache;
+            }
+
+            static const GUID &guid()
+            {
+                // {5D2A9C47-3E1B-4F86-9A0D-7C4E2B61F3A9}
+                static const GUID g = { 0x5d2a9c47, 0x3e1b, 0x4f86, { 0x9a, 0x0d, 0x7c, 0x4e, 0x2b, 0x61, 0xf3, 0xa9 } };
+                return g;
+            }
+        };
+
+        class devicecontext {
+        private:
+            ID3D11DeviceContext *m_devicecontext = nullptr;
+
+            void reclaim()
+            {
+                if(nullptr != m_devicecontext) {
+                    DEBUG_REF(m_devicecontext->AddRef());
+                }
+            }
+
+        public:
+            void release()
+            {
+                if(nullptr != m_devicecontext) {
+                    DEBUG_REF(m_devicecontext->Release());
+                    m_devicecontext = nullptr;
+                }
+                m_statecache = nullptr;
+            }
+
+            explicit devicecontext(ID3D11DeviceContext *pdevicecontext)
+                : m_devicecontext(pdevicecontext)
+            {
+                reclaim();
+                if(nullptr != m_devicecontext) {
+                    m_statecache = &statecache::of(m_devicecontext);
+                }
+            }
+
+            devicecontext(ID3D11DeviceContext *pdevicecontext, adopt_t)
+                : m_devicecontext(pdevicecontext)
+            {
+                if(nullptr != m_devicecontext) {
+                    m_statecache = &statecache::of(m_devicecontext);
+                }
+            }
+
+            devicecontext(const devicecontext &c)
+            {
+                release();
+                m_devicecontext = c.m_devicecontext;
+                m_statecache = c.m_statecache;
+                reclaim();
+            }
+
+            devicecontext(devicecontext &&c)
+            {
+                release();
+                m_devicecontext = c.m_devicecontext;
+                m_statecache = c.m_statecache;
+                c.m_devicecontext = nullptr;
+                c.m_statecache = nullptr;
+            }
+
+            ~devicecontext()
+            {
+                release();
+            }
+
+            devicecontext &operator= (const devicecontext &c)
+            {
+                if(this != &c) {
+                    release();
+                    m_devicecontext = c.m_devicecontext;
+                    m_statecache = c.m_statecache;
+                    reclaim();
+                }
+                return *this;
+            }
+
+            devicecontext &operator= (devicecontext &&c)
+            {
+                if(this != &c) {
+                    release();
+                    m_devicecontext = c.m_devicecontext;
+                    m_statecache = c.m_statecache;
+                    c.m_devicecontext = nullptr;
+                    c.m_statecache = nullptr;
+                }
+                return *this;
+            }
+
+            bool is_valid() const
+            {
+                return (nullptr != m_devicecontext);
+            }
+
+            ID3D11DeviceContext *winapi() const
+            {
+                return m_devicecontext;
+            }
+
+            template<class T> T as();
+
+        public:
+            devicecontext() {}
+
+            /// <summary>
+            /// Skip binds that would set state which is already bound.
+            /// The shadow state belongs to the native context, every devicecontext wrapping it shares it.
+            /// </summary>
+            void enable_state_filter(bool enable = true)
+            {
+                if(m_statecache) {
+                    m_statecache->enabled = enable;
+                }
+            }
+
+            bool is_state_filter_enabled() const
+            {
+                return m_statecache && m_statecache->enabled;
+            }
+
+            /// <summary>
+            /// Forget the shadow state, e.g. after the context was used behind our back (d2d1, ClearState).
+            /// </summary>
+            void invalidate_state()
+            {
+                if(m_statecache) {
+                    m_statecache->invalidate();
+                }
+            }
+
+            statestatistics state_statistics() const
+            {
+                return m_statecache ? m_statecache->statistics : statestatistics();
+            }
+
+            /// <summary>
+            /// Return the counts gathered since the last call and start over, call it once per frame.
+            /// </summary>
+            statestatistics reset_state_statistics()
+            {
+                statestatistics result;
+                if(m_statecache) {
+                    result = m_statecache->statistics;
+                    m_statecache->statistics = statestatistics();
+                }
+                return result;
+            }
+
+            /// <summary>
+            /// Record every following call into a stream, until end_capture. Every devicecontext wrapping the same native context records too.
+            /// The stream must outlive the capture.
+            /// </summary>
+            void begin_capture(commandstream &stream)
+            {
+                if(m_statecache) {
+                    m_statecache->capture = &stream;
+                    m_statecache->captured_maps.clear();
+                }
+            }
+
+            void end_capture()
+            {
+                if(m_statecache) {
+                    m_statecache->capture = nullptr;
+                    m_statecache->captured_maps.clear();
+                }
+            }
+
+            bool is_capturing() const
+            {
+                return nullptr != capturing();
+            }
+
+            void set_rendertarget() {
+                rendertargetbinding b;
+                b.count = 0;
+                b.dsv = nullptr;
+                set_rendertargets(b);
+            }
+
+            void set_rendertarget(borrowed<rendertargetview> rtv, borrowed<depthstencilview> dsv) {
+                rendertargetbinding b;
+                b.count = 1;
+                b.rtvs[0] = rtv.winapi();
+                b.dsv = dsv.winapi();
+                set_rendertargets(b);
+            }
+
+            /// <summary>
+            /// Bind any range of rendertargetviews (vector, std::array, plain array, static_vector).
+            /// </summary>
+            template<class Range>
+            void set_rendertargets(const Range &rtvs, borrowed<depthstencilview> dsv) {
+                rendertargetbinding b;
+                b.count = 0;
+                b.dsv = dsv.winapi();
+                for(auto& rtv : rtvs) {
+                    if(b.count >= D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT) {
+                        throw runtime_error(E_INVALIDARG);
+                    }
+                    b.rtvs[b.count++] = rtv.winapi();
+                }
+                set_rendertargets(b);
+            }
+
+            void set_viewport(const D3D11_VIEWPORT &vp)
+            {
+                if(commandstream *capture = capturing()) {
+                    capture->set_viewports(1, &vp);
+                }
+                viewportbinding b;
+                b.viewport = vp;
+                if(should_issue(&statecache::viewport, b)) {
+                    m_devicecontext->RSSetViewports(1, &vp);
+                }
+            }
+
+            void set_viewport(float width, float height)
+            {
+                set_viewport(CD3D11_VIEWPORT(0.0f, 0.0f, width, height, 0.0f, 1.0f));
+            }
+
+            void set_viewports(const D3D11_VIEWPORT *vps, unsigned int count) {
+                if(commandstream *capture = capturing()) {
+                    capture->set_viewports(count, vps);
+                }
+                if(m_statecache) {
+                    m_statecache->viewport.known = false;
+                    m_statecache->statistics.issued++;
+                }
+                m_devicecontext->RSSetViewports(count, vps);
+            }
+
+            template<class Range>
+            void set_viewports(const Range &vps) {
+                static_vector<D3D11_VIEWPORT, D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE> v(vps);
+                set_viewports(v.data(), v.size());
+            }
+
+            void clear_rendertargetview(borrowed<rendertargetview> rtv, const float rgba[])
+            {
+                if(commandstream *capture = capturing()) {
+                    capture->clear_rendertargetview(rtv.winapi(), rgba);
+                }
+                m_devicecontext->ClearRenderTargetView(rtv.winapi(), rgba);
+            }
+
+            void clear_depthstencilview(borrowed<depthstencilview> dsv, UINT flag, float depth, unsigned char stencil)
+            {
+                if(commandstream *capture = capturing()) {
+                    capture->clear_depthstencilview(dsv.winapi(), flag, depth, stencil);
+                }
+                m_devicecontext->ClearDepthStencilView(dsv.winapi(), flag, depth, stencil);
+            }
+
+            void clear_depthstencilview(borrowed<depthstencilview> dsv, float depth, unsigned char stencil, bool clear_depth = true, bool clear_stencil = false)
+            {
+                UINT flag = (clear_depth?D3D11_CLEAR_DEPTH:0)|(clear_stencil?D3D11_CLEAR_STENCIL:0);
+                clear_depthstencilview(dsv, flag, depth, stencil);
+            }
+
+            D3D11_MAPPED_SUBRESOURCE map(borrowed<buffer> buf, D3D11_MAP type, unsigned int flags = 0)
+            {
+                return map(buf.winapi(), 0, type, flags);
+            }
+
+            D3D11_MAPPED_SUBRESOURCE map(borrowed<texture2d> tex, unsigned int subresource, D3D11_MAP type, unsigned int flags = 0)
+            {
+                return map(tex.winapi(), subresource, type, flags);
+            }
+
+            void unmap(borrowed<buffer> buf)
+            {
+                unmap(buf.winapi(), 0);
+            }
+
+            void unmap(borrowed<texture2d> tex, unsigned int subresource = 0)
+            {
+                unmap(tex.winapi(), subresource);
+            }
+
+            /// <summary>
+            /// Whether a Map with D3D11_MAP_FLAG_DO_NOT_WAIT succeeded, false if the GPU still uses the resource.
+            /// </summary>
+            bool try_map(borrowed<texture2d> tex, unsigned int subresource, D3D11_MAP type, D3D11_MAPPED_SUBRESOURCE &mapped)
+            {
+                HRESULT hr = m_devicecontext->Map(tex.winapi(), subresource, type, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped);
+                if(hr == DXGI_ERROR_WAS_STILL_DRAWING) {
+                    return false;
+                }
+                throw_if_failed(hr);
+                capture_map(tex.winapi(), subresource, type, D3D11_MAP_FLAG_DO_NOT_WAIT, mapped);
+                return true;
+            }
+
+            void update_subresource(borrowed<texture2d> tex, unsigned int subresource, const D3D11_BOX *box, const void *data, unsigned int row_pitch, unsigned int depth_pitch)
+            {
+                if(commandstream *capture = capturing()) {
+                    D3D11_TEXTURE2D_DESC desc;
+                    tex.winapi()->GetDesc(&desc);
+                    unsigned int mip = subresource % desc.MipLevels;
+                    unsigned int width = (nullptr != box) ? box->right - box->left : dxgi::mip_size(desc.Width, mip);
+                    unsigned int height = (nullptr != box) ? box->bottom - box->top : dxgi::mip_size(desc.Height, mip);
+                    // the last row is only read up to its end, not up to the pitch
+                    uint32_t size = (dxgi::row_count(desc.Format, height) - 1) * row_pitch + dxgi::row_pitch(desc.Format, width);
+                    capture->update_subresource(tex.winapi(), objectkind::texture2d, subresource, box, data, size, row_pitch, depth_pitch);
+                }
+                m_devicecontext->UpdateSubresource(tex.winapi(), subresource, box, data, row_pitch, depth_pitch);
+            }
+
+            /// <summary>
+            /// Rewrite a whole mip level from tightly packed data.
+            /// </summary>
+            void update_subresource(borrowed<texture2d> tex, const void *data, unsigned int mip = 0)
+            {
+                D3D11_TEXTURE2D_DESC desc;
+                tex.winapi()->GetDesc(&desc);
+                unsigned int width = dxgi::mip_size(desc.Width, mip);
+                unsigned int height = dxgi::mip_size(desc.Height, mip);
+                update_subresource(tex, D3D11CalcSubresource(mip, 0, desc.MipLevels), nullptr, data, dxgi::row_pitch(desc.Format, width), dxgi::depth_pitch(desc.Format, width, height));
+            }
+
+            /// <summary>
+            /// Rewrite a rectangle of a mip level, e.g. one row of a spectrum texture.
+            /// row_pitch defaults to tightly packed rows, block-compressed rectangles must be block aligned.
+            /// </summary>
+            void update_subresource(borrowed<texture2d> tex, const void *data, unsigned int x, unsigned int y, unsigned int width, unsigned int height, unsigned int mip = 0, unsigned int row_pitch = 0)
+            {
+                D3D11_TEXTURE2D_DESC desc;
+                tex.winapi()->GetDesc(&desc);
+                if(row_pitch == 0) {
+                    row_pitch = dxgi::row_pitch(desc.Format, width);
+                }
+                D3D11_BOX box = { x, y, 0, x + width, y + height, 1 };
+                update_subresource(tex, D3D11CalcSubresource(mip, 0, desc.MipLevels), &box, data, row_pitch, row_pitch * dxgi::row_count(desc.Format, height));
+            }
+
+            void update_subresource(borrowed<buffer> buf, const void *data, unsigned int offset, unsigned int size)
+            {
+                D3D11_BOX box = { offset, 0, 0, offset + size, 1, 1 };
+                if(commandstream *capture = capturing()) {
+                    capture->update_subresource(buf.winapi(), objectkind::buffer, 0, &box, data, size, 0, 0);
+                }
+                m_devicecontext->UpdateSubresource(buf.winapi(), 0, &box, data, 0, 0);
+            }
+
+            void copy_resource(borrowed<texture2d> dst, borrowed<texture2d> src)
+            {
+                if(commandstream *capture = capturing()) {
+                    capture->copy_resource(dst.winapi(), src.winapi(), objectkind::texture2d);
+                }
+                m_devicecontext->CopyResource(dst.winapi(), src.winapi());
+            }
+
+            /// <summary>
+            /// Resolve a multisampled subresource into a single-sampled one.
+            /// </summary>
+            void resolve_subresource(borrowed<texture2d> dst, unsigned int dst_subresource, borrowed<texture2d> src, unsigned int src_subresource, DXGI_FORMAT format)
+            {
+                if(commandstream *capture = capturing()) {
+                    capture->resolve_subresource(dst.winapi(), dst_subresource, src.winapi(), src_subresource, (uint32_t)format, objectkind::texture2d);
+                }
+                m_devicecontext->ResolveSubresource(dst.winapi(), dst_subresource, src.winapi(), src_subresource, format);
+            }
+
+            void copy_subresource_region(borrowed<texture2d> dst, unsigned int dst_subresource, unsigned int x, unsigned int y, borrowed<texture2d> src, unsigned int src_subresource, const D3D11_BOX *box = nullptr)
+            {
+                if(commandstream *capture = capturing()) {
+                    capture->copy_subresource_region(dst.winapi(), dst_subresource, x, y, src.winapi(), src_subresource, box, objectkind::texture2d);
+                }
+                m_devicecontext->CopySubresourceRegion(dst.winapi(), dst_subresource, x, y, 0, src.winapi(), src_subresource, box);
+            }
+
+            void set_inputlayout(borrowed<inputlayout> layout)
+            {
+                if(commandstream *capture = capturing()) {
+                    capture->set_inputlayout(layout.winapi());
+                }
+                if(should_issue(&statecache::inputlayout, layout.winapi())) {
+                    m_devicecontext->IASetInputLayout(layout.winapi());
+                }
+            }
+
+            void set_vertexbuffer(borrowed<d3d11::buffer> buffer, unsigned int stride, unsigned int offset = 0)
+            {
+                set_vertexbuffer(0, buffer, stride, offset);
+            }
+
+            void set_vertexbuffer(unsigned int slot, borrowed<d3d11::buffer> buffer, unsigned int stride, unsigned int offset = 0)
+            {
+                ID3D11Buffer *pBuffer = buffer.winapi();
+                set_vertexbuffers(slot, &pBuffer, &stride, &offset, 1);
+            }
+
+            void set_vertexbuffers(unsigned int start_slot, ID3D11Buffer *const *buffers, const unsigned int *strides, const unsigned int *offsets, unsigned int count)
+            {
+                if(start_slot + count > D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT) {
+                    throw runtime_error(E_INVALIDARG);
+                }
+                if(commandstream *capture = capturing()) {
+                    capture->set_vertexbuffers(start_slot, count, buffers, strides, offsets);
+                }
+                vertexbufferbinding b[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+                for(unsigned int i = 0; i < count; ++i) {
+                    b[i].buffer = buffers[i];
+                    b[i].stride = strides[i];
+                    b[i].offset = offsets[i];
+                }
+                if(should_issue(&statecache::vertexbuffers, start_slot, b, count)) {
+                    m_devicecontext->IASetVertexBuffers(start_slot, count, buffers, strides, offsets);
+                }
+            }
+
+            /// <summary>
+            /// Bind consecutive vertex buffer slots, strides and offsets are ranges of unsigned int.
+            /// </summary>
+            template<class Buffers, class Strides, class Offsets>
+            void set_vertexbuffers(unsigned int start_slot, const Buffers &buffers, const Strides &strides, const Offsets &offsets)
+            {
+                auto b = winapi_array<ID3D11Buffer, D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT>(buffers);
+                static_vector<unsigned int, D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT> s(strides);
+                static_vector<unsigned int, D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT> o(offsets);
+                if(s.size() != b.size() || o.size() != b.size()) {
+                    throw runtime_error(E_INVALIDARG);
+                }
+                set_vertexbuffers(start_slot, b.data(), s.data(), o.data(), b.size());
+            }
+
+            void set_indexbuffer(borrowed<d3d11::buffer> buffer, INDEX_BUFFER_FORMAT format = INDEX_BUFFER_FORMAT_32_BIT, unsigned int offset = 0) {
+                set_indexbuffer(buffer.winapi(), format, offset);
+            }
+
+            void set_indexbuffer(ID3D11Buffer *buffer, INDEX_BUFFER_FORMAT format = INDEX_BUFFER_FORMAT_32_BIT, unsigned int offset = 0) {
+                if(commandstream *capture = capturing()) {
+                    capture->set_indexbuffer(buffer, format, offset);
+                }
+                indexbufferbinding b;
+                b.buffer = buffer;
+                b.format = (DXGI_FORMAT)format;
+                b.offset = offset;
+                if(should_issue(&statecache::indexbuffer, b)) {
+                    m_devicecontext->IASetIndexBuffer(b.buffer, b.format, b.offset);
+                }
+            }
+
+            void set_primitivetopology(D3D11_PRIMITIVE_TOPOLOGY topology)
+            {
+                if(commandstream *capture = capturing()) {
+                    capture->set_primitivetopology(topology);
+                }
+                if(should_issue(&statecache::topology, topology)) {
+                    m_devicecontext->IASetPrimitiveTopology(topology);
+                }
+            }
+
+            void set_blendstate(borrowed<blendstate> state, const float factor[4] = nullptr, unsigned int sample_mask = 0xFFFFFFFF)
+            {
+                blendbinding b;
+                b.state = state.winapi();
+                for(int i = 0; i < 4; ++i) {
+                    b.factor[i] = (nullptr != factor) ? factor[i] : 1.0f;
+                }
+                b.sample_mask = sample_mask;
+                if(commandstream *capture = capturing()) {
+                    capture->set_blendstate(b.state, b.factor, b.sample_mask);
+                }
+                if(should_issue(&statecache::blend, b)) {
+                    m_devicecontext->OMSetBlendState(b.state, b.factor, b.sample_mask);
+                }
+            }
+
+            void set_rasterizerstate(borrowed<rasterizerstate> state)
+            {
+                if(commandstream *capture = capturing()) {
+                    capture->set_rasterizerstate(state.winapi());
+                }
+                if(should_issue(&statecache::rasterizer, state.winapi())) {
+                    m_devicecontext->RSSetState(state.winapi());
+                }
+            }
+
+            void set_depthstencilstate(borrowed<depthstencilstate> state, unsigned int stencil_ref = 0)
+            {
+                depthstencilbinding b;
+                b.state = state.winapi();
+                b.stencil_ref = stencil_ref;
+                if(commandstream *capture = capturing()) {
+                    capture->set_depthstencilstate(b.state, b.stencil_ref);
+                }
+                if(should_issue(&statecache::depthstencil, b)) {
+                    m_devicecontext->OMSetDepthStencilState(b.state, b.stencil_ref);
+                }
+            }
+
+            void set_shader(borrowed<vertexshader> shader) {
+                capture_shader(shader);
+                if(should_issue(&statecache::vs, shader.winapi())) {
+                    m_devicecontext->VSSetShader(shader.winapi(), nullptr, 0);
+                }
+            }
+
+            void set_shader(borrowed<hullshader> shader) {
+                capture_shader(shader);
+                if(should_issue(&statecache::hs, shader.winapi())) {
+                    m_devicecontext->HSSetShader(shader.winapi(), nullptr, 0);
+                }
+            }
 
-            int width()
-            {
-                D3D11_TEXTURE2D_DESC s;
-                m_texture2d->GetDesc(&s);
-                return s.Width;
+            void set_shader(borrowed<domainshader> shader) {
+                capture_shader(shader);
+                if(should_issue(&statecache::ds, shader.winapi())) {
+                    m_devicecontext->DSSetShader(shader.winapi(), nullptr, 0);
+                }
             }
 
-            int height()
-            {
-                D3D11_TEXTURE2D_DESC s;
-                m_texture2d->GetDesc(&s);
-                return s.Height;
+            void set_shader(borrowed<geometryshader> shader) {
+                capture_shader(shader);
+                if(should_issue(&statecache::gs, shader.winapi())) {
+                    m_devicecontext->GSSetShader(shader.winapi(), nullptr, 0);
+                }
             }
-        };
 
-        class rendertargetview {
-            INJECT_COMOBJ_CONCEPT(rendertargetview, ID3D11RenderTargetView)
-        public:
-            rendertargetview() {}
-        };
+            void set_shader(borrowed<pixelshader> shader) {
+                capture_shader(shader);
+                if(should_issue(&statecache::ps, shader.winapi())) {
+                    m_devicecontext->PSSetShader(shader.winapi(), nullptr, 0);
+                }
+            }
 
-        class depthstencilview {
-            INJECT_COMOBJ_CONCEPT(depthstencilview, ID3D11DepthStencilView)
-        public:
-            depthstencilview() {}
-        };
+            void set_shader(borrowed<computeshader> shader) {
+                capture_shader(shader);
+                if(should_issue(&statecache::cs, shader.winapi())) {
+                    m_devicecontext->CSSetShader(shader.winapi(), nullptr, 0);
+                }
+            }
 
-        class shaderresourceview {
-            INJECT_COMOBJ_CONCEPT(shaderresourceview, ID3D11ShaderResourceView)
-        public:
-            shaderresourceview() {}
-        };
+            template<class shader>
+            void set_shaderresources(unsigned int start_slot, ID3D11ShaderResourceView *const *srvs, unsigned int count)
+            {
+                if(commandstream *capture = capturing()) {
+                    capture->set_shaderresources(shaderstage<shader>::kind, start_slot, count, srvs);
+                }
+                count_issued();
+                shaderstage<shader>::set_shaderresources(m_devicecontext, start_slot, count, srvs);
+            }
 
-        class buffer {
-            INJECT_COMOBJ_CONCEPT(buffer, ID3D11Buffer)
-        public:
-            buffer() {}
-        };
+            template<class shader, class Range>
+            void set_shaderresources(unsigned int start_slot, const Range &srvs)
+            {
+                auto v = winapi_array<ID3D11ShaderResourceView, D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT>(srvs);
+                set_shaderresources<shader>(start_slot, v.data(), v.size());
+            }
 
-        class vertexshader {
-            INJECT_COMOBJ_CONCEPT(vertexshader, ID3D11VertexShader)
-        public:
-            vertexshader() {}
-        };
+            template<class shader>
+            void set_shaderresource(unsigned int slot, borrowed<shaderresourceview> srv)
+            {
+                ID3D11ShaderResourceView *pView = srv.winapi();
+                set_shaderresources<shader>(slot, &pView, 1);
+            }
 
-        class hullshader {
-            INJECT_COMOBJ_CONCEPT(hullshader, ID3D11HullShader)
-        public:
-            hullshader() {}
-        };
+            template<class shader>
+            void set_samplers(unsigned int start_slot, ID3D11SamplerState *const *samplers, unsigned int count)
+            {
+                if(commandstream *capture = capturing()) {
+                    capture->set_samplers(shaderstage<shader>::kind, start_slot, count, samplers);
+                }
+                count_issued();
+                shaderstage<shader>::set_samplers(m_devicecontext, start_slot, count, samplers);
+            }
 
-        class domainshader {
-            INJECT_COMOBJ_CONCEPT(domainshader, ID3D11DomainShader)
-        public:
-            domainshader() {}
-        };
+            template<class shader, class Range>
+            void set_samplers(unsigned int start_slot, const Range &samplers)
+            {
+                auto v = winapi_array<ID3D11SamplerState, D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT>(samplers);
+                set_samplers<shader>(start_slot, v.data(), v.size());
+            }
 
-        class geometryshader {
-            INJECT_COMOBJ_CONCEPT(geometryshader, ID3D11GeometryShader)
-        public:
-            geometryshader() {}
-        };
+            template<class shader>
+            void set_sampler(unsigned int slot, borrowed<samplerstate> sampler)
+            {
+                ID3D11SamplerState *pSampler = sampler.winapi();
+                set_samplers<shader>(slot, &pSampler, 1);
+            }
 
-        class pixelshader {
-            INJECT_COMOBJ_CONCEPT(pixelshader, ID3D11PixelShader)
-        public:
-            pixelshader() {}
-        };
+            template<class shader>
+            void set_constantbuffers(unsigned int start_slot, ID3D11Buffer *const *buffers, unsigned int count)
+            {
+                if(commandstream *capture = capturing()) {
+                    capture->set_constantbuffers(shaderstage<shader>::kind, start_slot, count, buffers);
+                }
+                count_issued();
+                shaderstage<shader>::set_constantbuffers(m_devicecontext, start_slot, count, buffers);
+            }
 
-        class computeshader {
-            INJECT_COMOBJ_CONCEPT(computeshader, ID3D11ComputeShader)
-        public:
-            computeshader() {}
-        };
+            template<class shader, class Range>
+            void set_constantbuffers(unsigned int start_slot, const Range &buffers)
+            {
+                auto v = winapi_array<ID3D11Buffer, D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT>(buffers);
+                set_constantbuffers<shader>(start_slot, v.data(), v.size());
+            }
 
-        class inputlayout {
-            INJECT_COMOBJ_CONCEPT(inputlayout, ID3D11InputLayout)
-        public:
-            inputlayout() {}
-        };
+            template<class shader>
+            void set_constantbuffer(unsigned int slot, borrowed<buffer> cb)
+            {
+                ID3D11Buffer *pBuffer = cb.winapi();
+                set_constantbuffers<shader>(slot, &pBuffer, 1);
+            }
 
-        class devicecontext {
-            INJECT_COMOBJ_CONCEPT(devicecontext, ID3D11DeviceContext)
-        public:
-            devicecontext() {}
+            void draw(unsigned int vertex_num, unsigned int start_vertex = 0)
+            {
+                if(commandstream *capture = capturing()) {
+                    capture->draw(vertex_num, start_vertex);
+                }
+                m_devicecontext->Draw(vertex_num, start_vertex);
+            }
 
-            void set_rendertarget() {
-                m_devicecontext->OMSetRenderTargets(0, nullptr, nullptr);
+            void draw_indexed(unsigned int vertex_num, unsigned int start_index, int base_location = 0)
+            {
+                if(commandstream *capture = capturing()) {
+                    capture->draw_indexed(vertex_num, start_index, base_location);
+                }
+                m_devicecontext->DrawIndexed(vertex_num, start_index, base_location);
             }
 
-            void set_rendertarget(const rendertargetview &rtv, const depthstencilview &dsv) {
-                ID3D11RenderTargetView* r = rtv.winapi();
-                m_devicecontext->OMSetRenderTargets(1, &r, dsv.winapi());
+            void draw_instanced(unsigned int vertex_num, unsigned int instance_num, unsigned int start_vertex = 0, unsigned int start_instance = 0)
+            {
+                if(commandstream *capture = capturing()) {
+                    capture->draw_instanced(vertex_num, instance_num, start_vertex, start_instance);
+                }
+                m_devicecontext->DrawInstanced(vertex_num, instance_num, start_vertex, start_instance);
             }
 
-            void set_rendertargets(const std::vector<rendertargetview> &rtvs, const depthstencilview &dsv) {
-                std::vector<ID3D11RenderTargetView*> r;
-                for(auto& rtv : rtvs) {
-                    r.push_back(rtv.winapi());
+            void draw_indexed_instanced(unsigned int index_num, unsigned int instance_num, unsigned int start_index = 0, int base_location = 0, unsigned int start_instance = 0)
+            {
+                if(commandstream *capture = capturing()) {
+                    capture->draw_indexed_instanced(index_num, instance_num, start_index, base_location, start_instance);
                 }
-                m_devicecontext->OMSetRenderTargets((unsigned int)r.size(), r.data(), dsv.winapi());
+                m_devicecontext->DrawIndexedInstanced(index_num, instance_num, start_index, base_location, start_instance);
             }
 
-            void set_viewport(const D3D11_VIEWPORT &vp)
+            /// <summary>
+            /// Draw with a D3D11_DRAW_INSTANCED_INDIRECT_ARGS read by the GPU from args at offset,
+            /// args must be created with D3D11_RESOURCE_MISC_DRAWINDIRECT_ARGS.
+            /// </summary>
+            void draw_instanced_indirect(borrowed<buffer> args, unsigned int offset = 0)
             {
-                m_devicecontext->RSSetViewports(1, &vp);
+                if(commandstream *capture = capturing()) {
+                    capture->draw_indirect(args.winapi(), offset, false);
+                }
+                m_devicecontext->DrawInstancedIndirect(args.winapi(), offset);
             }
 
-            void set_viewport(float width, float height)
+            /// <summary>
+            /// Same as draw_instanced_indirect with D3D11_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS.
+            /// </summary>
+            void draw_indexed_instanced_indirect(borrowed<buffer> args, unsigned int offset = 0)
             {
-                set_viewport(CD3D11_VIEWPORT(0.0f, 0.0f, width, height, 0.0f, 1.0f));
+                if(commandstream *capture = capturing()) {
+                    capture->draw_indirect(args.winapi(), offset, true);
+                }
+                m_devicecontext->DrawIndexedInstancedIndirect(args.winapi(), offset);
             }
 
-            void set_viewports(const std::vector<D3D11_VIEWPORT> &vps) {
-                m_devicecontext->RSSetViewports((UINT)vps.size(), vps.data());
+            void begin(borrowed<query> q)
+            {
+                if(commandstream *capture = capturing()) {
+                    capture->begin_query(q.winapi());
+                }
+                m_devicecontext->Begin(q.winapi());
             }
 
-            void clear_rendertargetview(const rendertargetview &rtv, const float rgba[])
+            void end(borrowed<query> q)
             {
-                m_devicecontext->ClearRenderTargetView(rtv.winapi(), rgba);
+                if(commandstream *capture = capturing()) {
+                    capture->end_query(q.winapi());
+                }
+                m_devicecontext->End(q.winapi());
             }
 
-            void clear_depthstencilview(const depthstencilview &dsv, UINT flag, float depth, unsigned char stencil)
+            /// <summary>
+            /// Fetch the result of a query, returns false if it is not available yet.
+            /// </summary>
+            template<class T>
+            bool get_data(borrowed<query> q, T &result, unsigned int flags = 0)
             {
-                m_devicecontext->ClearDepthStencilView(dsv.winapi(), flag, depth, stencil);
+                HRESULT hr = m_devicecontext->GetData(q.winapi(), &result, sizeof(T), flags);
+                throw_if_failed(hr);
+                return hr == S_OK;
             }
 
-            void clear_depthstencilview(const depthstencilview &dsv, float depth, unsigned char stencil, bool clear_depth = true, bool clear_stencil = false)
+            bool is_deferred() const
             {
-                UINT flag = (clear_depth?D3D11_CLEAR_DEPTH:0)|(clear_stencil?D3D11_CLEAR_STENCIL:0);
-                clear_depthstencilview(dsv, flag, depth, stencil);
+                return m_devicecontext->GetType() == D3D11_DEVICE_CONTEXT_DEFERRED;
             }
 
-            // TODO - not good
-            void update_subresource(const texture2d &tex, void *data)
+            /// <summary>
+            /// Close the commands recorded on a deferred context into a command list.
+            /// The deferred context starts over from default state unless restore_state is set.
+            /// </summary>
+            commandlist finish_commandlist(bool restore_state = false)
             {
-                D3D11_TEXTURE2D_DESC desc;
-                tex.winapi()->GetDesc(&desc);
-                m_devicecontext->UpdateSubresource(tex.winapi(), 0, nullptr, data, desc.Width*4, desc.Width*desc.Height*4);
+                ID3D11CommandList *pList = nullptr;
+                throw_if_failed(m_devicecontext->FinishCommandList(restore_state ? TRUE : FALSE, &pList));
+                if(commandstream *capture = capturing()) {
+                    capture->finish_commandlist(pList);
+                }
+                if(!restore_state) {
+                    invalidate_state();
+                }
+                return make_comobj<commandlist>(pList);
             }
 
-            void set_inputlayout(const inputlayout &layout)
+            /// <summary>
+            /// Play back a command list on the immediate context.
+            /// Afterwards the context is in default state unless restore_state is set, which costs a state save.
+            /// </summary>
+            void execute_commandlist(borrowed<commandlist> list, bool restore_state = false)
             {
-                m_devicecontext->IASetInputLayout(layout.winapi());
+                if(commandstream *capture = capturing()) {
+                    capture->execute_commandlist(list.winapi(), restore_state);
+                }
+                m_devicecontext->ExecuteCommandList(list.winapi(), restore_state ? TRUE : FALSE);
+                if(!restore_state) {
+                    invalidate_state();
+                }
             }
 
-            // TODO - not good
-            void set_vertexbuffer(const d3d11::buffer &buffer, unsigned int stride, unsigned int offset = 0)
+            void clear_state()
             {
-                ID3D11Buffer *pBuffer = buffer.winapi();
-                m_devicecontext->IASetVertexBuffers(0, 1, &pBuffer, &stride, &offset);
+                if(commandstream *capture = capturing()) {
+                    capture->clear_state();
+                }
+                m_devicecontext->ClearState();
+                invalidate_state();
             }
 
-            void set_indexbuffer(const buffer &buffer, INDEX_BUFFER_FORMAT format = INDEX_BUFFER_FORMAT_32_BIT, unsigned int offset = 0) {
-                m_devicecontext->IASetIndexBuffer(buffer.winapi(), (DXGI_FORMAT)format, offset);
+        private:
+            D3D11_MAPPED_SUBRESOURCE map(ID3D11Resource *resource, unsigned int subresource, D3D11_MAP type, unsigned int flags)
+            {
+                D3D11_MAPPED_SUBRESOURCE mapped;
+                throw_if_failed(m_devicecontext->Map(resource, subresource, type, flags, &mapped));
+                capture_map(resource, subresource, type, flags, mapped);
+                return mapped;
             }
 
-            void set_primitivetopology(D3D11_PRIMITIVE_TOPOLOGY topology)
+            void unmap(ID3D11Resource *resource, unsigned int subresource)
             {
-                m_devicecontext->IASetPrimitiveTopology(topology);
+                if(commandstream *capture = capturing()) {
+                    // what the application wrote goes into the stream now that it is complete
+                    auto& maps = m_statecache->captured_maps;
+                    for(auto it = maps.begin(); it != maps.end(); ++it) {
+                        if(it->resource == resource && it->subresource == subresource) {
+                            capture->unmap(resource, resource_kind(resource), subresource, it->data, it->size);
+                            maps.erase(it);
+                            break;
+                        }
+                    }
+                }
+                m_devicecontext->Unmap(resource, subresource);
             }
 
-            template <class shader>
-            void set_shader(const shader &s);
+            commandstream *capturing() const
+            {
+                return m_statecache ? m_statecache->capture : nullptr;
+            }
 
-            template <>
-            void set_shader(const vertexshader &shader) {
-                m_devicecontext->VSSetShader(shader.winapi(), nullptr, 0);
+            template<class shader>
+            void capture_shader(borrowed<shader> s)
+            {
+                if(commandstream *capture = capturing()) {
+                    capture->set_shader(shaderstage<shader>::kind, s.winapi());
+                }
             }
 
-            template <>
-            void set_shader(const hullshader &shader) {
-                m_devicecontext->HSSetShader(shader.winapi(), nullptr, 0);
+            static objectkind resource_kind(ID3D11Resource *resource)
+            {
+                D3D11_RESOURCE_DIMENSION dimension;
+                resource->GetType(&dimension);
+                switch(dimension) {
+                case D3D11_RESOURCE_DIMENSION_BUFFER:
+                    return objectkind::buffer;
+                case D3D11_RESOURCE_DIMENSION_TEXTURE2D:
+                    return objectkind::texture2d;
+                default:
+                    return objectkind::unknown;
+                }
             }
 
-            template <>
-            void set_shader(const domainshader &shader) {
-                m_devicecontext->DSSetShader(shader.winapi(), nullptr, 0);
+            void capture_map(ID3D11Resource *resource, unsigned int subresource, D3D11_MAP type, unsigned int flags, const D3D11_MAPPED_SUBRESOURCE &mapped)
+            {
+                commandstream *capture = capturing();
+                if(nullptr == capture) {
+                    return;
+                }
+                objectkind kind = resource_kind(resource);
+                capture->map(resource, kind, subresource, type, flags);
+
+                statecache::capturedmap m;
+                m.resource = resource;
+                m.subresource = subresource;
+                m.data = mapped.pData;
+                m.size = 0;
+                if(type != D3D11_MAP_READ) {
+                    if(kind == objectkind::buffer) {
+                        D3D11_BUFFER_DESC desc;
+                        static_cast<ID3D11Buffer*>(resource)->GetDesc(&desc);
+                        m.size = desc.ByteWidth;
+                    }
+                    else if(kind == objectkind::texture2d) {
+                        D3D11_TEXTURE2D_DESC desc;
+                        static_cast<ID3D11Texture2D*>(resource)->GetDesc(&desc);
+                        unsigned int height = dxgi::mip_size(desc.Height, subresource % desc.MipLevels);
+                        m.size = mapped.RowPitch * dxgi::row_count(desc.Format, height);
+                    }
+                }
+                m_statecache->captured_maps.push_back(m);
             }
 
-            template <>
-            void set_shader(const geometryshader &shader) {
-                m_devicecontext->GSSetShader(shader.winapi(), nullptr, 0);
+            void set_rendertargets(const rendertargetbinding &b)
+            {
+                if(commandstream *capture = capturing()) {
+                    capture->set_rendertargets(b.count, b.rtvs, b.dsv);
+                }
+                if(should_issue(&statecache::rendertargets, b)) {
+                    m_devicecontext->OMSetRenderTargets(b.count, (b.count > 0) ? b.rtvs : nullptr, b.dsv);
+                }
             }
 
-            template <>
-            void set_shader(const pixelshader &shader) {
-                m_devicecontext->PSSetShader(shader.winapi(), nullptr, 0);
+            template<class T>
+            bool should_issue(shadowvalue<T> statecache::*slot, const T &value)
+            {
+                if(!m_statecache) {
+                    return true;
+                }
+                statecache &cache = *m_statecache;
+                shadowvalue<T> &shadow = cache.*slot;
+                if(cache.enabled && shadow.matches(value)) {
+                    cache.statistics.filtered++;
+                    return false;
+                }
+                // keep shadowing while disabled, so the filter can be turned on at any time
+                shadow.assign(value);
+                cache.statistics.issued++;
+                return true;
             }
 
-            template <>
-            void set_shader(const computeshader &shader) {
-                m_devicecontext->CSSetShader(shader.winapi(), nullptr, 0);
+            template<class T, size_t N>
+            bool should_issue(shadowvalue<T> (statecache::*slots)[N], unsigned int start, const T *values, unsigned int count)
+            {
+                if(!m_statecache) {
+                    return true;
+                }
+                statecache &cache = *m_statecache;
+                shadowvalue<T> *shadows = (cache.*slots) + start;
+                if(cache.enabled) {
+                    bool redundant = true;
+                    for(unsigned int i = 0; i < count && redundant; ++i) {
+                        redundant = shadows[i].matches(values[i]);
+                    }
+                    if(redundant) {
+                        cache.statistics.filtered++;
+                        return false;
+                    }
+                }
+                for(unsigned int i = 0; i < count; ++i) {
+                    shadows[i].assign(values[i]);
+                }
+                cache.statistics.issued++;
+                return true;
             }
 
-            void draw_indexed(unsigned int vertex_num, unsigned int start_index, int base_location = 0)
+            void count_issued()
             {
-                m_devicecontext->DrawIndexed(vertex_num, start_index, base_location);
+                if(m_statecache) {
+                    m_statecache->statistics.issued++;
+                }
             }
+
+            // private data of the native context, alive as long as the reference held above
+            statecache *m_statecache = nullptr;
         };
 
         // TODO - this class will be revised
@@ -517,15 +2187,13 @@ namespace dx {
                 : m_device(pdevice)
             {
                 reclaim();
-                if(nullptr != m_device) {
-                    ID3D11DeviceContext *pContext = nullptr;
-                    m_device->GetImmediateContext(&pContext);
-                    m_context = make_comobj<devicecontext>(pContext);
-                }
             }
 
+            device(ID3D11Device *pdevice, adopt_t)
+                : m_device(pdevice)
+            {}
+
             device(const device &c)
-                : m_context(c.m_context)
             {
                 release();
                 m_device = c.m_device;
@@ -533,7 +2201,6 @@ namespace dx {
             }
 
             device(device &&c)
-                : m_context(std::move(c.m_context))
             {
                 release();
                 m_device = c.m_device;
@@ -561,7 +2228,6 @@ namespace dx {
                     release();
                     m_device = c.m_device;
                     c.m_device = nullptr;
-                    m_context = std::move(c.m_context);
                 }
                 return *this;
             }
@@ -596,29 +2262,41 @@ namespace dx {
 #ifdef _DEBUG
                 deviceFlags |= D3D11_CREATE_DEVICE_DEBUG;
 #endif
-                ID3D11DeviceContext *pContext = nullptr;
-                throw_if_failed(D3D11CreateDevice(adapter.winapi(), D3D_DRIVER_TYPE_UNKNOWN, nullptr, deviceFlags, nullptr, 0, D3D11_SDK_VERSION, &m_device, &featureLevel, &pContext));
-                m_context = make_comobj<devicecontext>(pContext);
+                throw_if_failed(D3D11CreateDevice(adapter.winapi(), D3D_DRIVER_TYPE_UNKNOWN, nullptr, deviceFlags, nullptr, 0, D3D11_SDK_VERSION, &m_device, &featureLevel, nullptr));
             }
 
             static device create_default_device()
             {
-                device result;
-                D3D_FEATURE_LEVEL featureLevel;
-                UINT deviceFlags = D3D11_CREATE_DEVICE_BGRA_SUPPORT; // for d2d1
-#ifdef _DEBUG
-                deviceFlags |= D3D11_CREATE_DEVICE_DEBUG;
-#endif
-                ID3D11DeviceContext *pContext = nullptr;
-                throw_if_failed(D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr, deviceFlags, nullptr, 0, D3D11_SDK_VERSION, &(result.m_device), &featureLevel, &pContext));
-                result.m_context = make_comobj<devicecontext>(pContext);
-                return result;
+                return create_device(D3D_DRIVER_TYPE_HARDWARE, nullptr);
+            }
+
+            /// <summary>
+            /// A device on WARP, the multi-threaded CPU rasterizer of Windows, for hosts without a GPU.
+            /// </summary>
+            static device create_warp_device()
+            {
+                return create_device(D3D_DRIVER_TYPE_WARP, nullptr);
+            }
+
+            /// <summary>
+            /// A device on the software rasterizer module given, or on the reference rasterizer when there is none.
+            /// The reference rasterizer only exists where the SDK layers are installed, prefer WARP elsewhere.
+            /// </summary>
+            static device create_software_device(HMODULE rasterizer = nullptr)
+            {
+                return create_device((nullptr != rasterizer) ? D3D_DRIVER_TYPE_SOFTWARE : D3D_DRIVER_TYPE_REFERENCE, rasterizer);
+            }
+
+            /// <summary>
+            /// Bytes held by the resources created through this device, and their budgets.
+            /// </summary>
+            memoryaccounting &memory() const
+            {
+                return memoryaccounting::of(m_device);
             }
 
-            static device create_warp_device();
-            static device create_software_device();
 
-            buffer create_buffer(const void *data, unsigned int size, unsigned int stride = 0, D3D11_USAGE usage = D3D11_USAGE_DEFAULT, unsigned int bind = D3D11_BIND_VERTEX_BUFFER, unsigned int cpu_access = 0)
+            buffer create_buffer(const void *data, unsigned int size, unsigned int stride = 0, D3D11_USAGE usage = D3D11_USAGE_DEFAULT, unsigned int bind = D3D11_BIND_VERTEX_BUFFER, unsigned int cpu_access = 0, unsigned int misc = 0)
             {
                 D3D11_BUFFER_DESC bd;
                 ZeroMemory(&bd, sizeof(bd));
@@ -627,13 +2305,15 @@ namespace dx {
                 bd.Usage = usage;
                 bd.BindFlags = bind;
                 bd.CPUAccessFlags = cpu_access;
-                bd.MiscFlags = 0;
+                bd.MiscFlags = misc;
                 D3D11_SUBRESOURCE_DATA initData;
                 ZeroMemory(&initData, sizeof(initData));
                 initData.pSysMem = data;
                 ID3D11Buffer *pBuffer = nullptr;
-                throw_if_failed(m_device->CreateBuffer(&bd, &initData, &pBuffer));
-                return make_comobj<buffer>(pBuffer);
+                throw_if_failed(m_device->CreateBuffer(&bd, (nullptr != data) ? &initData : nullptr, &pBuffer));
+                buffer result = make_comobj<buffer>(pBuffer);
+                memory().track(pBuffer, memorycategory::buffer, size);
+                return result;
             }
 
             texture2d create_texture2d(unsigned int width, unsigned int height, unsigned int miplevels = 1, unsigned int arraysize = 1, DXGI_FORMAT format = DXGI_FORMAT_R8G8B8A8_UNORM, unsigned int sample_count = 1, unsigned int sample_quality = 0, D3D11_USAGE usage = D3D11_USAGE_DEFAULT, D3D11_BIND_FLAG bind = D3D11_BIND_SHADER_RESOURCE, unsigned int cpu_access = 0)
@@ -654,7 +2334,9 @@ namespace dx {
 
                 ID3D11Texture2D *pTexture = nullptr;
                 throw_if_failed(m_device->CreateTexture2D(&desc, nullptr, &pTexture));
-                return make_comobj<texture2d>(pTexture);
+                texture2d result = make_comobj<texture2d>(pTexture);
+                memory().track(pTexture, texture_category(desc), texture_bytes(desc));
+                return result;
             }
 
             template<class view>
@@ -697,76 +2379,179 @@ namespace dx {
                 return make_comobj<shaderresourceview>(pView);
             }
 
+            rendertargetview create_view(const texture2d &tex, const D3D11_RENDER_TARGET_VIEW_DESC &desc)
+            {
+                ID3D11RenderTargetView *pView = nullptr;
+                throw_if_failed(m_device->CreateRenderTargetView(tex.winapi(), &desc, &pView));
+                return make_comobj<rendertargetview>(pView);
+            }
+
+            depthstencilview create_view(const texture2d &tex, const D3D11_DEPTH_STENCIL_VIEW_DESC &desc)
+            {
+                ID3D11DepthStencilView *pView = nullptr;
+                throw_if_failed(m_device->CreateDepthStencilView(tex.winapi(), &desc, &pView));
+                return make_comobj<depthstencilview>(pView);
+            }
+
+            shaderresourceview create_view(const texture2d &tex, const D3D11_SHADER_RESOURCE_VIEW_DESC &desc)
+            {
+                ID3D11ShaderResourceView *pView = nullptr;
+                throw_if_failed(m_device->CreateShaderResourceView(tex.winapi(), &desc, &pView));
+                return make_comobj<shaderresourceview>(pView);
+            }
+
             template<class shader>
-            shader create_shader(const dx::blob &blob);
+            shader create_shader(const void *bytecode, size_t size);
 
             template<>
-            vertexshader create_shader<vertexshader>(const dx::blob &blob)
+            vertexshader create_shader<vertexshader>(const void *bytecode, size_t size)
             {
                 ID3D11VertexShader *pShader = nullptr;
-                throw_if_failed(m_device->CreateVertexShader(blob.winapi()->GetBufferPointer(), blob.winapi()->GetBufferSize(), nullptr, &pShader));
+                throw_if_failed(m_device->CreateVertexShader(bytecode, size, nullptr, &pShader));
                 return make_comobj<vertexshader>(pShader);
             }
 
             template<>
-            hullshader create_shader<hullshader>(const dx::blob &blob)
+            hullshader create_shader<hullshader>(const void *bytecode, size_t size)
             {
                 ID3D11HullShader *pShader = nullptr;
-                throw_if_failed(m_device->CreateHullShader(blob.winapi()->GetBufferPointer(), blob.winapi()->GetBufferSize(), nullptr, &pShader));
+                throw_if_failed(m_device->CreateHullShader(bytecode, size, nullptr, &pShader));
                 return make_comobj<hullshader>(pShader);
             }
 
             template<>
-            domainshader create_shader<domainshader>(const dx::blob &blob)
+            domainshader create_shader<domainshader>(const void *bytecode, size_t size)
             {
                 ID3D11DomainShader *pShader = nullptr;
-                throw_if_failed(m_device->CreateDomainShader(blob.winapi()->GetBufferPointer(), blob.winapi()->GetBufferSize(), nullptr, &pShader));
+                throw_if_failed(m_device->CreateDomainShader(bytecode, size, nullptr, &pShader));
                 return make_comobj<domainshader>(pShader);
             }
 
             template<>
-            geometryshader create_shader<geometryshader>(const dx::blob &blob)
+            geometryshader create_shader<geometryshader>(const void *bytecode, size_t size)
             {
                 ID3D11GeometryShader *pShader = nullptr;
-                throw_if_failed(m_device->CreateGeometryShader(blob.winapi()->GetBufferPointer(), blob.winapi()->GetBufferSize(), nullptr, &pShader));
+                throw_if_failed(m_device->CreateGeometryShader(bytecode, size, nullptr, &pShader));
                 return make_comobj<geometryshader>(pShader);
             }
 
             template<>
-            pixelshader create_shader<pixelshader>(const dx::blob &blob)
+            pixelshader create_shader<pixelshader>(const void *bytecode, size_t size)
             {
                 ID3D11PixelShader *pShader = nullptr;
-                throw_if_failed(m_device->CreatePixelShader(blob.winapi()->GetBufferPointer(), blob.winapi()->GetBufferSize(), nullptr, &pShader));
+                throw_if_failed(m_device->CreatePixelShader(bytecode, size, nullptr, &pShader));
                 return make_comobj<pixelshader>(pShader);
             }
 
             template<>
-            computeshader create_shader<computeshader>(const dx::blob &blob)
+            computeshader create_shader<computeshader>(const void *bytecode, size_t size)
             {
                 ID3D11ComputeShader *pShader = nullptr;
-                throw_if_failed(m_device->CreateComputeShader(blob.winapi()->GetBufferPointer(), blob.winapi()->GetBufferSize(), nullptr, &pShader));
+                throw_if_failed(m_device->CreateComputeShader(bytecode, size, nullptr, &pShader));
                 return make_comobj<computeshader>(pShader);
             }
 
-            inputlayout create_inputlayout(const std::vector<D3D11_INPUT_ELEMENT_DESC> &layout, const dx::blob &blob)
+            template<class shader>
+            shader create_shader(const dx::blob &blob)
+            {
+                return create_shader<shader>(blob.winapi()->GetBufferPointer(), blob.winapi()->GetBufferSize());
+            }
+
+            inputlayout create_inputlayout(const D3D11_INPUT_ELEMENT_DESC *layout, unsigned int count, const void *bytecode, size_t size)
             {
                 ID3D11InputLayout *pLayout = nullptr;
-                throw_if_failed(m_device->CreateInputLayout(layout.data(), (UINT)layout.size(), blob.winapi()->GetBufferPointer(), blob.winapi()->GetBufferSize(), &pLayout));
+                throw_if_failed(m_device->CreateInputLayout(layout, count, bytecode, size, &pLayout));
                 return make_comobj<inputlayout>(pLayout);
             }
 
-            const devicecontext &immediate_context() const
+            inputlayout create_inputlayout(const D3D11_INPUT_ELEMENT_DESC *layout, unsigned int count, const dx::blob &blob)
+            {
+                return create_inputlayout(layout, count, blob.winapi()->GetBufferPointer(), blob.winapi()->GetBufferSize());
+            }
+
+            inputlayout create_inputlayout(const std::vector<D3D11_INPUT_ELEMENT_DESC> &layout, const dx::blob &blob)
+            {
+                return create_inputlayout(layout.data(), (unsigned int)layout.size(), blob);
+            }
+
+            template<size_t N>
+            inputlayout create_inputlayout(const D3D11_INPUT_ELEMENT_DESC (&layout)[N], const dx::blob &blob)
+            {
+                return create_inputlayout(layout, (unsigned int)N, blob);
+            }
+
+            samplerstate create_samplerstate(const D3D11_SAMPLER_DESC &desc)
+            {
+                ID3D11SamplerState *pSampler = nullptr;
+                throw_if_failed(m_device->CreateSamplerState(&desc, &pSampler));
+                return make_comobj<samplerstate>(pSampler);
+            }
+
+            blendstate create_blendstate(const D3D11_BLEND_DESC &desc)
+            {
+                ID3D11BlendState *pState = nullptr;
+                throw_if_failed(m_device->CreateBlendState(&desc, &pState));
+                return make_comobj<blendstate>(pState);
+            }
+
+            rasterizerstate create_rasterizerstate(const D3D11_RASTERIZER_DESC &desc)
+            {
+                ID3D11RasterizerState *pState = nullptr;
+                throw_if_failed(m_device->CreateRasterizerState(&desc, &pState));
+                return make_comobj<rasterizerstate>(pState);
+            }
+
+            depthstencilstate create_depthstencilstate(const D3D11_DEPTH_STENCIL_DESC &desc)
+            {
+                ID3D11DepthStencilState *pState = nullptr;
+                throw_if_failed(m_device->CreateDepthStencilState(&desc, &pState));
+                return make_comobj<depthstencilstate>(pState);
+            }
+
+            query create_query(D3D11_QUERY type, unsigned int misc_flags = 0)
             {
-                return m_context;
+                D3D11_QUERY_DESC desc;
+                desc.Query = type;
+                desc.MiscFlags = misc_flags;
+                ID3D11Query *pQuery = nullptr;
+                throw_if_failed(m_device->CreateQuery(&desc, &pQuery));
+                return make_comobj<query>(pQuery);
+            }
+
+            /// <summary>
+            /// A context recording into command lists, each one may be used by one thread at a time.
+            /// Only WRITE_DISCARD and NO_OVERWRITE maps of dynamic resources are allowed on it.
+            /// </summary>
+            devicecontext create_deferred_context()
+            {
+                ID3D11DeviceContext *pContext = nullptr;
+                throw_if_failed(m_device->CreateDeferredContext(0, &pContext));
+                return make_comobj<devicecontext>(pContext);
             }
 
-            devicecontext &immediate_context()
+            /// <summary>
+            /// The immediate context, fetched from the device on every call. Its state filter and capture are
+            /// kept with the native context, so every wrapper of it shares them and devices don't hold one.
+            /// </summary>
+            devicecontext immediate_context() const
             {
-                return m_context;
+                ID3D11DeviceContext *pContext = nullptr;
+                m_device->GetImmediateContext(&pContext);
+                return make_comobj<devicecontext>(pContext);
             }
 
         private:
-            devicecontext m_context;
+            static device create_device(D3D_DRIVER_TYPE type, HMODULE software)
+            {
+                device result;
+                D3D_FEATURE_LEVEL featureLevel;
+                UINT deviceFlags = D3D11_CREATE_DEVICE_BGRA_SUPPORT; // for d2d1
+#ifdef _DEBUG
+                deviceFlags |= D3D11_CREATE_DEVICE_DEBUG;
+#endif
+                throw_if_failed(D3D11CreateDevice(nullptr, type, software, deviceFlags, nullptr, 0, D3D11_SDK_VERSION, &(result.m_device), &featureLevel, nullptr));
+                return result;
+            }
         };
 
     } /* End of namespace d3d11 */
@@ -904,7 +2689,32 @@ inline dx::dxgi::swapchain dx::dxgi::factory::create_swapchain(const dx::d3d11::
 
     IDXGISwapChain *pSwapChain = nullptr;
     throw_if_failed(m_factory->CreateSwapChain(device.winapi(), &desc, &pSwapChain));
-    return make_comobj<swapchain>(pSwapChain);
+    swapchain result = make_comobj<swapchain>(pSwapChain);
+    result.track();
+    return result;
+}
+
+inline void dx::dxgi::swapchain::resize(unsigned int width, unsigned int height, unsigned int buffer_count, DXGI_FORMAT new_format, unsigned int flags)
+{
+    // the buffers are reallocated in place, count the new size instead of the old one,
+    // or the old one again if they weren't, so a failed resize doesn't drop them from the accounting
+    dx::d3d11::memoryaccounting::untrack(m_swapchain);
+    HRESULT hr = m_swapchain->ResizeBuffers(buffer_count, width, height, new_format, flags);
+    track();
+    throw_if_failed(hr);
+}
+
+inline void dx::dxgi::swapchain::track()
+{
+    ID3D11Device *pDevice = nullptr;
+    if(FAILED(m_swapchain->GetDevice(__uuidof(ID3D11Device), (void**)&pDevice))) {
+        return;
+    }
+    DXGI_SWAP_CHAIN_DESC desc;
+    m_swapchain->GetDesc(&desc);
+    uint64_t bytes = (uint64_t)dxgi::depth_pitch(desc.BufferDesc.Format, desc.BufferDesc.Width, desc.BufferDesc.Height) * desc.BufferCount * desc.SampleDesc.Count;
+    dx::d3d11::memoryaccounting::of(pDevice).track(m_swapchain, dx::d3d11::memorycategory::swapchain, bytes);
+    pDevice->Release();
 }
 
 template<>
@@ -1,6 +1,11 @@
 #include "DirectXWidget.hpp"
+#include <chrono>
+#include <algorithm>
+#include <math.h>
+#include <string.h>
 
-DirectXWidget::DirectXWidget(QWidget *parent) : QWidget(parent)
+DirectXWidget::DirectXWidget(QWidget *parent) : QWidget(parent),
+    m_renderLoopQuit(false), m_resizePending(false), m_pendingSize(0), m_captureRequested(false), m_evictionCallback(0), m_resolutionScale(1.0), m_dynamicActive(false)
 {
     setAttribute(Qt::WA_PaintOnScreen, true);
     setAttribute(Qt::WA_NativeWindow, true);
@@ -8,53 +13,407 @@ DirectXWidget::DirectXWidget(QWidget *parent) : QWidget(parent)
     D3DInit();
 }
 
+DirectXWidget::~DirectXWidget()
+{
+    stopRenderLoop();
+    if(m_hub) {
+        {
+            // other widgets run the eviction callbacks while holding the context
+            std::lock_guard<std::mutex> contextLock(m_hub->context_mutex());
+            m_device.memory().remove_eviction_callback(m_evictionCallback);
+        }
+        m_hub->remove_widget(this);
+    }
+}
+
 void DirectXWidget::paintEvent(QPaintEvent *)
 {
-    D3DDraw();
+    renderFrame();
 }
 
 void DirectXWidget::resizeEvent(QResizeEvent *)
 {
-    D3DResize();
+    // only remember the size, resizes are coalesced and applied once before the next frame
+    m_pendingSize = ((uint64_t)width() << 32) | (uint32_t)height();
+    m_resizePending = true;
+}
+
+void DirectXWidget::renderFrame()
+{
+    // the render thread owns the context while it runs
+    if(!isRenderLoopRunning()) {
+        D3DFrame();
+    }
+}
+
+void DirectXWidget::startRenderLoop(double targetFps, unsigned int presentInterval)
+{
+    stopRenderLoop();
+
+    m_targetFps = targetFps;
+    m_presentInterval = presentInterval;
+    m_renderLoopQuit = false;
+    m_renderThread = std::thread(&DirectXWidget::RenderLoop, this);
+}
+
+void DirectXWidget::stopRenderLoop()
+{
+    if(m_renderThread.joinable()) {
+        m_renderLoopQuit = true;
+        m_renderThread.join();
+        update();
+    }
+}
+
+void DirectXWidget::RenderLoop()
+{
+    using clock = std::chrono::steady_clock;
+
+    const bool throttled = (m_presentInterval == 0 && m_targetFps > 0.0);
+    const clock::duration period = throttled ? std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / m_targetFps)) : clock::duration::zero();
+    clock::time_point deadline = clock::now();
+
+    while(!m_renderLoopQuit) {
+        D3DFrame();
+
+        if(throttled) {
+            deadline += period;
+            clock::time_point now = clock::now();
+            if(deadline < now) {
+                // fell behind by more than a frame, don't try to catch up with a burst
+                deadline = now;
+            }
+            else {
+                std::this_thread::sleep_until(deadline);
+            }
+        }
+    }
+}
+
+void DirectXWidget::captureFrames(const std::string &path, unsigned int frames)
+{
+    if(frames == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_captureMutex);
+    m_capturePath = path;
+    m_captureFrames = frames;
+    m_captureRequested = true;
+}
+
+namespace {
+
+    // A capture loaded from a file knows its objects only by kind, the widget's own targets stand in for them
+    class widgetreplay : public dx::d3d11::contextreplay {
+    public:
+        widgetreplay(const dx::d3d11::devicecontext &context, dx::dxgi::swapchain &swapchain, unsigned int presentInterval,
+                     const dx::d3d11::rendertargetview &rtv, const dx::d3d11::depthstencilview &dsv)
+            : contextreplay(context), m_swapchain(swapchain), m_presentInterval(presentInterval), m_rtv(rtv), m_dsv(dsv)
+        {}
+
+        void object(uint32_t id, dx::objectkind kind) override
+        {
+            if(kind == dx::objectkind::rendertargetview) {
+                bind_object(id, m_rtv.winapi());
+            }
+            else if(kind == dx::objectkind::depthstencilview && m_dsv.is_valid()) {
+                bind_object(id, m_dsv.winapi());
+            }
+        }
+
+        void end_frame() override
+        {
+            m_swapchain.present(m_presentInterval);
+        }
+
+    private:
+        dx::dxgi::swapchain &m_swapchain;
+        unsigned int m_presentInterval;
+        dx::d3d11::rendertargetview m_rtv;
+        dx::d3d11::depthstencilview m_dsv;
+    };
+
+} /* End of anonymous namespace */
+
+bool DirectXWidget::replayCapture(const std::string &path, dx::replaystatistics *statistics)
+{
+    dx::commandstream capture;
+    if(!capture.load(path)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> contextLock(m_hub->context_mutex());
+    if(m_resizePending.exchange(false)) {
+        uint64_t size = m_pendingSize;
+        D3DResize((unsigned int)(size >> 32), (unsigned int)(size & 0xFFFFFFFF));
+    }
+    // the backbuffer is only bound with a depth buffer of its size
+    widgetreplay replay(m_context, m_swapchain, m_presentInterval, m_rtv, m_dynamicResolution ? dx::d3d11::depthstencilview() : m_depth.dsv);
+    bool ok = capture.replay(replay, statistics);
+    // frames start from default state, as the passes leave it
+    m_context.clear_state();
+    return ok;
+}
+
+void DirectXWidget::setFrameReadback(ReadbackCallback callback)
+{
+    std::lock_guard<std::mutex> lock(m_readbackMutex);
+    m_readbackCallback = std::move(callback);
+}
+
+dx::d3d11::readbackstatistics DirectXWidget::readbackStatistics() const
+{
+    std::lock_guard<std::mutex> lock(m_readbackMutex);
+    return m_readback->statistics();
+}
+
+void DirectXWidget::setDynamicResolution(bool enabled, double targetMs, double minScale, double maxScale)
+{
+    std::lock_guard<std::mutex> lock(m_resolutionMutex);
+    m_dynamicRequested = enabled;
+    m_resolutionRequested.target_ms = targetMs;
+    m_resolutionRequested.min_scale = minScale;
+    m_resolutionRequested.max_scale = maxScale;
+    m_resolutionChanged = true;
 }
 
 void DirectXWidget::D3DInit()
 {
     using namespace dx::d3d11;
 
-    dx::dxgi::factory factory = dx::dxgi::factory::create();
+    // every widget draws with the same device, only the swapchain is its own
+    m_hub = devicehub::acquire();
+    m_device = m_hub->device();
+    m_context = m_hub->immediate_context();
+
+    m_profiler.reset(new frameprofiler(m_device, m_context));
+    m_targets.reset(new rendertargetpool(m_device));
+    // the widget only uploads a few constant buffers per frame
+    m_uploads.reset(new uploadring(m_device, m_context, 64 << 10));
+    // each pass reads what the one before drew, they are submitted one at a time and recorded on this thread
+    m_passes.reset(new passrecorder(m_device, 1));
+    frameprofiler::cpuscope scope(*m_profiler, "D3DInit");
+
+    // unused pooled targets are the first thing to give back when the device goes over budget
+    m_evictionCallback = m_device.memory().add_eviction_callback([this](const memorysnapshot &) {
+        m_targets->trim();
+    });
+
+    m_swapchain = m_hub->factory().create_swapchain(m_device, (HWND)winId());
+    m_readback.reset(new readbackring(m_device, m_context));
+    m_epoch = std::chrono::steady_clock::now();
+}
+
+void DirectXWidget::D3DFrame()
+{
+    // the context is shared with the other widgets, which may draw from their own render threads
+    std::lock_guard<std::mutex> contextLock(m_hub->context_mutex());
+
+    if(m_resizePending.exchange(false)) {
+        uint64_t size = m_pendingSize;
+        D3DResize((unsigned int)(size >> 32), (unsigned int)(size & 0xFFFFFFFF));
+    }
+    bool resolutionChanged = false;
+    {
+        std::lock_guard<std::mutex> lock(m_resolutionMutex);
+        if(m_resolutionChanged) {
+            m_resolutionChanged = false;
+            m_dynamicWanted = m_dynamicRequested;
+            m_resolution.set_settings(m_resolutionRequested);
+            resolutionChanged = true;
+        }
+    }
+    if(m_dynamicWanted && !m_upsampler) {
+        // one worker is plenty for two shaders, frames stay at full size until they are compiled
+        m_shaders.reset(new dx::d3d11::shadercompiler(m_device, nullptr, 1));
+        m_upsampler.reset(new dx::d3d11::upsampler(m_device, *m_shaders));
+    }
+    bool dynamic = m_dynamicWanted && m_upsampler->ready();
+    if(resolutionChanged || dynamic != m_dynamicResolution) {
+        m_dynamicResolution = dynamic;
+        D3DSceneTargets();
+        m_resolutionScale = m_dynamicResolution ? m_resolution.scale() : 1.0;
+        m_dynamicActive = m_dynamicResolution;
+    }
+    if(m_captureRequested.exchange(false) && !m_context.is_capturing()) {
+        std::lock_guard<std::mutex> lock(m_captureMutex);
+        m_capture.clear();
+        m_captureFramesLeft = m_captureFrames;
+        m_context.begin_capture(m_capture);
+    }
 
-    m_device = device::create_default_device();
-    m_context = m_device.immediate_context();
+    D3DDraw();
+
+    if(m_context.is_capturing()) {
+        m_capture.end_frame();
+        if(--m_captureFramesLeft == 0) {
+            m_context.end_capture();
+            std::lock_guard<std::mutex> lock(m_captureMutex);
+            m_capture.save(m_capturePath);
+        }
+    }
 
-    m_swapchain = factory.create_swapchain(m_device, (HWND)winId());
+    m_device.memory().enforce_budgets();
 }
 
-void DirectXWidget::D3DResize()
+void DirectXWidget::D3DResize(unsigned int width, unsigned int height)
 {
     using namespace dx::d3d11;
 
+    if(width == 0 || height == 0 || (width == m_width && height == m_height)) {
+        return;
+    }
+
+    frameprofiler::cpuscope scope(*m_profiler, "D3DResize");
+
     m_context.set_rendertarget();
 
     m_rtv.release();
-    m_dsv.release();
-    m_dsvbuffer.release();
 
-    m_swapchain.resize();
+    m_swapchain.resize(width, height);
+    m_width = width;
+    m_height = height;
 
     texture2d backbuffer = m_swapchain.backbuffer<texture2d>(0);
     m_rtv = m_device.create_view<rendertargetview>(backbuffer);
-    m_dsvbuffer = m_device.create_texture2d(backbuffer.width(),backbuffer.height(),1, 1, DXGI_FORMAT_D24_UNORM_S8_UINT, 1, 0, D3D11_USAGE_DEFAULT, D3D11_BIND_DEPTH_STENCIL, 0);
-    m_dsv = m_device.create_view<depthstencilview>(m_dsvbuffer);
 
-    m_context.set_rendertarget(m_rtv, m_dsv);
-    m_context.set_viewport(width(), height());
+    D3DSceneTargets();
+
+    uint64_t bytes = texture_bytes(backbuffer.desc()) + m_targets->statistics().pooled_bytes;
+    for(const rendertarget *rt : { &m_depth, &m_sceneColor, &m_sceneDepth }) {
+        if(rt->is_valid()) {
+            bytes += rt->desc.bytes();
+        }
+    }
+    m_hub->report_widget_memory(this, objectName().toStdString(), bytes);
 }
 
-void DirectXWidget::D3DDraw()
+void DirectXWidget::D3DSceneTargets()
 {
+    using namespace dx::d3d11;
+
+    if(m_width == 0 || m_height == 0) {
+        return;
+    }
+
+    if(!m_dynamicResolution) {
+        // the backbuffer is bound with this depth, D3D11 wants both the same size
+        m_targets->release(m_sceneColor);
+        m_targets->release(m_sceneDepth);
+        if(!m_depth.is_valid() || m_depth.desc.width != m_width || m_depth.desc.height != m_height) {
+            m_targets->release(m_depth);
+            m_depth = m_targets->acquire(rendertargetdesc(m_width, m_height, DXGI_FORMAT_D24_UNORM_S8_UINT, D3D11_BIND_DEPTH_STENCIL));
+        }
+        return;
+    }
+    m_targets->release(m_depth);
+
+    // sized for the largest scale, smaller scales draw into the top-left part
+    double maxScale = m_resolution.settings().max_scale;
+    unsigned int width = (unsigned int)ceil(m_width * maxScale);
+    unsigned int height = (unsigned int)ceil(m_height * maxScale);
+
+    // color and depth are allocated together in buckets, so both are always the same size
+    if(!m_sceneColor.is_valid() || !bucket_fits(m_sceneColor.desc.width, width) || !bucket_fits(m_sceneColor.desc.height, height)) {
+        m_targets->release(m_sceneColor);
+        m_targets->release(m_sceneDepth);
+        m_sceneColor = m_targets->acquire(rendertargetdesc(bucket_size(width), bucket_size(height), DXGI_FORMAT_R8G8B8A8_UNORM));
+        m_sceneDepth = m_targets->acquire(rendertargetdesc(bucket_size(width), bucket_size(height), DXGI_FORMAT_D24_UNORM_S8_UINT, D3D11_BIND_DEPTH_STENCIL));
+    }
+}
+
+void DirectXWidget::D3DUpdateResolution()
+{
+    using namespace dx::d3d11;
+
+    // GPU times arrive a few frames late, use each frame once
+    profileframe frame;
+    if(m_profiler->snapshot(&frame, 1) == 0 || frame.frame < m_resolutionFrame) {
+        return;
+    }
+    m_resolutionFrame = frame.frame + 1;
+
+    for(unsigned int i = 0; i < frame.scope_count; ++i) {
+        const profilescope &s = frame.scopes[i];
+        if(s.gpu && strcmp(s.name, "scene") == 0) {
+            m_resolutionScale = m_resolution.update((s.end_us - s.begin_us) / 1000.0);
+            break;
+        }
+    }
+}
+
+void DirectXWidget::D3DScene(dx::d3d11::devicecontext &context, const dx::d3d11::rendertargetview &rtv, const dx::d3d11::depthstencilview &dsv, unsigned int width, unsigned int height, double time)
+{
+    (void)time;
+
+    // other widgets bind their own targets in between, the state filter drops this when they don't
+    context.set_rendertarget(rtv, dsv);
+    context.set_viewport((float)width, (float)height);
+
     float bg[] = {0.0f, 0.0f, 0.0f, 0.0f};
-    m_context.clear_rendertargetview(m_rtv, bg);
-    m_context.clear_depthstencilview(m_dsv, 1.0f, 0);
-    m_swapchain.present();
+    context.clear_rendertargetview(rtv, bg);
+    context.clear_depthstencilview(dsv, 1.0f, 0);
+}
+
+void DirectXWidget::D3DDraw()
+{
+    using namespace dx::d3d11;
+
+    m_profiler->begin_frame();
+    {
+        frameprofiler::cpuscope cpu(*m_profiler, "D3DDraw");
+        frameprofiler::gpuscope gpu(*m_profiler, "D3DDraw");
+
+        // passes only capture this, which std::function keeps without allocating
+        m_sceneTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_epoch).count();
+        if(m_dynamicResolution) {
+            double scale = m_resolution.scale();
+            m_sceneWidth = std::max(1u, (unsigned int)(m_width * scale + 0.5));
+            m_sceneHeight = std::max(1u, (unsigned int)(m_height * scale + 0.5));
+            {
+                frameprofiler::gpuscope gpu(*m_profiler, "scene");
+                m_passes->add([this](devicecontext &context) {
+                    D3DScene(context, m_sceneColor.rtv, m_sceneDepth.dsv, m_sceneWidth, m_sceneHeight, m_sceneTime);
+                });
+                m_passes->submit(m_context);
+            }
+            {
+                frameprofiler::gpuscope gpu(*m_profiler, "upsample");
+                // mapped on the immediate context, ahead of the command list reading it
+                m_upsampler->upload_extent(*m_uploads, m_sceneWidth, m_sceneHeight, m_sceneColor.desc.width, m_sceneColor.desc.height);
+                m_passes->add([this](devicecontext &context) {
+                    m_upsampler->blit(context, m_sceneColor.srv, m_rtv, m_width, m_height);
+                });
+                m_passes->submit(m_context);
+            }
+        }
+        else {
+            m_sceneWidth = m_width;
+            m_sceneHeight = m_height;
+            m_passes->add([this](devicecontext &context) {
+                D3DScene(context, m_rtv, m_depth.dsv, m_sceneWidth, m_sceneHeight, m_sceneTime);
+            });
+            m_passes->submit(m_context);
+        }
+    }
+    {
+        // the backbuffer is only defined until present
+        std::lock_guard<std::mutex> lock(m_readbackMutex);
+        if(m_readbackCallback) {
+            frameprofiler::cpuscope cpu(*m_profiler, "readback");
+            m_readback->read(m_swapchain.backbuffer<texture2d>(0), m_frameIndex);
+            m_readback->poll(m_readbackCallback);
+        }
+    }
+    {
+        frameprofiler::cpuscope cpu(*m_profiler, "present");
+        m_swapchain.present(m_presentInterval);
+    }
+    m_profiler->end_frame();
+    m_targets->next_frame();
+    m_uploads->next_frame();
+    if(m_dynamicResolution) {
+        D3DUpdateResolution();
+    }
+    m_frameIndex++;
 }
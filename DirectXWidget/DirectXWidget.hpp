@@ -2,7 +2,23 @@
 #define DIRECTXWIDGET_HPP
 
 #include <QWidget>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <memory>
+#include <mutex>
+#include <string>
 #include "DirectXPlus.h"
+#include "CommandStream.h"
+#include "CommandReplay.h"
+#include "DeviceHub.h"
+#include "ReadbackRing.h"
+#include "DynamicResolution.h"
+#include "FrameProfiler.h"
+#include "PassRecorder.h"
+#include "RenderTargetPool.h"
+#include "UploadRing.h"
 
 class DirectXWidget : public QWidget
 {
@@ -13,26 +29,121 @@ public slots:
 
 public:
     explicit DirectXWidget(QWidget *parent = 0);
+    ~DirectXWidget();
 
     QPaintEngine* paintEngine() const { return nullptr; }
 
+    // Render from a dedicated thread instead of paintEvent.
+    // With presentInterval > 0 frames are paced by vsync, otherwise by targetFps (0 means unthrottled).
+    void startRenderLoop(double targetFps = 60.0, unsigned int presentInterval = 0);
+    void stopRenderLoop();
+    bool isRenderLoopRunning() const { return m_renderThread.joinable(); }
+
+    // Draw and present one frame from the calling thread, does nothing while the render loop runs.
+    void renderFrame();
+
+    // Timings of the last frames, snapshot() and dump_chrome_trace() may be called from any thread.
+    dx::d3d11::frameprofiler &profiler() { return *m_profiler; }
+
+    // Device, caches and memory report shared by all widgets of the process.
+    dx::d3d11::devicehub &hub() { return *m_hub; }
+
+    // Record the context calls of the next frames and save them to path, for replay without a window.
+    void captureFrames(const std::string &path, unsigned int frames = 1);
+
+    // Play a saved capture back on the widget's context from the calling thread, presenting each captured frame.
+    // Render target views draw into the window and depth views into its depth buffer, every other object replays as null.
+    // Returns false if path can't be read or the capture is malformed.
+    bool replayCapture(const std::string &path, dx::replaystatistics *statistics = nullptr);
+
+    // Hand every presented frame to callback on the render thread, a few frames late and without stalling.
+    // Frames are dropped when the callback falls behind, an empty callback stops reading back.
+    typedef std::function<void(const dx::d3d11::readbackframe &frame)> ReadbackCallback;
+    void setFrameReadback(ReadbackCallback callback);
+    dx::d3d11::readbackstatistics readbackStatistics() const;
+
+    // Render the scene at a fraction of the widget size, picked each frame to keep the GPU time of the scene under targetMs,
+    // and stretch it over the window. Scales are per axis.
+    void setDynamicResolution(bool enabled, double targetMs = 16.0, double minScale = 0.5, double maxScale = 1.0);
+    double resolutionScale() const { return m_resolutionScale; }
+    // The upsampler's shaders are compiled in the background, frames stay at full size until they are there.
+    bool isDynamicResolutionActive() const { return m_dynamicActive; }
+
+    // What the widget draws, also used to render offscreen without a window. time is in seconds.
+    static void D3DScene(dx::d3d11::devicecontext &context, const dx::d3d11::rendertargetview &rtv, const dx::d3d11::depthstencilview &dsv, unsigned int width, unsigned int height, double time);
+
 protected:
     void paintEvent(QPaintEvent *);
     void resizeEvent(QResizeEvent *);
 
 private:
     void D3DInit();
-    void D3DResize();
+    void D3DFrame();
+    void D3DResize(unsigned int width, unsigned int height);
+    void D3DSceneTargets();
+    void D3DUpdateResolution();
     void D3DDraw();
 
+    void RenderLoop();
+
+    std::thread m_renderThread;
+    std::atomic<bool> m_renderLoopQuit;
+    std::atomic<bool> m_resizePending;
+    std::atomic<uint64_t> m_pendingSize;
+    double m_targetFps = 60.0;
+    unsigned int m_presentInterval = 0;
+
+    std::atomic<bool> m_captureRequested;
+    std::mutex m_captureMutex;
+    std::string m_capturePath;
+    unsigned int m_captureFrames = 0;
+    unsigned int m_captureFramesLeft = 0;
+    dx::commandstream m_capture;
+
+    std::shared_ptr<dx::d3d11::devicehub> m_hub;
     dx::d3d11::device m_device;
     dx::d3d11::devicecontext m_context;
     dx::dxgi::swapchain m_swapchain;
 
     dx::d3d11::rendertargetview m_rtv;
-    dx::d3d11::depthstencilview m_dsv;
+    dx::d3d11::rendertarget m_depth;
+
+    unsigned int m_width = 0;
+    unsigned int m_height = 0;
+
+    std::unique_ptr<dx::d3d11::frameprofiler> m_profiler;
+    std::unique_ptr<dx::d3d11::rendertargetpool> m_targets;
+    std::unique_ptr<dx::d3d11::uploadring> m_uploads;
+    std::unique_ptr<dx::d3d11::passrecorder> m_passes;
+    unsigned int m_evictionCallback;
+
+    mutable std::mutex m_readbackMutex;
+    ReadbackCallback m_readbackCallback;
+    std::unique_ptr<dx::d3d11::readbackring> m_readback;
+    uint64_t m_frameIndex = 0;
+    std::chrono::steady_clock::time_point m_epoch;
+
+    std::mutex m_resolutionMutex;
+    bool m_resolutionChanged = false;
+    bool m_dynamicRequested = false;
+    dx::d3d11::resolutionsettings m_resolutionRequested;
+    std::atomic<double> m_resolutionScale;
+    std::atomic<bool> m_dynamicActive;
+
+    // render thread only
+    bool m_dynamicWanted = false;
+    bool m_dynamicResolution = false;
+    dx::d3d11::resolutioncontroller m_resolution;
+    std::unique_ptr<dx::d3d11::shadercompiler> m_shaders;
+    std::unique_ptr<dx::d3d11::upsampler> m_upsampler;
+    dx::d3d11::rendertarget m_sceneColor;
+    dx::d3d11::rendertarget m_sceneDepth;
+    uint64_t m_resolutionFrame = 0;
 
-    dx::d3d11::texture2d m_dsvbuffer;
+    // what the passes of the frame being drawn read, render thread only
+    unsigned int m_sceneWidth = 0;
+    unsigned int m_sceneHeight = 0;
+    double m_sceneTime = 0.0;
 };
 
 #endif // DIRECTXWIDGET_HPP
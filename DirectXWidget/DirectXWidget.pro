@@ -17,4 +17,31 @@ SOURCES += main.cxx\
 
 HEADERS  += MainWindow.hpp \
     DirectXWidget.hpp \
-    DirectXPlus.h
+    DirectXPlus.h \
+    FrameProfiler.h \
+    RenderTargetPool.h \
+    UploadRing.h \
+    DxgiFormat.h \
+    StreamingTexture.h \
+    MappedFile.h \
+    ShaderCache.h \
+    WorkerPool.h \
+    ShaderCompiler.h \
+    PipelineState.h \
+    PassRecorder.h \
+    CommandStream.h \
+    CommandReplay.h \
+    InstanceBatcher.h \
+    DeviceHub.h \
+    ReadbackRing.h \
+    FrameWriter.h \
+    OfflineRenderer.h \
+    DynamicResolution.h \
+    SoftRasterizer.h \
+    MilkPreset.h \
+    PresetLibrary.h \
+    MilkEquation.h \
+    MeshEvaluator.h \
+    MeshLanes.inl \
+    EquationJit.h \
+    SoftScene.h
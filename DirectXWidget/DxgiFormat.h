@@ -0,0 +1,133 @@
+#pragma once
+
+#include <dxgiformat.h>
+
+namespace dx {
+
+    namespace dxgi {
+
+        /// <summary>
+        /// Memory layout of a format: block_bytes for every block_width x block_height pixels.
+        /// Plain formats are 1x1 blocks, block-compressed formats 4x4, packed 4:2:2 formats 2x1.
+        /// Planar video formats are not described and report zero.
+        /// </summary>
+        struct formatinfo {
+            unsigned char block_bytes;
+            unsigned char block_width;
+            unsigned char block_height;
+        };
+
+        namespace detail {
+
+            // indexed by DXGI_FORMAT, up to DXGI_FORMAT_B4G4R4A4_UNORM
+            constexpr formatinfo format_table[] = {
+                {  0, 0, 0 },   // UNKNOWN
+                { 16, 1, 1 }, { 16, 1, 1 }, { 16, 1, 1 }, { 16, 1, 1 },                     // R32G32B32A32
+                { 12, 1, 1 }, { 12, 1, 1 }, { 12, 1, 1 }, { 12, 1, 1 },                     // R32G32B32
+                {  8, 1, 1 }, {  8, 1, 1 }, {  8, 1, 1 }, {  8, 1, 1 }, {  8, 1, 1 }, {  8, 1, 1 }, // R16G16B16A16
+                {  8, 1, 1 }, {  8, 1, 1 }, {  8, 1, 1 }, {  8, 1, 1 },                     // R32G32
+                {  8, 1, 1 }, {  8, 1, 1 }, {  8, 1, 1 }, {  8, 1, 1 },                     // R32G8X24, D32_FLOAT_S8X24
+                {  4, 1, 1 }, {  4, 1, 1 }, {  4, 1, 1 },                                   // R10G10B10A2
+                {  4, 1, 1 },                                                               // R11G11B10_FLOAT
+                {  4, 1, 1 }, {  4, 1, 1 }, {  4, 1, 1 }, {  4, 1, 1 }, {  4, 1, 1 }, {  4, 1, 1 }, // R8G8B8A8
+                {  4, 1, 1 }, {  4, 1, 1 }, {  4, 1, 1 }, {  4, 1, 1 }, {  4, 1, 1 }, {  4, 1, 1 }, // R16G16
+                {  4, 1, 1 }, {  4, 1, 1 }, {  4, 1, 1 }, {  4, 1, 1 }, {  4, 1, 1 },       // R32, D32_FLOAT
+                {  4, 1, 1 }, {  4, 1, 1 }, {  4, 1, 1 }, {  4, 1, 1 },                     // R24G8, D24_UNORM_S8_UINT
+                {  2, 1, 1 }, {  2, 1, 1 }, {  2, 1, 1 }, {  2, 1, 1 }, {  2, 1, 1 },       // R8G8
+                {  2, 1, 1 }, {  2, 1, 1 }, {  2, 1, 1 }, {  2, 1, 1 }, {  2, 1, 1 }, {  2, 1, 1 }, {  2, 1, 1 }, // R16, D16_UNORM
+                {  1, 1, 1 }, {  1, 1, 1 }, {  1, 1, 1 }, {  1, 1, 1 }, {  1, 1, 1 },       // R8
+                {  1, 1, 1 },                                                               // A8_UNORM
+                {  1, 8, 1 },                                                               // R1_UNORM
+                {  4, 1, 1 },                                                               // R9G9B9E5_SHAREDEXP
+                {  4, 2, 1 }, {  4, 2, 1 },                                                 // R8G8_B8G8, G8R8_G8B8
+                {  8, 4, 4 }, {  8, 4, 4 }, {  8, 4, 4 },                                   // BC1
+                { 16, 4, 4 }, { 16, 4, 4 }, { 16, 4, 4 },                                   // BC2
+                { 16, 4, 4 }, { 16, 4, 4 }, { 16, 4, 4 },                                   // BC3
+                {  8, 4, 4 }, {  8, 4, 4 }, {  8, 4, 4 },                                   // BC4
+                { 16, 4, 4 }, { 16, 4, 4 }, { 16, 4, 4 },                                   // BC5
+                {  2, 1, 1 }, {  2, 1, 1 },                                                 // B5G6R5, B5G5R5A1
+                {  4, 1, 1 }, {  4, 1, 1 }, {  4, 1, 1 },                                   // B8G8R8A8, B8G8R8X8, R10G10B10_XR_BIAS_A2
+                {  4, 1, 1 }, {  4, 1, 1 }, {  4, 1, 1 }, {  4, 1, 1 },                     // B8G8R8A8/X8 TYPELESS and SRGB
+                { 16, 4, 4 }, { 16, 4, 4 }, { 16, 4, 4 },                                   // BC6H
+                { 16, 4, 4 }, { 16, 4, 4 }, { 16, 4, 4 },                                   // BC7
+                {  4, 1, 1 }, {  4, 1, 1 }, {  8, 1, 1 },                                   // AYUV, Y410, Y416
+                {  0, 0, 0 }, {  0, 0, 0 }, {  0, 0, 0 }, {  0, 0, 0 },                     // NV12, P010, P016, 420_OPAQUE
+                {  4, 2, 1 }, {  8, 2, 1 }, {  8, 2, 1 },                                   // YUY2, Y210, Y216
+                {  0, 0, 0 },                                                               // NV11
+                {  1, 1, 1 }, {  1, 1, 1 }, {  1, 1, 1 }, {  2, 1, 1 },                     // AI44, IA44, P8, A8P8
+                {  2, 1, 1 }                                                                // B4G4R4A4
+            };
+
+            constexpr unsigned int format_count = sizeof(format_table) / sizeof(format_table[0]);
+
+            constexpr unsigned int blocks(unsigned int size, unsigned int block)
+            {
+                return (block == 0) ? 0 : (size + block - 1) / block;
+            }
+
+        } /* End of namespace detail */
+
+        constexpr formatinfo format_info(DXGI_FORMAT format)
+        {
+            return ((unsigned int)format < detail::format_count) ? detail::format_table[format] : detail::format_table[0];
+        }
+
+        constexpr bool is_block_compressed(DXGI_FORMAT format)
+        {
+            return format_info(format).block_height > 1;
+        }
+
+        /// <summary>
+        /// Bits per pixel, for formats with multi-pixel blocks this is the average.
+        /// </summary>
+        constexpr unsigned int bits_per_pixel(DXGI_FORMAT format)
+        {
+            return (format_info(format).block_width == 0) ? 0 :
+                format_info(format).block_bytes * 8 / (format_info(format).block_width * format_info(format).block_height);
+        }
+
+        /// <summary>
+        /// Bytes of one row of blocks covering width pixels, tightly packed.
+        /// </summary>
+        constexpr unsigned int row_pitch(DXGI_FORMAT format, unsigned int width)
+        {
+            return detail::blocks(width, format_info(format).block_width) * format_info(format).block_bytes;
+        }
+
+        /// <summary>
+        /// Number of block rows covering height pixels.
+        /// </summary>
+        constexpr unsigned int row_count(DXGI_FORMAT format, unsigned int height)
+        {
+            return detail::blocks(height, format_info(format).block_height);
+        }
+
+        constexpr unsigned int depth_pitch(DXGI_FORMAT format, unsigned int width, unsigned int height)
+        {
+            return row_pitch(format, width) * row_count(format, height);
+        }
+
+        constexpr unsigned int mip_size(unsigned int size, unsigned int mip)
+        {
+            return ((size >> mip) > 0) ? (size >> mip) : 1;
+        }
+
+        static_assert(detail::format_count == DXGI_FORMAT_B4G4R4A4_UNORM + 1, "format table out of sync with DXGI_FORMAT");
+        static_assert(bits_per_pixel(DXGI_FORMAT_R8G8B8A8_UNORM) == 32, "format table out of sync with DXGI_FORMAT");
+        static_assert(bits_per_pixel(DXGI_FORMAT_R32G32B32_FLOAT) == 96, "format table out of sync with DXGI_FORMAT");
+        static_assert(bits_per_pixel(DXGI_FORMAT_D24_UNORM_S8_UINT) == 32, "format table out of sync with DXGI_FORMAT");
+        static_assert(bits_per_pixel(DXGI_FORMAT_R16_UNORM) == 16, "format table out of sync with DXGI_FORMAT");
+        static_assert(bits_per_pixel(DXGI_FORMAT_A8_UNORM) == 8, "format table out of sync with DXGI_FORMAT");
+        static_assert(bits_per_pixel(DXGI_FORMAT_R1_UNORM) == 1, "format table out of sync with DXGI_FORMAT");
+        static_assert(bits_per_pixel(DXGI_FORMAT_BC1_UNORM) == 4, "format table out of sync with DXGI_FORMAT");
+        static_assert(bits_per_pixel(DXGI_FORMAT_BC5_SNORM) == 8, "format table out of sync with DXGI_FORMAT");
+        static_assert(bits_per_pixel(DXGI_FORMAT_B8G8R8X8_UNORM_SRGB) == 32, "format table out of sync with DXGI_FORMAT");
+        static_assert(bits_per_pixel(DXGI_FORMAT_BC7_UNORM_SRGB) == 8, "format table out of sync with DXGI_FORMAT");
+        static_assert(bits_per_pixel(DXGI_FORMAT_YUY2) == 16, "format table out of sync with DXGI_FORMAT");
+        static_assert(row_pitch(DXGI_FORMAT_BC1_UNORM, 5) == 16, "block-compressed pitch");
+        static_assert(depth_pitch(DXGI_FORMAT_BC3_UNORM, 5, 5) == 64, "block-compressed pitch");
+        static_assert(row_pitch(DXGI_FORMAT_R1_UNORM, 9) == 2, "sub-byte pitch");
+
+    } /* End of namespace dxgi */
+
+} /* End of namespace dx */
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <math.h>
+#include <string.h>
+
+#include "DirectXPlus.h"
+#include "ShaderCompiler.h"
+#include "UploadRing.h"
+
+namespace dx {
+
+    namespace d3d11 {
+
+        struct resolutionsettings {
+            double target_ms = 16.0;    // frame time to stay under
+            double min_scale = 0.5;     // of the output size, per axis
+            double max_scale = 1.0;
+            double headroom = 0.9;      // aim this far below the target so spikes don't miss it
+            double smoothing = 0.1;     // weight of the newest frame time
+            unsigned int settle_frames = 5;     // measurements lag a few frames behind a change, ignore those
+        };
+
+        /// <summary>
+        /// Picks the render scale from measured frame times.
+        ///
+        /// Cost is taken as proportional to the pixel count, so the scale moves by the square root
+        /// of target / measured. Going down is fast, going up is limited to a few percent per change
+        /// so a scale that just fits does not oscillate.
+        /// </summary>
+        class resolutioncontroller {
+        public:
+            explicit resolutioncontroller(const resolutionsettings &settings = resolutionsettings())
+            {
+                set_settings(settings);
+            }
+
+            void set_settings(const resolutionsettings &settings)
+            {
+                m_settings = settings;
+                if(m_settings.max_scale < m_settings.min_scale) {
+                    m_settings.max_scale = m_settings.min_scale;
+                }
+                reset();
+            }
+
+            const resolutionsettings &settings() const
+            {
+                return m_settings;
+            }
+
+            void reset()
+            {
+                m_scale = m_settings.max_scale;
+                m_smoothed_ms = 0.0;
+                m_settle = m_settings.settle_frames;
+            }
+
+            /// <summary>
+            /// Feed the time of a frame rendered at the current scale, returns the scale for the next one.
+            /// </summary>
+            double update(double frame_ms)
+            {
+                if(frame_ms <= 0.0) {
+                    return m_scale;
+                }
+                if(m_settle > 0) {
+                    --m_settle;
+                    return m_scale;
+                }
+                m_smoothed_ms = (m_smoothed_ms > 0.0) ? m_smoothed_ms + m_settings.smoothing * (frame_ms - m_smoothed_ms) : frame_ms;
+
+                double wanted = m_scale * sqrt(m_settings.target_ms * m_settings.headroom / m_smoothed_ms);
+                if(wanted > m_scale * 1.05) {
+                    wanted = m_scale * 1.05;
+                }
+                if(wanted < m_settings.min_scale) {
+                    wanted = m_settings.min_scale;
+                }
+                if(wanted > m_settings.max_scale) {
+                    wanted = m_settings.max_scale;
+                }
+
+                // ignore changes too small to pay for the frames it takes to see their effect
+                bool at_limit = (wanted == m_settings.min_scale || wanted == m_settings.max_scale);
+                if(wanted != m_scale && (fabs(wanted - m_scale) >= 0.02 || at_limit)) {
+                    // the smoothed time was measured at the old scale, carry it over
+                    m_smoothed_ms *= (wanted * wanted) / (m_scale * m_scale);
+                    m_scale = wanted;
+                    m_settle = m_settings.settle_frames;
+                }
+                return m_scale;
+            }
+
+            double scale() const
+            {
+                return m_scale;
+            }
+
+            double smoothed_ms() const
+            {
+                return m_smoothed_ms;
+            }
+
+        private:
+            resolutionsettings m_settings;
+            double m_scale = 1.0;
+            double m_smoothed_ms = 0.0;
+            unsigned int m_settle = 0;
+        };
+
+        /// <summary>
+        /// Stretches the top-left part of a texture over a render target with bilinear filtering.
+        /// Samples stay half a texel inside that part, so nothing left from larger frames bleeds in at the edges.
+        /// upload_extent() writes the size of that part and goes before blit() each frame.
+        /// The shaders are compiled in the background, blit() may only be called once ready() says so.
+        /// Leaves the pipeline with its own shaders, sampler and default blend, depth and rasterizer state.
+        /// </summary>
+        class upsampler {
+        public:
+            upsampler(device &dev, shadercompiler &compiler)
+            {
+                static const char source[] =
+                    "cbuffer extent : register(b0) { float2 uv_scale; float2 uv_max; };\n"
+                    "Texture2D source : register(t0);\n"
+                    "SamplerState bilinear : register(s0);\n"
+                    "void vs(uint id : SV_VertexID, out float4 pos : SV_Position, out float2 uv : TEXCOORD0)\n"
+                    "{\n"
+                    "    float2 t = float2((id << 1) & 2, id & 2);\n"
+                    "    pos = float4(t * float2(2, -2) + float2(-1, 1), 0, 1);\n"
+                    "    uv = t * uv_scale;\n"
+                    "}\n"
+                    "float4 ps(float4 pos : SV_Position, float2 uv : TEXCOORD0) : SV_Target\n"
+                    "{\n"
+                    "    return source.SampleLevel(bilinear, min(uv, uv_max), 0);\n"
+                    "}\n";
+
+                m_vs.request(compiler.compile<vertexshader>(source, "vs", "vs_4_0"));
+                m_ps.request(compiler.compile<pixelshader>(source, "ps", "ps_4_0"));
+
+                D3D11_SAMPLER_DESC sd;
+                ZeroMemory(&sd, sizeof(sd));
+                sd.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+                sd.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+                sd.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+                sd.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+                sd.ComparisonFunc = D3D11_COMPARISON_NEVER;
+                sd.MaxLOD = D3D11_FLOAT32_MAX;
+                m_sampler = dev.create_samplerstate(sd);
+
+                m_constants = dev.create_buffer(nullptr, sizeof(extent), 0, D3D11_USAGE_DYNAMIC, D3D11_BIND_CONSTANT_BUFFER, D3D11_CPU_ACCESS_WRITE);
+            }
+
+            /// <summary>
+            /// Whether both shaders are there, call it on the drawing thread. Stays false if they failed to compile.
+            /// </summary>
+            bool ready()
+            {
+                m_vs.poll();
+                m_ps.poll();
+                return m_vs.current().is_valid() && m_ps.current().is_valid();
+            }
+
+            /// <summary>
+            /// Message of a failed compilation, empty while none failed.
+            /// </summary>
+            const std::string &error() const
+            {
+                return m_vs.error().empty() ? m_ps.error() : m_vs.error();
+            }
+
+            /// <summary>
+            /// Make the next blit() read the source_width x source_height top-left part of a texture of texture_width x texture_height.
+            /// </summary>
+            void upload_extent(uploadring &uploads, unsigned int source_width, unsigned int source_height, unsigned int texture_width, unsigned int texture_height)
+            {
+                // the last texel centers of the source part, beyond them the filter would read outside it
+                extent e = { { (float)source_width / (float)texture_width, (float)source_height / (float)texture_height },
+                             { ((float)source_width - 0.5f) / (float)texture_width, ((float)source_height - 0.5f) / (float)texture_height } };
+                uploads.upload_constants(m_constants, e);
+            }
+
+            /// <summary>
+            /// Draw the part of src given to upload_extent() over the whole of dst.
+            /// </summary>
+            void blit(devicecontext &context, borrowed<shaderresourceview> src, borrowed<rendertargetview> dst, unsigned int width, unsigned int height)
+            {
+                context.set_rendertarget(dst, borrowed<depthstencilview>());
+                context.set_viewport((float)width, (float)height);
+                context.set_blendstate(borrowed<blendstate>());
+                context.set_depthstencilstate(borrowed<depthstencilstate>());
+                context.set_rasterizerstate(borrowed<rasterizerstate>());
+                context.set_inputlayout(borrowed<inputlayout>());
+                context.set_primitivetopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+                context.set_shader(m_vs.current());
+                context.set_shader(m_ps.current());
+                context.set_constantbuffer<vertexshader>(0, m_constants);
+                context.set_constantbuffer<pixelshader>(0, m_constants);
+                context.set_shaderresource<pixelshader>(0, src);
+                context.set_sampler<pixelshader>(0, m_sampler);
+                context.draw(3);
+
+                // src is a render target again next frame
+                context.set_shaderresource<pixelshader>(0, borrowed<shaderresourceview>());
+            }
+
+        private:
+            // the cbuffer of the shaders
+            struct extent {
+                float uv_scale[2];
+                float uv_max[2];
+            };
+
+            pendingobject<vertexshader> m_vs;
+            pendingobject<pixelshader> m_ps;
+            samplerstate m_sampler;
+            buffer m_constants;
+        };
+
+    } /* End of namespace d3d11 */
+
+} /* End of namespace dx */
@@ -0,0 +1,340 @@
+#include "EquationJit.h"
+#include "MeshEvaluator.h"
+#include "MilkEquation.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#ifndef DX_FIXTURES_DIR
+#define DX_FIXTURES_DIR "fixtures"
+#endif
+
+// Whether two results are the same bits, any NaN is the same as any other
+static bool sameResult(double a, double b)
+{
+    return memcmp(&a, &b, sizeof(a)) == 0 || (a != a && b != b);
+}
+
+// Snippets the compiler once got wrong. Bytecode, native code and the tree walker must agree on them to the bit.
+static int checkEquationCases()
+{
+    using namespace dx::milk;
+
+    static const char *const cases[] = {
+        // the right operand assigns what the left one read
+        "x = 3; y = x + (x = 1);",
+        "x = 3; y = (x = x + 1) - (x = 10);",
+        // -0 + 0 is +0, x + 0 isn't x
+        "x = 0; y = -x + 0; z = atan2(y, -1);",
+        "x = 0; y = -x - -0; z = atan2(y, -1);",
+    };
+    int failures = 0;
+    for(const char *source : cases) {
+        equationscope scope;
+        equationprogram program;
+        treeinterpreter tree;
+        std::string error;
+        if(!compile_equations(source, scope, program, &error) || !tree.compile(source)) {
+            fprintf(stderr, "%s: %s\n", source, error.c_str());
+            failures++;
+            continue;
+        }
+        treeinterpreter::variables vars;
+        for(auto& v : scope.variables()) {
+            vars[v.first] = scope[v.second];
+        }
+        equationscope jit_scope = scope;
+        equationjit jit;
+        jit.compile(program);
+        program.run(scope);
+        jit.run(jit_scope);
+        tree.run(vars);
+        for(auto& v : scope.variables()) {
+            double a = scope[v.second], n = jit_scope[v.second], b = vars[v.first];
+            if(!sameResult(a, b) || !sameResult(n, b)) {
+                printf("%s: %s is %g compiled, %g native, %g in the tree walker\n", source, v.first.c_str(), a, n, b);
+                failures++;
+                break;
+            }
+        }
+    }
+    return failures;
+}
+
+// Runs the per-frame and per-vertex equations of a preset on a 48x36 mesh as bytecode, as native code and
+// through the reference tree walker. All three must end with the same bits in every variable. Returns 1 if
+// the preset can't be compiled or the results differ, with timings the time per frame of each is reported.
+static int runPresetEquations(const char *path, unsigned int frames, bool timings)
+{
+    using namespace dx::milk;
+    typedef std::chrono::steady_clock clock;
+
+    const unsigned int meshx = 48, meshy = 36;
+    // what per-vertex code may change, reset to the per-frame result at every vertex
+    static const equationvariable outputs[] = { var_zoom, var_zoomexp, var_rot, var_warp, var_cx, var_cy, var_dx, var_dy, var_sx, var_sy };
+    static const char *const output_names[] = { "zoom", "zoomexp", "rot", "warp", "cx", "cy", "dx", "dy", "sx", "sy" };
+
+    preset p;
+    if(!p.open(path)) {
+        fprintf(stderr, "%s: can't read\n", path);
+        return 1;
+    }
+    std::string init = p.code(codeblock::per_frame_init).source();
+    std::string frame = p.code(codeblock::per_frame).source();
+    std::string vertex = p.code(codeblock::per_pixel).source();
+
+    equationscope scope;
+    equationprogram init_program, frame_program, vertex_program;
+    treeinterpreter init_tree, frame_tree, vertex_tree;
+    std::string error;
+    if(!compile_equations(init, scope, init_program, &error) || !compile_equations(frame, scope, frame_program, &error) ||
+        !compile_equations(vertex, scope, vertex_program, &error) || !init_tree.compile(init) || !frame_tree.compile(frame) || !vertex_tree.compile(vertex)) {
+        fprintf(stderr, "%s: %s\n", path, error.c_str());
+        return 1;
+    }
+
+    treeinterpreter::variables vars;
+    for(auto& v : scope.variables()) {
+        vars[v.first] = 0.0;
+    }
+    for(auto& kv : p.values()) {
+        // initial values of the preset, fields MilkDrop keeps under other names stay 0 on both sides
+        int slot = scope.find(kv.key);
+        if(slot >= 0) {
+            scope[slot] = p.number(kv.key);
+            vars[scope.lower(kv.key)] = scope[slot];
+        }
+    }
+
+    // the same frames through the virtual machine or native code, all runs see the same rand() sequence
+    auto run_frames = [&](equationscope &s, const auto &init, const auto &frame_code, const auto &vertex_code) {
+        srand(1);
+        clock::time_point start = clock::now();
+        init.run(s);
+        for(unsigned int f = 0; f < frames; ++f) {
+            double time = f / 60.0;
+            s[var_time] = time;
+            s[var_frame] = f;
+            s[var_bass] = 1.0 + 0.5 * sin(time * 3.1);
+            s[var_mid] = 1.0 + 0.5 * sin(time * 1.7);
+            s[var_treb] = 1.0 + 0.5 * sin(time * 0.9);
+            frame_code.run(s);
+            double saved[sizeof(outputs) / sizeof(outputs[0])];
+            for(size_t o = 0; o < sizeof(outputs) / sizeof(outputs[0]); ++o) {
+                saved[o] = s[outputs[o]];
+            }
+            for(unsigned int y = 0; y <= meshy; ++y) {
+                for(unsigned int x = 0; x <= meshx; ++x) {
+                    for(size_t o = 0; o < sizeof(outputs) / sizeof(outputs[0]); ++o) {
+                        s[outputs[o]] = saved[o];
+                    }
+                    double vx = (double)x / meshx, vy = (double)y / meshy;
+                    s[var_x] = vx;
+                    s[var_y] = vy;
+                    s[var_rad] = sqrt((vx - 0.5) * (vx - 0.5) + (vy - 0.5) * (vy - 0.5)) * 1.414;
+                    s[var_ang] = atan2(vy - 0.5, vx - 0.5);
+                    vertex_code.run(s);
+                }
+            }
+        }
+        return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    };
+    equationscope jit_scope = scope;
+    equationjit init_jit, frame_jit, vertex_jit;
+    init_jit.compile(init_program);
+    frame_jit.compile(frame_program);
+    vertex_jit.compile(vertex_program);
+    double compiled_ms = run_frames(scope, init_program, frame_program, vertex_program);
+    double jit_ms = run_frames(jit_scope, init_jit, frame_jit, vertex_jit);
+
+    srand(1);
+    clock::time_point start = clock::now();
+    init_tree.run(vars);
+    for(unsigned int f = 0; f < frames; ++f) {
+        double time = f / 60.0;
+        vars["time"] = time;
+        vars["frame"] = f;
+        vars["bass"] = 1.0 + 0.5 * sin(time * 3.1);
+        vars["mid"] = 1.0 + 0.5 * sin(time * 1.7);
+        vars["treb"] = 1.0 + 0.5 * sin(time * 0.9);
+        frame_tree.run(vars);
+        double saved[sizeof(outputs) / sizeof(outputs[0])];
+        for(size_t o = 0; o < sizeof(outputs) / sizeof(outputs[0]); ++o) {
+            saved[o] = vars[output_names[o]];
+        }
+        for(unsigned int y = 0; y <= meshy; ++y) {
+            for(unsigned int x = 0; x <= meshx; ++x) {
+                for(size_t o = 0; o < sizeof(outputs) / sizeof(outputs[0]); ++o) {
+                    vars[output_names[o]] = saved[o];
+                }
+                double vx = (double)x / meshx, vy = (double)y / meshy;
+                vars["x"] = vx;
+                vars["y"] = vy;
+                vars["rad"] = sqrt((vx - 0.5) * (vx - 0.5) + (vy - 0.5) * (vy - 0.5)) * 1.414;
+                vars["ang"] = atan2(vy - 0.5, vx - 0.5);
+                vertex_tree.run(vars);
+            }
+        }
+    }
+    double tree_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+    // the tree walker is the reference for both, native code agreeing with the bytecode proves nothing alone
+    unsigned int mismatches = 0, jit_mismatches = 0;
+    for(auto& v : scope.variables()) {
+        double a = scope[v.second], n = jit_scope[v.second], b = vars[v.first];
+        if(!sameResult(a, b)) {
+            if(mismatches++ == 0) {
+                printf("%s: %s is %.17g compiled, %.17g in the tree walker\n", path, v.first.c_str(), a, b);
+            }
+        }
+        if(!sameResult(n, b)) {
+            if(jit_mismatches++ == 0) {
+                printf("%s: %s is %.17g native, %.17g in the tree walker\n", path, v.first.c_str(), n, b);
+            }
+        }
+    }
+
+    if(timings) {
+        const equationstatistics &fs = frame_program.statistics(), &vs = vertex_program.statistics();
+        printf("%s: compiled %.3f ms/frame, tree %.3f ms/frame, %.1fx, %u+%u instructions, %u folded, %u dead stores%s\n",
+               path, compiled_ms / frames, tree_ms / frames, (compiled_ms > 0.0) ? tree_ms / compiled_ms : 0.0,
+               fs.instructions, vs.instructions, fs.folded + vs.folded, fs.dead_stores + vs.dead_stores,
+               mismatches ? ", RESULTS DIFFER" : "");
+        const equationjitstatistics &js = vertex_jit.statistics();
+        printf("%s: native %.3f ms/frame, %.1fx over bytecode, per-vertex %u inlined, %u calls, %u hot registers%s%s\n",
+               path, jit_ms / frames, (jit_ms > 0.0) ? compiled_ms / jit_ms : 0.0, js.inlined, js.calls, js.hot_registers,
+               vertex_jit.native() ? "" : " (interpreted)", jit_mismatches ? ", NATIVE CODE DIFFERS" : "");
+    } else {
+        printf("%s: %u variables, %s%s\n", path, (unsigned int)scope.variables().size(),
+               (mismatches || jit_mismatches) ? "RESULTS DIFFER" : "ok", vertex_jit.native() ? "" : " (interpreted)");
+    }
+    return (mismatches || jit_mismatches) ? 1 : 0;
+}
+
+// equationcheck --bench <preset.milk>...
+// Reports the time per frame of the bytecode, native code and the tree walker over presets, and whether
+// they agree. Checks the snippets of checkEquationCases first.
+static int benchEquations(int argc, char *argv[])
+{
+    int failures = checkEquationCases();
+    for(int i = 2; i < argc; ++i) {
+        failures += runPresetEquations(argv[i], 200, true);
+    }
+    return failures ? 1 : 0;
+}
+
+// equationcheck [preset.milk]...
+// Fails unless the bytecode, native code and the tree walker agree on every variable of the presets,
+// the fixtures next to the sources without arguments.
+static int checkEquations(int argc, char *argv[])
+{
+    static const char *const fixtures[] = { "tunnel-drift.milk", "beat-kaleido.milk", "liquid-noise.milk", "ripple-gate.milk" };
+
+    int failures = checkEquationCases();
+    if(argc > 1) {
+        for(int i = 1; i < argc; ++i) {
+            failures += runPresetEquations(argv[i], 60, false);
+        }
+    } else {
+        for(const char *name : fixtures) {
+            failures += runPresetEquations((std::string(DX_FIXTURES_DIR "/") + name).c_str(), 60, false);
+        }
+    }
+    if(failures) {
+        printf("%d failed\n", failures);
+    }
+    return failures ? 1 : 0;
+}
+
+// equationcheck --mesh <preset.milk>...
+// Runs the per-vertex equations of presets over a 192x144 warp mesh with every instruction set the
+// CPU has, and reports the time per frame and the largest texture coordinate difference to scalar.
+static int benchMesh(int argc, char *argv[])
+{
+    using namespace dx::milk;
+    typedef std::chrono::steady_clock clock;
+
+    const unsigned int frames = 100, meshx = 192, meshy = 144;
+    const simdlevel best = meshevaluator::detect();
+    int failures = 0;
+    for(int i = 2; i < argc; ++i) {
+        preset p;
+        if(!p.open(argv[i])) {
+            fprintf(stderr, "%s: can't read\n", argv[i]);
+            failures++;
+            continue;
+        }
+        equationscope scope;
+        equationprogram init_program, frame_program, vertex_program;
+        std::string error;
+        if(!compile_equations(p.code(codeblock::per_frame_init).source(), scope, init_program, &error) ||
+            !compile_equations(p.code(codeblock::per_frame).source(), scope, frame_program, &error) ||
+            !compile_equations(p.code(codeblock::per_pixel).source(), scope, vertex_program, &error)) {
+            fprintf(stderr, "%s: %s\n", argv[i], error.c_str());
+            failures++;
+            continue;
+        }
+        // MilkDrop's defaults, for presets leaving them out
+        scope[var_zoom] = scope[var_zoomexp] = scope[var_sx] = scope[var_sy] = 1.0;
+        scope[var_cx] = scope[var_cy] = 0.5;
+        scope[var_warp] = 1.0;
+        for(auto& kv : p.values()) {
+            int slot = scope.find(kv.key);
+            if(slot >= 0) {
+                scope[slot] = p.number(kv.key);
+            }
+        }
+        init_program.run(scope);
+        scope[var_time] = 1.0;
+        scope[var_fps] = 60.0;
+        frame_program.run(scope);
+        warpparameters parameters;
+        parameters.time = 1.0;
+
+        printf("%s:", argv[i]);
+        std::vector<warpvertex> reference;
+        for(simdlevel level : { simdlevel::scalar, simdlevel::sse2, simdlevel::avx2, simdlevel::avx512 }) {
+            if(level > best) {
+                break;
+            }
+            meshevaluator mesh(meshx, meshy, level);
+            mesh.set_program(vertex_program, scope);
+            std::vector<warpvertex> vertices(mesh.vertex_count());
+            clock::time_point start = clock::now();
+            for(unsigned int f = 0; f < frames; ++f) {
+                mesh.evaluate(scope, parameters, vertices.data());
+            }
+            double ms = std::chrono::duration<double, std::milli>(clock::now() - start).count() / frames;
+            if(reference.empty()) {
+                reference = vertices;
+            }
+            double difference = 0.0;
+            for(size_t v = 0; v < vertices.size(); ++v) {
+                difference = std::max(difference, (double)std::max(fabs(vertices[v].u - reference[v].u), fabs(vertices[v].v - reference[v].v)));
+            }
+            printf(" %s %.3f ms (%.1g)", meshevaluator::name(mesh.level()), ms, difference);
+            if(mesh.level() != level) {
+                // values carried between vertices, every level runs scalar
+                break;
+            }
+        }
+        printf("\n");
+    }
+    return failures ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        return benchEquations(argc, argv);
+    }
+    if(argc > 1 && strcmp(argv[1], "--mesh") == 0) {
+        return benchMesh(argc, argv);
+    }
+    return checkEquations(argc, argv);
+}
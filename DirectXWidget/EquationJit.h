@@ -0,0 +1,842 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "MilkEquation.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define DX_JIT_X64 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+/*
+    Native code for preset equations on x86-64.
+
+    An equationprogram becomes one function taking the register file. The most used registers of the
+    program live in xmm6..xmm15 from entry to exit, the others are read and written in place.
+    Arithmetic, comparisons, min, max, abs, sqrt, rounding and branches are inlined with SSE2 (rounding
+    with SSE4.1 when the CPU has it), everything else calls equationmath::apply, the code the virtual
+    machine runs, so results are the same to the bit. Every call follows the host ABI, Windows x64 or
+    System V, and hot registers survive it. The function has no unwind information, nothing it calls throws.
+*/
+
+namespace dx {
+
+    namespace milk {
+
+        /// <summary>
+        /// Pages holding generated code, writable while filled and executable after.
+        /// </summary>
+        class executablememory {
+        public:
+            executablememory() {}
+
+            executablememory(const executablememory &) = delete;
+            executablememory &operator= (const executablememory &) = delete;
+
+            executablememory(executablememory &&m)
+            {
+                *this = std::move(m);
+            }
+
+            executablememory &operator= (executablememory &&m)
+            {
+                if(this != &m) {
+                    release();
+                    std::swap(m_data, m.m_data);
+                    std::swap(m_size, m.m_size);
+                }
+                return *this;
+            }
+
+            ~executablememory()
+            {
+                release();
+            }
+
+            /// <summary>
+            /// Copy code in, false if the system refuses executable memory.
+            /// </summary>
+            bool assign(const void *code, size_t size)
+            {
+                release();
+                if(size == 0) {
+                    return false;
+                }
+#ifdef _WIN32
+                void *p = VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+                if(nullptr == p) {
+                    return false;
+                }
+                memcpy(p, code, size);
+                DWORD old;
+                if(!VirtualProtect(p, size, PAGE_EXECUTE_READ, &old)) {
+                    VirtualFree(p, 0, MEM_RELEASE);
+                    return false;
+                }
+                FlushInstructionCache(GetCurrentProcess(), p, size);
+#else
+                void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if(p == MAP_FAILED) {
+                    return false;
+                }
+                memcpy(p, code, size);
+                if(mprotect(p, size, PROT_READ | PROT_EXEC) != 0) {
+                    munmap(p, size);
+                    return false;
+                }
+#endif
+                m_data = p;
+                m_size = size;
+                return true;
+            }
+
+            void release()
+            {
+                if(nullptr != m_data) {
+#ifdef _WIN32
+                    VirtualFree(m_data, 0, MEM_RELEASE);
+#else
+                    munmap(m_data, m_size);
+#endif
+                }
+                m_data = nullptr;
+                m_size = 0;
+            }
+
+            const void *data() const
+            {
+                return m_data;
+            }
+
+            size_t size() const
+            {
+                return m_size;
+            }
+
+        private:
+            void *m_data = nullptr;
+            size_t m_size = 0;
+        };
+
+        /// <summary>
+        /// The few x86-64 instructions the JIT needs. Memory operands are registers of the file at rbx
+        /// or 16 byte constants after the code, addressed relative to rip and placed by finish.
+        /// </summary>
+        class x64emitter {
+        public:
+            enum : uint8_t {
+                none = 0,
+                pd = 0x66,      // packed double, and the operand size prefix
+                sd = 0xF2       // scalar double
+            };
+
+            // SSE opcodes after 0x0F
+            enum : uint8_t {
+                movsd_load = 0x10, movsd_store = 0x11, movapd = 0x28, ucomisd = 0x2E,
+                sqrtsd = 0x51, andpd = 0x54, andnpd = 0x55, orpd = 0x56, xorpd = 0x57,
+                addsd = 0x58, mulsd = 0x59, subsd = 0x5C, minsd = 0x5D, divsd = 0x5E, maxsd = 0x5F,
+                cmpsd = 0xC2
+            };
+
+            // cmpsd predicates
+            enum : uint8_t {
+                cmp_lt = 1, cmp_le = 2, cmp_neq = 4, cmp_nlt = 5
+            };
+
+            // register operand
+            void sse(uint8_t prefix, uint8_t opcode, int reg, int rm)
+            {
+                start(prefix, reg, rm);
+                byte(0x0F);
+                byte(opcode);
+                byte((uint8_t)(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+            }
+
+            // [rbx + 8 * slot]
+            void sse_slot(uint8_t prefix, uint8_t opcode, int reg, unsigned int slot)
+            {
+                start(prefix, reg, 0);
+                byte(0x0F);
+                byte(opcode);
+                const uint32_t disp = slot * 8;
+                if(disp < 128) {
+                    byte((uint8_t)(0x43 | ((reg & 7) << 3)));
+                    byte((uint8_t)disp);
+                }
+                else {
+                    byte((uint8_t)(0x83 | ((reg & 7) << 3)));
+                    dword(disp);
+                }
+            }
+
+            // [rip + constant]
+            void sse_constant(uint8_t prefix, uint8_t opcode, int reg, int constant)
+            {
+                start(prefix, reg, 0);
+                byte(0x0F);
+                byte(opcode);
+                byte((uint8_t)(0x05 | ((reg & 7) << 3)));
+                m_constant_fixups.emplace_back(m_code.size(), constant);
+                dword(0);
+            }
+
+            void compare(int reg, int rm, uint8_t predicate)
+            {
+                sse(sd, cmpsd, reg, rm);
+                byte(predicate);
+            }
+
+            // roundsd, SSE4.1, mode 9 floor, 10 ceil, 11 truncate
+            void round(int reg, int rm, uint8_t mode)
+            {
+                start(pd, reg, rm);
+                byte(0x0F);
+                byte(0x3A);
+                byte(0x0B);
+                byte((uint8_t)(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+                byte(mode);
+            }
+
+            // movdqu [rsp + disp], xmm and back
+            void save_xmm(int reg, uint32_t disp)
+            {
+                stack(0x7F, reg, disp);
+            }
+
+            void restore_xmm(int reg, uint32_t disp)
+            {
+                stack(0x6F, reg, disp);
+            }
+
+            /// <summary>
+            /// jmp, or jcc with the condition code (0x7 ja, 0x6 jbe), to a label placed later.
+            /// </summary>
+            void jump(int label, int condition = -1)
+            {
+                if(condition < 0) {
+                    byte(0xE9);
+                }
+                else {
+                    byte(0x0F);
+                    byte((uint8_t)(0x80 | condition));
+                }
+                m_jump_fixups.emplace_back(m_code.size(), label);
+                dword(0);
+            }
+
+            void label(int label)
+            {
+                if(m_labels.size() <= (size_t)label) {
+                    m_labels.resize(label + 1, 0);
+                }
+                m_labels[label] = m_code.size();
+            }
+
+            /// <summary>
+            /// A 16 byte constant, both halves given.
+            /// </summary>
+            int constant(uint64_t low, uint64_t high)
+            {
+                m_constants.push_back(low);
+                m_constants.push_back(high);
+                return (int)(m_constants.size() / 2 - 1);
+            }
+
+            void byte(uint8_t b)
+            {
+                m_code.push_back(b);
+            }
+
+            void dword(uint32_t d)
+            {
+                for(int i = 0; i < 4; ++i) {
+                    byte((uint8_t)(d >> (8 * i)));
+                }
+            }
+
+            void qword(uint64_t q)
+            {
+                dword((uint32_t)q);
+                dword((uint32_t)(q >> 32));
+            }
+
+            /// <summary>
+            /// Resolve jumps and append the constants, the code is ready to copy.
+            /// </summary>
+            const std::vector<uint8_t> &finish()
+            {
+                for(auto& f : m_jump_fixups) {
+                    patch(f.first, m_labels[f.second]);
+                }
+                while(m_code.size() % 16) {
+                    byte(0xCC);
+                }
+                const size_t base = m_code.size();
+                for(uint64_t c : m_constants) {
+                    for(int i = 0; i < 8; ++i) {
+                        byte((uint8_t)(c >> (8 * i)));
+                    }
+                }
+                for(auto& f : m_constant_fixups) {
+                    patch(f.first, base + 16 * (size_t)f.second);
+                }
+                return m_code;
+            }
+
+            size_t size() const
+            {
+                return m_code.size();
+            }
+
+        private:
+            // prefix and REX for an xmm register and an rm register or base
+            void start(uint8_t prefix, int reg, int rm)
+            {
+                if(prefix != none) {
+                    byte(prefix);
+                }
+                if(reg >= 8 || rm >= 8) {
+                    byte((uint8_t)(0x40 | ((reg >= 8) ? 4 : 0) | ((rm >= 8) ? 1 : 0)));
+                }
+            }
+
+            void stack(uint8_t opcode, int reg, uint32_t disp)
+            {
+                start(0xF3, reg, 0);
+                byte(0x0F);
+                byte(opcode);
+                byte((uint8_t)(0x84 | ((reg & 7) << 3)));
+                byte(0x24);     // SIB, base rsp
+                dword(disp);
+            }
+
+            // rel32 at position to target, relative to the end of the displacement
+            void patch(size_t position, size_t target)
+            {
+                int32_t rel = (int32_t)((int64_t)target - (int64_t)(position + 4));
+                memcpy(&m_code[position], &rel, sizeof(rel));
+            }
+
+            std::vector<uint8_t> m_code;
+            std::vector<uint64_t> m_constants;
+            std::vector<size_t> m_labels;
+            std::vector<std::pair<size_t, int>> m_jump_fixups;
+            std::vector<std::pair<size_t, int>> m_constant_fixups;
+        };
+
+        struct equationjitstatistics {
+            unsigned int instructions = 0;
+            unsigned int inlined = 0;       // instructions turned into SSE code
+            unsigned int calls = 0;         // instructions calling equationmath::apply
+            unsigned int hot_registers = 0; // registers kept in xmm6..xmm15
+            size_t code_bytes = 0;
+        };
+
+        /// <summary>
+        /// An equationprogram as native code. Where that isn't possible, on other CPUs or when the system
+        /// denies executable memory, run falls back to the virtual machine.
+        /// </summary>
+        class equationjit {
+        public:
+            equationjit() {}
+
+            equationjit(const equationjit &) = delete;
+            equationjit &operator= (const equationjit &) = delete;
+            equationjit(equationjit &&j)
+            {
+                *this = std::move(j);
+            }
+
+            equationjit &operator= (equationjit &&j)
+            {
+                if(this != &j) {
+                    m_program = std::move(j.m_program);
+                    m_memory = std::move(j.m_memory);
+                    m_entry = j.m_entry;
+                    m_statistics = j.m_statistics;
+                    j.m_entry = nullptr;
+                }
+                return *this;
+            }
+
+            /// <summary>
+            /// Translate program, false if run will interpret it.
+            /// </summary>
+            bool compile(const equationprogram &program)
+            {
+                m_program = program;
+                m_memory.release();
+                m_entry = nullptr;
+                m_statistics = equationjitstatistics();
+                m_statistics.instructions = (unsigned int)program.code().size();
+#ifdef DX_JIT_X64
+                if(program.empty()) {
+                    return false;
+                }
+                generator g(program.code(), m_statistics);
+                const std::vector<uint8_t> &code = g.generate();
+                if(!m_memory.assign(code.data(), code.size())) {
+                    return false;
+                }
+                m_statistics.code_bytes = code.size();
+                m_entry = (entry)m_memory.data();
+                return true;
+#else
+                return false;
+#endif
+            }
+
+            void run(double *r) const
+            {
+                if(nullptr != m_entry) {
+                    m_entry(r);
+                }
+                else {
+                    m_program.run(r);
+                }
+            }
+
+            void run(equationscope &scope) const
+            {
+                run(scope.registers());
+            }
+
+            bool native() const
+            {
+                return nullptr != m_entry;
+            }
+
+            const equationprogram &program() const
+            {
+                return m_program;
+            }
+
+            const equationjitstatistics &statistics() const
+            {
+                return m_statistics;
+            }
+
+        private:
+            typedef void (*entry)(double *);
+
+#ifdef DX_JIT_X64
+            /// <summary>
+            /// equationmath::apply for generated code, the operation widened to a register argument.
+            /// </summary>
+            static double callout(uint64_t op, double a, double b)
+            {
+                return equationmath::apply((equationop)op, a, b);
+            }
+
+            static bool has_sse41()
+            {
+#ifdef _MSC_VER
+                int r[4];
+                __cpuid(r, 1);
+                return (r[2] & (1 << 19)) != 0;
+#else
+                __builtin_cpu_init();
+                return __builtin_cpu_supports("sse4.1");
+#endif
+            }
+
+            class generator {
+            public:
+                generator(const std::vector<equationinstruction> &code, equationjitstatistics &statistics)
+                    : m_code(code), m_statistics(statistics)
+                {
+                }
+
+                const std::vector<uint8_t> &generate()
+                {
+                    m_sse41 = has_sse41();
+                    m_abs = m_x.constant(0x7FFFFFFFFFFFFFFFull, 0x7FFFFFFFFFFFFFFFull);
+                    m_sign = m_x.constant(0x8000000000000000ull, 0x8000000000000000ull);
+                    m_one = m_x.constant(0x3FF0000000000000ull, 0);
+                    uint64_t close;
+                    const double closefact = equationmath::closefact;
+                    memcpy(&close, &closefact, sizeof(close));
+                    m_close = m_x.constant(close, 0);
+
+                    allocate();
+                    prologue();
+                    for(size_t pc = 0; pc < m_code.size(); ++pc) {
+                        m_x.label((int)pc);
+                        instruction(m_code[pc]);
+                    }
+                    m_x.label((int)m_code.size());
+                    epilogue();
+                    return m_x.finish();
+                }
+
+            private:
+                static const int hot_first = 6, hot_count = 10;
+
+#ifdef _WIN64
+                // shadow space for calls, then xmm6..xmm15
+                static const uint32_t frame_size = 32 + 16 * hot_count;
+#endif
+
+                /// <summary>
+                /// Keep the registers used most, at least twice, in xmm6..xmm15.
+                /// </summary>
+                void allocate()
+                {
+                    std::vector<std::pair<unsigned int, uint16_t>> uses;
+                    std::vector<unsigned int> count;
+                    auto use = [&](uint16_t slot) {
+                        if(count.size() <= slot) {
+                            count.resize(slot + 1, 0);
+                        }
+                        count[slot]++;
+                    };
+                    for(auto& i : m_code) {
+                        if(i.op == equationop::jump) {
+                            continue;
+                        }
+                        use(i.a);
+                        if(i.op == equationop::jz || i.op == equationop::jnz) {
+                            continue;
+                        }
+                        use(i.dst);
+                        if(equationmath::is_binary(i.op)) {
+                            use(i.b);
+                        }
+                    }
+                    for(size_t slot = 0; slot < count.size(); ++slot) {
+                        if(count[slot] >= 2) {
+                            uses.emplace_back(count[slot], (uint16_t)slot);
+                        }
+                    }
+                    // most used first, lower slots on ties so code doesn't depend on the sort
+                    std::sort(uses.begin(), uses.end(), [](const std::pair<unsigned int, uint16_t> &a, const std::pair<unsigned int, uint16_t> &b) {
+                        return (a.first != b.first) ? a.first > b.first : a.second < b.second;
+                    });
+                    m_home.assign(count.size(), -1);
+                    for(size_t k = 0; k < uses.size() && k < (size_t)hot_count; ++k) {
+                        m_home[uses[k].second] = hot_first + (int)k;
+                        m_hot.push_back(uses[k].second);
+                    }
+                    m_written.assign(count.size(), false);
+                    for(auto& i : m_code) {
+                        if(i.op != equationop::jump && i.op != equationop::jz && i.op != equationop::jnz) {
+                            m_written[i.dst] = true;
+                        }
+                    }
+                    m_statistics.hot_registers = (unsigned int)m_hot.size();
+                }
+
+                int home(uint16_t slot) const
+                {
+                    return (slot < m_home.size()) ? m_home[slot] : -1;
+                }
+
+                void prologue()
+                {
+                    m_x.byte(0x53);                                     // push rbx
+#ifdef _WIN64
+                    m_x.byte(0x48); m_x.byte(0x81); m_x.byte(0xEC);     // sub rsp, frame_size
+                    m_x.dword(frame_size);
+                    for(size_t k = 0; k < m_hot.size(); ++k) {
+                        m_x.save_xmm(hot_first + (int)k, (uint32_t)(32 + 16 * k));
+                    }
+                    m_x.byte(0x48); m_x.byte(0x89); m_x.byte(0xCB);     // mov rbx, rcx
+#else
+                    m_x.byte(0x48); m_x.byte(0x89); m_x.byte(0xFB);     // mov rbx, rdi
+#endif
+                    reload();
+                }
+
+                void epilogue()
+                {
+                    spill();
+#ifdef _WIN64
+                    for(size_t k = 0; k < m_hot.size(); ++k) {
+                        m_x.restore_xmm(hot_first + (int)k, (uint32_t)(32 + 16 * k));
+                    }
+                    m_x.byte(0x48); m_x.byte(0x81); m_x.byte(0xC4);     // add rsp, frame_size
+                    m_x.dword(frame_size);
+#endif
+                    m_x.byte(0x5B);                                     // pop rbx
+                    m_x.byte(0xC3);                                     // ret
+                }
+
+                // hot registers the program writes back to the file
+                void spill()
+                {
+                    for(uint16_t slot : m_hot) {
+                        if(m_written[slot]) {
+                            m_x.sse_slot(x64emitter::sd, x64emitter::movsd_store, home(slot), slot);
+                        }
+                    }
+                }
+
+                void reload()
+                {
+                    for(uint16_t slot : m_hot) {
+                        m_x.sse_slot(x64emitter::sd, x64emitter::movsd_load, home(slot), slot);
+                    }
+                }
+
+                void load(int xmm, uint16_t slot)
+                {
+                    int h = home(slot);
+                    if(h >= 0) {
+                        if(h != xmm) {
+                            m_x.sse(x64emitter::pd, x64emitter::movapd, xmm, h);
+                        }
+                    }
+                    else {
+                        m_x.sse_slot(x64emitter::sd, x64emitter::movsd_load, xmm, slot);
+                    }
+                }
+
+                void store(uint16_t slot, int xmm)
+                {
+                    int h = home(slot);
+                    if(h >= 0) {
+                        m_x.sse(x64emitter::pd, x64emitter::movapd, h, xmm);
+                    }
+                    else {
+                        m_x.sse_slot(x64emitter::sd, x64emitter::movsd_store, xmm, slot);
+                    }
+                }
+
+                // xmm = xmm op slot, straight from memory when the slot isn't hot
+                void operate(uint8_t prefix, uint8_t opcode, int xmm, uint16_t slot)
+                {
+                    int h = home(slot);
+                    if(h >= 0) {
+                        m_x.sse(prefix, opcode, xmm, h);
+                    }
+                    else {
+                        m_x.sse_slot(prefix, opcode, xmm, slot);
+                    }
+                }
+
+                void constant(uint8_t prefix, uint8_t opcode, int xmm, int c)
+                {
+                    m_x.sse_constant(prefix, opcode, xmm, c);
+                }
+
+                // xmm = 1.0 where the mask in xmm is set, else 0.0
+                void one_if(int xmm)
+                {
+                    constant(x64emitter::pd, x64emitter::andpd, xmm, m_one);
+                }
+
+                // mask of truth(xmm), !(fabs(xmm) < closefact), in xmm
+                void truth(int xmm, int scratch)
+                {
+                    constant(x64emitter::pd, x64emitter::andpd, xmm, m_abs);
+                    constant(x64emitter::sd, x64emitter::movsd_load, scratch, m_close);
+                    m_x.compare(xmm, scratch, x64emitter::cmp_nlt);
+                }
+
+                void instruction(const equationinstruction &i)
+                {
+                    typedef x64emitter x;
+                    switch(i.op) {
+                    case equationop::jump:
+                        m_x.jump(i.dst);
+                        return;
+                    case equationop::jz:
+                    case equationop::jnz:
+                        // closefact against |a|: above means |a| < closefact, a is false, NaN is unordered
+                        load(0, i.a);
+                        constant(x::pd, x::andpd, 0, m_abs);
+                        constant(x::sd, x::movsd_load, 1, m_close);
+                        m_x.sse(x::pd, x::ucomisd, 1, 0);
+                        m_x.jump(i.dst, (i.op == equationop::jz) ? 0x7 : 0x6);
+                        m_statistics.inlined++;
+                        return;
+                    default:
+                        break;
+                    }
+
+                    if(!inline_instruction(i)) {
+                        call(i);
+                        m_statistics.calls++;
+                        return;
+                    }
+                    store(i.dst, 0);
+                    m_statistics.inlined++;
+                }
+
+                /// <summary>
+                /// Code computing the result into xmm0, false for operations left to equationmath::apply.
+                /// </summary>
+                bool inline_instruction(const equationinstruction &i)
+                {
+                    typedef x64emitter x;
+                    switch(i.op) {
+                    case equationop::mov:
+                        load(0, i.a);
+                        return true;
+                    case equationop::add:
+                    case equationop::sub:
+                    case equationop::mul:
+                    case equationop::min:
+                    case equationop::max: {
+                        static const uint8_t opcodes[] = { x::addsd, x::subsd, x::mulsd, x::minsd, x::maxsd };
+                        const uint8_t opcode = opcodes[(i.op == equationop::add) ? 0 : (i.op == equationop::sub) ? 1 :
+                                                       (i.op == equationop::mul) ? 2 : (i.op == equationop::min) ? 3 : 4];
+                        // minsd and maxsd return b unless a wins, like (a < b) ? a : b
+                        load(0, i.a);
+                        operate(x::sd, opcode, 0, i.b);
+                        return true;
+                    }
+                    case equationop::sqr:
+                        load(0, i.a);
+                        m_x.sse(x::sd, x::mulsd, 0, 0);
+                        return true;
+                    case equationop::div:
+                        // a / b masked by b != 0
+                        load(0, i.a);
+                        load(1, i.b);
+                        m_x.sse(x::sd, x::divsd, 0, 1);
+                        m_x.sse(x::pd, x::xorpd, 2, 2);
+                        m_x.compare(1, 2, x::cmp_neq);
+                        m_x.sse(x::pd, x::andpd, 0, 1);
+                        return true;
+                    case equationop::neg:
+                        load(0, i.a);
+                        constant(x::pd, x::xorpd, 0, m_sign);
+                        return true;
+                    case equationop::abs:
+                        load(0, i.a);
+                        constant(x::pd, x::andpd, 0, m_abs);
+                        return true;
+                    case equationop::sqrt:
+                        load(0, i.a);
+                        constant(x::pd, x::andpd, 0, m_abs);
+                        m_x.sse(x::sd, x::sqrtsd, 0, 0);
+                        return true;
+                    case equationop::invsqrt:
+                        load(1, i.a);
+                        m_x.sse(x::sd, x::sqrtsd, 1, 1);
+                        constant(x::sd, x::movsd_load, 0, m_one);
+                        m_x.sse(x::sd, x::divsd, 0, 1);
+                        return true;
+                    case equationop::lt:
+                    case equationop::le:
+                        load(0, i.a);
+                        load(1, i.b);
+                        m_x.compare(0, 1, (i.op == equationop::lt) ? x::cmp_lt : x::cmp_le);
+                        one_if(0);
+                        return true;
+                    case equationop::gt:
+                    case equationop::ge:
+                        // a > b as b < a
+                        load(0, i.b);
+                        load(1, i.a);
+                        m_x.compare(0, 1, (i.op == equationop::gt) ? x::cmp_lt : x::cmp_le);
+                        one_if(0);
+                        return true;
+                    case equationop::eq:
+                    case equationop::ne:
+                    case equationop::logical_not:
+                        // |a - b| < closefact, |a| for not
+                        load(0, i.a);
+                        if(i.op != equationop::logical_not) {
+                            operate(x::sd, x::subsd, 0, i.b);
+                        }
+                        constant(x::pd, x::andpd, 0, m_abs);
+                        constant(x::sd, x::movsd_load, 1, m_close);
+                        m_x.compare(0, 1, (i.op == equationop::ne) ? x::cmp_nlt : x::cmp_lt);
+                        one_if(0);
+                        return true;
+                    case equationop::band:
+                    case equationop::bor:
+                        load(0, i.a);
+                        truth(0, 2);
+                        load(1, i.b);
+                        truth(1, 2);
+                        m_x.sse(x::pd, (i.op == equationop::band) ? x::andpd : x::orpd, 0, 1);
+                        one_if(0);
+                        return true;
+                    case equationop::sign:
+                        // (0 < a) - (a < 0), 0 for NaN
+                        load(1, i.a);
+                        m_x.sse(x::pd, x::xorpd, 0, 0);
+                        m_x.compare(0, 1, x::cmp_lt);
+                        one_if(0);
+                        m_x.sse(x::pd, x::xorpd, 2, 2);
+                        m_x.compare(1, 2, x::cmp_lt);
+                        one_if(1);
+                        m_x.sse(x::sd, x::subsd, 0, 1);
+                        return true;
+                    case equationop::floor:
+                    case equationop::ceil:
+                    case equationop::truncate:
+                        if(!m_sse41) {
+                            return false;
+                        }
+                        load(0, i.a);
+                        m_x.round(0, 0, (i.op == equationop::floor) ? 0x9 : (i.op == equationop::ceil) ? 0xA : 0xB);
+                        return true;
+                    default:
+                        return false;
+                    }
+                }
+
+                /// <summary>
+                /// dst = equationmath::apply(op, a, b). Hot registers are caller-saved on System V, so they
+                /// go to the file around the call there.
+                /// </summary>
+                void call(const equationinstruction &i)
+                {
+#ifdef _WIN64
+                    load(1, i.a);
+                    load(2, i.b);
+                    m_x.byte(0xB9);                                     // mov ecx, op
+                    m_x.dword((uint32_t)i.op);
+#else
+                    spill();
+                    load(0, i.a);
+                    load(1, i.b);
+                    m_x.byte(0xBF);                                     // mov edi, op
+                    m_x.dword((uint32_t)i.op);
+#endif
+                    m_x.byte(0x48); m_x.byte(0xB8);                     // mov rax, callout
+                    m_x.qword((uint64_t)(uintptr_t)&callout);
+                    m_x.byte(0xFF); m_x.byte(0xD0);                     // call rax
+#ifndef _WIN64
+                    reload();
+#endif
+                    store(i.dst, 0);
+                }
+
+                const std::vector<equationinstruction> &m_code;
+                equationjitstatistics &m_statistics;
+                x64emitter m_x;
+                bool m_sse41 = false;
+                int m_abs = 0, m_sign = 0, m_one = 0, m_close = 0;
+                std::vector<int> m_home;            // xmm of each hot register, -1 for the others
+                std::vector<uint16_t> m_hot;
+                std::vector<bool> m_written;
+            };
+#endif
+
+            equationprogram m_program;
+            executablememory m_memory;
+            entry m_entry = nullptr;
+            equationjitstatistics m_statistics;
+        };
+
+    } /* End of namespace milk */
+
+} /* End of namespace dx */
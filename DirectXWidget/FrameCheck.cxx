@@ -0,0 +1,574 @@
+#include "DirectXWidget.hpp"
+#include "CountingContext.h"
+#include "InstanceBatcher.h"
+#include "StreamingTexture.h"
+#include <QApplication>
+#include <QDir>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <memory>
+#include <vector>
+
+// framecheck [--handles [frames]] [--binds [frames]] [--uploads [frames]] [--instances [frames]] [--frames [frames]] [--replay [frames]]
+// Checks of the frame machinery outside the application: steady-state frames must neither allocate nor touch reference
+// counts, and uploads, batches and captures must come out as drawn. Every check runs without arguments.
+// Replaces the global operator new to count allocations, which is why it isn't part of the application.
+
+// Heap allocations made by the program, for the checks that must not see any.
+static std::atomic<uint64_t> allocationCount(0);
+
+void *operator new(size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if(void *p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return operator new(size, std::nothrow);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    free(p);
+}
+
+// The objects of a frame on countingunknowns, owned like the widget owns them. Each adopts the reference
+// its mock starts with, so every mock is back to 0 references once the frame is gone.
+struct mockframe {
+    typedef std::vector<std::unique_ptr<dx::d3d11::countingunknown>> mockobjects;
+
+    mockframe(mockobjects &objects, dx::d3d11::refcountstatistics &counts)
+        : m_objects(objects), m_counts(counts)
+    {
+        using namespace dx::d3d11;
+        for(auto& r : rtvs) {
+            r = rendertargetview(make<ID3D11RenderTargetView>(), dx::adopt);
+        }
+        dsv = depthstencilview(make<ID3D11DepthStencilView>(), dx::adopt);
+        layout = inputlayout(make<ID3D11InputLayout>(), dx::adopt);
+        vs = vertexshader(make<ID3D11VertexShader>(), dx::adopt);
+        hs = hullshader(make<ID3D11HullShader>(), dx::adopt);
+        ds = domainshader(make<ID3D11DomainShader>(), dx::adopt);
+        gs = geometryshader(make<ID3D11GeometryShader>(), dx::adopt);
+        ps = pixelshader(make<ID3D11PixelShader>(), dx::adopt);
+        cs = computeshader(make<ID3D11ComputeShader>(), dx::adopt);
+        blend = blendstate(make<ID3D11BlendState>(), dx::adopt);
+        raster = rasterizerstate(make<ID3D11RasterizerState>(), dx::adopt);
+        depth = depthstencilstate(make<ID3D11DepthStencilState>(), dx::adopt);
+        indices = buffer(make<ID3D11Buffer>(), dx::adopt);
+        for(auto& b : vertices) {
+            b = buffer(make<ID3D11Buffer>(), dx::adopt);
+        }
+        for(auto& b : constants) {
+            b = buffer(make<ID3D11Buffer>(), dx::adopt);
+        }
+        for(auto& t : textures) {
+            t = shaderresourceview(make<ID3D11ShaderResourceView>(), dx::adopt);
+        }
+        for(auto& s : samplers) {
+            s = samplerstate(make<ID3D11SamplerState>(), dx::adopt);
+        }
+    }
+
+    template<class I>
+    I *make()
+    {
+        m_objects.emplace_back(new dx::d3d11::countingunknown(m_counts));
+        return m_objects.back()->as<I>();
+    }
+
+    /// <summary>
+    /// Whether every reference the wrappers took was given back, call it after the frame is gone.
+    /// </summary>
+    static bool released(const mockobjects &objects)
+    {
+        for(auto& o : objects) {
+            if(o->references() != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    mockobjects &m_objects;
+    dx::d3d11::refcountstatistics &m_counts;
+
+    std::array<dx::d3d11::rendertargetview, 2> rtvs;
+    dx::d3d11::depthstencilview dsv;
+    dx::d3d11::inputlayout layout;
+    dx::d3d11::vertexshader vs;
+    dx::d3d11::hullshader hs;
+    dx::d3d11::domainshader ds;
+    dx::d3d11::geometryshader gs;
+    dx::d3d11::pixelshader ps;
+    dx::d3d11::computeshader cs;
+    dx::d3d11::blendstate blend;
+    dx::d3d11::rasterizerstate raster;
+    dx::d3d11::depthstencilstate depth;
+    dx::d3d11::buffer indices;
+    std::array<dx::d3d11::buffer, 2> vertices;
+    std::array<dx::d3d11::buffer, 4> constants;
+    std::array<dx::d3d11::shaderresourceview, 8> textures;
+    std::array<dx::d3d11::samplerstate, 4> samplers;
+};
+
+// framecheck --handles [frames]
+// Binds a typical frame's state through devicecontext on a mock context that only counts references,
+// with and without the state filter, and fails if any AddRef or Release happens after the first frame.
+static int checkHandles(unsigned int frames)
+{
+    using namespace dx::d3d11;
+    typedef std::chrono::steady_clock clock;
+
+    refcountstatistics counts;
+    countingcontext mock(counts);
+    mockframe::mockobjects objects;
+
+    int failures = 0;
+    {
+        mockframe f(objects, counts);
+        const unsigned int strides[] = { 16, 8 }, offsets[] = { 0, 0 };
+        const float black[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+        auto frame = [&](devicecontext &context) {
+            // frame code keeps borrowed handles in arrays of its own
+            dx::borrowed<shaderresourceview> bound[] = { f.textures[2], f.textures[0], f.textures[3], f.textures[1] };
+            context.set_rendertarget(f.rtvs[0], f.dsv);
+            context.set_viewport(1280.0f, 720.0f);
+            context.clear_rendertargetview(f.rtvs[0], black);
+            context.clear_depthstencilview(f.dsv, 1.0f, 0);
+            context.set_inputlayout(f.layout);
+            context.set_vertexbuffers(0, f.vertices, strides, offsets);
+            context.set_indexbuffer(f.indices);
+            context.set_primitivetopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+            context.set_shader(f.vs);
+            context.set_shader(f.ps);
+            context.set_constantbuffers<vertexshader>(0, f.constants);
+            context.set_constantbuffer<pixelshader>(0, f.constants[1]);
+            context.set_shaderresources<pixelshader>(0, dx::handle_span<shaderresourceview>(bound, 4));
+            context.set_samplers<pixelshader>(0, f.samplers);
+            context.set_blendstate(f.blend);
+            context.set_rasterizerstate(f.raster);
+            context.set_depthstencilstate(f.depth);
+            context.draw_indexed(36, 0);
+        };
+
+        for(bool filter : { false, true }) {
+            devicecontext context(&mock);
+            context.enable_state_filter(filter);
+            frame(context);
+            counts.reset();
+            clock::time_point start = clock::now();
+            for(unsigned int f = 0; f < frames; ++f) {
+                frame(context);
+            }
+            double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count() / frames;
+            printf("%s: %.1f ns/frame, %llu AddRef, %llu Release in %u frames%s\n", filter ? "state filter" : "no state filter", ns,
+                   (unsigned long long)counts.addrefs, (unsigned long long)counts.releases, frames, counts.total() ? ", REFERENCES TOUCHED" : "");
+            failures += counts.total() ? 1 : 0;
+        }
+    }
+
+    if(!mockframe::released(objects) || mock.references() != 1) {
+        printf("references were left behind\n");
+        failures++;
+    }
+    return failures ? 1 : 0;
+}
+
+template<class S>
+static void bindStage(dx::d3d11::devicecontext &context, const mockframe &f)
+{
+    context.set_shaderresources<S>(0, f.textures);
+    context.set_samplers<S>(0, f.samplers);
+    context.set_constantbuffers<S>(0, f.constants);
+}
+
+// framecheck --binds [frames]
+// Binds several render targets, viewports, vertex buffers and the resources, samplers and constant
+// buffers of every shader stage through the multi-bind overloads of devicecontext on a mock context, and
+// fails if any heap allocation or reference count happens after the first frame.
+static int checkBinds(unsigned int frames)
+{
+    using namespace dx::d3d11;
+    typedef std::chrono::steady_clock clock;
+
+    refcountstatistics counts;
+    countingcontext mock(counts);
+    mockframe::mockobjects objects;
+
+    int failures = 0;
+    {
+        mockframe f(objects, counts);
+        const unsigned int strides[] = { 16, 8 }, offsets[] = { 0, 0 };
+        const D3D11_VIEWPORT viewports[] = { CD3D11_VIEWPORT(0.0f, 0.0f, 1280.0f, 720.0f), CD3D11_VIEWPORT(0.0f, 0.0f, 640.0f, 360.0f) };
+
+        auto frame = [&](devicecontext &context) {
+            dx::borrowed<rendertargetview> targets[] = { f.rtvs[1], f.rtvs[0] };
+            context.set_rendertargets(targets, f.dsv);
+            context.set_viewports(viewports);
+            context.set_inputlayout(f.layout);
+            context.set_vertexbuffers(0, f.vertices, strides, offsets);
+            context.set_indexbuffer(f.indices);
+            context.set_primitivetopology(D3D11_PRIMITIVE_TOPOLOGY_3_CONTROL_POINT_PATCHLIST);
+            context.set_shader(f.vs);
+            context.set_shader(f.hs);
+            context.set_shader(f.ds);
+            context.set_shader(f.gs);
+            context.set_shader(f.ps);
+            context.set_shader(f.cs);
+            bindStage<vertexshader>(context, f);
+            bindStage<hullshader>(context, f);
+            bindStage<domainshader>(context, f);
+            bindStage<geometryshader>(context, f);
+            bindStage<pixelshader>(context, f);
+            bindStage<computeshader>(context, f);
+            context.set_blendstate(f.blend);
+            context.set_rasterizerstate(f.raster);
+            context.set_depthstencilstate(f.depth);
+            context.draw_indexed(36, 0);
+        };
+
+        for(bool filter : { false, true }) {
+            devicecontext context(&mock);
+            context.enable_state_filter(filter);
+            frame(context);
+            counts.reset();
+            uint64_t allocations = allocationCount;
+            clock::time_point start = clock::now();
+            for(unsigned int i = 0; i < frames; ++i) {
+                frame(context);
+            }
+            double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count() / frames;
+            allocations = allocationCount - allocations;
+            printf("%s: %.1f ns/frame, %llu allocations, %llu AddRef, %llu Release in %u frames%s\n", filter ? "state filter" : "no state filter", ns,
+                   (unsigned long long)allocations, (unsigned long long)counts.addrefs, (unsigned long long)counts.releases, frames,
+                   (allocations || counts.total()) ? ", NOT FREE" : "");
+            failures += (allocations || counts.total()) ? 1 : 0;
+        }
+    }
+
+    if(!mockframe::released(objects) || mock.references() != 1) {
+        printf("references were left behind\n");
+        failures++;
+    }
+    return failures ? 1 : 0;
+}
+
+// framecheck --uploads [frames]
+// Streams rectangles of a pattern into a texture on a WARP device, reads the texture back and fails if it differs
+// from the pattern or if an update after the first few makes a heap allocation.
+static int checkUploads(unsigned int frames)
+{
+    using namespace dx::d3d11;
+
+    const unsigned int size = 64;
+    device dev = device::create_warp_device();
+    devicecontext context = dev.immediate_context();
+    streamingtexture texture(dev, context, size, size);
+    texture2d readback = dev.create_texture2d(size, size, 1, 1, DXGI_FORMAT_R8G8B8A8_UNORM, 1, 0, D3D11_USAGE_STAGING, (D3D11_BIND_FLAG)0, D3D11_CPU_ACCESS_READ);
+
+    // what the texture should hold, the first update writes all of it
+    std::vector<uint32_t> expected(size * size, 0);
+    std::vector<uint32_t> rect(size * size);
+    texture.update(expected.data());
+
+    auto update = [&](unsigned int frame) {
+        unsigned int x = (frame * 7) % 48, y = (frame * 13) % 48, width = 1 + frame % 16, height = 1 + (frame / 3) % 16;
+        for(unsigned int r = 0; r < height; ++r) {
+            for(unsigned int c = 0; c < width; ++c) {
+                rect[r * width + c] = expected[(y + r) * size + x + c] = frame * 0x9E3779B1u + (r << 8) + c;
+            }
+        }
+        texture.update(rect.data(), x, y, width, height);
+    };
+
+    // one round through the staging textures
+    for(unsigned int i = 0; i < 3; ++i) {
+        update(i);
+    }
+    uint64_t allocations = allocationCount;
+    for(unsigned int i = 3; i < frames; ++i) {
+        update(i);
+    }
+    allocations = allocationCount - allocations;
+
+    context.copy_resource(readback, texture.texture());
+    D3D11_MAPPED_SUBRESOURCE mapped = context.map(readback, 0, D3D11_MAP_READ);
+    unsigned int differences = 0;
+    for(unsigned int r = 0; r < size; ++r) {
+        differences += memcmp((const uint8_t*)mapped.pData + r * mapped.RowPitch, &expected[r * size], size * sizeof(uint32_t)) ? 1 : 0;
+    }
+    context.unmap(readback, 0);
+
+    streamingstatistics stats = texture.statistics();
+    printf("streaming texture: %u updates, %u stalls, %llu allocations, %u rows differ%s\n", stats.updates, stats.stalls,
+           (unsigned long long)allocations, differences, (allocations || differences) ? ", FAILED" : "");
+    return (allocations || differences) ? 1 : 0;
+}
+
+// The per-instance vertex stream of checkInstances
+struct cellinstance {
+    float offset[2];
+    float color[4];
+};
+
+// framecheck --instances [frames]
+// Draws the two triangles of every cell of a 4x4 grid through an instancebatcher on a WARP device, each triangle submitted
+// as a draw of its own, and fails unless they come out as one instanced draw per triangle with every cell in its colors.
+static int checkInstances(unsigned int frames)
+{
+    using namespace dx::d3d11;
+
+    static const char source[] =
+        "void vs(float2 pos : POSITION, float2 offset : OFFSET, float4 color : COLOR, out float4 p : SV_Position, out float4 c : COLOR)\n"
+        "{\n"
+        "    p = float4(pos + offset, 0, 1);\n"
+        "    c = color;\n"
+        "}\n"
+        "float4 ps(float4 p : SV_Position, float4 c : COLOR) : SV_Target\n"
+        "{\n"
+        "    return c;\n"
+        "}\n";
+    static const D3D11_INPUT_ELEMENT_DESC layout[] = {
+        { "POSITION", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+        { "OFFSET", 0, DXGI_FORMAT_R32G32_FLOAT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+        { "COLOR", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 8, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    };
+    // the lower left and upper right halves of a cell, half of clip space wide
+    static const float triangles[] = { 0.0f, 0.0f, 0.0f, 0.5f, 0.5f, 0.0f, 0.0f, 0.5f, 0.5f, 0.5f, 0.5f, 0.0f };
+    const unsigned int size = 64, cells = 4;
+
+    device dev = device::create_warp_device();
+    devicecontext context = dev.immediate_context();
+    context.enable_state_filter();
+
+    dx::blob vs = dx::compile_shader(source, sizeof(source) - 1, nullptr, "vs", "vs_4_0");
+    dx::blob ps = dx::compile_shader(source, sizeof(source) - 1, nullptr, "ps", "ps_4_0");
+    pipelinedesc desc;
+    desc.vs = dev.create_shader<vertexshader>(vs.data(), vs.size());
+    desc.ps = dev.create_shader<pixelshader>(ps.data(), ps.size());
+    desc.layout = dev.create_inputlayout(layout, vs);
+    desc.rasterizer.CullMode = D3D11_CULL_NONE;
+    pipelinecache pipelines(dev);
+    pipeline_state pipeline = pipelines.create(desc);
+
+    buffer vertices = dev.create_buffer(triangles, sizeof(triangles));
+    drawcommand halves[2];
+    for(unsigned int t = 0; t < 2; ++t) {
+        halves[t].vertexbuffer = vertices.winapi();
+        halves[t].stride = 2 * sizeof(float);
+        halves[t].index_count = 3;
+        halves[t].start_index = 3 * t;
+    }
+
+    texture2d target = dev.create_texture2d(size, size, 1, 1, DXGI_FORMAT_R8G8B8A8_UNORM, 1, 0, D3D11_USAGE_DEFAULT, D3D11_BIND_RENDER_TARGET);
+    rendertargetview rtv = dev.create_view<rendertargetview>(target);
+    texture2d readback = dev.create_texture2d(size, size, 1, 1, DXGI_FORMAT_R8G8B8A8_UNORM, 1, 0, D3D11_USAGE_STAGING, (D3D11_BIND_FLAG)0, D3D11_CPU_ACCESS_READ);
+
+    // red tells the cells apart, green the halves, and the halves are submitted in turns so the batcher has to sort them
+    auto color = [](unsigned int cell, unsigned int half) {
+        return (uint32_t)(cell * 16) | ((half ? 255u : 0u) << 8) | (255u << 24);
+    };
+    uploadring ring(dev, context, 64 << 10);
+    instancebatcher<cellinstance> batcher(ring);
+    batchstatistics stats;
+    for(unsigned int f = 0; f < frames; ++f) {
+        const float black[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        context.set_rendertarget(rtv, dx::borrowed<depthstencilview>());
+        context.set_viewport((float)size, (float)size);
+        context.clear_rendertargetview(rtv, black);
+        for(unsigned int cell = 0; cell < cells * cells; ++cell) {
+            for(unsigned int half = 0; half < 2; ++half) {
+                uint32_t c = color(cell, half);
+                cellinstance i = { { -1.0f + 0.5f * (cell % cells), -1.0f + 0.5f * (cell / cells) },
+                                   { (c & 0xFF) / 255.0f, ((c >> 8) & 0xFF) / 255.0f, 0.0f, 1.0f } };
+                batcher.submit(pipeline, halves[half], i);
+            }
+        }
+        batcher.flush(context);
+        ring.next_frame();
+        stats = batcher.reset_statistics();
+    }
+
+    context.copy_resource(readback, target);
+    D3D11_MAPPED_SUBRESOURCE mapped = context.map(readback, 0, D3D11_MAP_READ);
+    unsigned int differences = 0;
+    for(unsigned int cell = 0; cell < cells * cells; ++cell) {
+        for(unsigned int half = 0; half < 2; ++half) {
+            // a pixel well inside the half, clip space y points up and rows down
+            unsigned int x = (cell % cells) * (size / cells) + (half ? 12 : 4);
+            unsigned int y = size - 1 - ((cell / cells) * (size / cells) + (half ? 12 : 4));
+            uint32_t pixel;
+            memcpy(&pixel, (const uint8_t*)mapped.pData + y * mapped.RowPitch + x * sizeof(pixel), sizeof(pixel));
+            differences += (pixel != color(cell, half)) ? 1 : 0;
+        }
+    }
+    context.unmap(readback, 0);
+
+    bool ok = stats.submitted == 2 * cells * cells && stats.issued == 2 && stats.instances == stats.submitted && differences == 0;
+    printf("instance batcher: %u draws in %u draw calls, %u instances, %u pixels differ%s\n", stats.submitted, stats.issued, stats.instances,
+           differences, ok ? "" : ", FAILED");
+    return ok ? 0 : 1;
+}
+
+// framecheck --frames [frames]
+// Draws frames of a DirectXWidget from this thread, at full size and with dynamic resolution, and fails if any
+// frame after the first few makes a heap allocation.
+static int checkFrames(QApplication &app, unsigned int frames)
+{
+    typedef std::chrono::steady_clock clock;
+
+    DirectXWidget widget;
+    widget.resize(640, 360);
+    widget.show();
+    app.processEvents();
+
+    int failures = 0;
+    for(bool dynamic : { false, true }) {
+        widget.setDynamicResolution(dynamic, 8.0);
+        // targets and the profiler's queries are made by the first frames, the upsampler's shaders are compiled in the background
+        clock::time_point timeout = clock::now() + std::chrono::seconds(10);
+        for(unsigned int i = 0; i < 60 || (dynamic && !widget.isDynamicResolutionActive() && clock::now() < timeout); ++i) {
+            widget.renderFrame();
+        }
+        if(dynamic && !widget.isDynamicResolutionActive()) {
+            printf("dynamic resolution: the upsampler never got ready\n");
+            failures++;
+            continue;
+        }
+        uint64_t allocations = allocationCount;
+        clock::time_point start = clock::now();
+        for(unsigned int i = 0; i < frames; ++i) {
+            widget.renderFrame();
+        }
+        double ms = std::chrono::duration<double, std::milli>(clock::now() - start).count() / frames;
+        allocations = allocationCount - allocations;
+        printf("%s: %.3f ms/frame, %llu allocations in %u frames%s\n", dynamic ? "dynamic resolution" : "full resolution", ms,
+               (unsigned long long)allocations, frames, allocations ? ", NOT FREE" : "");
+        failures += allocations ? 1 : 0;
+    }
+    return failures ? 1 : 0;
+}
+
+// framecheck --replay [frames]
+// Captures frames of a DirectXWidget, plays the saved capture back on it and fails unless every frame came back.
+static int checkReplay(QApplication &app, unsigned int frames)
+{
+    DirectXWidget widget;
+    widget.resize(640, 360);
+    widget.show();
+    app.processEvents();
+
+    std::string path = QDir::temp().filePath("framecheck.capture").toStdString();
+    widget.captureFrames(path, frames);
+    for(unsigned int i = 0; i < frames; ++i) {
+        widget.renderFrame();
+    }
+    dx::replaystatistics stats;
+    bool ok = widget.replayCapture(path, &stats) && stats.frames == frames;
+    remove(path.c_str());
+    printf("replay: %u of %u frames, %llu bytes%s\n", stats.frames, frames, (unsigned long long)stats.bytes, ok ? "" : ", FAILED");
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+    QApplication app(argc, argv);
+
+    bool handles = false, binds = false, uploads = false, instances = false, drawn = false, replayed = false;
+    unsigned int handleFrames = 100000, bindFrames = 100000, uploadFrames = 1000, instanceFrames = 100, drawnFrames = 1000, replayFrames = 3;
+    for(int i = 1; i < argc; ++i) {
+        unsigned int *count = nullptr;
+        if(strcmp(argv[i], "--handles") == 0) {
+            handles = true;
+            count = &handleFrames;
+        }
+        else if(strcmp(argv[i], "--binds") == 0) {
+            binds = true;
+            count = &bindFrames;
+        }
+        else if(strcmp(argv[i], "--uploads") == 0) {
+            uploads = true;
+            count = &uploadFrames;
+        }
+        else if(strcmp(argv[i], "--instances") == 0) {
+            instances = true;
+            count = &instanceFrames;
+        }
+        else if(strcmp(argv[i], "--frames") == 0) {
+            drawn = true;
+            count = &drawnFrames;
+        }
+        else if(strcmp(argv[i], "--replay") == 0) {
+            replayed = true;
+            count = &replayFrames;
+        }
+        else {
+            fprintf(stderr, "usage: %s [--handles [frames]] [--binds [frames]] [--uploads [frames]] [--instances [frames]] [--frames [frames]] [--replay [frames]]\n", argv[0]);
+            return 1;
+        }
+        if(i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            *count = (unsigned int)atoi(argv[++i]);
+        }
+    }
+    if(!handles && !binds && !uploads && !instances && !drawn && !replayed) {
+        handles = binds = uploads = instances = drawn = replayed = true;
+    }
+
+    int failures = 0;
+    if(handles) {
+        failures += checkHandles(handleFrames);
+    }
+    if(binds) {
+        failures += checkBinds(bindFrames);
+    }
+    if(uploads) {
+        failures += checkUploads(uploadFrames);
+    }
+    if(instances) {
+        failures += checkInstances(instanceFrames);
+    }
+    if(drawn) {
+        failures += checkFrames(app, drawnFrames);
+    }
+    if(replayed) {
+        failures += checkReplay(app, replayFrames);
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,363 @@
+#pragma once
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+#include "DirectXPlus.h"
+
+namespace dx {
+
+    namespace d3d11 {
+
+        struct profilescope {
+            const char *name;   // must outlive the profiler, use string literals
+            double begin_us;    // microseconds since the profiler was created
+            double end_us;
+            bool gpu;
+        };
+
+        struct profileframe {
+            static const unsigned int max_scopes = 32;
+
+            uint64_t frame;
+            unsigned int scope_count;
+            profilescope scopes[max_scopes];
+        };
+
+        /// <summary>
+        /// Collects CPU and GPU timings of the last N frames.
+        ///
+        /// Scopes are written by the render thread only, readers (snapshot, dump)
+        /// may run on any thread and never block the writer: each history slot
+        /// is guarded by a sequence number and torn reads are simply dropped.
+        ///
+        /// GPU timings are resolved a few frames late without stalling,
+        /// a frame is published once its queries are done or its query set is needed again.
+        /// </summary>
+        class frameprofiler {
+        public:
+            static const unsigned int gpu_latency = 4;
+
+            explicit frameprofiler(unsigned int history = 256)
+                : m_history(history), m_slots(new slot[history]), m_epoch(clock::now())
+            {
+                clear_record();
+            }
+
+            frameprofiler(device &dev, const devicecontext &context, unsigned int history = 256)
+                : frameprofiler(history)
+            {
+                m_context = context;
+                for(auto& p : m_pending) {
+                    p.disjoint = dev.create_query(D3D11_QUERY_TIMESTAMP_DISJOINT);
+                    p.frame_begin = dev.create_query(D3D11_QUERY_TIMESTAMP);
+                    for(auto& q : p.queries) {
+                        q.begin = dev.create_query(D3D11_QUERY_TIMESTAMP);
+                        q.end = dev.create_query(D3D11_QUERY_TIMESTAMP);
+                    }
+                }
+            }
+
+            frameprofiler(const frameprofiler &) = delete;
+            frameprofiler &operator= (const frameprofiler &) = delete;
+
+            void begin_frame()
+            {
+                m_frame_begin_us = now_us();
+                if(!m_context.is_valid()) {
+                    return;
+                }
+
+                pendingframe &p = m_pending[m_frame % (gpu_latency + 1)];
+                if(p.in_flight) {
+                    // not resolved in time, give up its GPU part rather than stalling
+                    publish(p.record);
+                    p.in_flight = false;
+                }
+                p.gpu_count = 0;
+                m_context.begin(p.disjoint);
+                m_context.end(p.frame_begin);
+                m_in_gpu_frame = true;
+            }
+
+            void end_frame()
+            {
+                if(m_record.scope_count < profileframe::max_scopes) {
+                    m_record.scopes[m_record.scope_count++] = profilescope{"frame", m_frame_begin_us, now_us(), false};
+                }
+                m_record.frame = m_frame;
+
+                if(m_in_gpu_frame) {
+                    pendingframe &p = m_pending[m_frame % (gpu_latency + 1)];
+                    m_context.end(p.disjoint);
+                    p.record = m_record;
+                    p.cpu_begin_us = m_frame_begin_us;
+                    p.in_flight = true;
+                    m_in_gpu_frame = false;
+                    resolve();
+                }
+                else {
+                    publish(m_record);
+                }
+
+                clear_record();
+                m_frame++;
+            }
+
+            unsigned int begin_cpu(const char *name)
+            {
+                if(m_record.scope_count >= profileframe::max_scopes) {
+                    return invalid_scope;
+                }
+                double t = now_us();
+                m_record.scopes[m_record.scope_count] = profilescope{name, t, t, false};
+                return m_record.scope_count++;
+            }
+
+            void end_cpu(unsigned int scope)
+            {
+                if(scope != invalid_scope) {
+                    m_record.scopes[scope].end_us = now_us();
+                }
+            }
+
+            /// <summary>
+            /// GPU scopes are only recorded between begin_frame and end_frame.
+            /// </summary>
+            unsigned int begin_gpu(const char *name)
+            {
+                if(!m_in_gpu_frame) {
+                    return invalid_scope;
+                }
+                pendingframe &p = m_pending[m_frame % (gpu_latency + 1)];
+                if(p.gpu_count >= profileframe::max_scopes) {
+                    return invalid_scope;
+                }
+                p.queries[p.gpu_count].name = name;
+                m_context.end(p.queries[p.gpu_count].begin);
+                return p.gpu_count++;
+            }
+
+            void end_gpu(unsigned int scope)
+            {
+                if(scope != invalid_scope && m_in_gpu_frame) {
+                    pendingframe &p = m_pending[m_frame % (gpu_latency + 1)];
+                    m_context.end(p.queries[scope].end);
+                }
+            }
+
+            class cpuscope {
+            public:
+                cpuscope(frameprofiler &profiler, const char *name)
+                    : m_profiler(profiler), m_scope(profiler.begin_cpu(name))
+                {}
+
+                ~cpuscope()
+                {
+                    m_profiler.end_cpu(m_scope);
+                }
+
+            private:
+                frameprofiler &m_profiler;
+                unsigned int m_scope;
+            };
+
+            class gpuscope {
+            public:
+                gpuscope(frameprofiler &profiler, const char *name)
+                    : m_profiler(profiler), m_scope(profiler.begin_gpu(name))
+                {}
+
+                ~gpuscope()
+                {
+                    m_profiler.end_gpu(m_scope);
+                }
+
+            private:
+                frameprofiler &m_profiler;
+                unsigned int m_scope;
+            };
+
+            /// <summary>
+            /// Copy up to max_frames of the most recent frames, oldest first. Safe from any thread.
+            /// </summary>
+            unsigned int snapshot(profileframe *frames, unsigned int max_frames) const
+            {
+                uint64_t published = m_published.load(std::memory_order_acquire);
+                uint64_t first = published > m_history ? published - m_history : 0;
+                if(published - first > max_frames) {
+                    first = published - max_frames;
+                }
+
+                unsigned int count = 0;
+                for(uint64_t n = first; n < published; ++n) {
+                    const slot &s = m_slots[n % m_history];
+                    uint64_t seq = s.seq.load(std::memory_order_acquire);
+                    if(seq != 2 * n + 2) {
+                        continue;
+                    }
+                    frames[count] = s.frame;
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if(s.seq.load(std::memory_order_relaxed) == seq) {
+                        count++;
+                    }
+                }
+                return count;
+            }
+
+            /// <summary>
+            /// Write the frame history as Chrome trace-event JSON (chrome://tracing, Perfetto).
+            /// CPU scopes go to thread 1, GPU scopes to thread 2.
+            /// </summary>
+            bool dump_chrome_trace(const char *path) const
+            {
+                std::unique_ptr<profileframe[]> frames(new profileframe[m_history]);
+                unsigned int count = snapshot(frames.get(), m_history);
+
+                FILE *fp = fopen(path, "w");
+                if(nullptr == fp) {
+                    return false;
+                }
+
+                fprintf(fp, "{\"traceEvents\":[\n");
+                fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n");
+                fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}");
+                for(unsigned int i = 0; i < count; ++i) {
+                    const profileframe &f = frames[i];
+                    for(unsigned int j = 0; j < f.scope_count; ++j) {
+                        const profilescope &s = f.scopes[j];
+                        fprintf(fp, ",\n{\"name\":\"");
+                        write_escaped(fp, s.name);
+                        fprintf(fp, "\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"frame\":%llu}}",
+                                s.gpu ? "gpu" : "cpu", s.begin_us, s.end_us - s.begin_us, s.gpu ? 2 : 1, (unsigned long long)f.frame);
+                    }
+                }
+                fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+                bool ok = (ferror(fp) == 0);
+                fclose(fp);
+                return ok;
+            }
+
+        private:
+            typedef std::chrono::steady_clock clock;
+
+            static const unsigned int invalid_scope = 0xFFFFFFFF;
+
+            struct slot {
+                std::atomic<uint64_t> seq;
+                profileframe frame;
+
+                slot() : seq(0) {}
+            };
+
+            struct gpuquery {
+                const char *name;
+                query begin;
+                query end;
+            };
+
+            struct pendingframe {
+                query disjoint;
+                query frame_begin;
+                gpuquery queries[profileframe::max_scopes];
+                unsigned int gpu_count = 0;
+                bool in_flight = false;
+                double cpu_begin_us = 0.0;
+                profileframe record;
+            };
+
+            double now_us() const
+            {
+                return std::chrono::duration<double, std::micro>(clock::now() - m_epoch).count();
+            }
+
+            void clear_record()
+            {
+                m_record.frame = m_frame;
+                m_record.scope_count = 0;
+            }
+
+            void publish(const profileframe &f)
+            {
+                uint64_t n = m_published.load(std::memory_order_relaxed);
+                slot &s = m_slots[n % m_history];
+                s.seq.store(2 * n + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                s.frame = f;
+                s.seq.store(2 * n + 2, std::memory_order_release);
+                m_published.store(n + 1, std::memory_order_release);
+            }
+
+            /// <summary>
+            /// Publish in-flight frames whose queries are done, oldest first.
+            /// </summary>
+            void resolve()
+            {
+                for(unsigned int age = gpu_latency + 1; age > 0; --age) {
+                    if(m_frame + 1 < age) {
+                        continue;
+                    }
+                    pendingframe &p = m_pending[(m_frame + 1 - age) % (gpu_latency + 1)];
+                    if(!p.in_flight) {
+                        continue;
+                    }
+
+                    D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+                    if(!m_context.get_data(p.disjoint, disjoint, D3D11_ASYNC_GETDATA_DONOTFLUSH)) {
+                        // later frames can't be done either
+                        break;
+                    }
+
+                    UINT64 base = 0;
+                    bool ok = !disjoint.Disjoint && m_context.get_data(p.frame_begin, base, D3D11_ASYNC_GETDATA_DONOTFLUSH);
+                    for(unsigned int i = 0; ok && i < p.gpu_count; ++i) {
+                        UINT64 t0 = 0, t1 = 0;
+                        ok = m_context.get_data(p.queries[i].begin, t0, D3D11_ASYNC_GETDATA_DONOTFLUSH)
+                          && m_context.get_data(p.queries[i].end, t1, D3D11_ASYNC_GETDATA_DONOTFLUSH);
+                        if(ok && p.record.scope_count < profileframe::max_scopes) {
+                            // GPU clock is aligned to the CPU time the frame began
+                            double scale = 1e6 / (double)disjoint.Frequency;
+                            p.record.scopes[p.record.scope_count++] = profilescope{
+                                p.queries[i].name,
+                                p.cpu_begin_us + (double)(t0 - base) * scale,
+                                p.cpu_begin_us + (double)(t1 - base) * scale,
+                                true
+                            };
+                        }
+                    }
+
+                    publish(p.record);
+                    p.in_flight = false;
+                }
+            }
+
+            const unsigned int m_history;
+            std::unique_ptr<slot[]> m_slots;
+            std::atomic<uint64_t> m_published{0};
+
+            clock::time_point m_epoch;
+            uint64_t m_frame = 0;
+            double m_frame_begin_us = 0.0;
+            profileframe m_record;
+
+            devicecontext m_context;
+            pendingframe m_pending[gpu_latency + 1];
+            bool m_in_gpu_frame = false;
+
+            static void write_escaped(FILE *fp, const char *s)
+            {
+                for(; *s; ++s) {
+                    if(*s == '"' || *s == '\\') {
+                        fputc('\\', fp);
+                    }
+                    fputc(*s, fp);
+                }
+            }
+        };
+
+    } /* End of namespace d3d11 */
+
+} /* End of namespace dx */
@@ -0,0 +1,370 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace dx {
+
+    enum class frameformat {
+        raw,    // RGBA8 as is, frame after frame
+        ppm,    // binary RGB netpbm
+        y4m     // YUV 4:4:4, BT.601 limited range
+    };
+
+    struct framewriterstatistics {
+        uint64_t frames = 0;
+        uint64_t bytes = 0;
+        uint64_t waits = 0;         // push() blocked because the writer thread was behind
+        double seconds = 0.0;       // from the first push() to the last frame written
+
+        double fps() const
+        {
+            return (seconds > 0.0) ? (double)frames / seconds : 0.0;
+        }
+    };
+
+    /// <summary>
+    /// Writes 8-bit RGBA frames to a file, a numbered sequence or stdout on a thread of its own.
+    ///
+    /// path "-" is stdout. A path with an integer conversion ("frames/%05d.ppm") starts a file per frame,
+    /// otherwise every frame goes to the one file, Y4M is always a single stream. The conversion is
+    /// %d, %i or %u with an optional 0 flag and width, %% is a percent sign. Paths with any other
+    /// conversion or more than one are refused, push() and finish() then return false.
+    /// push() copies the pixels and only blocks while queue_depth frames are waiting to be written.
+    /// Write errors stop the writer, push() and finish() then return false. error() tells why.
+    /// </summary>
+    class framewriter {
+    public:
+        framewriter(const std::string &path, frameformat format, unsigned int width, unsigned int height, unsigned int fps = 60, unsigned int queue_depth = 4)
+            : m_path(path), m_format(format), m_width(width), m_height(height), m_fps(fps), m_queue_depth(queue_depth)
+        {
+            if(format != frameformat::y4m && path.find('%') != std::string::npos) {
+                m_failed = !split_sequence(path);
+                if(m_failed) {
+                    m_error = path + ": frame numbers need exactly one %d, %i or %u, write %% for a percent sign";
+                }
+            }
+            m_thread = std::thread([this] { run(); });
+        }
+
+        ~framewriter()
+        {
+            finish();
+        }
+
+        framewriter(const framewriter &) = delete;
+        framewriter &operator= (const framewriter &) = delete;
+
+        /// <summary>
+        /// Queue a frame, rows are row_pitch bytes apart. bgra swaps red and blue on the way out.
+        /// </summary>
+        bool push(const uint8_t *pixels, unsigned int row_pitch, bool bgra = false)
+        {
+            std::vector<uint8_t> frame;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if(m_failed || m_finished) {
+                    return false;
+                }
+                if(!m_started) {
+                    m_start = clock::now();
+                    m_started = true;
+                }
+                if(m_queue.size() >= m_queue_depth) {
+                    m_statistics.waits++;
+                    m_space.wait(lock, [this] { return m_queue.size() < m_queue_depth || m_failed; });
+                    if(m_failed) {
+                        return false;
+                    }
+                }
+                if(!m_free.empty()) {
+                    frame = std::move(m_free.back());
+                    m_free.pop_back();
+                }
+            }
+
+            // convert outside the lock, the writer keeps going meanwhile
+            convert(frame, pixels, row_pitch, bgra);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queue.push_back(std::move(frame));
+            m_ready.notify_one();
+            return true;
+        }
+
+        /// <summary>
+        /// Write what is queued, close the output and stop the thread. Returns false if anything failed.
+        /// </summary>
+        bool finish()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_finished = true;
+                m_ready.notify_one();
+            }
+            if(m_thread.joinable()) {
+                m_thread.join();
+            }
+            return !m_failed;
+        }
+
+        framewriterstatistics statistics() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_statistics;
+        }
+
+        /// <summary>
+        /// Why the writer failed, empty while it hasn't.
+        /// </summary>
+        std::string error() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_error;
+        }
+
+    private:
+        typedef std::chrono::steady_clock clock;
+
+        unsigned int frame_bytes() const
+        {
+            return m_width * m_height * ((m_format == frameformat::raw) ? 4 : 3);
+        }
+
+        void convert(std::vector<uint8_t> &frame, const uint8_t *pixels, unsigned int row_pitch, bool bgra) const
+        {
+            frame.resize(frame_bytes());
+            const unsigned int r = bgra ? 2 : 0;
+            const unsigned int b = bgra ? 0 : 2;
+            const size_t plane = (size_t)m_width * m_height;
+            uint8_t *dst = frame.data();
+
+            for(unsigned int y = 0; y < m_height; ++y) {
+                const uint8_t *src = pixels + (size_t)y * row_pitch;
+                switch(m_format) {
+                case frameformat::raw:
+                    if(!bgra) {
+                        memcpy(dst, src, m_width * 4);
+                        dst += m_width * 4;
+                        break;
+                    }
+                    for(unsigned int x = 0; x < m_width; ++x, src += 4) {
+                        *dst++ = src[r];
+                        *dst++ = src[1];
+                        *dst++ = src[b];
+                        *dst++ = src[3];
+                    }
+                    break;
+                case frameformat::ppm:
+                    for(unsigned int x = 0; x < m_width; ++x, src += 4) {
+                        *dst++ = src[r];
+                        *dst++ = src[1];
+                        *dst++ = src[b];
+                    }
+                    break;
+                case frameformat::y4m:
+                    // planar, Y then Cb then Cr
+                    for(unsigned int x = 0; x < m_width; ++x, src += 4) {
+                        int R = src[r], G = src[1], B = src[b];
+                        size_t i = (size_t)y * m_width + x;
+                        frame[i] = (uint8_t)(((66 * R + 129 * G + 25 * B + 128) >> 8) + 16);
+                        frame[plane + i] = (uint8_t)(((-38 * R - 74 * G + 112 * B + 128) >> 8) + 128);
+                        frame[2 * plane + i] = (uint8_t)(((112 * R - 94 * G - 18 * B + 128) >> 8) + 128);
+                    }
+                    break;
+                }
+            }
+        }
+
+        void run()
+        {
+            for(;;) {
+                std::vector<uint8_t> frame;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_ready.wait(lock, [this] { return !m_queue.empty() || m_finished; });
+                    if(m_queue.empty()) {
+                        break;
+                    }
+                    frame = std::move(m_queue.front());
+                    m_queue.pop_front();
+                }
+
+                bool ok = write(frame);
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if(!ok) {
+                    m_failed = true;
+                    m_error = (nullptr == m_fp ? "can't open " : "can't write ") + m_file;
+                    m_queue.clear();
+                }
+                else {
+                    m_statistics.frames++;
+                    m_statistics.bytes += frame.size();
+                    m_statistics.seconds = std::chrono::duration<double>(clock::now() - m_start).count();
+                }
+                m_free.push_back(std::move(frame));
+                m_space.notify_one();
+                if(m_failed) {
+                    break;
+                }
+            }
+            close();
+        }
+
+        bool write(const std::vector<uint8_t> &frame)
+        {
+            if(m_sequence || nullptr == m_fp) {
+                close();
+                if(!open()) {
+                    return false;
+                }
+            }
+
+            char header[64];
+            int length = 0;
+            switch(m_format) {
+            case frameformat::raw:
+                break;
+            case frameformat::ppm:
+                length = snprintf(header, sizeof(header), "P6\n%u %u\n255\n", m_width, m_height);
+                break;
+            case frameformat::y4m:
+                length = snprintf(header, sizeof(header), "FRAME\n");
+                break;
+            }
+            if(length > 0 && fwrite(header, length, 1, m_fp) != 1) {
+                return false;
+            }
+            return fwrite(frame.data(), frame.size(), 1, m_fp) == 1;
+        }
+
+        bool open()
+        {
+            if(m_path == "-") {
+#ifdef _WIN32
+                _setmode(_fileno(stdout), _O_BINARY);
+#endif
+                m_file = "standard output";
+                m_fp = stdout;
+            }
+            else {
+                std::string path = m_path;
+                if(m_sequence) {
+                    std::string number = std::to_string(m_statistics.frames);
+                    if(number.size() < m_name_digits) {
+                        number.insert(0, m_name_digits - number.size(), m_name_fill);
+                    }
+                    path = m_name_prefix + number + m_name_suffix;
+                }
+                m_file = path;
+                m_fp = fopen(path.c_str(), "wb");
+                if(nullptr == m_fp) {
+                    return false;
+                }
+            }
+
+            if(m_format == frameformat::y4m) {
+                return fprintf(m_fp, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C444\n", m_width, m_height, m_fps) > 0;
+            }
+            return true;
+        }
+
+        /// <summary>
+        /// Split a sequence path around its integer conversion, a path with %% only names one file.
+        /// Returns false if the path has another conversion or more than one.
+        /// </summary>
+        bool split_sequence(const std::string &path)
+        {
+            std::string *part = &m_name_prefix;
+            for(size_t i = 0; i < path.size(); ++i) {
+                if(path[i] != '%') {
+                    part->push_back(path[i]);
+                    continue;
+                }
+                if(++i < path.size() && path[i] == '%') {
+                    part->push_back('%');
+                    continue;
+                }
+                if(m_sequence) {
+                    return false;
+                }
+                if(i < path.size() && path[i] == '0') {
+                    m_name_fill = '0';
+                    ++i;
+                }
+                for(; i < path.size() && path[i] >= '0' && path[i] <= '9'; ++i) {
+                    m_name_digits = m_name_digits * 10 + (path[i] - '0');
+                    if(m_name_digits > 32) {
+                        return false;
+                    }
+                }
+                if(i >= path.size() || (path[i] != 'd' && path[i] != 'i' && path[i] != 'u')) {
+                    return false;
+                }
+                m_sequence = true;
+                part = &m_name_suffix;
+            }
+            if(!m_sequence) {
+                m_path = m_name_prefix;
+            }
+            return true;
+        }
+
+        void close()
+        {
+            if(nullptr != m_fp) {
+                if(m_fp == stdout) {
+                    fflush(m_fp);
+                }
+                else {
+                    fclose(m_fp);
+                }
+                m_fp = nullptr;
+            }
+        }
+
+        std::string m_path;
+        frameformat m_format;
+        unsigned int m_width;
+        unsigned int m_height;
+        unsigned int m_fps;
+        unsigned int m_queue_depth;
+        bool m_sequence = false;
+        std::string m_name_prefix;  // of a sequence, around the frame number
+        std::string m_name_suffix;
+        unsigned int m_name_digits = 0;
+        char m_name_fill = ' ';
+        FILE *m_fp = nullptr;       // writer thread only
+        std::string m_file;         // the name m_fp was opened with, writer thread only
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_ready;
+        std::condition_variable m_space;
+        std::deque<std::vector<uint8_t>> m_queue;
+        std::vector<std::vector<uint8_t>> m_free;
+        bool m_finished = false;
+        bool m_failed = false;
+        std::string m_error;
+        bool m_started = false;
+        clock::time_point m_start;
+        framewriterstatistics m_statistics;
+
+        // last, so everything it uses exists when it starts
+        std::thread m_thread;
+    };
+
+} /* End of namespace dx */
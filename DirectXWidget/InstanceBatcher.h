@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "DirectXPlus.h"
+#include "PipelineState.h"
+#include "UploadRing.h"
+
+namespace dx {
+
+    namespace d3d11 {
+
+        struct batchstatistics {
+            unsigned int submitted = 0;     // draws before batching
+            unsigned int issued = 0;        // draw calls after batching
+            unsigned int instances = 0;
+        };
+
+        /// <summary>
+        /// Merges draws of the same geometry with the same pipeline into one instanced draw.
+        ///
+        /// Each submitted draw carries one Instance (transform, color, ...). At flush the instances
+        /// of every run of compatible draws are written contiguously into the upload ring and bound
+        /// as a second vertex stream in instance_slot, the pipeline's input layout reads them with
+        /// D3D11_INPUT_PER_INSTANCE_DATA. A drawcommand without index buffer draws index_count vertices
+        /// from start_index.
+        ///
+        /// Draws are sorted by pipeline and geometry, submission order is only kept within a batch.
+        /// </summary>
+        template<class Instance>
+        class instancebatcher {
+        public:
+            explicit instancebatcher(uploadring &ring, unsigned int instance_slot = 1)
+                : m_ring(ring), m_slot(instance_slot)
+            {}
+
+            instancebatcher(const instancebatcher &) = delete;
+            instancebatcher &operator= (const instancebatcher &) = delete;
+
+            void submit(const pipeline_state &pipeline, const drawcommand &geometry, const Instance &instance)
+            {
+                item i;
+                i.pipeline = pipeline;
+                i.geometry = geometry;
+                i.instance = (unsigned int)m_instances.size();
+                m_items.push_back(i);
+                m_instances.push_back(instance);
+                m_statistics.submitted++;
+            }
+
+            void flush(devicecontext &context)
+            {
+                std::stable_sort(m_items.begin(), m_items.end(), [](const item &a, const item &b) {
+                    if(a.pipeline.id() != b.pipeline.id()) {
+                        return a.pipeline.id() < b.pipeline.id();
+                    }
+                    return geometry_less(a.geometry, b.geometry);
+                });
+
+                const pipeline_state *current = nullptr;
+                for(size_t first = 0; first < m_items.size();) {
+                    size_t last = first + 1;
+                    while(last < m_items.size() && m_items[last].pipeline == m_items[first].pipeline && same_geometry(m_items[last].geometry, m_items[first].geometry)) {
+                        ++last;
+                    }
+
+                    const item &head = m_items[first];
+                    if(nullptr == current || *current != head.pipeline) {
+                        head.pipeline.apply(context);
+                        current = &head.pipeline;
+                    }
+
+                    unsigned int count = (unsigned int)(last - first);
+                    uploadallocation<Instance> instances = m_ring.write<Instance>(count, [&](Instance *dst) {
+                        for(size_t i = first; i < last; ++i) {
+                            *dst++ = m_instances[m_items[i].instance];
+                        }
+                    });
+
+                    const drawcommand &g = head.geometry;
+                    ID3D11Buffer *buffers[] = { g.vertexbuffer, instances.buf.winapi() };
+                    unsigned int strides[] = { g.stride, (unsigned int)sizeof(Instance) };
+                    unsigned int offsets[] = { g.offset, instances.offset };
+                    if(m_slot == 1) {
+                        context.set_vertexbuffers(0, buffers, strides, offsets, 2);
+                    }
+                    else {
+                        context.set_vertexbuffers(0, buffers, strides, offsets, 1);
+                        context.set_vertexbuffers(m_slot, buffers + 1, strides + 1, offsets + 1, 1);
+                    }
+                    if(nullptr != g.bind) {
+                        g.bind(context, g.userdata);
+                    }
+                    if(nullptr != g.indexbuffer) {
+                        context.set_indexbuffer(g.indexbuffer, g.index_format);
+                        context.draw_indexed_instanced(g.index_count, count, g.start_index, g.base_vertex);
+                    }
+                    else {
+                        context.draw_instanced(g.index_count, count, g.start_index);
+                    }
+
+                    m_statistics.issued++;
+                    m_statistics.instances += count;
+                    first = last;
+                }
+
+                m_items.clear();
+                m_instances.clear();
+            }
+
+            /// <summary>
+            /// Return the counts gathered since the last call and start over.
+            /// </summary>
+            batchstatistics reset_statistics()
+            {
+                batchstatistics result = m_statistics;
+                m_statistics = batchstatistics();
+                return result;
+            }
+
+        private:
+            struct item {
+                pipeline_state pipeline;
+                drawcommand geometry;
+                unsigned int instance;
+            };
+
+            static bool same_geometry(const drawcommand &a, const drawcommand &b)
+            {
+                return a.vertexbuffer == b.vertexbuffer && a.stride == b.stride && a.offset == b.offset
+                    && a.indexbuffer == b.indexbuffer && a.index_format == b.index_format
+                    && a.index_count == b.index_count && a.start_index == b.start_index && a.base_vertex == b.base_vertex
+                    && a.bind == b.bind && a.userdata == b.userdata;
+            }
+
+            static bool geometry_less(const drawcommand &a, const drawcommand &b)
+            {
+                if(a.vertexbuffer != b.vertexbuffer) {
+                    return a.vertexbuffer < b.vertexbuffer;
+                }
+                if(a.indexbuffer != b.indexbuffer) {
+                    return a.indexbuffer < b.indexbuffer;
+                }
+                if(a.start_index != b.start_index) {
+                    return a.start_index < b.start_index;
+                }
+                if(a.index_count != b.index_count) {
+                    return a.index_count < b.index_count;
+                }
+                if(a.base_vertex != b.base_vertex) {
+                    return a.base_vertex < b.base_vertex;
+                }
+                if(a.userdata != b.userdata) {
+                    return a.userdata < b.userdata;
+                }
+                if(a.stride != b.stride) {
+                    return a.stride < b.stride;
+                }
+                if(a.offset != b.offset) {
+                    return a.offset < b.offset;
+                }
+                if(a.index_format != b.index_format) {
+                    return a.index_format < b.index_format;
+                }
+                return std::less<void (*)(devicecontext&, const void*)>()(a.bind, b.bind);
+            }
+
+            uploadring &m_ring;
+            unsigned int m_slot;
+            std::vector<item> m_items;
+            std::vector<Instance> m_instances;
+            batchstatistics m_statistics;
+        };
+
+    } /* End of namespace d3d11 */
+
+} /* End of namespace dx */
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace dx {
+
+    /// <summary>
+    /// Read-only memory mapping of a whole file. Empty files map to a null pointer with size 0.
+    /// </summary>
+    class mappedfile {
+    public:
+        mappedfile() {}
+
+        explicit mappedfile(const std::string &path)
+        {
+            open(path);
+        }
+
+        mappedfile(const mappedfile &) = delete;
+        mappedfile &operator= (const mappedfile &) = delete;
+
+        mappedfile(mappedfile &&m)
+        {
+            *this = std::move(m);
+        }
+
+        mappedfile &operator= (mappedfile &&m)
+        {
+            if(this != &m) {
+                close();
+                m_data = m.m_data;
+                m_size = m.m_size;
+                m_open = m.m_open;
+                m.m_data = nullptr;
+                m.m_size = 0;
+                m.m_open = false;
+            }
+            return *this;
+        }
+
+        ~mappedfile()
+        {
+            close();
+        }
+
+        bool open(const std::string &path)
+        {
+            close();
+#ifdef _WIN32
+            HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if(file == INVALID_HANDLE_VALUE) {
+                return false;
+            }
+            LARGE_INTEGER size;
+            if(!GetFileSizeEx(file, &size)) {
+                CloseHandle(file);
+                return false;
+            }
+            if(size.QuadPart > 0) {
+                HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                if(nullptr != mapping) {
+                    m_data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                    // the view keeps the mapping alive
+                    CloseHandle(mapping);
+                }
+                if(nullptr == m_data) {
+                    CloseHandle(file);
+                    return false;
+                }
+            }
+            CloseHandle(file);
+            m_size = (size_t)size.QuadPart;
+#else
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if(fd < 0) {
+                return false;
+            }
+            struct stat st;
+            if(fstat(fd, &st) != 0) {
+                ::close(fd);
+                return false;
+            }
+            if(st.st_size > 0) {
+                void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(p == MAP_FAILED) {
+                    ::close(fd);
+                    return false;
+                }
+                m_data = p;
+            }
+            ::close(fd);
+            m_size = (size_t)st.st_size;
+#endif
+            m_open = true;
+            return true;
+        }
+
+        void close()
+        {
+            if(nullptr != m_data) {
+#ifdef _WIN32
+                UnmapViewOfFile(m_data);
+#else
+                munmap(m_data, m_size);
+#endif
+            }
+            m_data = nullptr;
+            m_size = 0;
+            m_open = false;
+        }
+
+        bool is_open() const
+        {
+            return m_open;
+        }
+
+        const char *data() const
+        {
+            return (const char*)m_data;
+        }
+
+        size_t size() const
+        {
+            return m_size;
+        }
+
+    private:
+        void *m_data = nullptr;
+        size_t m_size = 0;
+        bool m_open = false;
+    };
+
+} /* End of namespace dx */
@@ -0,0 +1,732 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include "EquationJit.h"
+#include "MilkEquation.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define DX_MESH_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+namespace dx {
+
+    namespace milk {
+
+        /// <summary>
+        /// Instruction sets meshevaluator runs per-vertex code with.
+        /// </summary>
+        enum class simdlevel {
+            automatic,      // the best the CPU has
+            scalar,         // vertex by vertex in double, like MilkDrop
+            sse2,           // 4 vertices at a time
+            avx2,           // 8, with FMA
+            avx512          // 16, AVX-512F
+        };
+
+        /// <summary>
+        /// Vertex of the warp mesh: clip space position and the texture coordinate the previous frame is
+        /// sampled at. Bind with set_vertexbuffer(buffer, sizeof(warpvertex)), positions as
+        /// DXGI_FORMAT_R32G32_FLOAT at offset 0 and texture coordinates at offset 8.
+        /// </summary>
+        struct warpvertex {
+            float x, y;
+            float u, v;
+        };
+
+        /// <summary>
+        /// What the warp needs besides the per-vertex outputs.
+        /// </summary>
+        struct warpparameters {
+            double time = 0.0;
+            double warp_anim_speed = 1.0;
+            double warp_scale = 1.0;
+        };
+
+        /// <summary>
+        /// Per-frame constants of the warp formula.
+        /// </summary>
+        struct warpframe {
+            float aspectx, aspecty;
+            float inverse_aspectx, inverse_aspecty;
+            float warp_time;
+            float warp_scale_inv;
+            float f[4];
+        };
+
+        /// <summary>
+        /// A block of vertices for the vector kernels. Registers the program uses are remapped to
+        /// columns of block_lanes floats, column c at columns + c * block_lanes.
+        /// </summary>
+        struct lanejob {
+            static const unsigned int block_lanes = 64;
+
+            const equationinstruction *code;
+            size_t count;
+            float *columns;
+            uint64_t *pending;          // lanes waiting at each instruction, count + 1 entries
+            float *scratch;             // block_lanes floats
+            uint64_t active;            // lanes holding vertices
+            const float *outputs[10];   // zoom, zoomexp, rot, warp, cx, cy, dx, dy, sx, sy
+            const float *px, *py, *rad;
+            const warpframe *frame;
+        };
+
+#ifdef DX_MESH_X86
+
+        // Each instruction set gets its own namespace compiled for it, so one binary runs everywhere and
+        // the caller picks by CPU. MSVC emits any intrinsic anywhere, GCC and clang need target regions.
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("sse2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+
+        namespace lanes_sse2 {
+
+            struct vec {
+                static const unsigned int width = 4;
+                __m128 v;
+
+                vec() {}
+                vec(__m128 x) : v(x) {}
+                explicit vec(float x) : v(_mm_set1_ps(x)) {}
+
+                static vec load(const float *p) { return _mm_loadu_ps(p); }
+                void store(float *p) const { _mm_storeu_ps(p, v); }
+                static vec ones() { return _mm_castsi128_ps(_mm_set1_epi32(-1)); }
+
+                vec operator+ (vec b) const { return _mm_add_ps(v, b.v); }
+                vec operator- (vec b) const { return _mm_sub_ps(v, b.v); }
+                vec operator* (vec b) const { return _mm_mul_ps(v, b.v); }
+                vec operator/ (vec b) const { return _mm_div_ps(v, b.v); }
+                vec operator& (vec b) const { return _mm_and_ps(v, b.v); }
+                vec operator| (vec b) const { return _mm_or_ps(v, b.v); }
+                vec operator^ (vec b) const { return _mm_xor_ps(v, b.v); }
+                vec operator< (vec b) const { return _mm_cmplt_ps(v, b.v); }
+                vec operator<= (vec b) const { return _mm_cmple_ps(v, b.v); }
+                vec operator> (vec b) const { return _mm_cmpgt_ps(v, b.v); }
+                vec operator>= (vec b) const { return _mm_cmpge_ps(v, b.v); }
+                vec operator== (vec b) const { return _mm_cmpeq_ps(v, b.v); }
+                vec operator!= (vec b) const { return _mm_cmpneq_ps(v, b.v); }
+
+                // ~a & b
+                static vec andnot(vec a, vec b) { return _mm_andnot_ps(a.v, b.v); }
+                static vec select(vec m, vec a, vec b) { return _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v)); }
+                static vec min(vec a, vec b) { return _mm_min_ps(a.v, b.v); }
+                static vec max(vec a, vec b) { return _mm_max_ps(a.v, b.v); }
+                static vec sqrt(vec a) { return _mm_sqrt_ps(a.v); }
+                static vec abs(vec a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+                static vec fma(vec a, vec b, vec c) { return a * b + c; }
+
+                static vec trunc(vec a)
+                {
+                    // from 2^23 on floats are integers, and too large for the conversion
+                    vec t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+                    return select(abs(a) < vec(8388608.0f), t, a);
+                }
+                static vec floor(vec a) { vec t = trunc(a); return t - ((t > a) & vec(1.0f)); }
+                static vec ceil(vec a) { vec t = trunc(a); return t + ((t < a) & vec(1.0f)); }
+
+                // 2^n for integral n in [-126, 127]
+                static vec pow2(vec n) { return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(n.v), _mm_set1_epi32(127)), 23)); }
+
+                // mantissa in [0.5, 1) and exponent of a positive normal x
+                static vec split(vec x, vec &e)
+                {
+                    __m128i i = _mm_castps_si128(x.v);
+                    e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(i, 23), _mm_set1_epi32(126)));
+                    return _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(i, _mm_set1_epi32(0x007FFFFF)), _mm_set1_epi32(0x3F000000)));
+                }
+
+                static unsigned int bits(vec m) { return (unsigned int)_mm_movemask_ps(m.v); }
+            };
+
+#include "MeshLanes.inl"
+
+        } /* End of namespace lanes_sse2 */
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#pragma clang attribute push(__attribute__((target("avx2,fma"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+
+        namespace lanes_avx2 {
+
+            struct vec {
+                static const unsigned int width = 8;
+                __m256 v;
+
+                vec() {}
+                vec(__m256 x) : v(x) {}
+                explicit vec(float x) : v(_mm256_set1_ps(x)) {}
+
+                static vec load(const float *p) { return _mm256_loadu_ps(p); }
+                void store(float *p) const { _mm256_storeu_ps(p, v); }
+                static vec ones() { return _mm256_castsi256_ps(_mm256_set1_epi32(-1)); }
+
+                vec operator+ (vec b) const { return _mm256_add_ps(v, b.v); }
+                vec operator- (vec b) const { return _mm256_sub_ps(v, b.v); }
+                vec operator* (vec b) const { return _mm256_mul_ps(v, b.v); }
+                vec operator/ (vec b) const { return _mm256_div_ps(v, b.v); }
+                vec operator& (vec b) const { return _mm256_and_ps(v, b.v); }
+                vec operator| (vec b) const { return _mm256_or_ps(v, b.v); }
+                vec operator^ (vec b) const { return _mm256_xor_ps(v, b.v); }
+                vec operator< (vec b) const { return _mm256_cmp_ps(v, b.v, _CMP_LT_OQ); }
+                vec operator<= (vec b) const { return _mm256_cmp_ps(v, b.v, _CMP_LE_OQ); }
+                vec operator> (vec b) const { return _mm256_cmp_ps(v, b.v, _CMP_GT_OQ); }
+                vec operator>= (vec b) const { return _mm256_cmp_ps(v, b.v, _CMP_GE_OQ); }
+                vec operator== (vec b) const { return _mm256_cmp_ps(v, b.v, _CMP_EQ_OQ); }
+                vec operator!= (vec b) const { return _mm256_cmp_ps(v, b.v, _CMP_NEQ_UQ); }
+
+                static vec andnot(vec a, vec b) { return _mm256_andnot_ps(a.v, b.v); }
+                static vec select(vec m, vec a, vec b) { return _mm256_blendv_ps(b.v, a.v, m.v); }
+                static vec min(vec a, vec b) { return _mm256_min_ps(a.v, b.v); }
+                static vec max(vec a, vec b) { return _mm256_max_ps(a.v, b.v); }
+                static vec sqrt(vec a) { return _mm256_sqrt_ps(a.v); }
+                static vec abs(vec a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+                static vec fma(vec a, vec b, vec c) { return _mm256_fmadd_ps(a.v, b.v, c.v); }
+                static vec trunc(vec a) { return _mm256_round_ps(a.v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+                static vec floor(vec a) { return _mm256_round_ps(a.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+                static vec ceil(vec a) { return _mm256_round_ps(a.v, _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC); }
+                static vec pow2(vec n) { return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(n.v), _mm256_set1_epi32(127)), 23)); }
+
+                static vec split(vec x, vec &e)
+                {
+                    __m256i i = _mm256_castps_si256(x.v);
+                    e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(i, 23), _mm256_set1_epi32(126)));
+                    return _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(i, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3F000000)));
+                }
+
+                static unsigned int bits(vec m) { return (unsigned int)_mm256_movemask_ps(m.v); }
+            };
+
+#include "MeshLanes.inl"
+
+        } /* End of namespace lanes_avx2 */
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#pragma clang attribute push(__attribute__((target("avx512f,fma"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#pragma GCC push_options
+#pragma GCC target("avx512f,fma")
+#endif
+
+        namespace lanes_avx512 {
+
+            // AVX-512F alone: comparisons give mask registers, widened back to lanes of all ones so the
+            // kernels can combine them like the other instruction sets
+            struct vec {
+                static const unsigned int width = 16;
+                __m512 v;
+
+                vec() {}
+                vec(__m512 x) : v(x) {}
+                explicit vec(float x) : v(_mm512_set1_ps(x)) {}
+
+                static vec load(const float *p) { return _mm512_loadu_ps(p); }
+                void store(float *p) const { _mm512_storeu_ps(p, v); }
+                static vec ones() { return _mm512_castsi512_ps(_mm512_set1_epi32(-1)); }
+                static vec widen(__mmask16 k) { return _mm512_castsi512_ps(_mm512_maskz_set1_epi32(k, -1)); }
+                static __mmask16 narrow(vec m) { __m512i i = _mm512_castps_si512(m.v); return _mm512_test_epi32_mask(i, i); }
+                static __m512i integer(vec a) { return _mm512_castps_si512(a.v); }
+
+                vec operator+ (vec b) const { return _mm512_add_ps(v, b.v); }
+                vec operator- (vec b) const { return _mm512_sub_ps(v, b.v); }
+                vec operator* (vec b) const { return _mm512_mul_ps(v, b.v); }
+                vec operator/ (vec b) const { return _mm512_div_ps(v, b.v); }
+                vec operator& (vec b) const { return _mm512_castsi512_ps(_mm512_and_si512(integer(*this), integer(b))); }
+                vec operator| (vec b) const { return _mm512_castsi512_ps(_mm512_or_si512(integer(*this), integer(b))); }
+                vec operator^ (vec b) const { return _mm512_castsi512_ps(_mm512_xor_si512(integer(*this), integer(b))); }
+                vec operator< (vec b) const { return widen(_mm512_cmp_ps_mask(v, b.v, _CMP_LT_OQ)); }
+                vec operator<= (vec b) const { return widen(_mm512_cmp_ps_mask(v, b.v, _CMP_LE_OQ)); }
+                vec operator> (vec b) const { return widen(_mm512_cmp_ps_mask(v, b.v, _CMP_GT_OQ)); }
+                vec operator>= (vec b) const { return widen(_mm512_cmp_ps_mask(v, b.v, _CMP_GE_OQ)); }
+                vec operator== (vec b) const { return widen(_mm512_cmp_ps_mask(v, b.v, _CMP_EQ_OQ)); }
+                vec operator!= (vec b) const { return widen(_mm512_cmp_ps_mask(v, b.v, _CMP_NEQ_UQ)); }
+
+                static vec andnot(vec a, vec b) { return _mm512_castsi512_ps(_mm512_andnot_si512(integer(a), integer(b))); }
+                static vec select(vec m, vec a, vec b) { return _mm512_mask_blend_ps(narrow(m), b.v, a.v); }
+                static vec min(vec a, vec b) { return _mm512_min_ps(a.v, b.v); }
+                static vec max(vec a, vec b) { return _mm512_max_ps(a.v, b.v); }
+                static vec sqrt(vec a) { return _mm512_sqrt_ps(a.v); }
+                static vec abs(vec a) { return andnot(vec(-0.0f), a); }
+                static vec fma(vec a, vec b, vec c) { return _mm512_fmadd_ps(a.v, b.v, c.v); }
+                static vec trunc(vec a) { return _mm512_roundscale_ps(a.v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+                static vec floor(vec a) { return _mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+                static vec ceil(vec a) { return _mm512_roundscale_ps(a.v, _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC); }
+                static vec pow2(vec n) { return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(_mm512_cvttps_epi32(n.v), _mm512_set1_epi32(127)), 23)); }
+
+                static vec split(vec x, vec &e)
+                {
+                    __m512i i = integer(x);
+                    e = _mm512_cvtepi32_ps(_mm512_sub_epi32(_mm512_srli_epi32(i, 23), _mm512_set1_epi32(126)));
+                    return _mm512_castsi512_ps(_mm512_or_si512(_mm512_and_si512(i, _mm512_set1_epi32(0x007FFFFF)), _mm512_set1_epi32(0x3F000000)));
+                }
+
+                static unsigned int bits(vec m) { return (unsigned int)narrow(m); }
+            };
+
+#include "MeshLanes.inl"
+
+        } /* End of namespace lanes_avx512 */
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif
+
+        /// <summary>
+        /// Runs per-vertex equations over the warp mesh and writes warpvertex records, e.g. into a mapped
+        /// D3D11_USAGE_DYNAMIC vertex buffer made with create_buffer.
+        ///
+        /// Variables are kept as columns, one float per vertex, and the program runs on blocks of
+        /// lanejob::block_lanes vertices with as many lanes at a time as the instruction set has.
+        /// Registers the program only reads are broadcast once per frame, x, y, rad, ang and the outputs are
+        /// reset at every vertex. A program reading a variable it wrote at an earlier vertex depends on the
+        /// order vertices run in, it and CPUs without SSE2 take the scalar path: MilkDrop's, in double,
+        /// through equationjit.
+        /// The scope is never changed, vertices see what the per-frame code left in it.
+        /// </summary>
+        class meshevaluator {
+        public:
+            explicit meshevaluator(unsigned int meshx = 48, unsigned int meshy = 36, simdlevel level = simdlevel::automatic)
+                : m_level((level == simdlevel::automatic) ? detect() : level)
+            {
+#ifndef DX_MESH_X86
+                m_level = simdlevel::scalar;
+#endif
+                set_mesh(meshx, meshy, 1.0, 1.0);
+            }
+
+            /// <summary>
+            /// Grid of meshx by meshy cells, vertices row by row from the top left.
+            /// </summary>
+            void set_mesh(unsigned int meshx, unsigned int meshy, double aspectx, double aspecty)
+            {
+                m_meshx = std::max(meshx, 1u);
+                m_meshy = std::max(meshy, 1u);
+                m_aspectx = aspectx;
+                m_aspecty = aspecty;
+
+                size_t count = vertex_count();
+                size_t padded = (count + lanejob::block_lanes - 1) / lanejob::block_lanes * lanejob::block_lanes;
+                for(auto column : { &m_px, &m_py, &m_x, &m_y, &m_rad, &m_ang }) {
+                    column->assign(padded, 0.0f);
+                }
+                for(size_t i = 0; i < count; ++i) {
+                    double px, py, x, y, rad, ang;
+                    point(i, px, py, x, y, rad, ang);
+                    m_px[i] = (float)px;
+                    m_py[i] = (float)py;
+                    m_x[i] = (float)x;
+                    m_y[i] = (float)y;
+                    m_rad[i] = (float)rad;
+                    m_ang[i] = (float)ang;
+                }
+            }
+
+            /// <summary>
+            /// Per-vertex code to run, compiled against scope. An empty program leaves the per-frame outputs.
+            /// </summary>
+            void set_program(const equationprogram &program, const equationscope &scope)
+            {
+                m_scalar.compile(program);
+                m_columns.clear();
+                m_code.clear();
+                m_uniforms.clear();
+                m_resets.clear();
+                m_inputs.clear();
+
+                const std::vector<equationinstruction> &code = program.code();
+                std::vector<bool> written(scope.size(), false);
+                for(auto& i : code) {
+                    if(!is_jump(i.op)) {
+                        written[i.dst] = true;
+                    }
+                }
+                m_vectorized = (m_level != simdlevel::scalar) && !carries(code, written);
+                if(!m_vectorized) {
+                    return;
+                }
+
+                std::vector<int> column(scope.size(), -1);
+                auto map = [&](uint16_t slot) -> uint16_t {
+                    if(column[slot] < 0) {
+                        column[slot] = (int)m_columns.size();
+                        m_columns.push_back(slot);
+                    }
+                    return (uint16_t)column[slot];
+                };
+                for(uint16_t o : outputs()) {
+                    map(o);
+                }
+                for(auto i : code) {
+                    if(is_jump(i.op)) {
+                        i.a = (i.op == equationop::jump) ? 0 : map(i.a);
+                    }
+                    else {
+                        i.dst = map(i.dst);
+                        i.a = map(i.a);
+                        i.b = equationmath::is_binary(i.op) ? map(i.b) : 0;
+                    }
+                    m_code.push_back(i);
+                }
+
+                for(size_t c = 0; c < m_columns.size(); ++c) {
+                    uint16_t slot = m_columns[c];
+                    if(slot == var_x || slot == var_y || slot == var_rad || slot == var_ang) {
+                        m_inputs.push_back((uint16_t)c);
+                    }
+                    else if(written[slot]) {
+                        m_resets.push_back((uint16_t)c);
+                    }
+                    else {
+                        m_uniforms.push_back((uint16_t)c);
+                    }
+                }
+                m_arena.assign(m_columns.size() * lanejob::block_lanes, 0.0f);
+                m_pending.assign(m_code.size() + 1, 0);
+            }
+
+            /// <summary>
+            /// Run the program for every vertex and write vertex_count() warpvertex records, stride bytes apart.
+            /// </summary>
+            void evaluate(const equationscope &scope, const warpparameters &parameters, void *vertices, size_t stride = sizeof(warpvertex))
+            {
+                warpframe frame = make_frame(parameters);
+                if(!m_vectorized) {
+                    evaluate_scalar(scope, frame, (unsigned char *)vertices, stride);
+                    return;
+                }
+#ifdef DX_MESH_X86
+                void (*block)(const lanejob &, float *, float *) =
+                    (m_level == simdlevel::avx512) ? &lanes_avx512::evaluate_block :
+                    (m_level == simdlevel::avx2) ? &lanes_avx2::evaluate_block : &lanes_sse2::evaluate_block;
+
+                const unsigned int lanes = lanejob::block_lanes;
+                float *columns = m_arena.data();
+                for(uint16_t c : m_uniforms) {
+                    std::fill(columns + c * lanes, columns + (c + 1) * lanes, (float)scope[m_columns[c]]);
+                }
+
+                lanejob job;
+                job.code = m_code.data();
+                job.count = m_code.size();
+                job.columns = columns;
+                job.pending = m_pending.data();
+                job.scratch = m_scratch;
+                job.frame = &frame;
+                for(size_t o = 0; o < 10; ++o) {
+                    // outputs are mapped first, in order
+                    job.outputs[o] = columns + o * lanes;
+                }
+
+                const size_t count = vertex_count();
+                unsigned char *out = (unsigned char *)vertices;
+                float u[lanejob::block_lanes], v[lanejob::block_lanes];
+                for(size_t first = 0; first < count; first += lanes) {
+                    const size_t n = std::min((size_t)lanes, count - first);
+                    for(uint16_t c : m_inputs) {
+                        const std::vector<float> &source = input(m_columns[c]);
+                        memcpy(columns + c * lanes, source.data() + first, lanes * sizeof(float));
+                    }
+                    for(uint16_t c : m_resets) {
+                        std::fill(columns + c * lanes, columns + (c + 1) * lanes, (float)scope[m_columns[c]]);
+                    }
+                    job.active = (n == lanes) ? ~0ull : ((1ull << n) - 1);
+                    job.px = m_px.data() + first;
+                    job.py = m_py.data() + first;
+                    job.rad = m_rad.data() + first;
+                    block(job, u, v);
+
+                    for(size_t l = 0; l < n; ++l) {
+                        warpvertex *w = (warpvertex *)(out + (first + l) * stride);
+                        w->x = m_px[first + l];
+                        w->y = m_py[first + l];
+                        w->u = u[l];
+                        w->v = v[l];
+                    }
+                }
+#endif
+            }
+
+            size_t vertex_count() const
+            {
+                return (size_t)(m_meshx + 1) * (m_meshy + 1);
+            }
+
+            /// <summary>
+            /// Triangle list over the vertices evaluate writes, for an index buffer.
+            /// </summary>
+            std::vector<uint32_t> indices() const
+            {
+                std::vector<uint32_t> result;
+                result.reserve((size_t)m_meshx * m_meshy * 6);
+                for(unsigned int y = 0; y < m_meshy; ++y) {
+                    for(unsigned int x = 0; x < m_meshx; ++x) {
+                        uint32_t i = y * (m_meshx + 1) + x;
+                        uint32_t below = i + m_meshx + 1;
+                        result.insert(result.end(), { i, i + 1, below, i + 1, below + 1, below });
+                    }
+                }
+                return result;
+            }
+
+            /// <summary>
+            /// Instruction set vertices run with, scalar when the program has to go vertex by vertex.
+            /// </summary>
+            simdlevel level() const
+            {
+                return m_vectorized ? m_level : simdlevel::scalar;
+            }
+
+            /// <summary>
+            /// Best instruction set the CPU and the OS support.
+            /// </summary>
+            static simdlevel detect()
+            {
+#if defined(DX_MESH_X86) && defined(_MSC_VER)
+                int r[4];
+                __cpuid(r, 0);
+                const int leaves = r[0];
+                __cpuid(r, 1);
+                const bool sse2 = (r[3] & (1 << 26)) != 0;
+                const bool fma = (r[2] & (1 << 12)) != 0;
+                const bool osxsave = (r[2] & (1 << 27)) != 0;
+                bool avx2 = false, avx512 = false;
+                if(osxsave && leaves >= 7) {
+                    // the OS must save the registers too
+                    const unsigned long long xcr0 = _xgetbv(0);
+                    __cpuidex(r, 7, 0);
+                    avx2 = fma && (r[1] & (1 << 5)) && (xcr0 & 0x06) == 0x06;
+                    avx512 = avx2 && (r[1] & (1 << 16)) && (xcr0 & 0xE6) == 0xE6;
+                }
+                return avx512 ? simdlevel::avx512 : avx2 ? simdlevel::avx2 : sse2 ? simdlevel::sse2 : simdlevel::scalar;
+#elif defined(DX_MESH_X86) && defined(__GNUC__)
+                __builtin_cpu_init();
+                if(__builtin_cpu_supports("avx512f")) {
+                    return simdlevel::avx512;
+                }
+                if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+                    return simdlevel::avx2;
+                }
+                return __builtin_cpu_supports("sse2") ? simdlevel::sse2 : simdlevel::scalar;
+#else
+                return simdlevel::scalar;
+#endif
+            }
+
+            static const char *name(simdlevel level)
+            {
+                switch(level) {
+                case simdlevel::scalar: return "scalar";
+                case simdlevel::sse2: return "SSE2";
+                case simdlevel::avx2: return "AVX2";
+                case simdlevel::avx512: return "AVX-512";
+                default: return "automatic";
+                }
+            }
+
+        private:
+            static bool is_jump(equationop op)
+            {
+                return op == equationop::jump || op == equationop::jz || op == equationop::jnz;
+            }
+
+            static const uint16_t (&outputs())[10]
+            {
+                static const uint16_t slots[10] = { var_zoom, var_zoomexp, var_rot, var_warp, var_cx, var_cy, var_dx, var_dy, var_sx, var_sy };
+                return slots;
+            }
+
+            /// <summary>
+            /// Whether some path reads a written variable before writing it, seeing the previous vertex.
+            /// Inputs and outputs are set at every vertex and don't count. Jumps only go forward, so one
+            /// pass intersecting what is surely written along every way into an instruction is enough.
+            /// </summary>
+            static bool carries(const std::vector<equationinstruction> &code, const std::vector<bool> &written)
+            {
+                std::vector<uint16_t> tracked;
+                std::vector<int> index(written.size(), -1);
+                for(size_t slot = 0; slot < written.size(); ++slot) {
+                    bool reset = (slot == var_x || slot == var_y || slot == var_rad || slot == var_ang);
+                    for(uint16_t o : outputs()) {
+                        reset = reset || (slot == o);
+                    }
+                    if(written[slot] && !reset) {
+                        index[slot] = (int)tracked.size();
+                        tracked.push_back((uint16_t)slot);
+                    }
+                }
+                if(tracked.empty()) {
+                    return false;
+                }
+
+                // defined[pc]: tracked variables written on every path reaching pc, empty until a path does
+                std::vector<std::vector<bool>> defined(code.size() + 1);
+                auto merge = [&](size_t target, const std::vector<bool> &state) {
+                    if(defined[target].empty()) {
+                        defined[target] = state;
+                    }
+                    else {
+                        for(size_t k = 0; k < state.size(); ++k) {
+                            defined[target][k] = defined[target][k] && state[k];
+                        }
+                    }
+                };
+                defined[0].assign(tracked.size(), false);
+                for(size_t pc = 0; pc < code.size(); ++pc) {
+                    if(defined[pc].empty()) {
+                        continue;   // unreachable
+                    }
+                    std::vector<bool> state = defined[pc];
+                    const equationinstruction &i = code[pc];
+                    auto read = [&](uint16_t slot) {
+                        return index[slot] >= 0 && !state[index[slot]];
+                    };
+                    if(i.op == equationop::jump) {
+                        merge(i.dst, state);
+                        continue;
+                    }
+                    if(i.op == equationop::jz || i.op == equationop::jnz) {
+                        if(read(i.a)) {
+                            return true;
+                        }
+                        merge(i.dst, state);
+                    }
+                    else {
+                        if(read(i.a) || (equationmath::is_binary(i.op) && read(i.b))) {
+                            return true;
+                        }
+                        if(index[i.dst] >= 0) {
+                            state[index[i.dst]] = true;
+                        }
+                    }
+                    merge(pc + 1, state);
+                }
+                return false;
+            }
+
+            void point(size_t i, double &px, double &py, double &x, double &y, double &rad, double &ang) const
+            {
+                const unsigned int column = (unsigned int)(i % (m_meshx + 1)), row = (unsigned int)(i / (m_meshx + 1));
+                px = column * 2.0 / m_meshx - 1.0;
+                py = 1.0 - row * 2.0 / m_meshy;
+                x = px * 0.5 + 0.5;
+                y = py * -0.5 + 0.5;
+                rad = sqrt(px * m_aspectx * px * m_aspectx + py * m_aspecty * py * m_aspecty) * 0.7071067;
+                ang = atan2(py * m_aspecty, px * m_aspectx);
+                if(ang < 0.0) {
+                    ang += 6.2831853071796;
+                }
+            }
+
+            const std::vector<float> &input(uint16_t slot) const
+            {
+                return (slot == var_x) ? m_x : (slot == var_y) ? m_y : (slot == var_rad) ? m_rad : m_ang;
+            }
+
+            warpframe make_frame(const warpparameters &parameters) const
+            {
+                const double t = parameters.time;
+                warpframe frame;
+                frame.aspectx = (float)m_aspectx;
+                frame.aspecty = (float)m_aspecty;
+                frame.inverse_aspectx = (float)(1.0 / m_aspectx);
+                frame.inverse_aspecty = (float)(1.0 / m_aspecty);
+                frame.warp_time = (float)(t * parameters.warp_anim_speed);
+                frame.warp_scale_inv = (float)(1.0 / parameters.warp_scale);
+                frame.f[0] = (float)(11.68 + 4.0 * cos(t * 1.413 + 10));
+                frame.f[1] = (float)(8.77 + 3.0 * cos(t * 1.113 + 7));
+                frame.f[2] = (float)(10.54 + 3.0 * cos(t * 1.233 + 3));
+                frame.f[3] = (float)(11.49 + 4.0 * cos(t * 0.933 + 5));
+                return frame;
+            }
+
+            void evaluate_scalar(const equationscope &scope, const warpframe &frame, unsigned char *out, size_t stride)
+            {
+                m_registers.assign(scope.registers(), scope.registers() + scope.size());
+                double *r = m_registers.data();
+                double saved[10];
+                for(size_t o = 0; o < 10; ++o) {
+                    saved[o] = r[outputs()[o]];
+                }
+
+                const double amount_scale = 0.0035, wt = frame.warp_time, ws = frame.warp_scale_inv;
+                const double f0 = frame.f[0], f1 = frame.f[1], f2 = frame.f[2], f3 = frame.f[3];
+                const size_t count = vertex_count();
+                for(size_t i = 0; i < count; ++i) {
+                    double px, py;
+                    point(i, px, py, r[var_x], r[var_y], r[var_rad], r[var_ang]);
+                    const double rad = r[var_rad];
+                    for(size_t o = 0; o < 10; ++o) {
+                        r[outputs()[o]] = saved[o];
+                    }
+                    m_scalar.run(r);
+
+                    const double zoom = r[var_zoom], zoomexp = r[var_zoomexp], rot = r[var_rot], warp = r[var_warp];
+                    const double cx = r[var_cx], cy = r[var_cy], dx = r[var_dx], dy = r[var_dy], sx = r[var_sx], sy = r[var_sy];
+                    const double inverse = 1.0 / pow(zoom, pow(zoomexp, rad * 2.0 - 1.0));
+                    double u = px * m_aspectx * 0.5 * inverse + 0.5;
+                    double v = -py * m_aspecty * 0.5 * inverse + 0.5;
+                    u = (u - cx) / sx + cx;
+                    v = (v - cy) / sy + cy;
+
+                    const double amount = warp * amount_scale;
+                    u += amount * sin(wt * 0.333 + ws * (px * f0 - py * f3));
+                    v += amount * cos(wt * 0.375 - ws * (px * f2 + py * f1));
+                    u += amount * cos(wt * 0.753 - ws * (px * f1 - py * f2));
+                    v += amount * sin(wt * 0.825 + ws * (px * f0 + py * f3));
+
+                    const double u2 = u - cx, v2 = v - cy;
+                    const double c = cos(rot), s = sin(rot);
+                    u = u2 * c - v2 * s + cx - dx;
+                    v = u2 * s + v2 * c + cy - dy;
+
+                    warpvertex *w = (warpvertex *)(out + i * stride);
+                    w->x = (float)px;
+                    w->y = (float)py;
+                    w->u = (float)((u - 0.5) / m_aspectx + 0.5);
+                    w->v = (float)((v - 0.5) / m_aspecty + 0.5);
+                }
+            }
+
+            simdlevel m_level;
+            bool m_vectorized = false;
+            unsigned int m_meshx = 0, m_meshy = 0;
+            double m_aspectx = 1.0, m_aspecty = 1.0;
+            std::vector<float> m_px, m_py, m_x, m_y, m_rad, m_ang;
+
+            equationjit m_scalar;                       // the scalar path, native where possible
+            std::vector<equationinstruction> m_code;    // registers remapped to columns
+            std::vector<uint16_t> m_columns;            // scope register of each column
+            std::vector<uint16_t> m_uniforms, m_resets, m_inputs;
+            std::vector<float> m_arena;
+            std::vector<uint64_t> m_pending;
+            float m_scratch[lanejob::block_lanes];
+            std::vector<double> m_registers;
+        };
+
+    } /* End of namespace milk */
+
+} /* End of namespace dx */
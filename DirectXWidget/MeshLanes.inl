@@ -0,0 +1,268 @@
+// Kernels of meshevaluator for one instruction set.
+//
+// MeshEvaluator.h includes this file once per instruction set, inside a namespace that defines
+// vec, a SIMD register of vec::width floats, and compiled for that instruction set.
+// Nothing here may include headers or name the instruction set.
+
+static const unsigned int lanes = lanejob::block_lanes;
+
+/// <summary>
+/// Mask of the lanes MilkDrop treats as 0: closer to it than closefact.
+/// </summary>
+inline vec is_zero(vec x)
+{
+    return vec::abs(x) < vec((float)equationmath::closefact);
+}
+
+/// <summary>
+/// sin of arguments up to about 6e6 in magnitude, Cephes single precision polynomials.
+/// </summary>
+inline vec sin_lanes(vec x)
+{
+    const vec sign = x < vec(0.0f);
+    x = vec::abs(x);
+
+    // octant, rounded up to even so the reduced argument is in [-pi/4, pi/4]
+    vec j = vec::trunc(x * vec(1.27323954473516f));
+    j = j + (j - vec(2.0f) * vec::trunc(j * vec(0.5f)));
+    const vec k = j * vec(0.5f);
+    const vec odd = (k - vec(2.0f) * vec::trunc(k * vec(0.5f))) == vec(1.0f);
+    const vec upper = (k - vec(4.0f) * vec::trunc(k * vec(0.25f))) >= vec(2.0f);
+
+    x = ((x - j * vec(0.78515625f)) - j * vec(2.4187564849853515625e-4f)) - j * vec(3.77489497744594108e-8f);
+    const vec z = x * x;
+    vec s = vec::fma(vec::fma(vec::fma(vec(-1.9515295891e-4f), z, vec(8.3321608736e-3f)), z, vec(-1.6666654611e-1f)), z * x, x);
+    vec c = vec::fma(vec::fma(vec::fma(vec(2.443315711809948e-5f), z, vec(-1.388731625493765e-3f)), z, vec(4.166664568298827e-2f)), z * z, vec(1.0f) - vec(0.5f) * z);
+
+    const vec r = vec::select(odd, c, s);
+    // negative when exactly one of the argument and the half turn is
+    return vec::select(sign ^ upper, vec(0.0f) - r, r);
+}
+
+inline vec cos_lanes(vec x)
+{
+    return sin_lanes(vec::abs(x) + vec(1.57079632679489662f));
+}
+
+inline vec exp_lanes(vec x)
+{
+    const vec input = x;
+    const vec overflow = x > vec(88.7228391f);
+    const vec underflow = x < vec(-87.3365448f);
+    const vec nan = x != x;
+    x = vec::min(vec::max(x, vec(-87.3365448f)), vec(88.7228391f));
+
+    const vec n = vec::floor(vec::fma(x, vec(1.44269504088896341f), vec(0.5f)));
+    x = (x - n * vec(0.693359375f)) - n * vec(-2.12194440e-4f);
+    const vec z = x * x;
+    vec p = vec::fma(vec(1.9875691500e-4f), x, vec(1.3981999507e-3f));
+    p = vec::fma(p, x, vec(8.3334519073e-3f));
+    p = vec::fma(p, x, vec(4.1665795894e-2f));
+    p = vec::fma(p, x, vec(1.6666665459e-1f));
+    p = vec::fma(p, x, vec(5.0000001201e-1f));
+    p = vec::fma(p, z, x + vec(1.0f));
+
+    // 2^128 does not fit the exponent, scale in two steps
+    const vec half = vec::trunc(n * vec(0.5f));
+    vec r = p * vec::pow2(half) * vec::pow2(n - half);
+    r = vec::select(overflow, vec(HUGE_VALF), r);
+    r = vec::select(underflow, vec(0.0f), r);
+    return vec::select(nan, input, r);
+}
+
+inline vec log_lanes(vec x)
+{
+    const vec negative = x < vec(0.0f);
+    const vec zero = x == vec(0.0f);
+    const vec infinite = x == vec(HUGE_VALF);
+    const vec nan = x != x;
+
+    // denormals scaled up by 2^23 into the normal range
+    const vec denormal = x < vec(1.17549435e-38f);
+    vec e;
+    vec m = vec::split(vec::select(denormal, x * vec(8388608.0f), x), e);
+    e = vec::select(denormal, e - vec(23.0f), e);
+    const vec small = m < vec(0.707106781186547524f);
+    e = vec::select(small, e - vec(1.0f), e);
+    m = vec::select(small, m + m - vec(1.0f), m - vec(1.0f));
+
+    const vec z = m * m;
+    vec p = vec::fma(vec(7.0376836292e-2f), m, vec(-1.1514610310e-1f));
+    p = vec::fma(p, m, vec(1.1676998740e-1f));
+    p = vec::fma(p, m, vec(-1.2420140846e-1f));
+    p = vec::fma(p, m, vec(1.4249322787e-1f));
+    p = vec::fma(p, m, vec(-1.6668057665e-1f));
+    p = vec::fma(p, m, vec(2.0000714765e-1f));
+    p = vec::fma(p, m, vec(-2.4999993993e-1f));
+    p = vec::fma(p, m, vec(3.3333331174e-1f));
+    vec y = p * m * z;
+    y = vec::fma(e, vec(-2.12194440e-4f), y);
+    y = vec::fma(vec(-0.5f), z, y);
+    vec r = vec::fma(e, vec(0.693359375f), m + y);
+
+    r = vec::select(zero, vec(-HUGE_VALF), r);
+    r = vec::select(infinite, x, r);
+    return vec::select(negative | nan, vec(NAN), r);
+}
+
+/// <summary>
+/// d = a op b over a block. Operations without a vector form run lane by lane in double precision.
+/// </summary>
+inline void apply_lanes(equationop op, float *d, const float *a, const float *b)
+{
+#define DX_MILK_LANES(expression) \
+    for(unsigned int l = 0; l < lanes; l += vec::width) { \
+        const vec x = vec::load(a + l); \
+        const vec y = vec::load(b + l); \
+        (void)y; \
+        (expression).store(d + l); \
+    } \
+    return
+
+    const vec one(1.0f), zero(0.0f);
+    switch(op) {
+    case equationop::mov: DX_MILK_LANES(x);
+    case equationop::add: DX_MILK_LANES(x + y);
+    case equationop::sub: DX_MILK_LANES(x - y);
+    case equationop::mul: DX_MILK_LANES(x * y);
+    case equationop::div: DX_MILK_LANES(vec::select(y == zero, zero, x / y));
+    case equationop::neg: DX_MILK_LANES(zero - x);
+    case equationop::logical_not: DX_MILK_LANES(is_zero(x) & one);
+    case equationop::eq: DX_MILK_LANES(is_zero(x - y) & one);
+    case equationop::ne: DX_MILK_LANES(vec::andnot(is_zero(x - y), one));
+    case equationop::lt: DX_MILK_LANES((x < y) & one);
+    case equationop::le: DX_MILK_LANES((x <= y) & one);
+    case equationop::gt: DX_MILK_LANES((x > y) & one);
+    case equationop::ge: DX_MILK_LANES((x >= y) & one);
+    case equationop::band: DX_MILK_LANES(vec::andnot(is_zero(x) | is_zero(y), one));
+    case equationop::bor: DX_MILK_LANES(vec::andnot(is_zero(x) & is_zero(y), one));
+    case equationop::sin: DX_MILK_LANES(sin_lanes(x));
+    case equationop::cos: DX_MILK_LANES(cos_lanes(x));
+    case equationop::sqrt: DX_MILK_LANES(vec::sqrt(vec::abs(x)));
+    case equationop::sqr: DX_MILK_LANES(x * x);
+    case equationop::abs: DX_MILK_LANES(vec::abs(x));
+    case equationop::sign: DX_MILK_LANES(((x > zero) & one) - ((x < zero) & one));
+    case equationop::min: DX_MILK_LANES(vec::min(x, y));
+    case equationop::max: DX_MILK_LANES(vec::max(x, y));
+    case equationop::exp: DX_MILK_LANES(exp_lanes(x));
+    case equationop::log: DX_MILK_LANES(log_lanes(x));
+    case equationop::truncate: DX_MILK_LANES(vec::trunc(x));
+    case equationop::floor: DX_MILK_LANES(vec::floor(x));
+    case equationop::ceil: DX_MILK_LANES(vec::ceil(x));
+    case equationop::invsqrt: DX_MILK_LANES(one / vec::sqrt(x));
+    default:
+        for(unsigned int l = 0; l < lanes; ++l) {
+            d[l] = (float)equationmath::apply(op, a[l], b[l]);
+        }
+        return;
+    }
+#undef DX_MILK_LANES
+}
+
+/// <summary>
+/// Run the program over a block. Lanes follow their own branches: a jump parks the lanes taking it
+/// until its target, instructions only write the lanes still running.
+/// </summary>
+inline void run_lanes(const lanejob &job)
+{
+    uint64_t active = job.active;
+    for(size_t pc = 0; pc < job.count; ++pc) {
+        active |= job.pending[pc];
+        job.pending[pc] = 0;
+        if(active == 0) {
+            continue;
+        }
+
+        const equationinstruction &i = job.code[pc];
+        float *d = job.columns + (size_t)i.dst * lanes;
+        const float *a = job.columns + (size_t)i.a * lanes;
+        const float *b = job.columns + (size_t)i.b * lanes;
+        switch(i.op) {
+        case equationop::jump:
+            job.pending[i.dst] |= active;
+            active = 0;
+            break;
+        case equationop::jz:
+        case equationop::jnz: {
+            uint64_t zero = 0;
+            for(unsigned int l = 0; l < lanes; l += vec::width) {
+                zero |= (uint64_t)vec::bits(is_zero(vec::load(a + l))) << l;
+            }
+            uint64_t taken = active & ((i.op == equationop::jz) ? zero : ~zero);
+            job.pending[i.dst] |= taken;
+            active &= ~taken;
+            break;
+        }
+        case equationop::rand:
+            // one call per running lane, as many as the scalar path makes
+            for(unsigned int l = 0; l < lanes; ++l) {
+                if(active & (1ull << l)) {
+                    d[l] = (float)equationmath::apply(i.op, a[l], b[l]);
+                }
+            }
+            break;
+        default:
+            if(active == ~0ull) {
+                apply_lanes(i.op, d, a, b);
+            }
+            else {
+                apply_lanes(i.op, job.scratch, a, b);
+                for(unsigned int l = 0; l < lanes; ++l) {
+                    if(active & (1ull << l)) {
+                        d[l] = job.scratch[l];
+                    }
+                }
+            }
+            break;
+        }
+    }
+    job.pending[job.count] = 0;
+}
+
+/// <summary>
+/// Texture coordinates of a block from the warp outputs, the formula of MilkDrop's WarpedUV.
+/// </summary>
+inline void warp_lanes(const lanejob &job, float *u_out, float *v_out)
+{
+    const warpframe &w = *job.frame;
+    for(unsigned int l = 0; l < lanes; l += vec::width) {
+        const vec px = vec::load(job.px + l), py = vec::load(job.py + l), rad = vec::load(job.rad + l);
+        const vec zoom = vec::load(job.outputs[0] + l), zoomexp = vec::load(job.outputs[1] + l);
+        const vec rot = vec::load(job.outputs[2] + l), warp = vec::load(job.outputs[3] + l);
+        const vec cx = vec::load(job.outputs[4] + l), cy = vec::load(job.outputs[5] + l);
+        const vec dx = vec::load(job.outputs[6] + l), dy = vec::load(job.outputs[7] + l);
+        const vec sx = vec::load(job.outputs[8] + l), sy = vec::load(job.outputs[9] + l);
+        const vec half(0.5f);
+
+        // zoom ^ (zoomexp ^ (rad * 2 - 1))
+        const vec exponent = exp_lanes(log_lanes(zoomexp) * (rad * vec(2.0f) - vec(1.0f)));
+        const vec inverse = vec(1.0f) / exp_lanes(log_lanes(zoom) * exponent);
+
+        vec u = vec::fma(px * vec(w.aspectx * 0.5f), inverse, half);
+        vec v = vec::fma(py * vec(w.aspecty * -0.5f), inverse, half);
+        u = (u - cx) / sx + cx;
+        v = (v - cy) / sy + cy;
+
+        const vec amount = warp * vec(0.0035f);
+        const vec wt(w.warp_time), ws(w.warp_scale_inv);
+        const vec f0(w.f[0]), f1(w.f[1]), f2(w.f[2]), f3(w.f[3]);
+        u = vec::fma(amount, sin_lanes(vec::fma(ws, px * f0 - py * f3, wt * vec(0.333f))), u);
+        v = vec::fma(amount, cos_lanes(wt * vec(0.375f) - ws * (px * f2 + py * f1)), v);
+        u = vec::fma(amount, cos_lanes(wt * vec(0.753f) - ws * (px * f1 - py * f2)), u);
+        v = vec::fma(amount, sin_lanes(vec::fma(ws, px * f0 + py * f3, wt * vec(0.825f))), v);
+
+        const vec u2 = u - cx, v2 = v - cy;
+        const vec c = cos_lanes(rot), s = sin_lanes(rot);
+        u = u2 * c - v2 * s + cx - dx;
+        v = u2 * s + v2 * c + cy - dy;
+
+        vec::fma(u - half, vec(w.inverse_aspectx), half).store(u_out + l);
+        vec::fma(v - half, vec(w.inverse_aspecty), half).store(v_out + l);
+    }
+}
+
+inline void evaluate_block(const lanejob &job, float *u, float *v)
+{
+    run_lanes(job);
+    warp_lanes(job, u, v);
+}
@@ -0,0 +1,1399 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "MilkPreset.h"
+
+/*
+    Preset equations: the expression language of MilkDrop per-frame, per-vertex, wave and shape code.
+
+    Statements are separated by ';', "var = expr" assigns, +=, -=, *=, /= and %= too.
+    Operators by precedence, lowest first: = and compound assignments, ?:, ||, &&, |, &,
+    comparisons, + -, * / %, unary - + !, ^ (power, right associative).
+    Functions: if (lazy), sin cos tan asin acos atan atan2 sqrt sqr abs sign min max pow exp log log10
+    int floor ceil invsqrt sigmoid rand above below equal band bor bnot.
+    As in MilkDrop, x / 0 and x % 0 are 0, sqrt takes the absolute value, == and equal() allow 0.00001
+    of difference and a value is true unless it is that close to 0.
+    Names are case-insensitive, comments run from // to the end of the line or are C block comments.
+*/
+
+namespace dx {
+
+    namespace milk {
+
+        /// <summary>
+        /// Registers of the variables MilkDrop defines, always at these slots of an equationscope.
+        /// </summary>
+        enum equationvariable : uint16_t {
+            var_time, var_fps, var_frame, var_progress,
+            var_bass, var_mid, var_treb, var_bass_att, var_mid_att, var_treb_att,
+            var_meshx, var_meshy, var_pixelsx, var_pixelsy, var_aspectx, var_aspecty,
+            var_x, var_y, var_rad, var_ang,
+            var_zoom, var_zoomexp, var_rot, var_warp, var_cx, var_cy, var_dx, var_dy, var_sx, var_sy,
+            var_decay, var_gamma, var_echo_zoom, var_echo_alpha, var_echo_orient,
+            var_wave_mode, var_wave_x, var_wave_y, var_wave_r, var_wave_g, var_wave_b, var_wave_a,
+            var_wave_mystery, var_wave_usedots, var_wave_thick, var_wave_additive, var_wave_brighten,
+            var_ob_size, var_ob_r, var_ob_g, var_ob_b, var_ob_a,
+            var_ib_size, var_ib_r, var_ib_g, var_ib_b, var_ib_a,
+            var_mv_x, var_mv_y, var_mv_dx, var_mv_dy, var_mv_l, var_mv_r, var_mv_g, var_mv_b, var_mv_a,
+            var_darken_center, var_darken, var_invert, var_brighten, var_solarize, var_wrap, var_monitor,
+            // custom waves and shapes
+            var_sample, var_value1, var_value2, var_r, var_g, var_b, var_a, var_r2, var_g2, var_b2, var_a2,
+            var_samples, var_sides, var_thick, var_additive, var_textured, var_tex_zoom, var_tex_ang,
+            var_border_r, var_border_g, var_border_b, var_border_a, var_instance, var_num_inst,
+            var_q1,
+            var_t1 = var_q1 + 32,
+            var_builtin_count = var_t1 + 8
+        };
+
+        enum class equationop : uint8_t {
+            mov,
+            add, sub, mul, div, mod, pow,
+            bit_or, bit_and,
+            neg, logical_not,
+            eq, ne, lt, le, gt, ge,
+            band, bor,
+            sin, cos, tan, asin, acos, atan, atan2,
+            sqrt, sqr, abs, sign, min, max, exp, log, log10,
+            truncate, floor, ceil, invsqrt, sigmoid, rand,
+            jump,       // to dst
+            jz,         // to dst when a is false
+            jnz,        // to dst when a is true
+            count
+        };
+
+        /// <summary>
+        /// Three-address instruction over the registers of an equationscope.
+        /// </summary>
+        struct equationinstruction {
+            equationop op;
+            uint8_t unused;
+            uint16_t dst;
+            uint16_t a;
+            uint16_t b;
+        };
+
+        /// <summary>
+        /// Semantics shared by the virtual machine, constant folding and the reference interpreter.
+        /// </summary>
+        struct equationmath {
+            static constexpr double closefact = 0.00001;
+
+            /// <summary>
+            /// x != 0 in the sense of the ne operator, NaN is true.
+            /// </summary>
+            static bool truth(double x)
+            {
+                return !(fabs(x) < closefact);
+            }
+
+            /// <summary>
+            /// Truncate for the integer operators, 0 where the conversion would be undefined (NaN, infinities).
+            /// </summary>
+            static int64_t integer(double x)
+            {
+                return (fabs(x) < 9.0e18) ? (int64_t)x : 0;
+            }
+
+            static double apply(equationop op, double a, double b)
+            {
+                switch(op) {
+                case equationop::mov: return a;
+                case equationop::add: return a + b;
+                case equationop::sub: return a - b;
+                case equationop::mul: return a * b;
+                case equationop::div: return (b != 0.0) ? a / b : 0.0;
+                case equationop::mod: {
+                    // % -1 is always 0 but traps for the smallest integer
+                    int64_t d = integer(b);
+                    return (d != 0 && d != -1) ? (double)(integer(a) % d) : 0.0;
+                }
+                case equationop::pow: return ::pow(a, b);
+                case equationop::bit_or: return (double)(integer(a) | integer(b));
+                case equationop::bit_and: return (double)(integer(a) & integer(b));
+                case equationop::neg: return -a;
+                case equationop::logical_not: return truth(a) ? 0.0 : 1.0;
+                case equationop::eq: return (fabs(a - b) < closefact) ? 1.0 : 0.0;
+                case equationop::ne: return (fabs(a - b) < closefact) ? 0.0 : 1.0;
+                case equationop::lt: return (a < b) ? 1.0 : 0.0;
+                case equationop::le: return (a <= b) ? 1.0 : 0.0;
+                case equationop::gt: return (a > b) ? 1.0 : 0.0;
+                case equationop::ge: return (a >= b) ? 1.0 : 0.0;
+                case equationop::band: return (truth(a) && truth(b)) ? 1.0 : 0.0;
+                case equationop::bor: return (truth(a) || truth(b)) ? 1.0 : 0.0;
+                case equationop::sin: return ::sin(a);
+                case equationop::cos: return ::cos(a);
+                case equationop::tan: return ::tan(a);
+                case equationop::asin: return ::asin(a);
+                case equationop::acos: return ::acos(a);
+                case equationop::atan: return ::atan(a);
+                case equationop::atan2: return ::atan2(a, b);
+                case equationop::sqrt: return ::sqrt(fabs(a));
+                case equationop::sqr: return a * a;
+                case equationop::abs: return fabs(a);
+                case equationop::sign: return (a > 0.0) ? 1.0 : (a < 0.0) ? -1.0 : 0.0;
+                case equationop::min: return (a < b) ? a : b;
+                case equationop::max: return (a > b) ? a : b;
+                case equationop::exp: return ::exp(a);
+                case equationop::log: return ::log(a);
+                case equationop::log10: return ::log10(a);
+                case equationop::truncate: return ::trunc(a);
+                case equationop::floor: return ::floor(a);
+                case equationop::ceil: return ::ceil(a);
+                case equationop::invsqrt: return 1.0 / ::sqrt(a);
+                case equationop::sigmoid: {
+                    double t = 1.0 + ::exp(-a * b);
+                    return truth(t) ? 1.0 / t : 0.0;
+                }
+                case equationop::rand: {
+                    int n = (a >= 1.0) ? (int)std::min(a, (double)RAND_MAX + 1.0) : 1;
+                    return (double)(::rand() % n);
+                }
+                default:
+                    return 0.0;
+                }
+            }
+
+            /// <summary>
+            /// Result depends on the operands alone, so it can be folded and dropped when unused.
+            /// </summary>
+            static bool is_pure(equationop op)
+            {
+                return op != equationop::rand;
+            }
+
+            /// <summary>
+            /// Operation reads its b operand, the others leave it 0.
+            /// </summary>
+            static bool is_binary(equationop op)
+            {
+                switch(op) {
+                case equationop::add: case equationop::sub: case equationop::mul: case equationop::div:
+                case equationop::mod: case equationop::pow: case equationop::bit_or: case equationop::bit_and:
+                case equationop::eq: case equationop::ne: case equationop::lt: case equationop::le:
+                case equationop::gt: case equationop::ge: case equationop::band: case equationop::bor:
+                case equationop::atan2: case equationop::min: case equationop::max: case equationop::sigmoid:
+                    return true;
+                default:
+                    return false;
+                }
+            }
+        };
+
+        /// <summary>
+        /// The register file programs run on, and the names of its variables.
+        ///
+        /// Builtin variables sit at their equationvariable slots, user variables, constants and the
+        /// temporaries of compiled programs are appended as programs are compiled, so slots never move.
+        /// Programs compiled against a scope share its variables, per-frame code hands q1..q32 to
+        /// per-vertex code by simply leaving them in the registers.
+        /// </summary>
+        class equationscope {
+        public:
+            equationscope()
+            {
+                static const char *const names[] = {
+                    "time", "fps", "frame", "progress",
+                    "bass", "mid", "treb", "bass_att", "mid_att", "treb_att",
+                    "meshx", "meshy", "pixelsx", "pixelsy", "aspectx", "aspecty",
+                    "x", "y", "rad", "ang",
+                    "zoom", "zoomexp", "rot", "warp", "cx", "cy", "dx", "dy", "sx", "sy",
+                    "decay", "gamma", "echo_zoom", "echo_alpha", "echo_orient",
+                    "wave_mode", "wave_x", "wave_y", "wave_r", "wave_g", "wave_b", "wave_a",
+                    "wave_mystery", "wave_usedots", "wave_thick", "wave_additive", "wave_brighten",
+                    "ob_size", "ob_r", "ob_g", "ob_b", "ob_a",
+                    "ib_size", "ib_r", "ib_g", "ib_b", "ib_a",
+                    "mv_x", "mv_y", "mv_dx", "mv_dy", "mv_l", "mv_r", "mv_g", "mv_b", "mv_a",
+                    "darken_center", "darken", "invert", "brighten", "solarize", "wrap", "monitor",
+                    "sample", "value1", "value2", "r", "g", "b", "a", "r2", "g2", "b2", "a2",
+                    "samples", "sides", "thick", "additive", "textured", "tex_zoom", "tex_ang",
+                    "border_r", "border_g", "border_b", "border_a", "instance", "num_inst",
+                };
+                static_assert(sizeof(names) / sizeof(names[0]) == var_q1, "a builtin variable has no name");
+
+                for(auto name : names) {
+                    add(name);
+                }
+                char name[16];
+                for(int i = 1; i <= 32; ++i) {
+                    snprintf(name, sizeof(name), "q%d", i);
+                    add(name);
+                }
+                for(int i = 1; i <= 8; ++i) {
+                    snprintf(name, sizeof(name), "t%d", i);
+                    add(name);
+                }
+            }
+
+            /// <summary>
+            /// Register of a variable, created on first use. Throws std::length_error when the scope is full.
+            /// </summary>
+            uint16_t variable(textview name)
+            {
+                std::string key = lower(name);
+                auto it = m_names.find(key);
+                if(it != m_names.end()) {
+                    return it->second;
+                }
+                return add(key);
+            }
+
+            /// <summary>
+            /// Register of a variable, -1 if nothing used it.
+            /// </summary>
+            int find(textview name) const
+            {
+                auto it = m_names.find(lower(name));
+                return (it != m_names.end()) ? it->second : -1;
+            }
+
+            /// <summary>
+            /// Register holding a constant, shared by every program of the scope.
+            /// </summary>
+            uint16_t constant(double value)
+            {
+                uint64_t bits;
+                memcpy(&bits, &value, sizeof(bits));
+                auto it = m_constants.find(bits);
+                if(it != m_constants.end()) {
+                    return it->second;
+                }
+                uint16_t slot = allocate();
+                m_registers[slot] = value;
+                m_constants.emplace(bits, slot);
+                return slot;
+            }
+
+            /// <summary>
+            /// A register for a program's intermediate results.
+            /// </summary>
+            uint16_t temporary()
+            {
+                return allocate();
+            }
+
+            double &operator[] (size_t slot)
+            {
+                return m_registers[slot];
+            }
+
+            double operator[] (size_t slot) const
+            {
+                return m_registers[slot];
+            }
+
+            double *registers()
+            {
+                return m_registers.data();
+            }
+
+            const double *registers() const
+            {
+                return m_registers.data();
+            }
+
+            size_t size() const
+            {
+                return m_registers.size();
+            }
+
+            /// <summary>
+            /// Variable names and their registers, builtin and user.
+            /// </summary>
+            const std::unordered_map<std::string, uint16_t> &variables() const
+            {
+                return m_names;
+            }
+
+            static std::string lower(textview name)
+            {
+                std::string s(name.data, name.size);
+                for(auto& c : s) {
+                    c = (char)textview::lower(c);
+                }
+                return s;
+            }
+
+        private:
+            uint16_t add(const std::string &name)
+            {
+                uint16_t slot = allocate();
+                m_names.emplace(name, slot);
+                return slot;
+            }
+
+            uint16_t allocate()
+            {
+                if(m_registers.size() >= 0xFFFF) {
+                    throw std::length_error("too many registers");
+                }
+                m_registers.push_back(0.0);
+                return (uint16_t)(m_registers.size() - 1);
+            }
+
+            std::vector<double> m_registers;
+            std::unordered_map<std::string, uint16_t> m_names;
+            std::unordered_map<uint64_t, uint16_t> m_constants;
+        };
+
+        /// <summary>
+        /// Syntax tree of parsed equations. Variables are still names here, the compiler resolves them.
+        /// </summary>
+        struct equationnode {
+            enum kind_t : uint8_t {
+                constant,
+                variable,
+                operation,      // op on args[0] and args[1]
+                assign,         // name = args[0]
+                condition,      // args[0] ? args[1] : args[2], the else branch is optional
+                logical_and,
+                logical_or,
+                sequence        // every arg in turn, the value of the last
+            };
+
+            kind_t kind = constant;
+            equationop op = equationop::mov;
+            double value = 0.0;
+            std::string name;
+            std::vector<int> args;
+        };
+
+        struct equationtree {
+            std::vector<equationnode> nodes;
+            int root = -1;      // a sequence of statements
+        };
+
+        /// <summary>
+        /// Recursive descent parser, throws std::runtime_error with the offset of the error.
+        /// </summary>
+        class equationparser {
+        public:
+            static equationtree parse(textview source)
+            {
+                equationparser p(source);
+                equationtree tree;
+                p.m_tree = &tree;
+                p.next();
+                tree.root = p.parse_sequence();
+                if(p.m_token != token_end) {
+                    p.fail("unexpected input");
+                }
+                return tree;
+            }
+
+        private:
+            enum token_t {
+                token_end,
+                token_number,
+                token_name,
+                token_operator
+            };
+
+            explicit equationparser(textview source)
+                : m_source(source)
+            {}
+
+            [[noreturn]] void fail(const char *message) const
+            {
+                char buffer[160];
+                snprintf(buffer, sizeof(buffer), "%s at offset %u", message, (unsigned int)m_start);
+                throw std::runtime_error(buffer);
+            }
+
+            bool is(const char *op) const
+            {
+                return m_token == token_operator && m_text == op;
+            }
+
+            void expect(const char *op)
+            {
+                if(!is(op)) {
+                    std::string message = std::string("expected '") + op + "'";
+                    fail(message.c_str());
+                }
+                next();
+            }
+
+            void skip_space()
+            {
+                for(;;) {
+                    while(m_pos < m_source.size && (unsigned char)m_source.data[m_pos] <= ' ') {
+                        ++m_pos;
+                    }
+                    if(m_pos + 1 < m_source.size && m_source.data[m_pos] == '/' && m_source.data[m_pos + 1] == '/') {
+                        while(m_pos < m_source.size && m_source.data[m_pos] != '\n') {
+                            ++m_pos;
+                        }
+                        continue;
+                    }
+                    if(m_pos + 1 < m_source.size && m_source.data[m_pos] == '/' && m_source.data[m_pos + 1] == '*') {
+                        const char *end = strstr_n(m_source.data + m_pos + 2, m_source.size - m_pos - 2, "*/");
+                        m_pos = (nullptr != end) ? (size_t)(end - m_source.data) + 2 : m_source.size;
+                        continue;
+                    }
+                    break;
+                }
+            }
+
+            static const char *strstr_n(const char *s, size_t n, const char *what)
+            {
+                size_t w = strlen(what);
+                for(size_t i = 0; i + w <= n; ++i) {
+                    if(memcmp(s + i, what, w) == 0) {
+                        return s + i;
+                    }
+                }
+                return nullptr;
+            }
+
+            static bool is_name(char c, bool first)
+            {
+                return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || (!first && c >= '0' && c <= '9');
+            }
+
+            void next()
+            {
+                skip_space();
+                m_start = m_pos;
+                if(m_pos >= m_source.size) {
+                    m_token = token_end;
+                    m_text.clear();
+                    return;
+                }
+
+                const char *s = m_source.data;
+                char c = s[m_pos];
+                if((c >= '0' && c <= '9') || (c == '.' && m_pos + 1 < m_source.size && s[m_pos + 1] >= '0' && s[m_pos + 1] <= '9')) {
+                    // copy, the source isn't terminated
+                    size_t end = m_pos;
+                    while(end < m_source.size && ((s[end] >= '0' && s[end] <= '9') || s[end] == '.' || s[end] == 'e' || s[end] == 'E' ||
+                          ((s[end] == '+' || s[end] == '-') && (s[end - 1] == 'e' || s[end - 1] == 'E')))) {
+                        ++end;
+                    }
+                    std::string number(s + m_pos, end - m_pos);
+                    m_value = strtod(number.c_str(), nullptr);
+                    m_pos = end;
+                    m_token = token_number;
+                    return;
+                }
+                if(c == '$') {
+                    size_t end = m_pos + 1;
+                    while(end < m_source.size && is_name(s[end], false)) {
+                        ++end;
+                    }
+                    std::string name = equationscope::lower(textview(s + m_pos + 1, end - m_pos - 1));
+                    m_pos = end;
+                    m_token = token_number;
+                    if(name == "pi") {
+                        m_value = 3.14159265358979323846;
+                    }
+                    else if(name == "e") {
+                        m_value = 2.71828182845904523536;
+                    }
+                    else if(name == "phi") {
+                        m_value = 1.61803398874989484820;
+                    }
+                    else {
+                        fail("unknown constant");
+                    }
+                    return;
+                }
+                if(is_name(c, true)) {
+                    size_t end = m_pos;
+                    while(end < m_source.size && is_name(s[end], false)) {
+                        ++end;
+                    }
+                    m_text = equationscope::lower(textview(s + m_pos, end - m_pos));
+                    m_pos = end;
+                    m_token = token_name;
+                    return;
+                }
+
+                static const char *const operators[] = {
+                    "+=", "-=", "*=", "/=", "%=", "==", "!=", "<=", ">=", "&&", "||",
+                    "+", "-", "*", "/", "%", "^", "=", "<", ">", "!", "&", "|", "?", ":", "(", ")", ",", ";"
+                };
+                for(auto op : operators) {
+                    size_t n = strlen(op);
+                    if(m_pos + n <= m_source.size && memcmp(s + m_pos, op, n) == 0) {
+                        m_text = op;
+                        m_pos += n;
+                        m_token = token_operator;
+                        return;
+                    }
+                }
+                fail("unexpected character");
+            }
+
+            int add(equationnode n)
+            {
+                m_tree->nodes.push_back(std::move(n));
+                return (int)m_tree->nodes.size() - 1;
+            }
+
+            int make(equationnode::kind_t kind, equationop op, int a = -1, int b = -1, int c = -1)
+            {
+                equationnode n;
+                n.kind = kind;
+                n.op = op;
+                for(int arg : { a, b, c }) {
+                    if(arg >= 0) {
+                        n.args.push_back(arg);
+                    }
+                }
+                return add(std::move(n));
+            }
+
+            /// <summary>
+            /// Statements up to the end, a ')' or a ','.
+            /// </summary>
+            int parse_sequence()
+            {
+                equationnode seq;
+                seq.kind = equationnode::sequence;
+                for(;;) {
+                    while(is(";")) {
+                        next();
+                    }
+                    if(m_token == token_end || is(")") || is(",")) {
+                        break;
+                    }
+                    seq.args.push_back(parse_assignment());
+                    if(!is(";")) {
+                        break;
+                    }
+                }
+                return add(std::move(seq));
+            }
+
+            int parse_assignment()
+            {
+                int left = parse_ternary();
+                static const struct {
+                    const char *text;
+                    equationop op;
+                } assignments[] = {
+                    { "=", equationop::mov },
+                    { "+=", equationop::add },
+                    { "-=", equationop::sub },
+                    { "*=", equationop::mul },
+                    { "/=", equationop::div },
+                    { "%=", equationop::mod },
+                };
+                for(auto& a : assignments) {
+                    if(!is(a.text)) {
+                        continue;
+                    }
+                    if(m_tree->nodes[left].kind != equationnode::variable) {
+                        fail("can only assign to a variable");
+                    }
+                    next();
+                    int value = parse_assignment();
+                    if(a.op != equationop::mov) {
+                        // x += e is x = x + e
+                        value = make(equationnode::operation, a.op, left, value);
+                    }
+                    equationnode n;
+                    n.kind = equationnode::assign;
+                    n.name = m_tree->nodes[left].name;
+                    n.args.push_back(value);
+                    return add(std::move(n));
+                }
+                return left;
+            }
+
+            int parse_ternary()
+            {
+                int c = parse_or();
+                if(!is("?")) {
+                    return c;
+                }
+                next();
+                int a = parse_assignment();
+                int b = -1;
+                if(is(":")) {
+                    next();
+                    b = parse_assignment();
+                }
+                return make(equationnode::condition, equationop::mov, c, a, b);
+            }
+
+            int parse_or()
+            {
+                int left = parse_and();
+                while(is("||")) {
+                    next();
+                    left = make(equationnode::logical_or, equationop::mov, left, parse_and());
+                }
+                return left;
+            }
+
+            int parse_and()
+            {
+                int left = parse_bit_or();
+                while(is("&&")) {
+                    next();
+                    left = make(equationnode::logical_and, equationop::mov, left, parse_bit_or());
+                }
+                return left;
+            }
+
+            int parse_bit_or()
+            {
+                int left = parse_bit_and();
+                while(is("|")) {
+                    next();
+                    left = make(equationnode::operation, equationop::bit_or, left, parse_bit_and());
+                }
+                return left;
+            }
+
+            int parse_bit_and()
+            {
+                int left = parse_comparison();
+                while(is("&")) {
+                    next();
+                    left = make(equationnode::operation, equationop::bit_and, left, parse_comparison());
+                }
+                return left;
+            }
+
+            int parse_comparison()
+            {
+                int left = parse_additive();
+                for(;;) {
+                    equationop op;
+                    if(is("==")) {
+                        op = equationop::eq;
+                    }
+                    else if(is("!=")) {
+                        op = equationop::ne;
+                    }
+                    else if(is("<")) {
+                        op = equationop::lt;
+                    }
+                    else if(is("<=")) {
+                        op = equationop::le;
+                    }
+                    else if(is(">")) {
+                        op = equationop::gt;
+                    }
+                    else if(is(">=")) {
+                        op = equationop::ge;
+                    }
+                    else {
+                        return left;
+                    }
+                    next();
+                    left = make(equationnode::operation, op, left, parse_additive());
+                }
+            }
+
+            int parse_additive()
+            {
+                int left = parse_multiplicative();
+                while(is("+") || is("-")) {
+                    equationop op = is("+") ? equationop::add : equationop::sub;
+                    next();
+                    left = make(equationnode::operation, op, left, parse_multiplicative());
+                }
+                return left;
+            }
+
+            int parse_multiplicative()
+            {
+                int left = parse_unary();
+                while(is("*") || is("/") || is("%")) {
+                    equationop op = is("*") ? equationop::mul : is("/") ? equationop::div : equationop::mod;
+                    next();
+                    left = make(equationnode::operation, op, left, parse_unary());
+                }
+                return left;
+            }
+
+            int parse_unary()
+            {
+                if(is("-")) {
+                    next();
+                    return make(equationnode::operation, equationop::neg, parse_unary());
+                }
+                if(is("+")) {
+                    next();
+                    return parse_unary();
+                }
+                if(is("!")) {
+                    next();
+                    return make(equationnode::operation, equationop::logical_not, parse_unary());
+                }
+                return parse_power();
+            }
+
+            int parse_power()
+            {
+                int base = parse_primary();
+                if(is("^")) {
+                    next();
+                    return make(equationnode::operation, equationop::pow, base, parse_unary());
+                }
+                return base;
+            }
+
+            int parse_primary()
+            {
+                if(m_token == token_number) {
+                    equationnode n;
+                    n.kind = equationnode::constant;
+                    n.value = m_value;
+                    next();
+                    return add(std::move(n));
+                }
+                if(is("(")) {
+                    next();
+                    int seq = parse_sequence();
+                    expect(")");
+                    return seq;
+                }
+                if(m_token != token_name) {
+                    fail("expected a value");
+                }
+
+                std::string name = m_text;
+                size_t start = m_start;
+                next();
+                if(!is("(")) {
+                    equationnode n;
+                    n.kind = equationnode::variable;
+                    n.name = name;
+                    return add(std::move(n));
+                }
+
+                next();
+                std::vector<int> args;
+                if(!is(")")) {
+                    for(;;) {
+                        args.push_back(parse_sequence());
+                        if(!is(",")) {
+                            break;
+                        }
+                        next();
+                    }
+                }
+                expect(")");
+                m_start = start;
+                return call(name, args);
+            }
+
+            int call(const std::string &name, const std::vector<int> &args)
+            {
+                static const struct {
+                    const char *name;
+                    equationop op;
+                    unsigned int args;
+                } functions[] = {
+                    { "sin", equationop::sin, 1 }, { "cos", equationop::cos, 1 }, { "tan", equationop::tan, 1 },
+                    { "asin", equationop::asin, 1 }, { "acos", equationop::acos, 1 }, { "atan", equationop::atan, 1 },
+                    { "atan2", equationop::atan2, 2 }, { "sqrt", equationop::sqrt, 1 }, { "sqr", equationop::sqr, 1 },
+                    { "abs", equationop::abs, 1 }, { "sign", equationop::sign, 1 }, { "min", equationop::min, 2 },
+                    { "max", equationop::max, 2 }, { "pow", equationop::pow, 2 }, { "exp", equationop::exp, 1 },
+                    { "log", equationop::log, 1 }, { "log10", equationop::log10, 1 }, { "int", equationop::truncate, 1 },
+                    { "floor", equationop::floor, 1 }, { "ceil", equationop::ceil, 1 }, { "invsqrt", equationop::invsqrt, 1 },
+                    { "sigmoid", equationop::sigmoid, 2 }, { "rand", equationop::rand, 1 }, { "above", equationop::gt, 2 },
+                    { "below", equationop::lt, 2 }, { "equal", equationop::eq, 2 }, { "band", equationop::band, 2 },
+                    { "bor", equationop::bor, 2 }, { "bnot", equationop::logical_not, 1 },
+                };
+
+                if(name == "if") {
+                    if(args.size() != 3) {
+                        fail("if takes 3 arguments");
+                    }
+                    return make(equationnode::condition, equationop::mov, args[0], args[1], args[2]);
+                }
+                for(auto& f : functions) {
+                    if(name == f.name) {
+                        if(args.size() != f.args) {
+                            fail("wrong number of arguments");
+                        }
+                        return make(equationnode::operation, f.op, args[0], (f.args > 1) ? args[1] : -1);
+                    }
+                }
+                fail("unknown function");
+            }
+
+            textview m_source;
+            size_t m_pos = 0;
+            size_t m_start = 0;
+            token_t m_token = token_end;
+            std::string m_text;
+            double m_value = 0.0;
+            equationtree *m_tree = nullptr;
+        };
+
+        struct equationstatistics {
+            unsigned int nodes = 0;             // in the syntax tree
+            unsigned int folded = 0;            // operations replaced by their constant result
+            unsigned int dead_stores = 0;       // assignments overwritten before anything read them
+            unsigned int instructions = 0;
+        };
+
+        /// <summary>
+        /// Compiled equations, a flat array of instructions run by a switch loop.
+        /// Only valid with the registers of the scope it was compiled against.
+        /// </summary>
+        class equationprogram {
+        public:
+            void run(double *r) const
+            {
+                const equationinstruction *code = m_code.data();
+                const size_t count = m_code.size();
+                for(size_t pc = 0; pc < count; ++pc) {
+                    const equationinstruction &i = code[pc];
+                    switch(i.op) {
+                    case equationop::mov:
+                        r[i.dst] = r[i.a];
+                        break;
+                    case equationop::add:
+                        r[i.dst] = r[i.a] + r[i.b];
+                        break;
+                    case equationop::sub:
+                        r[i.dst] = r[i.a] - r[i.b];
+                        break;
+                    case equationop::mul:
+                        r[i.dst] = r[i.a] * r[i.b];
+                        break;
+                    case equationop::neg:
+                        r[i.dst] = -r[i.a];
+                        break;
+                    case equationop::sin:
+                        r[i.dst] = ::sin(r[i.a]);
+                        break;
+                    case equationop::cos:
+                        r[i.dst] = ::cos(r[i.a]);
+                        break;
+                    case equationop::jump:
+                        // jumps only go forward, the target is never 0
+                        pc = (size_t)i.dst - 1;
+                        break;
+                    case equationop::jz:
+                        if(!equationmath::truth(r[i.a])) {
+                            pc = (size_t)i.dst - 1;
+                        }
+                        break;
+                    case equationop::jnz:
+                        if(equationmath::truth(r[i.a])) {
+                            pc = (size_t)i.dst - 1;
+                        }
+                        break;
+                    default:
+                        r[i.dst] = equationmath::apply(i.op, r[i.a], r[i.b]);
+                        break;
+                    }
+                }
+            }
+
+            void run(equationscope &scope) const
+            {
+                run(scope.registers());
+            }
+
+            bool empty() const
+            {
+                return m_code.empty();
+            }
+
+            const std::vector<equationinstruction> &code() const
+            {
+                return m_code;
+            }
+
+            const equationstatistics &statistics() const
+            {
+                return m_statistics;
+            }
+
+        private:
+            friend class equationcompiler;
+
+            std::vector<equationinstruction> m_code;
+            equationstatistics m_statistics;
+        };
+
+        /// <summary>
+        /// Turns a syntax tree into an equationprogram: folds constant operations and branches,
+        /// drops statements without effect and stores overwritten before they are read,
+        /// resolves names to registers and emits three-address code writing results straight
+        /// into the variables they are assigned to.
+        /// </summary>
+        class equationcompiler {
+        public:
+            equationcompiler(equationscope &scope, equationtree &tree, equationprogram &program)
+                : m_scope(scope), m_tree(tree), m_program(program)
+            {}
+
+            void compile()
+            {
+                m_program.m_code.clear();
+                m_program.m_statistics = equationstatistics();
+                m_program.m_statistics.nodes = (unsigned int)m_tree.nodes.size();
+
+                int root = fold(m_tree.root);
+                std::vector<int> statements = (node(root).kind == equationnode::sequence) ? node(root).args : std::vector<int>(1, root);
+                eliminate_dead_stores(statements);
+
+                for(int s : statements) {
+                    release(generate(s, -1));
+                }
+                m_program.m_statistics.instructions = (unsigned int)m_program.m_code.size();
+            }
+
+        private:
+            equationnode &node(int i)
+            {
+                return m_tree.nodes[i];
+            }
+
+            int constant_node(double value)
+            {
+                equationnode n;
+                n.kind = equationnode::constant;
+                n.value = value;
+                m_tree.nodes.push_back(n);
+                return (int)m_tree.nodes.size() - 1;
+            }
+
+            bool is_constant(int i)
+            {
+                return node(i).kind == equationnode::constant;
+            }
+
+            bool is_constant(int i, double value)
+            {
+                return is_constant(i) && node(i).value == value;
+            }
+
+            /// <summary>
+            /// No assignment and no rand() anywhere below.
+            /// </summary>
+            bool is_pure(int i)
+            {
+                equationnode &n = node(i);
+                if(n.kind == equationnode::assign || (n.kind == equationnode::operation && !equationmath::is_pure(n.op))) {
+                    return false;
+                }
+                for(int a : n.args) {
+                    if(!is_pure(a)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            bool reads(int i, const std::string &name)
+            {
+                equationnode &n = node(i);
+                if(n.kind == equationnode::variable && n.name == name) {
+                    return true;
+                }
+                for(int a : n.args) {
+                    if(reads(a, name)) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            // whether node i assigns the variable in register slot
+            bool writes(int i, int slot)
+            {
+                equationnode &n = node(i);
+                if(n.kind == equationnode::assign && m_scope.find(textview(n.name.data(), n.name.size())) == slot) {
+                    return true;
+                }
+                for(int a : n.args) {
+                    if(writes(a, slot)) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            int fold(int i)
+            {
+                for(size_t k = 0; k < node(i).args.size(); ++k) {
+                    int a = fold(node(i).args[k]);
+                    node(i).args[k] = a;
+                }
+
+                equationnode &n = node(i);
+                switch(n.kind) {
+                case equationnode::operation: {
+                    int a = n.args[0];
+                    int b = (n.args.size() > 1) ? n.args[1] : -1;
+                    if(equationmath::is_pure(n.op) && is_constant(a) && (b < 0 || is_constant(b))) {
+                        double value = equationmath::apply(n.op, node(a).value, (b < 0) ? 0.0 : node(b).value);
+                        m_program.m_statistics.folded++;
+                        return constant_node(value);
+                    }
+                    // x - 0, x * 1, x / 1 and 1 * x are x, x + 0 and x - -0 aren't when x is -0
+                    if((n.op == equationop::sub && is_constant(b, 0.0) && !signbit(node(b).value)) || (n.op == equationop::mul && is_constant(b, 1.0)) ||
+                        (n.op == equationop::div && is_constant(b, 1.0))) {
+                        m_program.m_statistics.folded++;
+                        return a;
+                    }
+                    if(n.op == equationop::mul && is_constant(a, 1.0)) {
+                        m_program.m_statistics.folded++;
+                        return b;
+                    }
+                    return i;
+                }
+                case equationnode::condition:
+                    if(is_constant(n.args[0])) {
+                        m_program.m_statistics.folded++;
+                        if(equationmath::truth(node(n.args[0]).value)) {
+                            return n.args[1];
+                        }
+                        return (n.args.size() > 2) ? n.args[2] : constant_node(0.0);
+                    }
+                    return i;
+                case equationnode::logical_and:
+                case equationnode::logical_or:
+                    if(is_constant(n.args[0])) {
+                        m_program.m_statistics.folded++;
+                        bool left = equationmath::truth(node(n.args[0]).value);
+                        int right = n.args[1];
+                        if(left == (n.kind == equationnode::logical_or)) {
+                            return constant_node(left ? 1.0 : 0.0);
+                        }
+                        if(is_constant(right)) {
+                            return constant_node(equationmath::truth(node(right).value) ? 1.0 : 0.0);
+                        }
+                        equationnode test;
+                        test.kind = equationnode::operation;
+                        test.op = equationop::ne;
+                        test.args.push_back(right);
+                        test.args.push_back(constant_node(0.0));
+                        m_tree.nodes.push_back(test);
+                        return (int)m_tree.nodes.size() - 1;
+                    }
+                    return i;
+                case equationnode::sequence: {
+                    // only the last value is used, pure statements before it do nothing
+                    std::vector<int> kept;
+                    for(size_t k = 0; k < n.args.size(); ++k) {
+                        if(k + 1 == n.args.size() || !is_pure(n.args[k])) {
+                            kept.push_back(n.args[k]);
+                        }
+                    }
+                    if(kept.size() == 1) {
+                        return kept[0];
+                    }
+                    node(i).args = kept;
+                    return i;
+                }
+                default:
+                    return i;
+                }
+            }
+
+            /// <summary>
+            /// Drop top-level statements whose effect is lost: pure expressions, "x = x" and assignments
+            /// of pure values that a later statement overwrites before anything reads them.
+            /// Conditional stores inside if(), ?: and && / || never kill an earlier one.
+            /// </summary>
+            void eliminate_dead_stores(std::vector<int> &statements)
+            {
+                std::vector<int> kept;
+                for(size_t k = 0; k < statements.size(); ++k) {
+                    equationnode &n = node(statements[k]);
+                    if(n.kind != equationnode::assign) {
+                        if(!is_pure(statements[k])) {
+                            kept.push_back(statements[k]);
+                        }
+                        continue;
+                    }
+                    const equationnode &value = node(n.args[0]);
+                    if(value.kind == equationnode::variable && value.name == n.name) {
+                        m_program.m_statistics.dead_stores++;
+                        continue;
+                    }
+
+                    bool dead = false;
+                    if(is_pure(n.args[0])) {
+                        for(size_t j = k + 1; j < statements.size(); ++j) {
+                            if(reads(statements[j], n.name)) {
+                                break;
+                            }
+                            if(node(statements[j]).kind == equationnode::assign && node(statements[j]).name == n.name) {
+                                dead = true;
+                                break;
+                            }
+                        }
+                    }
+                    if(dead) {
+                        m_program.m_statistics.dead_stores++;
+                    }
+                    else {
+                        kept.push_back(statements[k]);
+                    }
+                }
+                statements.swap(kept);
+            }
+
+            void emit(equationop op, int dst, int a = 0, int b = 0)
+            {
+                if(m_program.m_code.size() >= 0xFFFF) {
+                    throw std::length_error("program too long");
+                }
+                equationinstruction i;
+                i.op = op;
+                i.unused = 0;
+                i.dst = (uint16_t)dst;
+                i.a = (uint16_t)a;
+                i.b = (uint16_t)b;
+                m_program.m_code.push_back(i);
+            }
+
+            size_t here() const
+            {
+                return m_program.m_code.size();
+            }
+
+            void patch(size_t jump)
+            {
+                m_program.m_code[jump].dst = (uint16_t)here();
+            }
+
+            int temporary()
+            {
+                if(!m_free.empty()) {
+                    int t = m_free.back();
+                    m_free.pop_back();
+                    return t;
+                }
+                int t = m_scope.temporary();
+                if(m_temporaries.size() <= (size_t)t) {
+                    m_temporaries.resize(t + 1, false);
+                }
+                m_temporaries[t] = true;
+                return t;
+            }
+
+            void release(int slot)
+            {
+                if(slot >= 0 && (size_t)slot < m_temporaries.size() && m_temporaries[slot]) {
+                    m_free.push_back(slot);
+                }
+            }
+
+            int move(int slot, int want)
+            {
+                if(want >= 0 && want != slot) {
+                    emit(equationop::mov, want, slot);
+                    release(slot);
+                    return want;
+                }
+                return slot;
+            }
+
+            /// <summary>
+            /// Emit node i and return the register holding its value, want if that isn't -1.
+            /// Variables and constants need no code, their own register is returned.
+            /// </summary>
+            int generate(int i, int want)
+            {
+                // copy, generating children adds nodes
+                equationnode n = node(i);
+                switch(n.kind) {
+                case equationnode::constant:
+                    return move(m_scope.constant(n.value), want);
+                case equationnode::variable:
+                    return move(m_scope.variable(textview(n.name.data(), n.name.size())), want);
+                case equationnode::assign: {
+                    int slot = m_scope.variable(textview(n.name.data(), n.name.size()));
+                    generate(n.args[0], slot);
+                    return move(slot, want);
+                }
+                case equationnode::operation: {
+                    int a = generate(n.args[0], -1);
+                    int b = 0;
+                    if(n.args.size() > 1) {
+                        // "x + (x = 1)" and "(x = x + 1) - (x = 10)" read x before the second assignment
+                        if(!is_temporary(a) && writes(n.args[1], a)) {
+                            int t = temporary();
+                            emit(equationop::mov, t, a);
+                            a = t;
+                        }
+                        b = generate(n.args[1], -1);
+                    }
+                    release(a);
+                    release(b);
+                    int dst = (want >= 0) ? want : temporary();
+                    emit(n.op, dst, a, b);
+                    return dst;
+                }
+                case equationnode::condition: {
+                    int dst = (want >= 0) ? want : temporary();
+                    int c = generate(n.args[0], -1);
+                    release(c);
+                    size_t skip_then = here();
+                    emit(equationop::jz, 0, c);
+                    generate(n.args[1], dst);
+                    size_t skip_else = here();
+                    emit(equationop::jump, 0);
+                    patch(skip_then);
+                    if(n.args.size() > 2) {
+                        generate(n.args[2], dst);
+                    }
+                    else {
+                        emit(equationop::mov, dst, m_scope.constant(0.0));
+                    }
+                    patch(skip_else);
+                    return dst;
+                }
+                case equationnode::logical_and:
+                case equationnode::logical_or: {
+                    bool is_or = (n.kind == equationnode::logical_or);
+                    int dst = (want >= 0) ? want : temporary();
+                    int left = generate(n.args[0], -1);
+                    release(left);
+                    size_t shortcut = here();
+                    emit(is_or ? equationop::jnz : equationop::jz, 0, left);
+                    int right = generate(n.args[1], -1);
+                    release(right);
+                    emit(equationop::ne, dst, right, m_scope.constant(0.0));
+                    size_t skip = here();
+                    emit(equationop::jump, 0);
+                    patch(shortcut);
+                    emit(equationop::mov, dst, m_scope.constant(is_or ? 1.0 : 0.0));
+                    patch(skip);
+                    return dst;
+                }
+                case equationnode::sequence: {
+                    if(n.args.empty()) {
+                        return move(m_scope.constant(0.0), want);
+                    }
+                    for(size_t k = 0; k + 1 < n.args.size(); ++k) {
+                        release(generate(n.args[k], -1));
+                    }
+                    return generate(n.args.back(), want);
+                }
+                }
+                return move(m_scope.constant(0.0), want);
+            }
+
+            bool is_temporary(int slot) const
+            {
+                return (size_t)slot < m_temporaries.size() && m_temporaries[slot];
+            }
+
+            equationscope &m_scope;
+            equationtree &m_tree;
+            equationprogram &m_program;
+            std::vector<bool> m_temporaries;
+            std::vector<int> m_free;
+        };
+
+        /// <summary>
+        /// Compile equations against a scope. On failure the program is left empty, the scope may
+        /// have gained variables, and error gets a message if it isn't null.
+        /// </summary>
+        inline bool compile_equations(textview source, equationscope &scope, equationprogram &program, std::string *error = nullptr)
+        {
+            try {
+                equationtree tree = equationparser::parse(source);
+                equationcompiler(scope, tree, program).compile();
+                return true;
+            }
+            catch(const std::exception &e) {
+                program = equationprogram();
+                if(nullptr != error) {
+                    *error = e.what();
+                }
+                return false;
+            }
+        }
+
+        /// <summary>
+        /// Walks the syntax tree and looks variables up by name on every access, the way equations
+        /// would run without compiling them. The reference for correctness and speed of equationprogram.
+        /// </summary>
+        class treeinterpreter {
+        public:
+            typedef std::unordered_map<std::string, double> variables;
+
+            bool compile(textview source, std::string *error = nullptr)
+            {
+                try {
+                    m_tree = equationparser::parse(source);
+                    return true;
+                }
+                catch(const std::exception &e) {
+                    m_tree = equationtree();
+                    if(nullptr != error) {
+                        *error = e.what();
+                    }
+                    return false;
+                }
+            }
+
+            void run(variables &vars) const
+            {
+                if(m_tree.root >= 0) {
+                    evaluate(m_tree.root, vars);
+                }
+            }
+
+        private:
+            double evaluate(int i, variables &vars) const
+            {
+                const equationnode &n = m_tree.nodes[i];
+                switch(n.kind) {
+                case equationnode::constant:
+                    return n.value;
+                case equationnode::variable:
+                    return vars[n.name];
+                case equationnode::assign: {
+                    double value = evaluate(n.args[0], vars);
+                    vars[n.name] = value;
+                    return value;
+                }
+                case equationnode::operation: {
+                    double a = evaluate(n.args[0], vars);
+                    double b = (n.args.size() > 1) ? evaluate(n.args[1], vars) : 0.0;
+                    return equationmath::apply(n.op, a, b);
+                }
+                case equationnode::condition:
+                    if(equationmath::truth(evaluate(n.args[0], vars))) {
+                        return evaluate(n.args[1], vars);
+                    }
+                    return (n.args.size() > 2) ? evaluate(n.args[2], vars) : 0.0;
+                case equationnode::logical_and:
+                    return (equationmath::truth(evaluate(n.args[0], vars)) && equationmath::truth(evaluate(n.args[1], vars))) ? 1.0 : 0.0;
+                case equationnode::logical_or:
+                    return (equationmath::truth(evaluate(n.args[0], vars)) || equationmath::truth(evaluate(n.args[1], vars))) ? 1.0 : 0.0;
+                case equationnode::sequence: {
+                    double value = 0.0;
+                    for(int a : n.args) {
+                        value = evaluate(a, vars);
+                    }
+                    return value;
+                }
+                }
+                return 0.0;
+            }
+
+            equationtree m_tree;
+        };
+
+    } /* End of namespace milk */
+
+} /* End of namespace dx */
@@ -0,0 +1,487 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "MappedFile.h"
+
+namespace dx {
+
+    namespace milk {
+
+        /// <summary>
+        /// Non-owning view of characters, valid as long as the memory it points into.
+        /// </summary>
+        struct textview {
+            const char *data = nullptr;
+            size_t size = 0;
+
+            textview() {}
+            textview(const char *d, size_t s) : data(d), size(s) {}
+            textview(const char *s) : data(s), size(strlen(s)) {}
+            textview(const std::string &s) : data(s.data()), size(s.size()) {}
+
+            bool empty() const
+            {
+                return size == 0;
+            }
+
+            const char *begin() const
+            {
+                return data;
+            }
+
+            const char *end() const
+            {
+                return data + size;
+            }
+
+            bool equals(textview t) const
+            {
+                return size == t.size && (size == 0 || memcmp(data, t.data, size) == 0);
+            }
+
+            /// <summary>
+            /// ASCII case-insensitive, as MilkDrop reads its keys.
+            /// </summary>
+            bool iequals(textview t) const
+            {
+                return size == t.size && icompare(*this, t) == 0;
+            }
+
+            bool starts_with(textview t) const
+            {
+                return size >= t.size && memcmp(data, t.data, t.size) == 0;
+            }
+
+            textview substr(size_t offset, size_t count = (size_t)-1) const
+            {
+                offset = std::min(offset, size);
+                return textview(data + offset, std::min(count, size - offset));
+            }
+
+            std::string str() const
+            {
+                return std::string(data, size);
+            }
+
+            static int icompare(textview a, textview b)
+            {
+                size_t n = std::min(a.size, b.size);
+                for(size_t i = 0; i < n; ++i) {
+                    int x = lower(a.data[i]), y = lower(b.data[i]);
+                    if(x != y) {
+                        return x - y;
+                    }
+                }
+                return (a.size < b.size) ? -1 : (a.size > b.size) ? 1 : 0;
+            }
+
+            static int lower(char c)
+            {
+                return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : (unsigned char)c;
+            }
+        };
+
+        /// <summary>
+        /// The equation and shader blocks of a preset. per_pixel is the per-vertex code of the warp mesh,
+        /// wave_per_point runs for every sample of a custom wave.
+        /// </summary>
+        enum class codeblock : uint8_t {
+            per_frame_init,
+            per_frame,
+            per_pixel,
+            warp_shader,
+            comp_shader,
+            wave_init,
+            wave_per_frame,
+            wave_per_point,
+            shape_init,
+            shape_per_frame,
+            count
+        };
+
+        struct keyvalue {
+            textview key;
+            textview value;
+            unsigned int section = 0;   // index into preset::sections(), 0 for lines before the first header
+        };
+
+        /// <summary>
+        /// One line of a code block, in the order of its number in the file ("per_frame_12" is number 12).
+        /// </summary>
+        struct codeline {
+            codeblock block;
+            unsigned int instance;      // custom wave or shape 0..3, 0 otherwise
+            unsigned int number;
+            textview text;
+        };
+
+        struct coderange {
+            const codeline *first = nullptr;
+            const codeline *last = nullptr;
+
+            const codeline *begin() const
+            {
+                return first;
+            }
+
+            const codeline *end() const
+            {
+                return last;
+            }
+
+            bool empty() const
+            {
+                return first == last;
+            }
+
+            size_t size() const
+            {
+                return (size_t)(last - first);
+            }
+
+            /// <summary>
+            /// The lines joined with newlines, the one place a copy is made.
+            /// </summary>
+            std::string source() const
+            {
+                std::string s;
+                for(const codeline *l = first; l != last; ++l) {
+                    s.append(l->text.data, l->text.size);
+                    s.push_back('\n');
+                }
+                return s;
+            }
+        };
+
+        /// <summary>
+        /// A parsed .milk preset.
+        ///
+        /// The file is memory-mapped and every key, value and code line is a textview into the mapping,
+        /// parsing allocates only the arrays of views. Values are looked up case-insensitively, the first
+        /// of duplicate keys wins. Code lines ("per_frame_3=", "wave_1_per_point2=", "warp_1=`...") are
+        /// taken out of the values and grouped by block, the backtick of shader lines is dropped.
+        /// A preset is movable but not copyable, views stay valid when it moves.
+        /// </summary>
+        class preset {
+        public:
+            preset() {}
+
+            explicit preset(const std::string &path)
+            {
+                open(path);
+            }
+
+            preset(const preset &) = delete;
+            preset &operator= (const preset &) = delete;
+            preset(preset &&) = default;
+            preset &operator= (preset &&) = default;
+
+            /// <summary>
+            /// Map and parse a file, returns false if it can't be read.
+            /// </summary>
+            bool open(const std::string &path)
+            {
+                clear();
+                if(!m_file.open(path)) {
+                    return false;
+                }
+                parse_text(m_file.data(), m_file.size());
+                return true;
+            }
+
+            /// <summary>
+            /// Parse text owned by the caller, it must outlive the preset.
+            /// </summary>
+            void parse(const char *text, size_t size)
+            {
+                clear();
+                parse_text(text, size);
+            }
+
+            void clear()
+            {
+                m_file.close();
+                m_text = textview();
+                m_sections.assign(1, textview());
+                m_values.clear();
+                m_sorted.clear();
+                m_code.clear();
+            }
+
+            /// <summary>
+            /// The whole file.
+            /// </summary>
+            textview text() const
+            {
+                return m_text;
+            }
+
+            /// <summary>
+            /// Section names without brackets, the first is the unnamed part before any header.
+            /// </summary>
+            const std::vector<textview> &sections() const
+            {
+                return m_sections;
+            }
+
+            /// <summary>
+            /// Key/value lines in file order, without the code lines.
+            /// </summary>
+            const std::vector<keyvalue> &values() const
+            {
+                return m_values;
+            }
+
+            const std::vector<codeline> &code() const
+            {
+                return m_code;
+            }
+
+            /// <summary>
+            /// Empty view when the key is missing.
+            /// </summary>
+            textview value(textview key) const
+            {
+                const keyvalue *kv = find(key);
+                return (nullptr != kv) ? kv->value : textview();
+            }
+
+            bool has(textview key) const
+            {
+                return nullptr != find(key);
+            }
+
+            double number(textview key, double fallback = 0.0) const
+            {
+                const keyvalue *kv = find(key);
+                if(nullptr == kv || kv->value.empty()) {
+                    return fallback;
+                }
+                // values end at a newline or the end of the mapping, copy the few characters strtod reads
+                char buffer[64];
+                size_t n = std::min(kv->value.size, sizeof(buffer) - 1);
+                memcpy(buffer, kv->value.data, n);
+                buffer[n] = '\0';
+                char *end = nullptr;
+                double d = strtod(buffer, &end);
+                return (end == buffer) ? fallback : d;
+            }
+
+            coderange code(codeblock block, unsigned int instance = 0) const
+            {
+                codeline key;
+                key.block = block;
+                key.instance = instance;
+                auto range = std::equal_range(m_code.begin(), m_code.end(), key, [](const codeline &a, const codeline &b) {
+                    return (a.block != b.block) ? a.block < b.block : a.instance < b.instance;
+                });
+                coderange r;
+                r.first = m_code.data() + (range.first - m_code.begin());
+                r.last = m_code.data() + (range.second - m_code.begin());
+                return r;
+            }
+
+        private:
+            static bool is_space(char c)
+            {
+                return c == ' ' || c == '\t' || c == '\r';
+            }
+
+            static textview trim(const char *b, const char *e)
+            {
+                while(b < e && is_space(*b)) {
+                    ++b;
+                }
+                while(e > b && is_space(e[-1])) {
+                    --e;
+                }
+                return textview(b, (size_t)(e - b));
+            }
+
+            /// <summary>
+            /// Read a decimal number, optionally after an underscore, off the front of rest. Returns false if there is none.
+            /// </summary>
+            static bool read_number(textview &rest, unsigned int &n)
+            {
+                size_t i = 0;
+                if(i < rest.size && rest.data[i] == '_') {
+                    ++i;
+                }
+                size_t digits = i;
+                n = 0;
+                while(i < rest.size && rest.data[i] >= '0' && rest.data[i] <= '9') {
+                    n = n * 10 + (unsigned int)(rest.data[i] - '0');
+                    ++i;
+                }
+                if(i == digits) {
+                    return false;
+                }
+                rest = rest.substr(i);
+                return true;
+            }
+
+            static bool consume(textview &rest, textview prefix)
+            {
+                if(rest.size < prefix.size || textview::icompare(rest.substr(0, prefix.size), prefix) != 0) {
+                    return false;
+                }
+                rest = rest.substr(prefix.size);
+                return true;
+            }
+
+            /// <summary>
+            /// Recognise the key of a code line, "per_frame_init_1" or "shape_2_per_frame7".
+            /// </summary>
+            static bool code_key(textview key, codeline &line)
+            {
+                static const struct {
+                    const char *prefix;
+                    codeblock block;
+                } plain[] = {
+                    { "per_frame_init", codeblock::per_frame_init },
+                    { "per_frame", codeblock::per_frame },
+                    { "per_pixel", codeblock::per_pixel },
+                    { "warp", codeblock::warp_shader },
+                    { "comp", codeblock::comp_shader },
+                };
+                static const struct {
+                    const char *suffix;
+                    codeblock block;
+                } waves[] = {
+                    { "_init", codeblock::wave_init },
+                    { "_per_frame", codeblock::wave_per_frame },
+                    { "_per_point", codeblock::wave_per_point },
+                }, shapes[] = {
+                    { "_init", codeblock::shape_init },
+                    { "_per_frame", codeblock::shape_per_frame },
+                };
+
+                line.instance = 0;
+                for(auto& p : plain) {
+                    textview rest = key;
+                    if(consume(rest, p.prefix) && read_number(rest, line.number) && rest.empty()) {
+                        line.block = p.block;
+                        return true;
+                    }
+                }
+
+                textview rest = key;
+                bool wave = consume(rest, "wave");
+                if(!wave && !consume(rest, "shape")) {
+                    return false;
+                }
+                if(!read_number(rest, line.instance)) {
+                    return false;
+                }
+                const size_t count = wave ? sizeof(waves) / sizeof(waves[0]) : sizeof(shapes) / sizeof(shapes[0]);
+                for(size_t i = 0; i < count; ++i) {
+                    textview r = rest;
+                    if(consume(r, wave ? waves[i].suffix : shapes[i].suffix) && read_number(r, line.number) && r.empty()) {
+                        line.block = wave ? waves[i].block : shapes[i].block;
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            void parse_text(const char *text, size_t size)
+            {
+                m_text = textview(text, size);
+                const char *p = text;
+                const char *end = text + size;
+                if(size >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0) {
+                    p += 3;
+                }
+
+                while(p < end) {
+                    const char *eol = (const char*)memchr(p, '\n', (size_t)(end - p));
+                    if(nullptr == eol) {
+                        eol = end;
+                    }
+                    textview line = trim(p, eol);
+                    p = (eol < end) ? eol + 1 : end;
+
+                    if(line.empty() || line.data[0] == ';' || line.data[0] == '#') {
+                        continue;
+                    }
+                    if(line.data[0] == '[') {
+                        const char *close = (const char*)memchr(line.data, ']', line.size);
+                        if(nullptr != close) {
+                            m_sections.push_back(trim(line.data + 1, close));
+                        }
+                        continue;
+                    }
+                    const char *equals = (const char*)memchr(line.data, '=', line.size);
+                    if(nullptr == equals) {
+                        continue;
+                    }
+
+                    textview key = trim(line.data, equals);
+                    // code keeps its leading spaces, values don't
+                    textview value(equals + 1, (size_t)(line.end() - equals - 1));
+
+                    codeline code;
+                    if(code_key(key, code)) {
+                        if(code.block == codeblock::warp_shader || code.block == codeblock::comp_shader) {
+                            if(!value.empty() && value.data[0] == '`') {
+                                value = value.substr(1);
+                            }
+                        }
+                        code.text = value;
+                        m_code.push_back(code);
+                        continue;
+                    }
+
+                    keyvalue kv;
+                    kv.key = key;
+                    kv.value = trim(value.begin(), value.end());
+                    kv.section = (unsigned int)m_sections.size() - 1;
+                    m_values.push_back(kv);
+                }
+
+                // lines are numbered, MilkDrop runs them in number order whatever order the file has them in
+                std::stable_sort(m_code.begin(), m_code.end(), [](const codeline &a, const codeline &b) {
+                    if(a.block != b.block) {
+                        return a.block < b.block;
+                    }
+                    return (a.instance != b.instance) ? a.instance < b.instance : a.number < b.number;
+                });
+
+                m_sorted.resize(m_values.size());
+                for(size_t i = 0; i < m_sorted.size(); ++i) {
+                    m_sorted[i] = (uint32_t)i;
+                }
+                std::stable_sort(m_sorted.begin(), m_sorted.end(), [this](uint32_t a, uint32_t b) {
+                    return textview::icompare(m_values[a].key, m_values[b].key) < 0;
+                });
+            }
+
+            const keyvalue *find(textview key) const
+            {
+                auto it = std::lower_bound(m_sorted.begin(), m_sorted.end(), key, [this](uint32_t i, textview k) {
+                    return textview::icompare(m_values[i].key, k) < 0;
+                });
+                if(it == m_sorted.end() || !m_values[*it].key.iequals(key)) {
+                    return nullptr;
+                }
+                return &m_values[*it];
+            }
+
+            mappedfile m_file;
+            textview m_text;
+            std::vector<textview> m_sections = std::vector<textview>(1);
+            std::vector<keyvalue> m_values;
+            std::vector<uint32_t> m_sorted;     // m_values by key
+            std::vector<codeline> m_code;       // by block, instance, number
+        };
+
+    } /* End of namespace milk */
+
+} /* End of namespace dx */
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+
+#include "DirectXPlus.h"
+#include "FrameWriter.h"
+#include "ReadbackRing.h"
+#include "RenderTargetPool.h"
+
+namespace dx {
+
+    namespace d3d11 {
+
+        /// <summary>
+        /// The simulated clock of an offline frame, time is frame / fps whatever the frame took to render.
+        /// </summary>
+        struct offlineframe {
+            uint64_t frame = 0;
+            double time = 0.0;
+            double delta = 0.0;
+            unsigned int width = 0;
+            unsigned int height = 0;
+        };
+
+        struct offlinestatistics {
+            uint64_t frames = 0;        // handed to the writer
+            double seconds = 0.0;       // wall time of render(), including the wait for the writer
+            bool write_failed = false;
+
+            double fps() const
+            {
+                return (seconds > 0.0) ? (double)frames / seconds : 0.0;
+            }
+        };
+
+        /// <summary>
+        /// Renders frames into offscreen targets as fast as the GPU and the writer allow, without a window.
+        ///
+        /// Each frame is drawn into a color and a depth target, read back through a readbackring and
+        /// pushed to a framewriter, so drawing, the copy to the CPU and the file output overlap.
+        /// Unlike on screen, no frame is ever dropped: the renderer waits when the ring or the writer is full.
+        /// The color format must be 8-bit RGBA or BGRA. Multisampled color is resolved before the read back.
+        /// </summary>
+        class offlinerenderer {
+        public:
+            typedef std::function<void(devicecontext &context, const rendertarget &color, const rendertarget &depth, const offlineframe &frame)> drawfunction;
+
+            offlinerenderer(const device &dev, const devicecontext &context, unsigned int width, unsigned int height, DXGI_FORMAT format = DXGI_FORMAT_R8G8B8A8_UNORM, unsigned int sample_count = 1, unsigned int staging_count = 3)
+                : m_context(context), m_targets(dev), m_readback(dev, context, staging_count), m_width(width), m_height(height)
+            {
+                switch(format) {
+                case DXGI_FORMAT_R8G8B8A8_UNORM:
+                case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+                    m_bgra = false;
+                    break;
+                case DXGI_FORMAT_B8G8R8A8_UNORM:
+                case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+                    m_bgra = true;
+                    break;
+                default:
+                    throw runtime_error(E_INVALIDARG);
+                }
+                m_color = m_targets.acquire(rendertargetdesc(width, height, format, D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE, sample_count));
+                m_depth = m_targets.acquire(rendertargetdesc(width, height, DXGI_FORMAT_D24_UNORM_S8_UINT, D3D11_BIND_DEPTH_STENCIL, sample_count));
+                if(sample_count > 1) {
+                    // multisampled textures can't be copied to staging, they are resolved first
+                    m_resolved = m_targets.acquire(rendertargetdesc(width, height, format, D3D11_BIND_SHADER_RESOURCE));
+                }
+            }
+
+            offlinerenderer(const offlinerenderer &) = delete;
+            offlinerenderer &operator= (const offlinerenderer &) = delete;
+
+            /// <summary>
+            /// Render frames first_frame .. first_frame + frames - 1 at fps simulated frames per second.
+            /// Stops early when the writer fails. The writer is left open, finish() it when done.
+            /// </summary>
+            offlinestatistics render(uint64_t first_frame, uint64_t frames, double fps, const drawfunction &draw, framewriter &writer)
+            {
+                typedef std::chrono::steady_clock clock;
+                clock::time_point start = clock::now();
+                offlinestatistics result;
+
+                auto consume = [&](const readbackframe &f) {
+                    if(!result.write_failed) {
+                        result.write_failed = !writer.push(f.data, f.row_pitch, m_bgra);
+                        result.frames += result.write_failed ? 0 : 1;
+                    }
+                };
+
+                const unsigned int keep = m_readback.staging_count() - 1;
+                for(uint64_t i = 0; i < frames && !result.write_failed; ++i) {
+                    offlineframe f;
+                    f.frame = first_frame + i;
+                    f.time = (double)f.frame / fps;
+                    f.delta = 1.0 / fps;
+                    f.width = m_width;
+                    f.height = m_height;
+                    draw(m_context, m_color, m_depth, f);
+
+                    // make room first, read() would drop the frame otherwise
+                    m_readback.drain(consume, keep);
+                    if(m_resolved.is_valid()) {
+                        m_context.resolve_subresource(m_resolved.texture, 0, m_color.texture, 0, m_color.desc.format);
+                        m_readback.read(m_resolved.texture, f.frame);
+                    }
+                    else {
+                        m_readback.read(m_color.texture, f.frame);
+                    }
+                }
+                m_readback.drain(consume, 0);
+
+                result.seconds = std::chrono::duration<double>(clock::now() - start).count();
+                return result;
+            }
+
+            const rendertarget &color() const
+            {
+                return m_color;
+            }
+
+            const rendertarget &depth() const
+            {
+                return m_depth;
+            }
+
+            readbackstatistics readback_statistics() const
+            {
+                return m_readback.statistics();
+            }
+
+        private:
+            devicecontext m_context;
+            rendertargetpool m_targets;
+            readbackring m_readback;
+            rendertarget m_color;
+            rendertarget m_depth;
+            rendertarget m_resolved;
+            unsigned int m_width;
+            unsigned int m_height;
+            bool m_bgra = false;
+        };
+
+    } /* End of namespace d3d11 */
+
+} /* End of namespace dx */
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "DirectXPlus.h"
+#include "WorkerPool.h"
+
+namespace dx {
+
+    namespace d3d11 {
+
+        struct passstatistics {
+            unsigned int passes = 0;
+            double record_ms = 0.0;         // wall time until every pass was recorded
+            double record_cpu_ms = 0.0;     // sum over the passes, record_cpu_ms / record_ms is the speed-up
+            double execute_ms = 0.0;
+        };
+
+        /// <summary>
+        /// Records independent passes of a frame on deferred contexts in parallel,
+        /// then executes the command lists on the immediate context in the order the passes were added.
+        ///
+        /// A pass must not depend on state set by another pass, each one starts from default state
+        /// and the immediate context is left in default state after submit().
+        ///
+        /// While the immediate context is being captured the passes run on it one after the other instead,
+        /// so the capture holds their commands rather than command lists it can't look into.
+        /// </summary>
+        class passrecorder {
+        public:
+            typedef std::function<void(devicecontext &context)> pass;
+
+            explicit passrecorder(const device &dev, unsigned int threads = workerpool::default_threads())
+                : m_device(dev), m_pool(threads)
+            {}
+
+            passrecorder(const passrecorder &) = delete;
+            passrecorder &operator= (const passrecorder &) = delete;
+
+            void add(pass p)
+            {
+                m_passes.push_back(std::move(p));
+            }
+
+            /// <summary>
+            /// Record every added pass and execute them. Rethrows the first exception of a pass,
+            /// in which case nothing of the frame is executed.
+            /// </summary>
+            void submit(devicecontext &immediate)
+            {
+                typedef std::chrono::steady_clock clock;
+                if(immediate.is_capturing()) {
+                    submit_inline(immediate);
+                    return;
+                }
+                const size_t count = m_passes.size();
+                while(m_contexts.size() < count) {
+                    devicecontext context = m_device.create_deferred_context();
+                    context.enable_state_filter();
+                    m_contexts.push_back(context);
+                }
+                m_lists.assign(count, commandlist());
+                m_errors.assign(count, std::exception_ptr());
+                m_cpu_us.assign(count, 0);
+
+                clock::time_point start = clock::now();
+                m_remaining = count;
+                // the last pass runs on this thread, which would only be waiting otherwise
+                for(size_t i = 0; i + 1 < count; ++i) {
+                    m_pool.submit([this, i]() {
+                        record(i);
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        if(--m_remaining == 0) {
+                            m_done.notify_one();
+                        }
+                    });
+                }
+                if(count > 0) {
+                    record(count - 1);
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    --m_remaining;
+                    m_done.wait(lock, [this] { return m_remaining == 0; });
+                }
+                clock::time_point recorded = clock::now();
+                m_passes.clear();
+
+                for(auto& e : m_errors) {
+                    if(e) {
+                        m_lists.clear();
+                        std::rethrow_exception(e);
+                    }
+                }
+
+                for(auto& l : m_lists) {
+                    immediate.execute_commandlist(l);
+                }
+                // drop our references, the driver keeps what is still in flight
+                m_lists.clear();
+
+                uint64_t cpu_us = 0;
+                for(auto us : m_cpu_us) {
+                    cpu_us += us;
+                }
+                m_statistics.passes = (unsigned int)count;
+                m_statistics.record_ms = std::chrono::duration<double, std::milli>(recorded - start).count();
+                m_statistics.record_cpu_ms = (double)cpu_us / 1000.0;
+                m_statistics.execute_ms = std::chrono::duration<double, std::milli>(clock::now() - recorded).count();
+            }
+
+            /// <summary>
+            /// Timings of the last submit().
+            /// </summary>
+            const passstatistics &statistics() const
+            {
+                return m_statistics;
+            }
+
+        private:
+            /// <summary>
+            /// Run the passes on the immediate context. A pass that throws leaves what the passes before it issued.
+            /// </summary>
+            void submit_inline(devicecontext &immediate)
+            {
+                typedef std::chrono::steady_clock clock;
+                clock::time_point start = clock::now();
+                const size_t count = m_passes.size();
+                try {
+                    for(auto& p : m_passes) {
+                        immediate.clear_state();
+                        p(immediate);
+                    }
+                }
+                catch(...) {
+                    m_passes.clear();
+                    immediate.clear_state();
+                    throw;
+                }
+                m_passes.clear();
+                immediate.clear_state();
+
+                m_statistics.passes = (unsigned int)count;
+                m_statistics.record_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+                m_statistics.record_cpu_ms = m_statistics.record_ms;
+                m_statistics.execute_ms = 0.0;
+            }
+
+            void record(size_t i)
+            {
+                typedef std::chrono::steady_clock clock;
+                clock::time_point start = clock::now();
+                devicecontext &context = m_contexts[i];
+                try {
+                    m_passes[i](context);
+                    m_lists[i] = context.finish_commandlist();
+                }
+                catch(...) {
+                    m_errors[i] = std::current_exception();
+                    // throw away whatever was recorded so the context is clean for the next frame
+                    try {
+                        context.finish_commandlist();
+                    }
+                    catch(...) {
+                    }
+                }
+                m_cpu_us[i] = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count();
+            }
+
+            device m_device;
+            std::vector<pass> m_passes;
+            std::vector<devicecontext> m_contexts;
+            std::vector<commandlist> m_lists;
+            std::vector<std::exception_ptr> m_errors;
+            std::vector<uint64_t> m_cpu_us;
+            passstatistics m_statistics;
+
+            std::mutex m_mutex;
+            std::condition_variable m_done;
+            size_t m_remaining = 0;
+
+            // last, so the workers are joined before anything they use goes away
+            workerpool m_pool;
+        };
+
+    } /* End of namespace d3d11 */
+
+} /* End of namespace dx */
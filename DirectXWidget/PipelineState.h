@@ -0,0 +1,300 @@
+#pragma once
+
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "DirectXPlus.h"
+
+namespace dx {
+
+    namespace d3d11 {
+
+        /// <summary>
+        /// Everything a draw needs besides its geometry and resources.
+        /// Fixed-function state starts out as the D3D11 defaults.
+        /// </summary>
+        struct pipelinedesc {
+            vertexshader vs;
+            hullshader hs;
+            domainshader ds;
+            geometryshader gs;
+            pixelshader ps;
+            inputlayout layout;
+            D3D11_PRIMITIVE_TOPOLOGY topology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+
+            D3D11_BLEND_DESC blend = CD3D11_BLEND_DESC(D3D11_DEFAULT);
+            float blend_factor[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+            unsigned int sample_mask = 0xFFFFFFFF;
+            D3D11_RASTERIZER_DESC rasterizer = CD3D11_RASTERIZER_DESC(D3D11_DEFAULT);
+            D3D11_DEPTH_STENCIL_DESC depthstencil = CD3D11_DEPTH_STENCIL_DESC(D3D11_DEFAULT);
+            unsigned int stencil_ref = 0;
+
+            uint64_t hash() const
+            {
+                uint64_t h = 14695981039346656037ull;
+                const void *objects[] = { vs.winapi(), hs.winapi(), ds.winapi(), gs.winapi(), ps.winapi(), layout.winapi() };
+                h = fnv1a(h, objects, sizeof(objects));
+                h = fnv1a(h, &topology, sizeof(topology));
+                h = fnv1a(h, &blend, sizeof(blend));
+                h = fnv1a(h, blend_factor, sizeof(blend_factor));
+                h = fnv1a(h, &sample_mask, sizeof(sample_mask));
+                h = fnv1a(h, &rasterizer, sizeof(rasterizer));
+                h = fnv1a(h, &depthstencil, sizeof(depthstencil));
+                h = fnv1a(h, &stencil_ref, sizeof(stencil_ref));
+                return h;
+            }
+
+            bool operator== (const pipelinedesc &d) const
+            {
+                return vs.winapi() == d.vs.winapi() && hs.winapi() == d.hs.winapi() && ds.winapi() == d.ds.winapi()
+                    && gs.winapi() == d.gs.winapi() && ps.winapi() == d.ps.winapi() && layout.winapi() == d.layout.winapi()
+                    && topology == d.topology
+                    && memcmp(&blend, &d.blend, sizeof(blend)) == 0
+                    && memcmp(blend_factor, d.blend_factor, sizeof(blend_factor)) == 0
+                    && sample_mask == d.sample_mask
+                    && memcmp(&rasterizer, &d.rasterizer, sizeof(rasterizer)) == 0
+                    && memcmp(&depthstencil, &d.depthstencil, sizeof(depthstencil)) == 0
+                    && stencil_ref == d.stencil_ref;
+            }
+
+        private:
+            static uint64_t fnv1a(uint64_t h, const void *data, size_t size)
+            {
+                const unsigned char *p = (const unsigned char*)data;
+                for(size_t i = 0; i < size; ++i) {
+                    h = (h ^ p[i]) * 1099511628211ull;
+                }
+                return h;
+            }
+        };
+
+        /// <summary>
+        /// Immutable, deduplicated pipeline. Copies share the same state objects.
+        /// Ids are small and dense, they make up the high bits of draw sort keys.
+        /// </summary>
+        class pipeline_state {
+        public:
+            pipeline_state() {}
+
+            bool is_valid() const
+            {
+                return (bool)m_data;
+            }
+
+            unsigned int id() const
+            {
+                return m_data ? m_data->id : 0;
+            }
+
+            const pipelinedesc &desc() const
+            {
+                return m_data->desc;
+            }
+
+            /// <summary>
+            /// Bind everything, the context's state filter drops what is already bound.
+            /// </summary>
+            void apply(devicecontext &context) const
+            {
+                const data &d = *m_data;
+                context.set_inputlayout(d.desc.layout);
+                context.set_primitivetopology(d.desc.topology);
+                context.set_shader(d.desc.vs);
+                context.set_shader(d.desc.hs);
+                context.set_shader(d.desc.ds);
+                context.set_shader(d.desc.gs);
+                context.set_shader(d.desc.ps);
+                context.set_blendstate(d.blend, d.desc.blend_factor, d.desc.sample_mask);
+                context.set_rasterizerstate(d.rasterizer);
+                context.set_depthstencilstate(d.depthstencil, d.desc.stencil_ref);
+            }
+
+            bool operator== (const pipeline_state &p) const
+            {
+                return m_data == p.m_data;
+            }
+
+            bool operator!= (const pipeline_state &p) const
+            {
+                return m_data != p.m_data;
+            }
+
+        private:
+            friend class pipelinecache;
+
+            struct data {
+                unsigned int id;
+                pipelinedesc desc;
+                blendstate blend;
+                rasterizerstate rasterizer;
+                depthstencilstate depthstencil;
+            };
+
+            explicit pipeline_state(const std::shared_ptr<const data> &d)
+                : m_data(d)
+            {}
+
+            std::shared_ptr<const data> m_data;
+        };
+
+        /// <summary>
+        /// Creates pipeline_states, identical descriptions give back the same object. Thread-safe.
+        /// </summary>
+        class pipelinecache {
+        public:
+            explicit pipelinecache(const device &dev)
+                : m_device(dev)
+            {}
+
+            pipelinecache(const pipelinecache &) = delete;
+            pipelinecache &operator= (const pipelinecache &) = delete;
+
+            pipeline_state create(const pipelinedesc &desc)
+            {
+                uint64_t h = desc.hash();
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto range = m_pipelines.equal_range(h);
+                for(auto it = range.first; it != range.second; ++it) {
+                    if(it->second->desc == desc) {
+                        return pipeline_state(it->second);
+                    }
+                }
+
+                auto d = std::make_shared<pipeline_state::data>();
+                d->id = ++m_last_id;
+                d->desc = desc;
+                d->blend = m_device.create_blendstate(desc.blend);
+                d->rasterizer = m_device.create_rasterizerstate(desc.rasterizer);
+                d->depthstencil = m_device.create_depthstencilstate(desc.depthstencil);
+                m_pipelines.emplace(h, d);
+                return pipeline_state(d);
+            }
+
+            size_t size() const
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                return m_pipelines.size();
+            }
+
+            /// <summary>
+            /// Forget pipelines nobody else holds any more.
+            /// </summary>
+            void trim()
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                for(auto it = m_pipelines.begin(); it != m_pipelines.end();) {
+                    if(it->second.use_count() == 1) {
+                        it = m_pipelines.erase(it);
+                    }
+                    else {
+                        ++it;
+                    }
+                }
+            }
+
+        private:
+            device m_device;
+            mutable std::mutex m_mutex;
+            std::unordered_multimap<uint64_t, std::shared_ptr<const pipeline_state::data>> m_pipelines;
+            unsigned int m_last_id = 0;
+        };
+
+        /// <summary>
+        /// Geometry of one draw, referenced without holding a reference for the frame.
+        /// Without index buffer it draws index_count vertices starting at start_index.
+        /// bind, if set, binds per-draw resources (textures, constants) from userdata.
+        /// </summary>
+        struct drawcommand {
+            ID3D11Buffer *vertexbuffer = nullptr;
+            unsigned int stride = 0;
+            unsigned int offset = 0;
+            ID3D11Buffer *indexbuffer = nullptr;
+            INDEX_BUFFER_FORMAT index_format = INDEX_BUFFER_FORMAT_32_BIT;
+            unsigned int index_count = 0;
+            unsigned int start_index = 0;
+            int base_vertex = 0;
+            void (*bind)(devicecontext &context, const void *userdata) = nullptr;
+            const void *userdata = nullptr;
+        };
+
+        struct drawqueuestatistics {
+            unsigned int draws = 0;
+            unsigned int pipeline_changes = 0;
+        };
+
+        /// <summary>
+        /// Collects a frame's draws and submits them sorted by pipeline, then by a caller-chosen key
+        /// (material, depth), then by geometry, so that each state is bound as few times as possible.
+        /// </summary>
+        class drawqueue {
+        public:
+            void submit(const pipeline_state &pipeline, const drawcommand &command, uint32_t key = 0)
+            {
+                item i;
+                i.sort_key = ((uint64_t)pipeline.id() << 32) | key;
+                i.pipeline = pipeline;
+                i.command = command;
+                m_items.push_back(i);
+            }
+
+            void flush(devicecontext &context)
+            {
+                std::stable_sort(m_items.begin(), m_items.end(), [](const item &a, const item &b) {
+                    if(a.sort_key != b.sort_key) {
+                        return a.sort_key < b.sort_key;
+                    }
+                    return a.command.vertexbuffer < b.command.vertexbuffer;
+                });
+
+                const pipeline_state *current = nullptr;
+                for(auto& i : m_items) {
+                    if(nullptr == current || *current != i.pipeline) {
+                        i.pipeline.apply(context);
+                        current = &i.pipeline;
+                        m_statistics.pipeline_changes++;
+                    }
+                    const drawcommand &c = i.command;
+                    context.set_vertexbuffers(0, &c.vertexbuffer, &c.stride, &c.offset, 1);
+                    if(nullptr != c.bind) {
+                        c.bind(context, c.userdata);
+                    }
+                    if(nullptr != c.indexbuffer) {
+                        context.set_indexbuffer(c.indexbuffer, c.index_format);
+                        context.draw_indexed(c.index_count, c.start_index, c.base_vertex);
+                    }
+                    else {
+                        context.draw(c.index_count, c.start_index);
+                    }
+                    m_statistics.draws++;
+                }
+
+                // keep the capacity, the next frame has about as many draws
+                m_items.clear();
+            }
+
+            drawqueuestatistics reset_statistics()
+            {
+                drawqueuestatistics result = m_statistics;
+                m_statistics = drawqueuestatistics();
+                return result;
+            }
+
+        private:
+            struct item {
+                uint64_t sort_key;
+                pipeline_state pipeline;
+                drawcommand command;
+            };
+
+            std::vector<item> m_items;
+            drawqueuestatistics m_statistics;
+        };
+
+    } /* End of namespace d3d11 */
+
+} /* End of namespace dx */
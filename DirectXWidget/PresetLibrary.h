@@ -0,0 +1,577 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
+#include "MappedFile.h"
+#include "MilkPreset.h"
+#include "WorkerPool.h"
+
+namespace dx {
+
+    namespace milk {
+
+        enum presetflags : uint8_t {
+            preset_warp_shader = 1,
+            preset_comp_shader = 2
+        };
+
+        /// <summary>
+        /// What the index knows about a preset without opening it. Stored as is in the index file.
+        /// </summary>
+        struct presetrecord {
+            uint64_t path_hash;         // of the path relative to the library root, records are sorted by it
+            uint64_t content_hash;
+            uint64_t file_size;
+            int64_t modified;           // file time in the units of the platform, only compared for equality
+            double cumulative_rating;   // sum of the ratings of this and every record before it
+            uint32_t path_offset;       // into the string table
+            uint32_t path_length;
+            float rating;               // fRating, MilkDrop picks presets in proportion to it
+            uint32_t code_lines;
+            uint16_t version;           // MILKDROP_PRESET_VERSION, 0 for MilkDrop 1 presets
+            uint8_t warp_ps;            // pixel shader models, 0 when the preset has none
+            uint8_t comp_ps;
+            uint8_t waves;              // bit i set when custom wave i is enabled
+            uint8_t shapes;
+            uint8_t flags;              // presetflags
+            uint8_t reserved;
+        };
+        static_assert(sizeof(presetrecord) == 64, "presetrecord is part of the index file layout");
+
+        struct presetscanstatistics {
+            unsigned int directories = 0;
+            unsigned int files = 0;         // *.milk found
+            unsigned int parsed = 0;        // new or changed since the previous index
+            unsigned int reused = 0;        // taken from the previous index without reading the file
+            unsigned int failed = 0;        // unreadable or not a preset, left out
+            double scan_ms = 0.0;
+            double parse_ms = 0.0;
+            double write_ms = 0.0;
+        };
+
+        /// <summary>
+        /// Binary index of a directory tree of .milk presets.
+        ///
+        /// build() lists the tree and parses the presets on a workerpool and the calling thread,
+        /// presets whose size and time match the previous index are not read again.
+        /// The index file is a header, the records sorted by path hash and a string table of
+        /// '/'-separated paths relative to the root. open() maps it and serves records straight
+        /// from the mapping, so startup costs a page fault per record touched and nothing is parsed.
+        /// The layout is native endian, an index from another architecture fails to open and is rebuilt.
+        /// </summary>
+        class presetlibrary {
+        public:
+            static const size_t npos = (size_t)-1;
+
+            presetlibrary() {}
+
+            explicit presetlibrary(const std::string &index_path)
+            {
+                open(index_path);
+            }
+
+            presetlibrary(const presetlibrary &) = delete;
+            presetlibrary &operator= (const presetlibrary &) = delete;
+
+            /// <summary>
+            /// Map an index file, returns false if it is missing, damaged or from another version.
+            /// </summary>
+            bool open(const std::string &index_path)
+            {
+                close();
+                if(!m_file.open(index_path) || !validate()) {
+                    close();
+                    return false;
+                }
+                m_file_path = index_path;
+                return true;
+            }
+
+            void close()
+            {
+                m_file.close();
+                m_file_path.clear();
+                m_header = nullptr;
+                m_records = nullptr;
+                m_strings = nullptr;
+            }
+
+            bool is_open() const
+            {
+                return nullptr != m_header;
+            }
+
+            /// <summary>
+            /// Index the presets under root into index_path and open the result.
+            /// The index open at the time, if any, provides the records of unchanged files.
+            /// Returns false if the index could not be written, the previous one then stays open.
+            /// </summary>
+            bool build(const std::string &root, const std::string &index_path, unsigned int threads = workerpool::default_threads())
+            {
+                typedef std::chrono::steady_clock clock;
+                m_statistics = presetscanstatistics();
+                workerpool pool(threads);
+
+                clock::time_point start = clock::now();
+                std::vector<found> files = scan(pool, root);
+                m_statistics.scan_ms = ms_since(start);
+
+                start = clock::now();
+                std::vector<presetrecord> records(files.size());
+                std::vector<char> ok(files.size(), 0);
+                std::atomic<size_t> next(0);
+                std::atomic<unsigned int> parsed(0), reused(0);
+                run_parallel(pool, [&] {
+                    for(size_t i = next++; i < files.size(); i = next++) {
+                        bool fresh = false;
+                        ok[i] = describe(root, files[i], records[i], fresh) ? 1 : 0;
+                        if(ok[i]) {
+                            (fresh ? parsed : reused)++;
+                        }
+                    }
+                });
+                m_statistics.parse_ms = ms_since(start);
+                m_statistics.parsed = parsed;
+                m_statistics.reused = reused;
+                m_statistics.failed = (unsigned int)(files.size() - parsed - reused);
+
+                start = clock::now();
+                bool written = write(root, index_path, files, records, ok);
+                m_statistics.write_ms = ms_since(start);
+                return written;
+            }
+
+            /// <summary>
+            /// Counts of the last build().
+            /// </summary>
+            presetscanstatistics statistics() const
+            {
+                return m_statistics;
+            }
+
+            size_t size() const
+            {
+                return is_open() ? (size_t)m_header->count : 0;
+            }
+
+            const presetrecord &record(size_t i) const
+            {
+                return m_records[i];
+            }
+
+            /// <summary>
+            /// The directory the index was built from.
+            /// </summary>
+            textview root() const
+            {
+                return is_open() ? textview(m_strings + m_header->root_offset, m_header->root_length) : textview();
+            }
+
+            /// <summary>
+            /// Path of a preset relative to root(), '/'-separated.
+            /// </summary>
+            textview path(size_t i) const
+            {
+                return textview(m_strings + m_records[i].path_offset, m_records[i].path_length);
+            }
+
+            std::string full_path(size_t i) const
+            {
+                return join(root().str(), path(i).str());
+            }
+
+            /// <summary>
+            /// Record of a path relative to root(), npos if it isn't indexed.
+            /// </summary>
+            size_t find(textview relative_path) const
+            {
+                uint64_t h = fnv1a(14695981039346656037ull, relative_path.data, relative_path.size);
+                const presetrecord *end = m_records + size();
+                const presetrecord *r = std::lower_bound(m_records, end, h, [](const presetrecord &a, uint64_t b) {
+                    return a.path_hash < b;
+                });
+                for(; r != end && r->path_hash == h; ++r) {
+                    if(textview(m_strings + r->path_offset, r->path_length).equals(relative_path)) {
+                        return (size_t)(r - m_records);
+                    }
+                }
+                return npos;
+            }
+
+            /// <summary>
+            /// Map u in [0, 1) to a record, presets are as likely as their rating as MilkDrop does it.
+            /// Uniform when every rating is 0. npos when the index is empty.
+            /// </summary>
+            size_t pick(double u) const
+            {
+                size_t n = size();
+                if(n == 0) {
+                    return npos;
+                }
+                u = std::min(std::max(u, 0.0), 1.0);
+                double total = m_records[n - 1].cumulative_rating;
+                if(total <= 0.0) {
+                    return std::min((size_t)(u * (double)n), n - 1);
+                }
+                double target = u * total;
+                const presetrecord *r = std::upper_bound(m_records, m_records + n, target, [](double t, const presetrecord &a) {
+                    return t < a.cumulative_rating;
+                });
+                return std::min((size_t)(r - m_records), n - 1);
+            }
+
+        private:
+            struct header {
+                char magic[8];
+                uint32_t version;
+                uint32_t record_size;
+                uint64_t count;
+                uint64_t records_offset;
+                uint64_t strings_offset;
+                uint64_t strings_size;
+                uint32_t root_offset;
+                uint32_t root_length;
+                uint64_t reserved;
+            };
+            static_assert(sizeof(header) == 64, "header is part of the index file layout");
+
+            // bump the version when the layout or the meaning of a field changes
+            static const uint32_t index_version = 1;
+
+            struct found {
+                std::string path;       // relative to the root
+                uint64_t size;
+                int64_t modified;
+            };
+
+            static double ms_since(std::chrono::steady_clock::time_point start)
+            {
+                return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            }
+
+            static uint64_t fnv1a(uint64_t h, const void *data, size_t size)
+            {
+                const unsigned char *p = (const unsigned char*)data;
+                for(size_t i = 0; i < size; ++i) {
+                    h = (h ^ p[i]) * 1099511628211ull;
+                }
+                return h;
+            }
+
+            static std::string join(const std::string &directory, const std::string &name)
+            {
+                if(directory.empty()) {
+                    return name;
+                }
+                if(name.empty()) {
+                    return directory;
+                }
+                return directory + "/" + name;
+            }
+
+            static bool is_preset(const char *name)
+            {
+                size_t n = strlen(name);
+                return n > 5 && textview(name + n - 5, 5).iequals(".milk");
+            }
+
+            bool validate()
+            {
+                if(m_file.size() < sizeof(header)) {
+                    return false;
+                }
+                const header *h = (const header*)m_file.data();
+                if(memcmp(h->magic, "MILKIDX", 8) != 0 || h->version != index_version || h->record_size != sizeof(presetrecord)) {
+                    return false;
+                }
+                if(h->records_offset != sizeof(header) || h->count > (m_file.size() - sizeof(header)) / sizeof(presetrecord) ||
+                    h->strings_offset != h->records_offset + h->count * sizeof(presetrecord) ||
+                    h->strings_size > m_file.size() - h->strings_offset ||
+                    (uint64_t)h->root_offset + h->root_length > h->strings_size) {
+                    return false;
+                }
+                const presetrecord *records = (const presetrecord*)(m_file.data() + h->records_offset);
+                for(uint64_t i = 0; i < h->count; ++i) {
+                    if((uint64_t)records[i].path_offset + records[i].path_length > h->strings_size) {
+                        return false;
+                    }
+                }
+                m_header = h;
+                m_records = records;
+                m_strings = m_file.data() + h->strings_offset;
+                return true;
+            }
+
+            /// <summary>
+            /// Run task on every thread of the pool and on the calling thread, return when all are done.
+            /// </summary>
+            static void run_parallel(workerpool &pool, const std::function<void()> &task)
+            {
+                std::mutex mutex;
+                std::condition_variable done;
+                unsigned int running = pool.thread_count();
+                for(unsigned int i = 0; i < pool.thread_count(); ++i) {
+                    pool.submit([&] {
+                        task();
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if(--running == 0) {
+                            done.notify_one();
+                        }
+                    });
+                }
+                task();
+                std::unique_lock<std::mutex> lock(mutex);
+                done.wait(lock, [&] { return running == 0; });
+            }
+
+            /// <summary>
+            /// List the presets under root, directories are read in parallel.
+            /// </summary>
+            std::vector<found> scan(workerpool &pool, const std::string &root)
+            {
+                std::mutex mutex;
+                std::condition_variable wake;
+                std::deque<std::string> directories(1, std::string());
+                unsigned int busy = 0;
+                unsigned int listed = 0;
+                std::vector<found> files;
+
+                run_parallel(pool, [&] {
+                    for(;;) {
+                        std::string directory;
+                        {
+                            std::unique_lock<std::mutex> lock(mutex);
+                            // done once nothing is queued and nobody is listing a directory that could add more
+                            wake.wait(lock, [&] { return !directories.empty() || busy == 0; });
+                            if(directories.empty()) {
+                                return;
+                            }
+                            directory = std::move(directories.front());
+                            directories.pop_front();
+                            busy++;
+                        }
+
+                        std::vector<found> local;
+                        std::vector<std::string> subdirectories;
+                        list(root, directory, local, subdirectories);
+
+                        std::lock_guard<std::mutex> lock(mutex);
+                        for(auto& f : local) {
+                            files.push_back(std::move(f));
+                        }
+                        for(auto& d : subdirectories) {
+                            directories.push_back(std::move(d));
+                        }
+                        busy--;
+                        listed++;
+                        wake.notify_all();
+                    }
+                });
+
+                m_statistics.directories = listed;
+                m_statistics.files = (unsigned int)files.size();
+                return files;
+            }
+
+            static void list(const std::string &root, const std::string &directory, std::vector<found> &files, std::vector<std::string> &subdirectories)
+            {
+                std::string path = join(root, directory);
+#ifdef _WIN32
+                WIN32_FIND_DATAA data;
+                HANDLE h = FindFirstFileA((path + "\\*").c_str(), &data);
+                if(h == INVALID_HANDLE_VALUE) {
+                    return;
+                }
+                do {
+                    const char *name = data.cFileName;
+                    if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+                        continue;
+                    }
+                    if(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+                        // links can loop
+                        continue;
+                    }
+                    if(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+                        subdirectories.push_back(join(directory, name));
+                    }
+                    else if(is_preset(name)) {
+                        found f;
+                        f.path = join(directory, name);
+                        f.size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+                        f.modified = (int64_t)(((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime);
+                        files.push_back(std::move(f));
+                    }
+                } while(FindNextFileA(h, &data));
+                FindClose(h);
+#else
+                DIR *dir = opendir(path.c_str());
+                if(nullptr == dir) {
+                    return;
+                }
+                while(struct dirent *e = readdir(dir)) {
+                    const char *name = e->d_name;
+                    if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+                        continue;
+                    }
+                    struct stat st;
+                    // lstat, links can loop
+                    if(lstat(join(path, name).c_str(), &st) != 0) {
+                        continue;
+                    }
+                    if(S_ISDIR(st.st_mode)) {
+                        subdirectories.push_back(join(directory, name));
+                    }
+                    else if(S_ISREG(st.st_mode) && is_preset(name)) {
+                        found f;
+                        f.path = join(directory, name);
+                        f.size = (uint64_t)st.st_size;
+                        f.modified = (int64_t)st.st_mtime * 1000000000 + (int64_t)st.st_mtim.tv_nsec;
+                        files.push_back(std::move(f));
+                    }
+                }
+                closedir(dir);
+#endif
+            }
+
+            /// <summary>
+            /// Fill the record of a file from the open index if it is unchanged, from the file otherwise.
+            /// Offsets and cumulative_rating are left for write().
+            /// </summary>
+            bool describe(const std::string &root, const found &f, presetrecord &r, bool &fresh) const
+            {
+                if(is_open()) {
+                    size_t i = find(textview(f.path.data(), f.path.size()));
+                    if(i != npos && m_records[i].file_size == f.size && m_records[i].modified == f.modified) {
+                        r = m_records[i];
+                        fresh = false;
+                        return true;
+                    }
+                }
+
+                fresh = true;
+                preset p;
+                if(!p.open(join(root, f.path)) || (p.values().empty() && p.code().empty())) {
+                    return false;
+                }
+                memset(&r, 0, sizeof(r));
+                r.path_hash = fnv1a(14695981039346656037ull, f.path.data(), f.path.size());
+                r.content_hash = fnv1a(14695981039346656037ull, p.text().data, p.text().size);
+                r.file_size = f.size;
+                r.modified = f.modified;
+                r.rating = (float)p.number("fRating", 3.0);
+                r.code_lines = (uint32_t)p.code().size();
+                r.version = (uint16_t)p.number("MILKDROP_PRESET_VERSION", 0.0);
+                double ps = p.number("PSVERSION", 0.0);
+                r.warp_ps = (uint8_t)p.number("PSVERSION_WARP", ps);
+                r.comp_ps = (uint8_t)p.number("PSVERSION_COMP", ps);
+                for(unsigned int i = 0; i < 4; ++i) {
+                    char key[32];
+                    snprintf(key, sizeof(key), "wavecode_%u_enabled", i);
+                    r.waves |= (p.number(key, 0.0) != 0.0) ? (uint8_t)(1 << i) : 0;
+                    snprintf(key, sizeof(key), "shapecode_%u_enabled", i);
+                    r.shapes |= (p.number(key, 0.0) != 0.0) ? (uint8_t)(1 << i) : 0;
+                }
+                r.flags |= p.code(codeblock::warp_shader).empty() ? 0 : preset_warp_shader;
+                r.flags |= p.code(codeblock::comp_shader).empty() ? 0 : preset_comp_shader;
+                return true;
+            }
+
+            bool write(const std::string &root, const std::string &index_path, const std::vector<found> &files, std::vector<presetrecord> &records, const std::vector<char> &ok)
+            {
+                std::vector<size_t> order;
+                for(size_t i = 0; i < files.size(); ++i) {
+                    if(ok[i]) {
+                        order.push_back(i);
+                    }
+                }
+                std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                    if(records[a].path_hash != records[b].path_hash) {
+                        return records[a].path_hash < records[b].path_hash;
+                    }
+                    return files[a].path < files[b].path;
+                });
+
+                std::string strings = root;
+                std::vector<presetrecord> sorted;
+                sorted.reserve(order.size());
+                double cumulative = 0.0;
+                for(size_t i : order) {
+                    presetrecord r = records[i];
+                    r.path_offset = (uint32_t)strings.size();
+                    r.path_length = (uint32_t)files[i].path.size();
+                    strings += files[i].path;
+                    cumulative += std::max(0.0f, r.rating);
+                    r.cumulative_rating = cumulative;
+                    sorted.push_back(r);
+                }
+
+                header h;
+                memset(&h, 0, sizeof(h));
+                memcpy(h.magic, "MILKIDX", 8);
+                h.version = index_version;
+                h.record_size = sizeof(presetrecord);
+                h.count = sorted.size();
+                h.records_offset = sizeof(header);
+                h.strings_offset = h.records_offset + sorted.size() * sizeof(presetrecord);
+                h.strings_size = strings.size();
+                h.root_offset = 0;
+                h.root_length = (uint32_t)root.size();
+
+                std::string temp = index_path + ".tmp";
+                FILE *fp = fopen(temp.c_str(), "wb");
+                if(nullptr == fp) {
+                    return false;
+                }
+                bool written = fwrite(&h, sizeof(h), 1, fp) == 1;
+                written = written && (sorted.empty() || fwrite(sorted.data(), sizeof(presetrecord) * sorted.size(), 1, fp) == 1);
+                written = written && (strings.empty() || fwrite(strings.data(), strings.size(), 1, fp) == 1);
+                written = (fclose(fp) == 0) && written;
+                if(!written) {
+                    remove(temp.c_str());
+                    return false;
+                }
+
+                // a mapped file can't be replaced on Windows, let go of the old index first
+                std::string previous = is_open() ? m_file_path : std::string();
+                close();
+#ifdef _WIN32
+                bool renamed = MoveFileExA(temp.c_str(), index_path.c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE;
+#else
+                bool renamed = rename(temp.c_str(), index_path.c_str()) == 0;
+#endif
+                if(!renamed) {
+                    remove(temp.c_str());
+                    if(!previous.empty()) {
+                        open(previous);
+                    }
+                    return false;
+                }
+                return open(index_path);
+            }
+
+            mappedfile m_file;
+            std::string m_file_path;
+            const header *m_header = nullptr;
+            const presetrecord *m_records = nullptr;
+            const char *m_strings = nullptr;
+            presetscanstatistics m_statistics;
+        };
+
+    } /* End of namespace milk */
+
+} /* End of namespace dx */
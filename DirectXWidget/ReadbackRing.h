@@ -0,0 +1,226 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+
+#include "DirectXPlus.h"
+
+namespace dx {
+
+    namespace d3d11 {
+
+        /// <summary>
+        /// Pixels of mip 0 of a texture as the GPU had it when read() was called,
+        /// valid only during the callback of poll().
+        /// </summary>
+        struct readbackframe {
+            uint64_t frame = 0;
+            unsigned int width = 0;
+            unsigned int height = 0;
+            DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+            const uint8_t *data = nullptr;
+            unsigned int row_pitch = 0;
+            unsigned int latency_frames = 0;    // read() calls between this one and its completion
+            double latency_ms = 0.0;
+        };
+
+        struct readbackstatistics {
+            unsigned int requested = 0;
+            unsigned int completed = 0;
+            unsigned int dropped = 0;           // every staging texture was still waiting for the GPU
+            unsigned int latency_frames = 0;    // of the last completed frame
+            double latency_ms = 0.0;
+        };
+
+        /// <summary>
+        /// Reads textures back to the CPU without waiting for the GPU.
+        ///
+        /// read() copies the source into the next of a ring of staging textures, poll() hands out
+        /// the copies the GPU has finished, oldest first, typically staging_count - 1 frames later.
+        /// When every staging texture is still pending read() drops the frame instead of stalling.
+        /// Multisampled sources are resolved first. The ring follows the size and format of the source,
+        /// pending frames are dropped when that changes.
+        /// </summary>
+        class readbackring {
+        public:
+            readbackring(const device &dev, const devicecontext &context, unsigned int staging_count = 3)
+                : m_device(dev), m_context(context), m_slots(staging_count)
+            {}
+
+            readbackring(const readbackring &) = delete;
+            readbackring &operator= (const readbackring &) = delete;
+
+            /// <summary>
+            /// Queue a copy of mip 0 of src. Returns false if the frame was dropped.
+            /// </summary>
+            bool read(borrowed<texture2d> src, uint64_t frame)
+            {
+                m_statistics.requested++;
+                m_sequence++;
+
+                D3D11_TEXTURE2D_DESC desc;
+                src.winapi()->GetDesc(&desc);
+                if(desc.Width != m_width || desc.Height != m_height || desc.Format != m_format || desc.SampleDesc.Count != m_samples) {
+                    recreate(desc);
+                }
+
+                slot &s = m_slots[m_next];
+                if(s.pending) {
+                    m_statistics.dropped++;
+                    return false;
+                }
+
+                if(m_samples > 1) {
+                    m_context.resolve_subresource(m_resolve, 0, src, 0, m_format);
+                    m_context.copy_subresource_region(s.staging, 0, 0, 0, m_resolve, 0);
+                }
+                else {
+                    m_context.copy_subresource_region(s.staging, 0, 0, 0, src, 0);
+                }
+                s.pending = true;
+                s.frame = frame;
+                s.sequence = m_sequence;
+                s.issued = clock::now();
+                m_next = (m_next + 1) % m_slots.size();
+                return true;
+            }
+
+            /// <summary>
+            /// Call consume(const readbackframe &) for every copy the GPU has finished, never blocks.
+            /// Returns how many frames were handed out.
+            /// </summary>
+            template<class F>
+            unsigned int poll(F consume)
+            {
+                unsigned int count = 0;
+                while(m_slots[m_oldest].pending) {
+                    slot &s = m_slots[m_oldest];
+                    D3D11_MAPPED_SUBRESOURCE mapped;
+                    if(!m_context.try_map(s.staging, 0, D3D11_MAP_READ, mapped)) {
+                        break;
+                    }
+                    hand_out(s, mapped, consume);
+                    count++;
+                }
+                return count;
+            }
+
+            /// <summary>
+            /// Like poll(), but waits for the GPU until no more than keep frames are pending.
+            /// For offline rendering, where no frame may be dropped: drain(consume, staging_count - 1) before read().
+            /// </summary>
+            template<class F>
+            unsigned int drain(F consume, unsigned int keep = 0)
+            {
+                unsigned int count = poll(consume);
+                while(pending() > keep) {
+                    slot &s = m_slots[m_oldest];
+                    hand_out(s, m_context.map(s.staging, 0, D3D11_MAP_READ), consume);
+                    count++;
+                }
+                return count;
+            }
+
+            /// <summary>
+            /// Frames read but not handed out yet.
+            /// </summary>
+            unsigned int pending() const
+            {
+                unsigned int count = 0;
+                for(auto& s : m_slots) {
+                    count += s.pending ? 1 : 0;
+                }
+                return count;
+            }
+
+            unsigned int staging_count() const
+            {
+                return (unsigned int)m_slots.size();
+            }
+
+            readbackstatistics statistics() const
+            {
+                return m_statistics;
+            }
+
+        private:
+            typedef std::chrono::steady_clock clock;
+
+            struct slot {
+                texture2d staging;
+                bool pending = false;
+                uint64_t frame = 0;
+                uint64_t sequence = 0;
+                clock::time_point issued;
+            };
+
+            template<class F>
+            void hand_out(slot &s, const D3D11_MAPPED_SUBRESOURCE &mapped, F &consume)
+            {
+                readbackframe f;
+                f.frame = s.frame;
+                f.width = m_width;
+                f.height = m_height;
+                f.format = m_format;
+                f.data = (const uint8_t*)mapped.pData;
+                f.row_pitch = mapped.RowPitch;
+                f.latency_frames = (unsigned int)(m_sequence - s.sequence);
+                f.latency_ms = std::chrono::duration<double, std::milli>(clock::now() - s.issued).count();
+                try {
+                    consume(f);
+                }
+                catch(...) {
+                    complete(s);
+                    throw;
+                }
+                complete(s);
+
+                m_statistics.completed++;
+                m_statistics.latency_frames = f.latency_frames;
+                m_statistics.latency_ms = f.latency_ms;
+            }
+
+            void complete(slot &s)
+            {
+                m_context.unmap(s.staging, 0);
+                s.pending = false;
+                m_oldest = (m_oldest + 1) % m_slots.size();
+            }
+
+            void recreate(const D3D11_TEXTURE2D_DESC &desc)
+            {
+                for(auto& s : m_slots) {
+                    if(s.pending) {
+                        m_statistics.dropped++;
+                    }
+                    s = slot();
+                    s.staging = m_device.create_texture2d(desc.Width, desc.Height, 1, 1, desc.Format, 1, 0, D3D11_USAGE_STAGING, (D3D11_BIND_FLAG)0, D3D11_CPU_ACCESS_READ);
+                }
+                m_resolve = (desc.SampleDesc.Count > 1) ? m_device.create_texture2d(desc.Width, desc.Height, 1, 1, desc.Format, 1, 0, D3D11_USAGE_DEFAULT, (D3D11_BIND_FLAG)0, 0) : texture2d();
+                m_width = desc.Width;
+                m_height = desc.Height;
+                m_format = desc.Format;
+                m_samples = desc.SampleDesc.Count;
+                m_next = 0;
+                m_oldest = 0;
+            }
+
+            device m_device;
+            devicecontext m_context;
+            std::vector<slot> m_slots;
+            texture2d m_resolve;
+            size_t m_next = 0;
+            size_t m_oldest = 0;
+            uint64_t m_sequence = 0;
+
+            unsigned int m_width = 0;
+            unsigned int m_height = 0;
+            DXGI_FORMAT m_format = DXGI_FORMAT_UNKNOWN;
+            unsigned int m_samples = 0;
+
+            readbackstatistics m_statistics;
+        };
+
+    } /* End of namespace d3d11 */
+
+} /* End of namespace dx */
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <vector>
+
+#include "DirectXPlus.h"
+
+namespace dx {
+
+    namespace d3d11 {
+
+        struct rendertargetdesc {
+            unsigned int width;
+            unsigned int height;
+            DXGI_FORMAT format;
+            unsigned int bind;
+            unsigned int sample_count;
+
+            rendertargetdesc(unsigned int w = 0, unsigned int h = 0, DXGI_FORMAT f = DXGI_FORMAT_R8G8B8A8_UNORM, unsigned int b = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE, unsigned int samples = 1)
+                : width(w), height(h), format(f), bind(b), sample_count(samples)
+            {}
+
+            uint64_t bytes() const
+            {
+                return (uint64_t)dxgi::depth_pitch(format, width, height) * sample_count;
+            }
+
+            bool operator== (const rendertargetdesc &d) const
+            {
+                return width == d.width && height == d.height && format == d.format && bind == d.bind && sample_count == d.sample_count;
+            }
+        };
+
+        /// <summary>
+        /// A texture with the views its bind flags allow.
+        /// </summary>
+        struct rendertarget {
+            rendertargetdesc desc;
+            texture2d texture;
+            rendertargetview rtv;
+            depthstencilview dsv;
+            shaderresourceview srv;
+
+            bool is_valid() const
+            {
+                return texture.is_valid();
+            }
+        };
+
+        struct rendertargetpoolstatistics {
+            unsigned int hits = 0;
+            unsigned int misses = 0;
+            unsigned int evictions = 0;
+            unsigned int pooled = 0;
+            uint64_t pooled_bytes = 0;
+        };
+
+        /// <summary>
+        /// Recycles transient render targets by description.
+        ///
+        /// acquire() hands out a pooled target matching the description or creates one,
+        /// release() returns it. Targets that stay unused for max_age frames are dropped by next_frame().
+        /// </summary>
+        class rendertargetpool {
+        public:
+            explicit rendertargetpool(const device &dev, unsigned int max_age = 120)
+                : m_device(dev), m_max_age(max_age)
+            {}
+
+            rendertarget acquire(const rendertargetdesc &desc)
+            {
+                for(size_t i = 0; i < m_free.size(); ++i) {
+                    if(m_free[i].target.desc == desc) {
+                        rendertarget result = std::move(m_free[i].target);
+                        m_free[i] = std::move(m_free.back());
+                        m_free.pop_back();
+                        m_statistics.hits++;
+                        return result;
+                    }
+                }
+
+                m_statistics.misses++;
+                return create(desc);
+            }
+
+            void release(rendertarget &rt)
+            {
+                if(rt.is_valid()) {
+                    m_free.push_back(entry{std::move(rt), m_frame});
+                    rt = rendertarget();
+                }
+            }
+
+            /// <summary>
+            /// Advance the frame counter and drop targets that have not been acquired for max_age frames.
+            /// </summary>
+            void next_frame()
+            {
+                m_frame++;
+                for(size_t i = 0; i < m_free.size();) {
+                    if(m_frame - m_free[i].last_used > m_max_age) {
+                        m_free[i] = std::move(m_free.back());
+                        m_free.pop_back();
+                        m_statistics.evictions++;
+                    }
+                    else {
+                        ++i;
+                    }
+                }
+            }
+
+            /// <summary>
+            /// Drop every target that is not in use.
+            /// </summary>
+            void trim()
+            {
+                m_statistics.evictions += (unsigned int)m_free.size();
+                m_free.clear();
+            }
+
+            rendertargetpoolstatistics statistics() const
+            {
+                rendertargetpoolstatistics result = m_statistics;
+                result.pooled = (unsigned int)m_free.size();
+                for(auto& e : m_free) {
+                    result.pooled_bytes += e.target.desc.bytes();
+                }
+                return result;
+            }
+
+            void reset_statistics()
+            {
+                m_statistics = rendertargetpoolstatistics();
+            }
+
+        private:
+            struct entry {
+                rendertarget target;
+                uint64_t last_used;
+            };
+
+            rendertarget create(const rendertargetdesc &desc)
+            {
+                rendertarget rt;
+                rt.desc = desc;
+                rt.texture = m_device.create_texture2d(desc.width, desc.height, 1, 1, desc.format, desc.sample_count, 0, D3D11_USAGE_DEFAULT, (D3D11_BIND_FLAG)desc.bind, 0);
+                // the views follow the description, multisampled textures need the MS dimensions
+                bool multisampled = desc.sample_count > 1;
+                if(desc.bind & D3D11_BIND_RENDER_TARGET) {
+                    D3D11_RENDER_TARGET_VIEW_DESC descRTV;
+                    ZeroMemory(&descRTV, sizeof(descRTV));
+                    descRTV.Format = desc.format;
+                    descRTV.ViewDimension = multisampled ? D3D11_RTV_DIMENSION_TEXTURE2DMS : D3D11_RTV_DIMENSION_TEXTURE2D;
+                    rt.rtv = m_device.create_view(rt.texture, descRTV);
+                }
+                if(desc.bind & D3D11_BIND_DEPTH_STENCIL) {
+                    D3D11_DEPTH_STENCIL_VIEW_DESC descDSV;
+                    ZeroMemory(&descDSV, sizeof(descDSV));
+                    descDSV.Format = desc.format;
+                    descDSV.ViewDimension = multisampled ? D3D11_DSV_DIMENSION_TEXTURE2DMS : D3D11_DSV_DIMENSION_TEXTURE2D;
+                    rt.dsv = m_device.create_view(rt.texture, descDSV);
+                }
+                if(desc.bind & D3D11_BIND_SHADER_RESOURCE) {
+                    D3D11_SHADER_RESOURCE_VIEW_DESC descSRV;
+                    ZeroMemory(&descSRV, sizeof(descSRV));
+                    descSRV.Format = desc.format;
+                    descSRV.ViewDimension = multisampled ? D3D11_SRV_DIMENSION_TEXTURE2DMS : D3D11_SRV_DIMENSION_TEXTURE2D;
+                    if(!multisampled) {
+                        descSRV.Texture2D.MipLevels = 1;
+                    }
+                    rt.srv = m_device.create_view(rt.texture, descSRV);
+                }
+                return rt;
+            }
+
+            device m_device;
+            unsigned int m_max_age;
+            uint64_t m_frame = 0;
+            std::vector<entry> m_free;
+            rendertargetpoolstatistics m_statistics;
+        };
+
+    } /* End of namespace d3d11 */
+
+} /* End of namespace dx */
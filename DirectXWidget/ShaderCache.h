@@ -0,0 +1,345 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "DirectXPlus.h"
+#include "MappedFile.h"
+
+namespace dx {
+
+    namespace d3d11 {
+
+        /// <summary>
+        /// Shader bytecode, either mapped from the cache directory or freshly compiled.
+        /// </summary>
+        class shaderbytecode {
+        public:
+            shaderbytecode() {}
+
+            explicit shaderbytecode(const std::shared_ptr<const mappedfile> &file)
+                : m_file(file)
+            {}
+
+            explicit shaderbytecode(const blob &b)
+                : m_blob(b)
+            {}
+
+            bool is_valid() const
+            {
+                return m_file || m_blob.is_valid();
+            }
+
+            const void *data() const
+            {
+                return m_file ? (const void*)m_file->data() : m_blob.data();
+            }
+
+            size_t size() const
+            {
+                return m_file ? m_file->size() : m_blob.size();
+            }
+
+        private:
+            std::shared_ptr<const mappedfile> m_file;
+            blob m_blob;
+        };
+
+        struct shadercachestatistics {
+            unsigned int hits = 0;
+            unsigned int misses = 0;
+            unsigned int evictions = 0;
+            unsigned int entries = 0;
+            uint64_t bytes = 0;
+        };
+
+        /// <summary>
+        /// On-disk cache of compiled shaders, addressed by a hash of everything that goes into the compiler.
+        ///
+        /// Entries are plain bytecode files named after their key and are memory-mapped on lookup.
+        /// Least recently used entries are deleted once the directory exceeds max_bytes,
+        /// file times carry the LRU order over to the next run.
+        /// All members may be called from any thread.
+        /// </summary>
+        class shadercache {
+        public:
+            explicit shadercache(const std::string &directory, uint64_t max_bytes = 256ull << 20)
+                : m_directory(directory), m_max_bytes(max_bytes)
+            {
+                CreateDirectoryA(m_directory.c_str(), nullptr);
+                scan();
+                std::lock_guard<std::mutex> lock(m_mutex);
+                evict(0);
+            }
+
+            shadercache(const shadercache &) = delete;
+            shadercache &operator= (const shadercache &) = delete;
+
+            /// <summary>
+            /// Hash of a compilation. The source is hashed as it is, compile() expands includes before it gets here.
+            /// </summary>
+            static uint64_t key(const char *source, size_t length, const D3D_SHADER_MACRO *defines, const char *entry, const char *profile, unsigned int flags)
+            {
+                // bump the salt when the file layout changes
+                static const char salt[] = "DirectXPlus shader cache 2";
+                uint64_t h = 14695981039346656037ull;
+                h = fnv1a(h, salt, sizeof(salt));
+                h = fnv1a(h, source, length);
+                for(const D3D_SHADER_MACRO *d = defines; nullptr != d && nullptr != d->Name; ++d) {
+                    h = fnv1a_string(h, d->Name);
+                    h = fnv1a_string(h, d->Definition);
+                }
+                h = fnv1a_string(h, entry);
+                h = fnv1a_string(h, profile);
+                h = fnv1a(h, &flags, sizeof(flags));
+                unsigned int compiler = D3D_COMPILER_VERSION;
+                h = fnv1a(h, &compiler, sizeof(compiler));
+                return h;
+            }
+
+            /// <summary>
+            /// Look up a key, returns invalid bytecode on a miss.
+            /// </summary>
+            shaderbytecode find(uint64_t key)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto it = m_entries.find(key);
+                if(it == m_entries.end()) {
+                    m_statistics.misses++;
+                    return shaderbytecode();
+                }
+
+                entry &e = it->second;
+                m_lru.splice(m_lru.end(), m_lru, e.lru);
+
+                std::shared_ptr<const mappedfile> file = e.mapping.lock();
+                if(!file) {
+                    std::string path = file_path(key);
+                    auto mapped = std::make_shared<mappedfile>();
+                    if(!mapped->open(path)) {
+                        // removed behind our back
+                        m_bytes -= e.size;
+                        m_lru.erase(e.lru);
+                        m_entries.erase(it);
+                        m_statistics.misses++;
+                        return shaderbytecode();
+                    }
+                    touch(path);
+                    file = mapped;
+                    e.mapping = file;
+                }
+
+                m_statistics.hits++;
+                return shaderbytecode(file);
+            }
+
+            /// <summary>
+            /// Return cached bytecode, or compile and store it. Throws compile_error.
+            /// </summary>
+            shaderbytecode compile(const char *source, size_t length, const D3D_SHADER_MACRO *defines, const char *entry, const char *profile, unsigned int flags = D3DCOMPILE_OPTIMIZATION_LEVEL3)
+            {
+                // the key must cover included files too: the source is expanded first, and the expanded text
+                // is both hashed and compiled without an include handler so the compiler sees what was hashed
+                blob expanded;
+                ID3DInclude *include = D3D_COMPILE_STANDARD_FILE_INCLUDE;
+                if(may_include(source, length)) {
+                    expanded = preprocess_shader(source, length, defines);
+                    source = (const char*)expanded.data();
+                    length = strnlen(source, expanded.size());
+                    include = nullptr;
+                }
+
+                uint64_t k = key(source, length, defines, entry, profile, flags);
+                shaderbytecode cached = find(k);
+                if(cached.is_valid()) {
+                    return cached;
+                }
+
+                // compile outside the lock, racing compilations of the same key just store the same bytes
+                blob code = compile_shader(source, length, defines, entry, profile, flags, include);
+                store(k, code.data(), code.size());
+                return shaderbytecode(code);
+            }
+
+            void store(uint64_t key, const void *data, size_t size)
+            {
+                std::string path = file_path(key);
+                char suffix[32];
+                sprintf_s(suffix, ".%lu.tmp", GetCurrentThreadId());
+                std::string temp = path + suffix;
+
+                FILE *fp = nullptr;
+                if(fopen_s(&fp, temp.c_str(), "wb") != 0 || nullptr == fp) {
+                    return;
+                }
+                bool ok = (fwrite(data, 1, size, fp) == size);
+                ok = (fclose(fp) == 0) && ok;
+                if(!ok || !MoveFileExA(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+                    DeleteFileA(temp.c_str());
+                    return;
+                }
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                insert(key, size);
+                evict(key);
+            }
+
+            void set_max_bytes(uint64_t max_bytes)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_max_bytes = max_bytes;
+                evict(0);
+            }
+
+            shadercachestatistics statistics() const
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                shadercachestatistics result = m_statistics;
+                result.entries = (unsigned int)m_entries.size();
+                result.bytes = m_bytes;
+                return result;
+            }
+
+        private:
+            struct entry {
+                uint64_t size;
+                std::list<uint64_t>::iterator lru;
+                std::weak_ptr<const mappedfile> mapping;
+            };
+
+            static uint64_t fnv1a(uint64_t h, const void *data, size_t size)
+            {
+                const unsigned char *p = (const unsigned char*)data;
+                for(size_t i = 0; i < size; ++i) {
+                    h = (h ^ p[i]) * 1099511628211ull;
+                }
+                return h;
+            }
+
+            static bool may_include(const char *source, size_t length)
+            {
+                static const char directive[] = "include";
+                return std::search(source, source + length, directive, directive + sizeof(directive) - 1) != source + length;
+            }
+
+            static uint64_t fnv1a_string(uint64_t h, const char *s)
+            {
+                // keep the terminator so that ("ab", "c") and ("a", "bc") differ
+                return (nullptr == s) ? fnv1a(h, "", 1) : fnv1a(h, s, strlen(s) + 1);
+            }
+
+            std::string file_path(uint64_t key) const
+            {
+                char name[32];
+                sprintf_s(name, "\\%016llx.cso", (unsigned long long)key);
+                return m_directory + name;
+            }
+
+            static void touch(const std::string &path)
+            {
+                HANDLE file = CreateFileA(path.c_str(), FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+                if(file != INVALID_HANDLE_VALUE) {
+                    FILETIME now;
+                    GetSystemTimeAsFileTime(&now);
+                    SetFileTime(file, nullptr, nullptr, &now);
+                    CloseHandle(file);
+                }
+            }
+
+            void scan()
+            {
+                struct found {
+                    uint64_t key;
+                    uint64_t size;
+                    uint64_t time;
+                };
+                std::vector<found> files;
+
+                WIN32_FIND_DATAA data;
+                HANDLE h = FindFirstFileA((m_directory + "\\*.cso").c_str(), &data);
+                if(h == INVALID_HANDLE_VALUE) {
+                    return;
+                }
+                do {
+                    unsigned long long key = 0;
+                    if(strlen(data.cFileName) == 20 && sscanf_s(data.cFileName, "%16llx.cso", &key) == 1) {
+                        found f;
+                        f.key = key;
+                        f.size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+                        f.time = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+                        files.push_back(f);
+                    }
+                } while(FindNextFileA(h, &data));
+                FindClose(h);
+
+                std::sort(files.begin(), files.end(), [](const found &a, const found &b) {
+                    return a.time < b.time;
+                });
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                for(auto& f : files) {
+                    insert(f.key, f.size);
+                }
+            }
+
+            void insert(uint64_t key, uint64_t size)
+            {
+                auto it = m_entries.find(key);
+                if(it != m_entries.end()) {
+                    m_bytes -= it->second.size;
+                    it->second.size = size;
+                    m_lru.splice(m_lru.end(), m_lru, it->second.lru);
+                }
+                else {
+                    entry e;
+                    e.size = size;
+                    e.lru = m_lru.insert(m_lru.end(), key);
+                    m_entries.emplace(key, e);
+                }
+                m_bytes += size;
+            }
+
+            /// <summary>
+            /// Delete least recently used entries until the cache fits, never the one just stored.
+            /// </summary>
+            void evict(uint64_t keep)
+            {
+                while(m_bytes > m_max_bytes && !m_lru.empty()) {
+                    uint64_t key = m_lru.front();
+                    if(key == keep) {
+                        if(m_lru.size() == 1) {
+                            break;
+                        }
+                        m_lru.splice(m_lru.end(), m_lru, m_lru.begin());
+                        continue;
+                    }
+                    // a file still mapped somewhere can't be deleted, the next scan picks it up again
+                    DeleteFileA(file_path(key).c_str());
+                    auto it = m_entries.find(key);
+                    m_bytes -= it->second.size;
+                    m_entries.erase(it);
+                    m_lru.pop_front();
+                    m_statistics.evictions++;
+                }
+            }
+
+            std::string m_directory;
+            uint64_t m_max_bytes;
+
+            mutable std::mutex m_mutex;
+            std::list<uint64_t> m_lru;     // least recently used first
+            std::unordered_map<uint64_t, entry> m_entries;
+            uint64_t m_bytes = 0;
+            shadercachestatistics m_statistics;
+        };
+
+    } /* End of namespace d3d11 */
+
+} /* End of namespace dx */
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "DirectXPlus.h"
+#include "ShaderCache.h"
+#include "WorkerPool.h"
+
+namespace dx {
+
+    namespace d3d11 {
+
+        /// <summary>
+        /// Result of a background compilation, polled by the render loop.
+        /// </summary>
+        template<class T>
+        class compilehandle {
+        public:
+            compilehandle() {}
+
+            explicit compilehandle(std::shared_future<T> f)
+                : m_future(std::move(f))
+            {}
+
+            bool is_valid() const
+            {
+                return m_future.valid();
+            }
+
+            bool ready() const
+            {
+                return m_future.valid() && m_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+            }
+
+            /// <summary>
+            /// Blocks until done, rethrows compile_error or runtime_error from the worker.
+            /// </summary>
+            T get() const
+            {
+                return m_future.get();
+            }
+
+        private:
+            std::shared_future<T> m_future;
+        };
+
+        /// <summary>
+        /// Keeps drawing with the current object until the requested replacement has finished compiling.
+        /// A failed replacement is dropped and the current object stays.
+        /// </summary>
+        template<class T>
+        class pendingobject {
+        public:
+            void request(const compilehandle<T> &next)
+            {
+                m_next = next;
+            }
+
+            /// <summary>
+            /// Swap in the replacement if it is ready, returns true when current() changed.
+            /// </summary>
+            bool poll()
+            {
+                if(!m_next.ready()) {
+                    return false;
+                }
+                compilehandle<T> next = m_next;
+                m_next = compilehandle<T>();
+                try {
+                    m_current = next.get();
+                    m_error.clear();
+                    return true;
+                }
+                catch(const std::exception &e) {
+                    m_error = e.what();
+                    return false;
+                }
+            }
+
+            bool is_pending() const
+            {
+                return m_next.is_valid();
+            }
+
+            const T &current() const
+            {
+                return m_current;
+            }
+
+            /// <summary>
+            /// Message of the last failed replacement, empty if it succeeded.
+            /// </summary>
+            const std::string &error() const
+            {
+                return m_error;
+            }
+
+        private:
+            T m_current;
+            compilehandle<T> m_next;
+            std::string m_error;
+        };
+
+        /// <summary>
+        /// A vertex shader together with the input layout validated against it.
+        /// </summary>
+        struct vertexprogram {
+            vertexshader shader;
+            inputlayout layout;
+        };
+
+        struct compilestatistics {
+            size_t queue_depth = 0;
+            unsigned int in_flight = 0;
+            unsigned int completed = 0;
+            unsigned int failed = 0;
+            double average_latency_ms = 0.0;
+            double max_latency_ms = 0.0;
+        };
+
+        /// <summary>
+        /// Compiles HLSL and creates the shader objects on worker threads.
+        /// ID3D11Device creation methods are free-threaded, the immediate context is never touched here.
+        /// </summary>
+        class shadercompiler {
+        public:
+            struct define {
+                std::string name;
+                std::string value;
+            };
+
+            shadercompiler(const device &dev, shadercache *cache = nullptr, unsigned int threads = workerpool::default_threads())
+                : m_device(dev), m_cache(cache), m_pool(threads)
+            {}
+
+            template<class shader>
+            compilehandle<shader> compile(std::string source, std::string entry, std::string profile, std::vector<define> defines = std::vector<define>())
+            {
+                device dev = m_device;
+                return submit<shader>([=]() mutable {
+                    shaderbytecode code = build(source, defines, entry, profile);
+                    return dev.create_shader<shader>(code.data(), code.size());
+                });
+            }
+
+            /// <summary>
+            /// Compile a vertex shader and create its input layout, semantic names are copied.
+            /// </summary>
+            compilehandle<vertexprogram> compile_vertex(std::string source, std::string entry, std::string profile, std::vector<D3D11_INPUT_ELEMENT_DESC> layout, std::vector<define> defines = std::vector<define>())
+            {
+                std::vector<std::string> semantics;
+                for(auto& e : layout) {
+                    semantics.push_back(e.SemanticName);
+                }
+                device dev = m_device;
+                return submit<vertexprogram>([=]() mutable {
+                    for(size_t i = 0; i < layout.size(); ++i) {
+                        layout[i].SemanticName = semantics[i].c_str();
+                    }
+                    shaderbytecode code = build(source, defines, entry, profile);
+                    vertexprogram result;
+                    result.shader = dev.create_shader<vertexshader>(code.data(), code.size());
+                    result.layout = dev.create_inputlayout(layout.data(), (unsigned int)layout.size(), code.data(), code.size());
+                    return result;
+                });
+            }
+
+            compilestatistics statistics() const
+            {
+                compilestatistics result;
+                result.queue_depth = m_pool.queue_depth();
+                result.in_flight = m_in_flight;
+                result.completed = m_completed;
+                result.failed = m_failed;
+                unsigned int done = result.completed + result.failed;
+                result.average_latency_ms = (done > 0) ? (double)m_total_latency_us / done / 1000.0 : 0.0;
+                result.max_latency_ms = (double)m_max_latency_us / 1000.0;
+                return result;
+            }
+
+        private:
+            typedef std::chrono::steady_clock clock;
+
+            template<class T, class F>
+            compilehandle<T> submit(F job)
+            {
+                auto promise = std::make_shared<std::promise<T>>();
+                compilehandle<T> handle(promise->get_future().share());
+                clock::time_point queued = clock::now();
+                m_in_flight++;
+
+                m_pool.submit([this, promise, job, queued]() mutable {
+                    bool ok = true;
+                    try {
+                        promise->set_value(job());
+                    }
+                    catch(...) {
+                        ok = false;
+                        promise->set_exception(std::current_exception());
+                    }
+                    record(queued, ok);
+                });
+                return handle;
+            }
+
+            shaderbytecode build(const std::string &source, const std::vector<define> &defines, const std::string &entry, const std::string &profile)
+            {
+                std::vector<D3D_SHADER_MACRO> macros;
+                for(auto& d : defines) {
+                    D3D_SHADER_MACRO m = { d.name.c_str(), d.value.c_str() };
+                    macros.push_back(m);
+                }
+                D3D_SHADER_MACRO terminator = { nullptr, nullptr };
+                macros.push_back(terminator);
+
+                if(nullptr != m_cache) {
+                    return m_cache->compile(source.data(), source.size(), macros.data(), entry.c_str(), profile.c_str());
+                }
+                return shaderbytecode(compile_shader(source.data(), source.size(), macros.data(), entry.c_str(), profile.c_str()));
+            }
+
+            void record(clock::time_point queued, bool ok)
+            {
+                uint64_t latency = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - queued).count();
+                m_total_latency_us += latency;
+                uint64_t previous = m_max_latency_us;
+                while(latency > previous && !m_max_latency_us.compare_exchange_weak(previous, latency)) {
+                }
+                (ok ? m_completed : m_failed)++;
+                m_in_flight--;
+            }
+
+            device m_device;
+            shadercache *m_cache;
+
+            std::atomic<unsigned int> m_in_flight{0};
+            std::atomic<unsigned int> m_completed{0};
+            std::atomic<unsigned int> m_failed{0};
+            std::atomic<uint64_t> m_total_latency_us{0};
+            std::atomic<uint64_t> m_max_latency_us{0};
+
+            // last, so the workers are joined before anything they use goes away
+            workerpool m_pool;
+        };
+
+    } /* End of namespace d3d11 */
+
+} /* End of namespace dx */
@@ -0,0 +1,853 @@
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DX_SOFT_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#include "WorkerPool.h"
+
+namespace dx {
+
+    namespace soft {
+
+        /// <summary>
+        /// Four floats with the few operations edge functions and depth tests need,
+        /// SSE2 where the compiler targets it, plain arrays otherwise.
+        /// </summary>
+#ifdef DX_SOFT_SSE2
+        struct float4 {
+            __m128 v;
+
+            float4() {}
+            float4(__m128 x) : v(x) {}
+            explicit float4(float x) : v(_mm_set1_ps(x)) {}
+            float4(float a, float b, float c, float d) : v(_mm_setr_ps(a, b, c, d)) {}
+
+            static float4 load(const float *p) { return _mm_loadu_ps(p); }
+            void store(float *p) const { _mm_storeu_ps(p, v); }
+
+            friend float4 operator+ (float4 a, float4 b) { return _mm_add_ps(a.v, b.v); }
+            friend float4 operator- (float4 a, float4 b) { return _mm_sub_ps(a.v, b.v); }
+            friend float4 operator* (float4 a, float4 b) { return _mm_mul_ps(a.v, b.v); }
+            friend float4 operator> (float4 a, float4 b) { return _mm_cmpgt_ps(a.v, b.v); }
+            friend float4 operator< (float4 a, float4 b) { return _mm_cmplt_ps(a.v, b.v); }
+            friend float4 operator<= (float4 a, float4 b) { return _mm_cmple_ps(a.v, b.v); }
+            friend float4 operator== (float4 a, float4 b) { return _mm_cmpeq_ps(a.v, b.v); }
+            friend float4 operator& (float4 a, float4 b) { return _mm_and_ps(a.v, b.v); }
+            friend float4 operator| (float4 a, float4 b) { return _mm_or_ps(a.v, b.v); }
+
+            // one bit per lane of a comparison result
+            int mask() const { return _mm_movemask_ps(v); }
+        };
+#else
+        struct float4 {
+            float f[4];
+
+            float4() {}
+            explicit float4(float x) { f[0] = f[1] = f[2] = f[3] = x; }
+            float4(float a, float b, float c, float d) { f[0] = a; f[1] = b; f[2] = c; f[3] = d; }
+
+            static float4 load(const float *p) { return float4(p[0], p[1], p[2], p[3]); }
+            void store(float *p) const { memcpy(p, f, sizeof(f)); }
+
+#define DX_SOFT_LANES(op, expr) \
+            friend float4 operator op (float4 a, float4 b) { float4 r; for(int i = 0; i < 4; ++i) { r.f[i] = (expr); } return r; }
+#define DX_SOFT_COMPARE(op) DX_SOFT_LANES(op, (a.f[i] op b.f[i]) ? lane_true() : 0.0f)
+
+            DX_SOFT_LANES(+, a.f[i] + b.f[i])
+            DX_SOFT_LANES(-, a.f[i] - b.f[i])
+            DX_SOFT_LANES(*, a.f[i] * b.f[i])
+            DX_SOFT_COMPARE(>)
+            DX_SOFT_COMPARE(<)
+            DX_SOFT_COMPARE(<=)
+            DX_SOFT_COMPARE(==)
+            DX_SOFT_LANES(&, bits(bits(a.f[i]) & bits(b.f[i])))
+            DX_SOFT_LANES(|, bits(bits(a.f[i]) | bits(b.f[i])))
+
+#undef DX_SOFT_COMPARE
+#undef DX_SOFT_LANES
+
+            int mask() const
+            {
+                int m = 0;
+                for(int i = 0; i < 4; ++i) {
+                    m |= (bits(f[i]) >> 31) << i;
+                }
+                return m;
+            }
+
+
+        private:
+            static float lane_true() { return bits(0xFFFFFFFFu); }
+            static uint32_t bits(float x) { uint32_t u; memcpy(&u, &x, 4); return u; }
+            static float bits(uint32_t u) { float x; memcpy(&x, &u, 4); return x; }
+        };
+#endif
+
+        /// <summary>
+        /// A vertex after the vertex stage: clip-space position, texture coordinates and color.
+        /// </summary>
+        struct vertex {
+            float x, y, z, w;
+            float u, v;
+            float r, g, b, a;
+        };
+
+        /// <summary>
+        /// 8-bit RGBA image, red in the lowest byte, rows of pitch texels.
+        /// </summary>
+        class texture {
+        public:
+            texture(unsigned int width = 0, unsigned int height = 0)
+                : m_width(width), m_height(height), m_texels((size_t)width * height)
+            {}
+
+            texture(unsigned int width, unsigned int height, const uint32_t *texels)
+                : m_width(width), m_height(height), m_texels(texels, texels + (size_t)width * height)
+            {}
+
+            unsigned int width() const { return m_width; }
+            unsigned int height() const { return m_height; }
+            uint32_t *data() { return m_texels.data(); }
+            const uint32_t *data() const { return m_texels.data(); }
+
+        private:
+            unsigned int m_width;
+            unsigned int m_height;
+            std::vector<uint32_t> m_texels;
+        };
+
+        /// <summary>
+        /// Color (8-bit RGBA, red in the lowest byte) and float depth, rows padded to 4 pixels
+        /// so the rasterizer can always work on whole spans.
+        /// </summary>
+        class rendertarget {
+        public:
+            rendertarget(unsigned int width = 0, unsigned int height = 0)
+            {
+                resize(width, height);
+            }
+
+            void resize(unsigned int width, unsigned int height)
+            {
+                m_width = width;
+                m_height = height;
+                m_pitch = (width + 3) & ~3u;
+                m_color.assign((size_t)m_pitch * height, 0);
+                m_depth.assign((size_t)m_pitch * height, 1.0f);
+            }
+
+            unsigned int width() const { return m_width; }
+            unsigned int height() const { return m_height; }
+            unsigned int pitch() const { return m_pitch; }               // in pixels
+            unsigned int row_pitch() const { return m_pitch * 4; }       // in bytes
+            uint32_t *color() { return m_color.data(); }
+            const uint32_t *color() const { return m_color.data(); }
+            float *depth() { return m_depth.data(); }
+            const float *depth() const { return m_depth.data(); }
+
+        private:
+            unsigned int m_width = 0;
+            unsigned int m_height = 0;
+            unsigned int m_pitch = 0;
+            std::vector<uint32_t> m_color;
+            std::vector<float> m_depth;
+        };
+
+        enum class blendmode {
+            opaque,
+            alpha,              // src * a + dst * (1 - a)
+            premultiplied,      // src + dst * (1 - a)
+            additive            // src * a + dst
+        };
+
+        enum class filtermode {
+            point,
+            bilinear
+        };
+
+        enum class addressmode {
+            clamp,
+            wrap
+        };
+
+        struct viewport {
+            float x = 0.0f;
+            float y = 0.0f;
+            float width = 0.0f;
+            float height = 0.0f;
+        };
+
+        struct rasterstatistics {
+            unsigned int triangles = 0;     // submitted
+            unsigned int culled = 0;        // back faces, clipped away or without pixels
+            unsigned int binned = 0;        // triangle and tile pairs
+            uint64_t pixels = 0;            // passed coverage and depth
+            unsigned int tiles = 0;         // with work
+            double bin_ms = 0.0;            // spent in draw()
+            double raster_ms = 0.0;         // wall time of flush()
+            double raster_cpu_ms = 0.0;     // summed over the threads, wall times on 1 and n threads give the speed-up
+        };
+
+        /// <summary>
+        /// Tiled software rasterizer for textured, vertex-colored triangle lists.
+        ///
+        /// draw() clips, sets up and bins triangles into screen tiles on the calling thread,
+        /// flush() rasterizes the tiles in parallel on a workerpool and the calling thread.
+        /// Every tile replays its commands in submission order, so blending is ordered as on a GPU.
+        /// Coverage and depth are evaluated four pixels at a time with SIMD edge functions,
+        /// the D3D top-left fill rule applies and front faces are clockwise.
+        ///
+        /// Textures and the target must stay alive and unchanged until flush() returns.
+        /// </summary>
+        class rasterizer {
+        public:
+            explicit rasterizer(unsigned int threads = workerpool::default_threads(), unsigned int tile_size = 64)
+                : m_tile_size(std::max(4u, tile_size & ~3u)), m_pool(threads)
+            {}
+
+            rasterizer(const rasterizer &) = delete;
+            rasterizer &operator= (const rasterizer &) = delete;
+
+            /// <summary>
+            /// Flushes pending work and sets the viewport to the whole target.
+            /// </summary>
+            void set_target(rendertarget *target)
+            {
+                flush();
+                m_target = target;
+                m_tiles_x = (target->width() + m_tile_size - 1) / m_tile_size;
+                m_tiles_y = (target->height() + m_tile_size - 1) / m_tile_size;
+                m_bins.assign((size_t)m_tiles_x * m_tiles_y, std::vector<uint32_t>());
+                viewport vp;
+                vp.width = (float)target->width();
+                vp.height = (float)target->height();
+                set_viewport(vp);
+            }
+
+            void set_viewport(const viewport &vp)
+            {
+                m_state.vp = vp;
+                m_state_dirty = true;
+            }
+
+            /// <summary>
+            /// nullptr draws vertex colors only.
+            /// </summary>
+            void set_texture(const texture *tex, filtermode filter = filtermode::bilinear, addressmode address = addressmode::clamp)
+            {
+                m_state.tex = tex;
+                m_state.filter = filter;
+                m_state.address = address;
+                m_state_dirty = true;
+            }
+
+            void set_blend(blendmode mode)
+            {
+                m_state.blend = mode;
+                m_state_dirty = true;
+            }
+
+            /// <summary>
+            /// Depth passes when less than the stored value.
+            /// </summary>
+            void set_depth(bool test, bool write)
+            {
+                m_state.depth_test = test;
+                m_state.depth_write = write;
+                m_state_dirty = true;
+            }
+
+            void set_cull_back(bool cull)
+            {
+                m_state.cull_back = cull;
+                m_state_dirty = true;
+            }
+
+            /// <summary>
+            /// Clear the whole target, like ClearRenderTargetView it ignores the viewport.
+            /// </summary>
+            void clear(const float rgba[4])
+            {
+                command c;
+                c.kind = command::clear_color;
+                c.color = pack(rgba[0], rgba[1], rgba[2], rgba[3]);
+                push_to_all(c);
+            }
+
+            void clear_depth(float depth = 1.0f)
+            {
+                command c;
+                c.kind = command::clear_depth;
+                c.depth = depth;
+                push_to_all(c);
+            }
+
+            void draw(const vertex *vertices, unsigned int count)
+            {
+                clock::time_point start = clock::now();
+                for(unsigned int i = 0; i + 2 < count; i += 3) {
+                    triangle(vertices[i], vertices[i + 1], vertices[i + 2]);
+                }
+                m_statistics.bin_ms += ms_since(start);
+            }
+
+            void draw_indexed(const vertex *vertices, const uint32_t *indices, unsigned int count)
+            {
+                clock::time_point start = clock::now();
+                for(unsigned int i = 0; i + 2 < count; i += 3) {
+                    triangle(vertices[indices[i]], vertices[indices[i + 1]], vertices[indices[i + 2]]);
+                }
+                m_statistics.bin_ms += ms_since(start);
+            }
+
+            /// <summary>
+            /// Rasterize everything drawn so far into the target, blocks until done.
+            /// </summary>
+            void flush()
+            {
+                clock::time_point start = clock::now();
+                m_work.clear();
+                for(uint32_t t = 0; t < (uint32_t)m_bins.size(); ++t) {
+                    if(!m_bins[t].empty()) {
+                        m_work.push_back(t);
+                    }
+                }
+                if(m_work.empty()) {
+                    m_commands.clear();
+                    m_triangles.clear();
+                    return;
+                }
+                m_next_tile = 0;
+                m_pixels = 0;
+                m_cpu_us = 0;
+
+                // the calling thread takes tiles as well, it would only be waiting otherwise
+                unsigned int helpers = std::min((unsigned int)m_work.size(), m_pool.thread_count() + 1) - 1;
+                m_running = helpers;
+                for(unsigned int i = 0; i < helpers; ++i) {
+                    m_pool.submit([this] {
+                        raster_tiles();
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        if(--m_running == 0) {
+                            m_done.notify_one();
+                        }
+                    });
+                }
+                raster_tiles();
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_done.wait(lock, [this] { return m_running == 0; });
+                }
+
+                m_statistics.tiles += (unsigned int)m_work.size();
+                m_statistics.pixels += m_pixels;
+                m_statistics.raster_ms += ms_since(start);
+                m_statistics.raster_cpu_ms += (double)m_cpu_us / 1000.0;
+
+                for(auto& b : m_bins) {
+                    b.clear();
+                }
+                m_commands.clear();
+                m_triangles.clear();
+                m_states.clear();
+                m_state_dirty = true;
+            }
+
+            /// <summary>
+            /// Return the counts gathered since the last call and start over.
+            /// </summary>
+            rasterstatistics reset_statistics()
+            {
+                rasterstatistics result = m_statistics;
+                m_statistics = rasterstatistics();
+                return result;
+            }
+
+            unsigned int thread_count() const
+            {
+                return m_pool.thread_count() + 1;
+            }
+
+        private:
+            typedef std::chrono::steady_clock clock;
+
+            struct state {
+                viewport vp;
+                const texture *tex = nullptr;
+                filtermode filter = filtermode::bilinear;
+                addressmode address = addressmode::clamp;
+                blendmode blend = blendmode::opaque;
+                bool depth_test = true;
+                bool depth_write = true;
+                bool cull_back = false;
+            };
+
+            struct command {
+                enum { draw_triangle, clear_color, clear_depth } kind;
+                uint32_t index = 0;     // triangle
+                uint32_t color = 0;
+                float depth = 1.0f;
+            };
+
+            // screen space after setup, edge i runs opposite of vertex i
+            struct setup {
+                float a[3], b[3], c[3];     // edge functions a * x + b * y + c
+                bool top_left[3];
+                float inv_area;
+                int x0, y0, x1, y1;         // pixel bounds, inclusive
+                float z[3];
+                float inv_w[3];
+                float u[3], v[3];           // divided by w
+                float color[3][4];          // divided by w
+                uint32_t state;
+            };
+
+            struct clipvertex {
+                float p[4];
+                float attr[6];
+            };
+
+            static double ms_since(clock::time_point start)
+            {
+                return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+            }
+
+            static uint32_t pack(float r, float g, float b, float a)
+            {
+                auto c = [](float x) -> uint32_t {
+                    x = (x < 0.0f) ? 0.0f : (x > 1.0f) ? 1.0f : x;
+                    return (uint32_t)(x * 255.0f + 0.5f);
+                };
+                return c(r) | (c(g) << 8) | (c(b) << 16) | (c(a) << 24);
+            }
+
+            static void unpack(uint32_t p, float rgba[4])
+            {
+                const float s = 1.0f / 255.0f;
+                rgba[0] = (float)(p & 0xFF) * s;
+                rgba[1] = (float)((p >> 8) & 0xFF) * s;
+                rgba[2] = (float)((p >> 16) & 0xFF) * s;
+                rgba[3] = (float)(p >> 24) * s;
+            }
+
+            void push_to_all(const command &c)
+            {
+                uint32_t index = (uint32_t)m_commands.size();
+                m_commands.push_back(c);
+                for(auto& b : m_bins) {
+                    b.push_back(index);
+                }
+            }
+
+            uint32_t current_state()
+            {
+                if(m_state_dirty) {
+                    m_states.push_back(m_state);
+                    m_state_dirty = false;
+                }
+                return (uint32_t)m_states.size() - 1;
+            }
+
+            void triangle(const vertex &v0, const vertex &v1, const vertex &v2)
+            {
+                m_statistics.triangles++;
+                if(nullptr == m_target) {
+                    return;
+                }
+
+                // near, far and a guard band wide enough that x / w and y / w stay well inside float precision
+                static const float guard = 8.0f;
+                static const float planes[6][4] = {
+                    {  0.0f,  0.0f,  1.0f,  0.0f },
+                    {  0.0f,  0.0f, -1.0f,  1.0f },
+                    {  1.0f,  0.0f,  0.0f, guard },
+                    { -1.0f,  0.0f,  0.0f, guard },
+                    {  0.0f,  1.0f,  0.0f, guard },
+                    {  0.0f, -1.0f,  0.0f, guard },
+                };
+
+                clipvertex poly[2][9];
+                unsigned int n = 3;
+                const vertex *in[3] = { &v0, &v1, &v2 };
+                for(unsigned int i = 0; i < 3; ++i) {
+                    const vertex &s = *in[i];
+                    clipvertex &d = poly[0][i];
+                    d.p[0] = s.x; d.p[1] = s.y; d.p[2] = s.z; d.p[3] = s.w;
+                    d.attr[0] = s.u; d.attr[1] = s.v;
+                    d.attr[2] = s.r; d.attr[3] = s.g; d.attr[4] = s.b; d.attr[5] = s.a;
+                }
+
+                unsigned int cur = 0;
+                for(auto& pl : planes) {
+                    float d[9];
+                    bool all_in = true;
+                    bool all_out = true;
+                    for(unsigned int i = 0; i < n; ++i) {
+                        const float *p = poly[cur][i].p;
+                        d[i] = pl[0] * p[0] + pl[1] * p[1] + pl[2] * p[2] + pl[3] * p[3];
+                        all_in = all_in && d[i] >= 0.0f;
+                        all_out = all_out && d[i] < 0.0f;
+                    }
+                    if(all_out) {
+                        m_statistics.culled++;
+                        return;
+                    }
+                    if(all_in) {
+                        continue;
+                    }
+                    unsigned int m = 0;
+                    for(unsigned int i = 0; i < n; ++i) {
+                        unsigned int j = (i + 1) % n;
+                        const clipvertex &a = poly[cur][i];
+                        const clipvertex &b = poly[cur][j];
+                        if(d[i] >= 0.0f) {
+                            poly[cur ^ 1][m++] = a;
+                        }
+                        if((d[i] >= 0.0f) != (d[j] >= 0.0f)) {
+                            float t = d[i] / (d[i] - d[j]);
+                            clipvertex &o = poly[cur ^ 1][m++];
+                            for(int k = 0; k < 4; ++k) {
+                                o.p[k] = a.p[k] + t * (b.p[k] - a.p[k]);
+                            }
+                            for(int k = 0; k < 6; ++k) {
+                                o.attr[k] = a.attr[k] + t * (b.attr[k] - a.attr[k]);
+                            }
+                        }
+                    }
+                    n = m;
+                    cur ^= 1;
+                }
+
+                for(unsigned int i = 1; i + 1 < n; ++i) {
+                    bin(poly[cur][0], poly[cur][i], poly[cur][i + 1]);
+                }
+            }
+
+            void bin(const clipvertex &c0, const clipvertex &c1, const clipvertex &c2)
+            {
+                const state &st = m_state;
+                const clipvertex *c[3] = { &c0, &c1, &c2 };
+                float sx[3], sy[3];
+                setup s;
+                for(int i = 0; i < 3; ++i) {
+                    float inv_w = 1.0f / c[i]->p[3];
+                    // snap to 1/16 pixel so that shared edges evaluate the same from both sides
+                    sx[i] = floorf((st.vp.x + (c[i]->p[0] * inv_w * 0.5f + 0.5f) * st.vp.width) * 16.0f + 0.5f) / 16.0f;
+                    sy[i] = floorf((st.vp.y + (0.5f - c[i]->p[1] * inv_w * 0.5f) * st.vp.height) * 16.0f + 0.5f) / 16.0f;
+                    s.z[i] = c[i]->p[2] * inv_w;
+                    s.inv_w[i] = inv_w;
+                    s.u[i] = c[i]->attr[0] * inv_w;
+                    s.v[i] = c[i]->attr[1] * inv_w;
+                    for(int k = 0; k < 4; ++k) {
+                        s.color[i][k] = c[i]->attr[2 + k] * inv_w;
+                    }
+                }
+
+                float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sy[1] - sy[0]) * (sx[2] - sx[0]);
+                if(area == 0.0f || (area < 0.0f && st.cull_back)) {
+                    m_statistics.culled++;
+                    return;
+                }
+                if(area < 0.0f) {
+                    // back face drawn anyway, flip to clockwise
+                    std::swap(sx[1], sx[2]);
+                    std::swap(sy[1], sy[2]);
+                    std::swap(s.z[1], s.z[2]);
+                    std::swap(s.inv_w[1], s.inv_w[2]);
+                    std::swap(s.u[1], s.u[2]);
+                    std::swap(s.v[1], s.v[2]);
+                    for(int k = 0; k < 4; ++k) {
+                        std::swap(s.color[1][k], s.color[2][k]);
+                    }
+                    area = -area;
+                }
+                s.inv_area = 1.0f / area;
+
+                for(int i = 0; i < 3; ++i) {
+                    // edge opposite of vertex i, from vertex i + 1 to vertex i + 2
+                    int j = (i + 1) % 3, k = (i + 2) % 3;
+                    s.a[i] = sy[j] - sy[k];
+                    s.b[i] = sx[k] - sx[j];
+                    s.c[i] = -s.a[i] * sx[j] - s.b[i] * sy[j];
+                    s.top_left[i] = s.a[i] > 0.0f || (s.a[i] == 0.0f && s.b[i] > 0.0f);
+                }
+
+                // pixel centers inside the bounding box, clamped to viewport and target
+                float vx0 = std::max(0.0f, st.vp.x), vy0 = std::max(0.0f, st.vp.y);
+                float vx1 = std::min((float)m_target->width(), st.vp.x + st.vp.width);
+                float vy1 = std::min((float)m_target->height(), st.vp.y + st.vp.height);
+                float minx = std::max(vx0, std::min(sx[0], std::min(sx[1], sx[2])));
+                float miny = std::max(vy0, std::min(sy[0], std::min(sy[1], sy[2])));
+                float maxx = std::min(vx1, std::max(sx[0], std::max(sx[1], sx[2])));
+                float maxy = std::min(vy1, std::max(sy[0], std::max(sy[1], sy[2])));
+                s.x0 = (int)ceilf(minx - 0.5f);
+                s.y0 = (int)ceilf(miny - 0.5f);
+                s.x1 = std::min((int)floorf(maxx - 0.5f), (int)vx1 - 1);
+                s.y1 = std::min((int)floorf(maxy - 0.5f), (int)vy1 - 1);
+                if(s.x0 > s.x1 || s.y0 > s.y1) {
+                    m_statistics.culled++;
+                    return;
+                }
+                s.state = current_state();
+
+                uint32_t tri = (uint32_t)m_triangles.size();
+                m_triangles.push_back(s);
+                command cmd;
+                cmd.kind = command::draw_triangle;
+                cmd.index = tri;
+                uint32_t index = (uint32_t)m_commands.size();
+                m_commands.push_back(cmd);
+
+                for(int ty = s.y0 / (int)m_tile_size; ty <= s.y1 / (int)m_tile_size; ++ty) {
+                    for(int tx = s.x0 / (int)m_tile_size; tx <= s.x1 / (int)m_tile_size; ++tx) {
+                        m_bins[(size_t)ty * m_tiles_x + tx].push_back(index);
+                        m_statistics.binned++;
+                    }
+                }
+            }
+
+            void raster_tiles()
+            {
+                clock::time_point start = clock::now();
+                uint64_t pixels = 0;
+                for(;;) {
+                    size_t w = m_next_tile.fetch_add(1);
+                    if(w >= m_work.size()) {
+                        break;
+                    }
+                    pixels += raster_tile(m_work[w]);
+                }
+                m_pixels += pixels;
+                m_cpu_us += (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count();
+            }
+
+            uint64_t raster_tile(uint32_t t)
+            {
+                int tx0 = (int)((t % m_tiles_x) * m_tile_size);
+                int ty0 = (int)((t / m_tiles_x) * m_tile_size);
+                int tx1 = std::min(tx0 + (int)m_tile_size, (int)m_target->width()) - 1;
+                int ty1 = std::min(ty0 + (int)m_tile_size, (int)m_target->height()) - 1;
+                const unsigned int pitch = m_target->pitch();
+                uint64_t pixels = 0;
+
+                for(uint32_t index : m_bins[t]) {
+                    const command &c = m_commands[index];
+                    if(c.kind == command::clear_color || c.kind == command::clear_depth) {
+                        for(int y = ty0; y <= ty1; ++y) {
+                            if(c.kind == command::clear_color) {
+                                std::fill_n(m_target->color() + (size_t)y * pitch + tx0, tx1 - tx0 + 1, c.color);
+                            }
+                            else {
+                                std::fill_n(m_target->depth() + (size_t)y * pitch + tx0, tx1 - tx0 + 1, c.depth);
+                            }
+                        }
+                        continue;
+                    }
+                    const setup &s = m_triangles[c.index];
+                    pixels += raster_triangle(s, m_states[s.state], std::max(tx0, s.x0), std::max(ty0, s.y0), std::min(tx1, s.x1), std::min(ty1, s.y1));
+                }
+                return pixels;
+            }
+
+            uint64_t raster_triangle(const setup &s, const state &st, int x0, int y0, int x1, int y1)
+            {
+                const unsigned int pitch = m_target->pitch();
+                uint64_t pixels = 0;
+
+                // spans start at multiples of 4, rows are padded so the last one never leaves the row
+                const int first = x0;
+                x0 &= ~3;
+                const float4 offsets(0.5f, 1.5f, 2.5f, 3.5f);
+                float4 a[3], b[3], c[3], top_left[3];
+                for(int i = 0; i < 3; ++i) {
+                    a[i] = float4(s.a[i]);
+                    b[i] = float4(s.b[i]);
+                    c[i] = float4(s.c[i]);
+                    top_left[i] = s.top_left[i] ? (float4(0.0f) == float4(0.0f)) : float4(0.0f);
+                }
+                const float4 zero(0.0f);
+                const float4 inv_area(s.inv_area);
+
+                for(int y = y0; y <= y1; ++y) {
+                    const float4 py((float)y + 0.5f);
+                    uint32_t *color_row = m_target->color() + (size_t)y * pitch;
+                    float *depth_row = m_target->depth() + (size_t)y * pitch;
+
+                    for(int x = x0; x <= x1; x += 4) {
+                        const float4 px = float4((float)x) + offsets;
+                        float4 e[3];
+                        float4 inside = float4(0.0f) == float4(0.0f);
+                        for(int i = 0; i < 3; ++i) {
+                            e[i] = a[i] * px + b[i] * py + c[i];
+                            inside = inside & ((e[i] > zero) | ((e[i] == zero) & top_left[i]));
+                        }
+                        int mask = inside.mask();
+                        if(x + 3 > x1) {
+                            mask &= (1 << (x1 - x + 1)) - 1;
+                        }
+                        if(x < first) {
+                            mask &= ~((1 << (first - x)) - 1);
+                        }
+                        if(mask == 0) {
+                            continue;
+                        }
+
+                        const float4 l0 = e[0] * inv_area;
+                        const float4 l1 = e[1] * inv_area;
+                        const float4 l2 = e[2] * inv_area;
+                        const float4 z = l0 * float4(s.z[0]) + l1 * float4(s.z[1]) + l2 * float4(s.z[2]);
+                        if(st.depth_test) {
+                            mask &= (z < float4::load(depth_row + x)).mask();
+                            if(mask == 0) {
+                                continue;
+                            }
+                        }
+
+                        float w0[4], w1[4], w2[4], depth[4];
+                        l0.store(w0);
+                        l1.store(w1);
+                        l2.store(w2);
+                        z.store(depth);
+                        for(int lane = 0; lane < 4; ++lane) {
+                            if(0 == (mask & (1 << lane))) {
+                                continue;
+                            }
+                            shade(s, st, w0[lane], w1[lane], w2[lane], color_row[x + lane]);
+                            if(st.depth_write) {
+                                depth_row[x + lane] = depth[lane];
+                            }
+                            pixels++;
+                        }
+                    }
+                }
+                return pixels;
+            }
+
+            static void shade(const setup &s, const state &st, float l0, float l1, float l2, uint32_t &dst)
+            {
+                // perspective correct: interpolate attribute / w and 1 / w, then divide
+                float w = 1.0f / (l0 * s.inv_w[0] + l1 * s.inv_w[1] + l2 * s.inv_w[2]);
+                float src[4];
+                for(int k = 0; k < 4; ++k) {
+                    src[k] = (l0 * s.color[0][k] + l1 * s.color[1][k] + l2 * s.color[2][k]) * w;
+                }
+                if(nullptr != st.tex) {
+                    float u = (l0 * s.u[0] + l1 * s.u[1] + l2 * s.u[2]) * w;
+                    float v = (l0 * s.v[0] + l1 * s.v[1] + l2 * s.v[2]) * w;
+                    float texel[4];
+                    sample(*st.tex, st.filter, st.address, u, v, texel);
+                    for(int k = 0; k < 4; ++k) {
+                        src[k] *= texel[k];
+                    }
+                }
+
+                if(st.blend == blendmode::opaque) {
+                    dst = pack(src[0], src[1], src[2], src[3]);
+                    return;
+                }
+                float d[4];
+                unpack(dst, d);
+                float sa = src[3];
+                for(int k = 0; k < 4; ++k) {
+                    switch(st.blend) {
+                    case blendmode::alpha:
+                        d[k] = src[k] * sa + d[k] * (1.0f - sa);
+                        break;
+                    case blendmode::premultiplied:
+                        d[k] = src[k] + d[k] * (1.0f - sa);
+                        break;
+                    case blendmode::additive:
+                        d[k] = src[k] * sa + d[k];
+                        break;
+                    default:
+                        break;
+                    }
+                }
+                dst = pack(d[0], d[1], d[2], d[3]);
+            }
+
+            static int address(int i, int size, addressmode mode)
+            {
+                if(mode == addressmode::wrap) {
+                    i %= size;
+                    return (i < 0) ? i + size : i;
+                }
+                return (i < 0) ? 0 : (i >= size) ? size - 1 : i;
+            }
+
+            static void sample(const texture &tex, filtermode filter, addressmode mode, float u, float v, float out[4])
+            {
+                const int w = (int)tex.width(), h = (int)tex.height();
+                if(w == 0 || h == 0) {
+                    out[0] = out[1] = out[2] = out[3] = 1.0f;
+                    return;
+                }
+                const uint32_t *texels = tex.data();
+                float fx = u * (float)w - 0.5f;
+                float fy = v * (float)h - 0.5f;
+
+                if(filter == filtermode::point) {
+                    int x = address((int)floorf(fx + 0.5f), w, mode);
+                    int y = address((int)floorf(fy + 0.5f), h, mode);
+                    unpack(texels[(size_t)y * w + x], out);
+                    return;
+                }
+
+                float x0f = floorf(fx), y0f = floorf(fy);
+                float tx = fx - x0f, ty = fy - y0f;
+                int x0 = address((int)x0f, w, mode), x1 = address((int)x0f + 1, w, mode);
+                int y0 = address((int)y0f, h, mode), y1 = address((int)y0f + 1, h, mode);
+                float c00[4], c10[4], c01[4], c11[4];
+                unpack(texels[(size_t)y0 * w + x0], c00);
+                unpack(texels[(size_t)y0 * w + x1], c10);
+                unpack(texels[(size_t)y1 * w + x0], c01);
+                unpack(texels[(size_t)y1 * w + x1], c11);
+                for(int k = 0; k < 4; ++k) {
+                    float top = c00[k] + (c10[k] - c00[k]) * tx;
+                    float bottom = c01[k] + (c11[k] - c01[k]) * tx;
+                    out[k] = top + (bottom - top) * ty;
+                }
+            }
+
+            unsigned int m_tile_size;
+            rendertarget *m_target = nullptr;
+            unsigned int m_tiles_x = 0;
+            unsigned int m_tiles_y = 0;
+
+            state m_state;
+            bool m_state_dirty = true;
+            std::vector<state> m_states;
+            std::vector<command> m_commands;
+            std::vector<setup> m_triangles;
+            std::vector<std::vector<uint32_t>> m_bins;
+
+            std::vector<uint32_t> m_work;
+            std::atomic<size_t> m_next_tile{0};
+            std::atomic<uint64_t> m_pixels{0};
+            std::atomic<uint64_t> m_cpu_us{0};
+            rasterstatistics m_statistics;
+
+            std::mutex m_mutex;
+            std::condition_variable m_done;
+            unsigned int m_running = 0;
+
+            // last, so the workers are joined before anything they use goes away
+            workerpool m_pool;
+        };
+
+    } /* End of namespace soft */
+
+} /* End of namespace dx */
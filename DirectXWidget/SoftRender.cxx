@@ -0,0 +1,147 @@
+#include "SoftReplay.h"
+#include "SoftScene.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+
+// Frames, raster work and the speed-up over drawing on one thread, baseline is 0 when there was none.
+// stdout may carry the frames, report on stderr.
+template<class S>
+static void report(const S &stats, unsigned int threads, double baseline)
+{
+    const dx::soft::rasterstatistics &r = stats.raster;
+    fprintf(stderr, "%llu frames in %.2f s, %.1f fps\n", (unsigned long long)stats.frames, stats.seconds, stats.fps());
+    if(stats.frames == 0) {
+        return;
+    }
+    fprintf(stderr, "drawing %.2f ms/frame on %u threads, raster %.2f ms/frame, bin %.2f ms/frame, %u triangles, %llu pixels\n",
+            stats.draw_seconds * 1e3 / stats.frames, threads, r.raster_ms / stats.frames, r.bin_ms / stats.frames,
+            r.triangles, (unsigned long long)r.pixels);
+    if(baseline > 0.0 && stats.draw_seconds > 0.0) {
+        fprintf(stderr, "drawing %.2f ms/frame on 1 thread, %.2fx speed-up on %u threads\n",
+                baseline * 1e3 / stats.frames, baseline / stats.draw_seconds, threads);
+    }
+}
+
+// softrender <frames> <output> [--preset <preset.milk>] [options]
+// softrender --capture <capture> <output> [--repeat <n>] [options]
+// options: [--format raw|ppm|y4m] [--size <width>x<height>] [--fps <fps>] [--threads <n>]
+// The widget's scene drawn by the software rasterizer, or a capture saved by DirectXWidget::captureFrames
+// replayed on it, without Direct3D or Qt. Output "-" is stdout. A capture wants the size of the widget it came from.
+// With more than one thread the same frames are drawn again on one thread, without writing them,
+// and the speed-up is the ratio of the two wall times.
+int main(int argc, char *argv[])
+{
+    uint64_t frames = 0;
+    std::string output, presetPath, capturePath;
+    dx::frameformat format = dx::frameformat::y4m;
+    unsigned int width = 1280, height = 720, fps = 60, repeat = 1;
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+
+    int positional = 0;
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            ++i;
+            format = (strcmp(argv[i], "raw") == 0) ? dx::frameformat::raw : (strcmp(argv[i], "ppm") == 0) ? dx::frameformat::ppm : dx::frameformat::y4m;
+        }
+        else if(strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            sscanf(argv[++i], "%ux%u", &width, &height);
+        }
+        else if(strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            fps = (unsigned int)atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--preset") == 0 && i + 1 < argc) {
+            presetPath = argv[++i];
+        }
+        else if(strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            capturePath = argv[++i];
+            positional = 1;
+        }
+        else if(strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = (unsigned int)atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = (unsigned int)atoi(argv[++i]);
+        }
+        else if(positional == 0) {
+            frames = strtoull(argv[i], nullptr, 10);
+            positional++;
+        }
+        else if(positional == 1) {
+            output = argv[i];
+            positional++;
+        }
+    }
+    if(output.empty() || width == 0 || height == 0 || fps == 0 || repeat == 0 || threads == 0) {
+        fprintf(stderr, "usage: %s <frames> <output> [--preset <preset.milk>] [options]\n"
+                        "       %s --capture <capture> <output> [--repeat <n>] [options]\n"
+                        "options: [--format raw|ppm|y4m] [--size <width>x<height>] [--fps <fps>] [--threads <n>]\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    dx::commandstream capture;
+    if(!capturePath.empty()) {
+        dx::commandsink check;
+        if(!capture.load(capturePath)) {
+            fprintf(stderr, "can't load %s\n", capturePath.c_str());
+            return 1;
+        }
+        if(!capture.replay(check)) {
+            fprintf(stderr, "%s is malformed\n", capturePath.c_str());
+            return 1;
+        }
+    }
+    dx::milk::preset preset;
+    if(!presetPath.empty() && !preset.open(presetPath)) {
+        fprintf(stderr, "%s: can't read\n", presetPath.c_str());
+        return 1;
+    }
+
+    dx::framewriter writer(output, format, width, height, fps);
+    if(!writer.error().empty()) {
+        fprintf(stderr, "%s\n", writer.error().c_str());
+        return 1;
+    }
+
+    // the rasterizer's pool helps the calling thread
+    bool ok = true;
+    if(!capturePath.empty()) {
+        dx::soft::rasterreplay replay(width, height, threads - 1);
+        dx::soft::capturestatistics stats = replay.render(capture, repeat, &writer);
+        ok = writer.finish() && !stats.write_failed;
+        double baseline = 0.0;
+        if(threads > 1 && ok) {
+            dx::soft::rasterreplay single(width, height, 0);
+            baseline = single.render(capture, repeat, nullptr).draw_seconds;
+        }
+        report(stats, replay.thread_count(), baseline);
+        if(stats.draws > 0) {
+            fprintf(stderr, "%u draws skipped, a capture doesn't carry shader code\n", stats.draws);
+        }
+    }
+    else {
+        std::string error;
+        dx::soft::scene scene(width, height, threads - 1);
+        if(!presetPath.empty() && !scene.load(preset, &error)) {
+            fprintf(stderr, "%s: %s\n", presetPath.c_str(), error.c_str());
+            return 1;
+        }
+        dx::soft::scenestatistics stats = scene.render(0, frames, (double)fps, &writer);
+        ok = writer.finish() && !stats.write_failed;
+        double baseline = 0.0;
+        if(threads > 1 && ok) {
+            dx::soft::scene single(width, height, 0);
+            if(!presetPath.empty()) {
+                single.load(preset);
+            }
+            baseline = single.render(0, stats.frames, (double)fps, nullptr).draw_seconds;
+        }
+        report(stats, scene.thread_count(), baseline);
+    }
+    if(!ok && !writer.error().empty()) {
+        fprintf(stderr, "%s\n", writer.error().c_str());
+    }
+    return ok ? 0 : 1;
+}
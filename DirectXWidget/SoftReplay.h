@@ -0,0 +1,229 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+
+#include "CommandStream.h"
+#include "FrameWriter.h"
+#include "SoftRasterizer.h"
+
+namespace dx {
+
+    namespace soft {
+
+        struct capturestatistics {
+            uint64_t frames = 0;        // ended, and handed to the writer if there is one
+            double seconds = 0.0;       // wall time of render(), including the wait for the writer
+            double draw_seconds = 0.0;  // the part of seconds spent replaying, without the writer
+            unsigned int draws = 0;     // skipped, see rasterreplay
+            bool write_failed = false;
+            bool malformed = false;
+            rasterstatistics raster;
+
+            double fps() const
+            {
+                return (seconds > 0.0) ? (double)frames / seconds : 0.0;
+            }
+        };
+
+        /// <summary>
+        /// Replays a capture saved by DirectXWidget::captureFrames on the software rasterizer,
+        /// for hosts without Direct3D.
+        ///
+        /// A capture knows its objects only by id and kind. Every render target view gets a target of the
+        /// replay's size, a depth-stencil view is the depth of the target it was last bound with.
+        /// Render targets, viewports and clears are replayed, draws are only counted since the capture
+        /// names shaders and input layouts without their code. The target bound last before end_frame
+        /// is the frame, a black one while none was.
+        /// </summary>
+        class rasterreplay : public commandsink {
+        public:
+            rasterreplay(unsigned int width, unsigned int height, unsigned int threads = workerpool::default_threads())
+                : m_width(width), m_height(height), m_blank(width, height), m_raster(threads)
+            {}
+
+            rasterreplay(const rasterreplay &) = delete;
+            rasterreplay &operator= (const rasterreplay &) = delete;
+
+            /// <summary>
+            /// Replay the capture repeat times and push every frame to the writer, which may be null to only draw.
+            /// Stops early when the writer fails or the capture is malformed. The writer is left open, finish() it when done.
+            /// </summary>
+            capturestatistics render(const commandstream &capture, unsigned int repeat, framewriter *writer)
+            {
+                clock::time_point start = clock::now();
+                capturestatistics result;
+
+                m_writer = writer;
+                m_frames = 0;
+                m_draws = 0;
+                m_write_seconds = 0.0;
+                m_write_failed = false;
+                m_raster.reset_statistics();
+                for(unsigned int i = 0; i < repeat && !m_write_failed; ++i) {
+                    if(!capture.replay(*this)) {
+                        result.malformed = true;
+                        break;
+                    }
+                }
+                m_raster.flush();
+                m_writer = nullptr;
+
+                result.frames = m_frames;
+                result.draws = m_draws;
+                result.write_failed = m_write_failed;
+                result.raster = m_raster.reset_statistics();
+                result.seconds = std::chrono::duration<double>(clock::now() - start).count();
+                result.draw_seconds = result.seconds - m_write_seconds;
+                return result;
+            }
+
+            unsigned int thread_count() const
+            {
+                return m_raster.thread_count();
+            }
+
+            void object(uint32_t id, objectkind kind) override
+            {
+                // a capture replayed again declares its objects again, they keep their pixels
+                if(kind == objectkind::rendertargetview && m_targets.find(id) == m_targets.end()) {
+                    m_targets.emplace(id, std::unique_ptr<rendertarget>(new rendertarget(m_width, m_height)));
+                }
+            }
+
+            void set_rendertargets(uint32_t count, const uint32_t *rtvs, uint32_t dsv) override
+            {
+                m_target = (count > 0) ? find(rtvs[0]) : nullptr;
+                if(nullptr != m_target) {
+                    m_presented = m_target;
+                    if(0 != dsv) {
+                        m_depths[dsv] = m_target;
+                    }
+                }
+            }
+
+            void set_viewports(uint32_t count, const commandviewport *viewports) override
+            {
+                m_has_viewport = count > 0;
+                if(m_has_viewport) {
+                    m_viewport.x = viewports[0].x;
+                    m_viewport.y = viewports[0].y;
+                    m_viewport.width = viewports[0].width;
+                    m_viewport.height = viewports[0].height;
+                    if(nullptr != m_bound && m_bound == m_target) {
+                        m_raster.set_viewport(m_viewport);
+                    }
+                }
+            }
+
+            void clear_rendertargetview(uint32_t rtv, const float rgba[4]) override
+            {
+                rendertarget *target = find(rtv);
+                if(nullptr != target) {
+                    select(target);
+                    m_raster.clear(rgba);
+                }
+            }
+
+            void clear_depthstencilview(uint32_t dsv, uint32_t flags, float depth, uint32_t /*stencil*/) override
+            {
+                // D3D11_CLEAR_DEPTH, there is no stencil
+                auto it = m_depths.find(dsv);
+                if((flags & 1) != 0 && it != m_depths.end()) {
+                    select(it->second);
+                    m_raster.clear_depth(depth);
+                }
+            }
+
+            void draw(uint32_t, uint32_t) override
+            {
+                m_draws++;
+            }
+
+            void draw_indexed(uint32_t, uint32_t, int32_t) override
+            {
+                m_draws++;
+            }
+
+            void draw_instanced(uint32_t, uint32_t, uint32_t, uint32_t) override
+            {
+                m_draws++;
+            }
+
+            void draw_indexed_instanced(uint32_t, uint32_t, uint32_t, int32_t, uint32_t) override
+            {
+                m_draws++;
+            }
+
+            void draw_indirect(uint32_t, uint32_t, bool) override
+            {
+                m_draws++;
+            }
+
+            void clear_state() override
+            {
+                m_target = nullptr;
+                m_has_viewport = false;
+            }
+
+            void end_frame() override
+            {
+                m_raster.flush();
+                m_frames++;
+                if(nullptr == m_writer || m_write_failed) {
+                    return;
+                }
+                const rendertarget *frame = (nullptr != m_presented) ? m_presented : &m_blank;
+                clock::time_point start = clock::now();
+                m_write_failed = !m_writer->push((const uint8_t *)frame->color(), frame->row_pitch());
+                m_write_seconds += std::chrono::duration<double>(clock::now() - start).count();
+            }
+
+        private:
+            typedef std::chrono::steady_clock clock;
+
+            rendertarget *find(uint32_t rtv) const
+            {
+                auto it = m_targets.find(rtv);
+                return (it != m_targets.end()) ? it->second.get() : nullptr;
+            }
+
+            /// <summary>
+            /// Point the rasterizer at target, which flushes what was drawn into the one before.
+            /// </summary>
+            void select(rendertarget *target)
+            {
+                if(m_bound == target) {
+                    return;
+                }
+                m_raster.set_target(target);
+                m_bound = target;
+                if(m_has_viewport && m_bound == m_target) {
+                    m_raster.set_viewport(m_viewport);
+                }
+            }
+
+            unsigned int m_width;
+            unsigned int m_height;
+            rendertarget m_blank;
+            rasterizer m_raster;
+            std::unordered_map<uint32_t, std::unique_ptr<rendertarget>> m_targets;
+            std::unordered_map<uint32_t, rendertarget*> m_depths;     // by depth-stencil view
+            rendertarget *m_target = nullptr;       // bound by the capture
+            rendertarget *m_bound = nullptr;        // the rasterizer's
+            rendertarget *m_presented = nullptr;
+            viewport m_viewport;
+            bool m_has_viewport = false;
+
+            framewriter *m_writer = nullptr;
+            uint64_t m_frames = 0;
+            unsigned int m_draws = 0;
+            double m_write_seconds = 0.0;
+            bool m_write_failed = false;
+        };
+
+    } /* End of namespace soft */
+
+} /* End of namespace dx */
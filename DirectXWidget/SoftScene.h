@@ -0,0 +1,246 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "FrameWriter.h"
+#include "MeshEvaluator.h"
+#include "MilkEquation.h"
+#include "SoftRasterizer.h"
+
+namespace dx {
+
+    namespace soft {
+
+        struct scenestatistics {
+            uint64_t frames = 0;        // handed to the writer
+            double seconds = 0.0;       // wall time of render(), including the wait for the writer
+            double draw_seconds = 0.0;  // the part of seconds spent in draw()
+            bool write_failed = false;
+            rasterstatistics raster;
+
+            double fps() const
+            {
+                return (seconds > 0.0) ? (double)frames / seconds : 0.0;
+            }
+        };
+
+        /// <summary>
+        /// The widget's scene drawn by the software rasterizer, for hosts without Direct3D.
+        ///
+        /// Every frame is cleared as D3DScene does, then MilkDrop's warp pass draws the previous frame
+        /// through the warp mesh of a preset, darkened by decay, and a spinning shape feeds new color in.
+        /// Without a preset a slow zoom and rotation stand in for one. There is no audio, bass, mid and
+        /// treb stay at their neutral 1.
+        /// </summary>
+        class scene {
+        public:
+            scene(unsigned int width, unsigned int height, unsigned int threads = workerpool::default_threads(), unsigned int meshx = 48, unsigned int meshy = 36)
+                : m_target(width, height), m_previous(width, height), m_raster(threads), m_mesh(meshx, meshy), m_meshx(meshx), m_meshy(meshy)
+            {
+                // MilkDrop's aspect correction, the longer side runs from -1 to 1
+                m_aspectx = (width > height) ? (double)height / width : 1.0;
+                m_aspecty = (height > width) ? (double)width / height : 1.0;
+                m_mesh.set_mesh(meshx, meshy, m_aspectx, m_aspecty);
+                m_indices = m_mesh.indices();
+                m_warped.resize(m_mesh.vertex_count());
+                m_vertices.resize(m_mesh.vertex_count());
+                m_raster.set_target(&m_target);
+
+                milk::preset fallback;
+                static const char text[] =
+                    "[preset00]\n"
+                    "fDecay=0.97\n"
+                    "per_frame_1=zoom = 1.01 + 0.01*sin(time*0.6); rot = 0.005*sin(time*0.37);\n"
+                    "per_pixel_1=rot = rot + 0.01*(1 - rad);\n";
+                fallback.parse(text, sizeof(text) - 1);
+                load(fallback);
+            }
+
+            scene(const scene &) = delete;
+            scene &operator= (const scene &) = delete;
+
+            /// <summary>
+            /// Run a preset's equations from now on, returns false and keeps the current ones if they don't compile.
+            /// </summary>
+            bool load(const milk::preset &p, std::string *error = nullptr)
+            {
+                using namespace milk;
+
+                equationscope scope;
+                equationprogram init, frame, vertex;
+                if(!compile_equations(p.code(codeblock::per_frame_init).source(), scope, init, error) ||
+                    !compile_equations(p.code(codeblock::per_frame).source(), scope, frame, error) ||
+                    !compile_equations(p.code(codeblock::per_pixel).source(), scope, vertex, error)) {
+                    return false;
+                }
+
+                // MilkDrop's defaults, for presets leaving them out
+                scope[var_zoom] = scope[var_zoomexp] = scope[var_sx] = scope[var_sy] = 1.0;
+                scope[var_cx] = scope[var_cy] = 0.5;
+                scope[var_warp] = 1.0;
+                for(auto& kv : p.values()) {
+                    int slot = scope.find(kv.key);
+                    if(slot >= 0) {
+                        scope[slot] = p.number(kv.key);
+                    }
+                }
+                // fields MilkDrop keeps under other names in the file
+                scope[var_decay] = p.number("fDecay", 0.98);
+                scope[var_wrap] = p.number("bWrap", 1.0);
+                m_parameters.warp_anim_speed = p.number("fWarpAnimSpeed", 1.0);
+                m_parameters.warp_scale = p.number("fWarpScale", 1.0);
+
+                scope[var_meshx] = m_meshx;
+                scope[var_meshy] = m_meshy;
+                scope[var_pixelsx] = m_target.width();
+                scope[var_pixelsy] = m_target.height();
+                scope[var_aspectx] = m_aspectx;
+                scope[var_aspecty] = m_aspecty;
+                for(int v = var_bass; v <= var_treb_att; ++v) {
+                    scope[v] = 1.0;
+                }
+                init.run(scope);
+
+                m_scope = std::move(scope);
+                m_frame = std::move(frame);
+                m_vertex = std::move(vertex);
+                m_mesh.set_program(m_vertex, m_scope);
+                return true;
+            }
+
+            /// <summary>
+            /// Draw a frame into target(), time in seconds since the first frame.
+            /// </summary>
+            void draw(uint64_t frame, double time, double delta)
+            {
+                using namespace milk;
+
+                m_scope[var_time] = time;
+                m_scope[var_frame] = (double)frame;
+                m_scope[var_fps] = (delta > 0.0) ? 1.0 / delta : 60.0;
+                m_frame.run(m_scope);
+                m_parameters.time = time;
+                m_mesh.evaluate(m_scope, m_parameters, m_warped.data());
+
+                // the warp samples the previous frame, rows of the target are padded
+                const unsigned int width = m_target.width(), height = m_target.height();
+                for(unsigned int y = 0; y < height; ++y) {
+                    memcpy(m_previous.data() + (size_t)y * width, m_target.color() + (size_t)y * m_target.pitch(), width * sizeof(uint32_t));
+                }
+
+                float decay = (float)std::min(std::max(m_scope[var_decay], 0.0), 1.0);
+                for(size_t i = 0; i < m_warped.size(); ++i) {
+                    const milk::warpvertex &w = m_warped[i];
+                    vertex &v = m_vertices[i];
+                    v.x = w.x;
+                    v.y = w.y;
+                    v.z = 0.0f;
+                    v.w = 1.0f;
+                    v.u = w.u;
+                    v.v = w.v;
+                    v.r = v.g = v.b = decay;
+                    v.a = 1.0f;
+                }
+
+                // what D3DScene does
+                float black[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+                m_raster.clear(black);
+                m_raster.clear_depth(1.0f);
+
+                m_raster.set_depth(false, false);
+                m_raster.set_blend(blendmode::opaque);
+                m_raster.set_texture(&m_previous, filtermode::bilinear, (m_scope[var_wrap] != 0.0) ? addressmode::wrap : addressmode::clamp);
+                m_raster.draw_indexed(m_vertices.data(), m_indices.data(), (unsigned int)m_indices.size());
+
+                draw_shape(time);
+                m_raster.flush();
+            }
+
+            /// <summary>
+            /// Draw frames first_frame .. first_frame + frames - 1 at fps simulated frames per second and push
+            /// them to the writer, which may be null to only draw. Stops early when the writer fails.
+            /// The writer is left open, finish() it when done.
+            /// </summary>
+            scenestatistics render(uint64_t first_frame, uint64_t frames, double fps, framewriter *writer)
+            {
+                typedef std::chrono::steady_clock clock;
+                clock::time_point start = clock::now();
+                scenestatistics result;
+
+                m_raster.reset_statistics();
+                for(uint64_t i = 0; i < frames; ++i) {
+                    uint64_t frame = first_frame + i;
+                    clock::time_point drawn = clock::now();
+                    draw(frame, (double)frame / fps, 1.0 / fps);
+                    result.draw_seconds += std::chrono::duration<double>(clock::now() - drawn).count();
+                    if(nullptr != writer && !writer->push((const uint8_t *)m_target.color(), m_target.row_pitch())) {
+                        result.write_failed = true;
+                        break;
+                    }
+                    result.frames++;
+                }
+                result.raster = m_raster.reset_statistics();
+                result.seconds = std::chrono::duration<double>(clock::now() - start).count();
+                return result;
+            }
+
+            const rendertarget &target() const
+            {
+                return m_target;
+            }
+
+            unsigned int thread_count() const
+            {
+                return m_raster.thread_count();
+            }
+
+        private:
+            void draw_shape(double time)
+            {
+                // a pentagon circling the center, hue turning with time
+                const unsigned int sides = 5;
+                const float pi2 = 6.2831853f;
+                float cx = 0.3f * (float)cos(time * 0.7), cy = 0.3f * (float)sin(time * 0.9);
+                float radius = 0.12f, turn = (float)time * 1.3f;
+                float r = 0.5f + 0.5f * (float)sin(time * 1.1), g = 0.5f + 0.5f * (float)sin(time * 1.3 + 2.0), b = 0.5f + 0.5f * (float)sin(time * 1.7 + 4.0);
+
+                vertex fan[sides * 3];
+                for(unsigned int i = 0; i < sides; ++i) {
+                    vertex *t = fan + i * 3;
+                    float a0 = turn + pi2 * i / sides, a1 = turn + pi2 * (i + 1) / sides;
+                    t[0] = vertex{ cx, cy, 0.0f, 1.0f, 0.0f, 0.0f, r, g, b, 0.6f };
+                    t[1] = vertex{ cx + radius * (float)m_aspectx * cosf(a0), cy + radius * (float)m_aspecty * sinf(a0), 0.0f, 1.0f, 0.0f, 0.0f, r, g, b, 0.0f };
+                    t[2] = vertex{ cx + radius * (float)m_aspectx * cosf(a1), cy + radius * (float)m_aspecty * sinf(a1), 0.0f, 1.0f, 0.0f, 0.0f, r, g, b, 0.0f };
+                }
+                m_raster.set_texture(nullptr);
+                m_raster.set_blend(blendmode::additive);
+                m_raster.draw(fan, sides * 3);
+            }
+
+            rendertarget m_target;
+            texture m_previous;
+            rasterizer m_raster;
+            milk::meshevaluator m_mesh;
+            unsigned int m_meshx;
+            unsigned int m_meshy;
+            double m_aspectx = 1.0;
+            double m_aspecty = 1.0;
+            std::vector<uint32_t> m_indices;
+            std::vector<milk::warpvertex> m_warped;
+            std::vector<vertex> m_vertices;
+
+            milk::equationscope m_scope;
+            milk::equationprogram m_frame;
+            milk::equationprogram m_vertex;
+            milk::warpparameters m_parameters;
+        };
+
+    } /* End of namespace soft */
+
+} /* End of namespace dx */
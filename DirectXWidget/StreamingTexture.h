@@ -0,0 +1,112 @@
+#pragma once
+
+#include <string.h>
+#include <vector>
+
+#include "DirectXPlus.h"
+
+namespace dx {
+
+    namespace d3d11 {
+
+        struct streamingstatistics {
+            unsigned int updates = 0;
+            unsigned int stalls = 0;    // every staging texture was still in use
+            unsigned int bytes = 0;
+        };
+
+        /// <summary>
+        /// A texture rewritten every frame (spectrum, waveform, video).
+        ///
+        /// Data goes through a ring of staging textures and is copied on the GPU,
+        /// so the CPU never waits for the frame that is still reading the previous contents.
+        /// Only mip 0 is streamed.
+        /// </summary>
+        class streamingtexture {
+        public:
+            streamingtexture(device &dev, const devicecontext &context, unsigned int width, unsigned int height, DXGI_FORMAT format = DXGI_FORMAT_R8G8B8A8_UNORM, unsigned int staging_count = 3)
+                : m_context(context), m_width(width), m_height(height), m_format(format)
+            {
+                m_texture = dev.create_texture2d(width, height, 1, 1, format, 1, 0, D3D11_USAGE_DEFAULT, D3D11_BIND_SHADER_RESOURCE, 0);
+                m_srv = dev.create_view<shaderresourceview>(m_texture);
+                for(unsigned int i = 0; i < staging_count; ++i) {
+                    m_staging.push_back(dev.create_texture2d(width, height, 1, 1, format, 1, 0, D3D11_USAGE_STAGING, (D3D11_BIND_FLAG)0, D3D11_CPU_ACCESS_WRITE));
+                }
+            }
+
+            /// <summary>
+            /// Replace a rectangle of the texture, data rows are row_pitch bytes apart (0 means tightly packed).
+            /// </summary>
+            void update(const void *data, unsigned int x, unsigned int y, unsigned int width, unsigned int height, unsigned int row_pitch = 0)
+            {
+                if(row_pitch == 0) {
+                    row_pitch = dxgi::row_pitch(m_format, width);
+                }
+                unsigned int row_bytes = dxgi::row_pitch(m_format, width);
+                unsigned int rows = dxgi::row_count(m_format, height);
+                unsigned int first_row = y / dxgi::format_info(m_format).block_height;
+                unsigned int first_byte = dxgi::row_pitch(m_format, x);
+
+                const texture2d &staging = acquire_staging();
+                D3D11_MAPPED_SUBRESOURCE mapped;
+                if(!m_context.try_map(staging, 0, D3D11_MAP_WRITE, mapped)) {
+                    m_statistics.stalls++;
+                    mapped = m_context.map(staging, 0, D3D11_MAP_WRITE);
+                }
+                for(unsigned int r = 0; r < rows; ++r) {
+                    memcpy((uint8_t*)mapped.pData + (first_row + r) * mapped.RowPitch + first_byte, (const uint8_t*)data + r * row_pitch, row_bytes);
+                }
+                m_context.unmap(staging, 0);
+
+                D3D11_BOX box = { x, y, 0, x + width, y + height, 1 };
+                m_context.copy_subresource_region(m_texture, 0, x, y, staging, 0, &box);
+
+                m_statistics.updates++;
+                m_statistics.bytes += row_bytes * rows;
+            }
+
+            void update(const void *data, unsigned int row_pitch = 0)
+            {
+                update(data, 0, 0, m_width, m_height, row_pitch);
+            }
+
+            const texture2d &texture() const
+            {
+                return m_texture;
+            }
+
+            const shaderresourceview &srv() const
+            {
+                return m_srv;
+            }
+
+            streamingstatistics statistics() const
+            {
+                return m_statistics;
+            }
+
+        private:
+            const texture2d &acquire_staging()
+            {
+                // the least recently used one is the most likely to be idle
+                const texture2d &t = m_staging[m_next];
+                m_next = (m_next + 1) % m_staging.size();
+                return t;
+            }
+
+            devicecontext m_context;
+            unsigned int m_width;
+            unsigned int m_height;
+            DXGI_FORMAT m_format;
+
+            texture2d m_texture;
+            shaderresourceview m_srv;
+            std::vector<texture2d> m_staging;
+            size_t m_next = 0;
+
+            streamingstatistics m_statistics;
+        };
+
+    } /* End of namespace d3d11 */
+
+} /* End of namespace dx */
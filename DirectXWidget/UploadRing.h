@@ -0,0 +1,187 @@
+#pragma once
+
+#include <string.h>
+#include <vector>
+
+#include "DirectXPlus.h"
+
+namespace dx {
+
+    namespace d3d11 {
+
+        /// <summary>
+        /// Where a block of T landed in the ring, bind buffer at offset or draw from first_element().
+        /// Valid until the ring's next_frame().
+        /// </summary>
+        template<class T>
+        struct uploadallocation {
+            borrowed<buffer> buf;
+            unsigned int offset;    // in bytes
+            unsigned int count;
+
+            unsigned int first_element() const
+            {
+                return offset / sizeof(T);
+            }
+
+            unsigned int size() const
+            {
+                return count * sizeof(T);
+            }
+        };
+
+        struct uploadstatistics {
+            unsigned int bytes = 0;         // uploaded in the current frame
+            unsigned int last_frame_bytes = 0;
+            unsigned int wraps = 0;
+            unsigned int grows = 0;
+            unsigned int capacity = 0;
+        };
+
+        /// <summary>
+        /// Sub-allocates per-frame vertex and index data from one large dynamic buffer.
+        ///
+        /// Allocations are appended with D3D11_MAP_WRITE_NO_OVERWRITE, when the end is reached
+        /// the buffer is mapped with D3D11_MAP_WRITE_DISCARD and the ring starts over,
+        /// so data still in use by the GPU is never touched.
+        /// If a frame needed more than the capacity, the ring grows at the next frame.
+        /// </summary>
+        class uploadring {
+        public:
+            uploadring(const device &dev, const devicecontext &context, unsigned int capacity = 4 << 20, unsigned int bind = D3D11_BIND_VERTEX_BUFFER | D3D11_BIND_INDEX_BUFFER)
+                : m_device(dev), m_context(context), m_bind(bind)
+            {
+                allocate_buffer(capacity);
+            }
+
+            uploadring(const uploadring &) = delete;
+            uploadring &operator= (const uploadring &) = delete;
+
+            /// <summary>
+            /// Copy count elements into the ring.
+            /// </summary>
+            template<class T>
+            uploadallocation<T> push(const T *data, unsigned int count)
+            {
+                return write<T>(count, [&](T *dst) {
+                    memcpy(dst, data, count * sizeof(T));
+                });
+            }
+
+            /// <summary>
+            /// Reserve count elements and let fill(T*) write them in place while the ring is mapped.
+            /// fill must not issue other calls on the context.
+            /// </summary>
+            template<class T, class F>
+            uploadallocation<T> write(unsigned int count, F fill)
+            {
+                unsigned int size = count * sizeof(T);
+                // keep offsets a multiple of the element size, so they can be used as base vertex
+                unsigned int offset = (m_head + sizeof(T) - 1) / sizeof(T) * sizeof(T);
+
+                D3D11_MAP type = m_fresh ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE;
+                if(offset + size > m_capacity) {
+                    if(size > m_capacity) {
+                        allocate_buffer(grown_capacity(size));
+                        m_statistics.grows++;
+                    }
+                    else {
+                        m_statistics.wraps++;
+                    }
+                    type = D3D11_MAP_WRITE_DISCARD;
+                    offset = 0;
+                }
+
+                D3D11_MAPPED_SUBRESOURCE mapped = m_context.map(m_buffer, type);
+                fill((T*)((uint8_t*)mapped.pData + offset));
+                m_context.unmap(m_buffer);
+
+                m_head = offset + size;
+                m_fresh = false;
+                m_statistics.bytes += size;
+
+                uploadallocation<T> result;
+                result.buf = m_buffer;
+                result.offset = offset;
+                result.count = count;
+                return result;
+            }
+
+            /// <summary>
+            /// Rewrite a whole dynamic constant buffer, counted in the frame statistics.
+            /// Constant buffers can't be bound at an offset before D3D 11.1, so they are not sub-allocated.
+            /// </summary>
+            template<class T>
+            void upload_constants(const buffer &cb, const T &data)
+            {
+                D3D11_MAPPED_SUBRESOURCE mapped = m_context.map(cb, D3D11_MAP_WRITE_DISCARD);
+                memcpy(mapped.pData, &data, sizeof(T));
+                m_context.unmap(cb);
+                m_statistics.bytes += sizeof(T);
+            }
+
+            /// <summary>
+            /// Call once per frame, after the frame's uploads.
+            /// </summary>
+            void next_frame()
+            {
+                if(m_statistics.bytes > m_capacity) {
+                    // the frame wrapped onto data it wrote itself, the driver had to rename
+                    allocate_buffer(grown_capacity(m_statistics.bytes));
+                    m_statistics.grows++;
+                }
+                m_statistics.last_frame_bytes = m_statistics.bytes;
+                m_statistics.bytes = 0;
+                m_retired.clear();
+            }
+
+            uploadstatistics statistics() const
+            {
+                uploadstatistics result = m_statistics;
+                result.capacity = m_capacity;
+                return result;
+            }
+
+            const buffer &current_buffer() const
+            {
+                return m_buffer;
+            }
+
+        private:
+            unsigned int grown_capacity(unsigned int needed) const
+            {
+                unsigned int capacity = (m_capacity > 0) ? m_capacity : 1;
+                while(capacity < needed) {
+                    capacity *= 2;
+                }
+                return capacity;
+            }
+
+            void allocate_buffer(unsigned int capacity)
+            {
+                // allocations already handed out this frame still point into the old buffer
+                if(m_buffer.is_valid()) {
+                    m_retired.push_back(m_buffer);
+                }
+                m_buffer = m_device.create_buffer(nullptr, capacity, 0, D3D11_USAGE_DYNAMIC, m_bind, D3D11_CPU_ACCESS_WRITE);
+                m_capacity = capacity;
+                m_head = 0;
+                m_fresh = true;
+            }
+
+            device m_device;
+            devicecontext m_context;
+            unsigned int m_bind;
+
+            buffer m_buffer;
+            std::vector<buffer> m_retired;
+            unsigned int m_capacity = 0;
+            unsigned int m_head = 0;
+            bool m_fresh = true;
+
+            uploadstatistics m_statistics;
+        };
+
+    } /* End of namespace d3d11 */
+
+} /* End of namespace dx */
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dx {
+
+    /// <summary>
+    /// Fixed set of threads running queued tasks in submission order.
+    /// Tasks still queued when the pool is destroyed are dropped.
+    /// </summary>
+    class workerpool {
+    public:
+        explicit workerpool(unsigned int threads = default_threads())
+        {
+            for(unsigned int i = 0; i < threads; ++i) {
+                m_threads.emplace_back(&workerpool::run, this);
+            }
+        }
+
+        workerpool(const workerpool &) = delete;
+        workerpool &operator= (const workerpool &) = delete;
+
+        ~workerpool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_quit = true;
+                m_tasks.clear();
+            }
+            m_wake.notify_all();
+            for(auto& t : m_threads) {
+                t.join();
+            }
+        }
+
+        void submit(std::function<void()> task)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_tasks.push_back(std::move(task));
+            }
+            m_wake.notify_one();
+        }
+
+        /// <summary>
+        /// Tasks waiting for a thread, not counting the running ones.
+        /// </summary>
+        size_t queue_depth() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_tasks.size();
+        }
+
+        unsigned int thread_count() const
+        {
+            return (unsigned int)m_threads.size();
+        }
+
+        /// <summary>
+        /// One thread per core, leaving one for the render thread.
+        /// </summary>
+        static unsigned int default_threads()
+        {
+            unsigned int n = std::thread::hardware_concurrency();
+            return (n > 1) ? n - 1 : 1;
+        }
+
+    private:
+        void run()
+        {
+            for(;;) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_wake.wait(lock, [this] { return m_quit || !m_tasks.empty(); });
+                    if(m_quit) {
+                        return;
+                    }
+                    task = std::move(m_tasks.front());
+                    m_tasks.pop_front();
+                }
+                task();
+            }
+        }
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::deque<std::function<void()>> m_tasks;
+        std::vector<std::thread> m_threads;
+        bool m_quit = false;
+    };
+
+} /* End of namespace dx */
@@ -0,0 +1,17 @@
+#-------------------------------------------------
+#
+# capturereplay: times replaying a saved capture into the
+# null command sink, a console tool without Qt or Direct3D
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = capturereplay
+TEMPLATE = app
+CONFIG += console c++14
+CONFIG -= app_bundle qt
+
+SOURCES += CaptureReplay.cxx
+
+HEADERS += CommandStream.h
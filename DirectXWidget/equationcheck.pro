@@ -0,0 +1,30 @@
+#-------------------------------------------------
+#
+# equationcheck: preset equations as bytecode, native code, through
+# the tree walker and over the warp mesh, a console tool without Qt or Direct3D
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = equationcheck
+TEMPLATE = app
+CONFIG += console c++14
+CONFIG -= app_bundle qt
+
+SOURCES += EquationCheck.cxx
+
+HEADERS += MilkEquation.h \
+    EquationJit.h \
+    MeshEvaluator.h \
+    MeshLanes.inl \
+    MilkPreset.h
+
+DISTFILES += \
+    fixtures/tunnel-drift.milk \
+    fixtures/beat-kaleido.milk \
+    fixtures/liquid-noise.milk \
+    fixtures/ripple-gate.milk
+
+# presets equationcheck runs without arguments
+DEFINES += DX_FIXTURES_DIR=\\\"$$PWD/fixtures\\\"
@@ -0,0 +1,38 @@
+#-------------------------------------------------
+#
+# framecheck: steady-state frames of the widget and of
+# devicecontext must not allocate or touch reference counts,
+# a console tool that counts every heap allocation it makes
+#
+#-------------------------------------------------
+
+QT       += core gui widgets
+
+TARGET = framecheck
+TEMPLATE = app
+CONFIG += console c++14
+CONFIG -= app_bundle
+
+SOURCES += FrameCheck.cxx \
+    DirectXWidget.cxx
+
+HEADERS += DirectXWidget.hpp \
+    DirectXPlus.h \
+    CountingContext.h \
+    CommandStream.h \
+    CommandReplay.h \
+    DeviceHub.h \
+    PipelineState.h \
+    ReadbackRing.h \
+    DynamicResolution.h \
+    ShaderCompiler.h \
+    ShaderCache.h \
+    MappedFile.h \
+    WorkerPool.h \
+    FrameProfiler.h \
+    PassRecorder.h \
+    RenderTargetPool.h \
+    UploadRing.h \
+    StreamingTexture.h \
+    InstanceBatcher.h \
+    DxgiFormat.h
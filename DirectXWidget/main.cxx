@@ -1,8 +1,138 @@
 #include "MainWindow.hpp"
+#include "DirectXWidget.hpp"
+#include "OfflineRenderer.h"
+#include "PresetLibrary.h"
+#include "SoftScene.h"
 #include <QApplication>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// DirectXWidget --render <frames> <output> [--format raw|ppm|y4m] [--size <width>x<height>] [--fps <fps>] [--warp] [--soft [--preset <preset.milk>]]
+// Renders the widget's scene without a window, as fast as possible. Output "-" is stdout.
+// --warp renders on the CPU, for hosts without a GPU. --soft draws the scene with the software rasterizer
+// instead of Direct3D, as softrender does on other platforms.
+static int renderOffline(int argc, char *argv[])
+{
+    using namespace dx::d3d11;
+
+    uint64_t frames = 0;
+    std::string output;
+    dx::frameformat format = dx::frameformat::y4m;
+    unsigned int width = 1280, height = 720, fps = 60;
+    bool warp = false, soft = false;
+    std::string presetPath;
+
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "--render") == 0 && i + 2 < argc) {
+            frames = strtoull(argv[++i], nullptr, 10);
+            output = argv[++i];
+        }
+        else if(strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            ++i;
+            format = (strcmp(argv[i], "raw") == 0) ? dx::frameformat::raw : (strcmp(argv[i], "ppm") == 0) ? dx::frameformat::ppm : dx::frameformat::y4m;
+        }
+        else if(strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            sscanf(argv[++i], "%ux%u", &width, &height);
+        }
+        else if(strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            fps = (unsigned int)atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--warp") == 0) {
+            warp = true;
+        }
+        else if(strcmp(argv[i], "--soft") == 0) {
+            soft = true;
+        }
+        else if(strcmp(argv[i], "--preset") == 0 && i + 1 < argc) {
+            presetPath = argv[++i];
+        }
+    }
+    if(output.empty() || width == 0 || height == 0 || fps == 0) {
+        fprintf(stderr, "usage: %s --render <frames> <output> [--format raw|ppm|y4m] [--size <width>x<height>] [--fps <fps>] [--warp] [--soft [--preset <preset.milk>]]\n", argv[0]);
+        return 1;
+    }
+
+    if(soft) {
+        dx::soft::scene scene(width, height);
+        if(!presetPath.empty()) {
+            dx::milk::preset p;
+            std::string error;
+            if(!p.open(presetPath) || !scene.load(p, &error)) {
+                fprintf(stderr, "%s: %s\n", presetPath.c_str(), error.empty() ? "can't read" : error.c_str());
+                return 1;
+            }
+        }
+        dx::framewriter writer(output, format, width, height, fps);
+        if(!writer.error().empty()) {
+            fprintf(stderr, "%s\n", writer.error().c_str());
+            return 1;
+        }
+        dx::soft::scenestatistics stats = scene.render(0, frames, (double)fps, &writer);
+        bool ok = writer.finish() && !stats.write_failed;
+        if(!ok && !writer.error().empty()) {
+            fprintf(stderr, "%s\n", writer.error().c_str());
+        }
+        fprintf(stderr, "%llu frames in %.2f s, %.1f fps, drawing %.2f ms/frame on %u threads\n", (unsigned long long)stats.frames,
+                stats.seconds, stats.fps(), stats.frames ? stats.draw_seconds * 1e3 / stats.frames : 0.0, scene.thread_count());
+        return ok ? 0 : 1;
+    }
+
+    device dev = warp ? device::create_warp_device() : device::create_default_device();
+    devicecontext context = dev.immediate_context();
+    context.enable_state_filter();
+
+    offlinerenderer renderer(dev, context, width, height);
+    dx::framewriter writer(output, format, width, height, fps);
+    if(!writer.error().empty()) {
+        fprintf(stderr, "%s\n", writer.error().c_str());
+        return 1;
+    }
+    offlinestatistics stats = renderer.render(0, frames, (double)fps, [](devicecontext &ctx, const rendertarget &color, const rendertarget &depth, const offlineframe &f) {
+        DirectXWidget::D3DScene(ctx, color.rtv, depth.dsv, f.width, f.height, f.time);
+    }, writer);
+    bool ok = writer.finish() && !stats.write_failed;
+    if(!ok && !writer.error().empty()) {
+        fprintf(stderr, "%s\n", writer.error().c_str());
+    }
+
+    // stdout may carry the frames, report on stderr
+    fprintf(stderr, "%llu frames in %.2f s, %.1f fps\n", (unsigned long long)stats.frames, stats.seconds, stats.fps());
+    return ok ? 0 : 1;
+}
+
+// DirectXWidget --index <library> <index>
+// Indexes the .milk presets under library, presets unchanged since an existing index aren't read again.
+static int indexPresets(int argc, char *argv[])
+{
+    using namespace dx::milk;
+
+    if(argc < 4) {
+        fprintf(stderr, "usage: %s --index <library> <index>\n", argv[0]);
+        return 1;
+    }
+    presetlibrary library(argv[3]);
+    bool ok = library.build(argv[2], argv[3]);
+    presetscanstatistics stats = library.statistics();
+    fprintf(stderr, "%u presets in %u directories: %u parsed, %u unchanged, %u failed (scan %.0f ms, parse %.0f ms, write %.0f ms)\n",
+            stats.files, stats.directories, stats.parsed, stats.reused, stats.failed, stats.scan_ms, stats.parse_ms, stats.write_ms);
+    if(!ok) {
+        fprintf(stderr, "can't write %s\n", argv[3]);
+    }
+    return ok ? 0 : 1;
+}
 
 int main(int argc, char *argv[])
 {
+    if(argc > 1 && strcmp(argv[1], "--index") == 0) {
+        return indexPresets(argc, argv);
+    }
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "--render") == 0) {
+            return renderOffline(argc, argv);
+        }
+    }
+
     QApplication a(argc, argv);
     MainWindow w;
     w.show();
@@ -0,0 +1,30 @@
+#-------------------------------------------------
+#
+# softrender: the widget's scene, or a capture of it, on the software
+# rasterizer, a console tool without Qt or Direct3D for other platforms
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = softrender
+TEMPLATE = app
+CONFIG += console c++14
+CONFIG -= app_bundle qt
+
+SOURCES += SoftRender.cxx
+
+HEADERS += SoftScene.h \
+    SoftReplay.h \
+    SoftRasterizer.h \
+    CommandStream.h \
+    WorkerPool.h \
+    FrameWriter.h \
+    MeshEvaluator.h \
+    MeshLanes.inl \
+    EquationJit.h \
+    MilkEquation.h \
+    MilkPreset.h \
+    MappedFile.h
+
+unix: LIBS += -pthread
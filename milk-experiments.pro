@@ -1,4 +1,12 @@
 TEMPLATE = subdirs
 
-SUBDIRS += \
-    DirectXWidget
+# Direct3D 11 only builds on Windows, the console tools everywhere
+win32: SUBDIRS += \
+    DirectXWidget \
+    framecheck
+framecheck.file = DirectXWidget/framecheck.pro
+
+SUBDIRS += softrender capturereplay equationcheck
+softrender.file = DirectXWidget/softrender.pro
+capturereplay.file = DirectXWidget/capturereplay.pro
+equationcheck.file = DirectXWidget/equationcheck.pro